@@ -0,0 +1,94 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "univalue/univalue.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <assert.h>
+
+benchmark::BenchRunner::BenchmarkMap& benchmark::BenchRunner::benchmarks()
+{
+    static BenchmarkMap benchmarks_map;
+    return benchmarks_map;
+}
+
+benchmark::BenchRunner::BenchRunner(const std::string& name, benchmark::BenchFunction func)
+{
+    benchmarks().insert(std::make_pair(name, func));
+}
+
+std::vector<std::string> benchmark::BenchRunner::List()
+{
+    std::vector<std::string> vNames;
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it)
+        vNames.push_back(it->first);
+    return vNames;
+}
+
+UniValue benchmark::BenchRunner::RunAll(const std::string& strFilter, int64_t nSampleMicros, unsigned int nSamples)
+{
+    UniValue results(UniValue::VARR);
+    for (BenchmarkMap::iterator it = benchmarks().begin(); it != benchmarks().end(); ++it) {
+        if (it->first.find(strFilter) == std::string::npos)
+            continue;
+
+        State state(nSampleMicros, nSamples);
+        it->second(state);
+
+        std::vector<double> vSamples = state.GetSamples();
+        assert(!vSamples.empty());
+        std::sort(vSamples.begin(), vSamples.end());
+        double dTotal = 0;
+        for (size_t i = 0; i < vSamples.size(); i++)
+            dTotal += vSamples[i];
+
+        UniValue result(UniValue::VOBJ);
+        result.push_back(Pair("name", it->first));
+        result.push_back(Pair("iterations", state.GetIterations()));
+        result.push_back(Pair("samples", (uint64_t)vSamples.size()));
+        result.push_back(Pair("ns_per_op", vSamples[vSamples.size() / 2]));
+        result.push_back(Pair("ns_min", vSamples.front()));
+        result.push_back(Pair("ns_max", vSamples.back()));
+        result.push_back(Pair("ns_mean", dTotal / vSamples.size()));
+        results.push_back(result);
+    }
+    return results;
+}
+
+benchmark::State::State(int64_t nSampleMicrosIn, unsigned int nSamplesIn) :
+    nSampleMicros(std::max<int64_t>(1, nSampleMicrosIn)), nSamples(std::max(1U, nSamplesIn)),
+    fCalibrating(true), nBatch(1), nLeft(0), nBatchStart(-1), nIterations(0)
+{
+}
+
+bool benchmark::State::KeepRunning()
+{
+    if (nLeft > 0) {
+        --nLeft;
+        return true;
+    }
+
+    int64_t nNow = GetTimeMicros();
+    if (nBatchStart >= 0) {
+        int64_t nElapsed = nNow - nBatchStart;
+        if (fCalibrating) {
+            if (nElapsed < nSampleMicros)
+                nBatch *= 2;
+            else
+                fCalibrating = false;
+        } else {
+            vSampleNanos.push_back(nElapsed * 1000.0 / nBatch);
+            nIterations += nBatch;
+            if (vSampleNanos.size() >= nSamples)
+                return false;
+        }
+    }
+
+    nLeft = nBatch - 1;
+    nBatchStart = GetTimeMicros();
+    return true;
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GROESTLCOIN_BENCH_BENCH_H
+#define GROESTLCOIN_BENCH_BENCH_H
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/preprocessor/stringize.hpp>
+
+class UniValue;
+
+// Simple micro-benchmarking framework; API mostly matches a subset of the
+// Google Benchmark framework (see https://github.com/google/benchmark).
+// Why not use the Google Benchmark framework? Because adding another
+// dependency (that uses cmake as its build system and has lots of features
+// we don't need) isn't worth it.
+
+/*
+ * Usage:
+
+static void CODE_TO_TIME(benchmark::State& state)
+{
+    ... do any setup needed...
+    while (state.KeepRunning()) {
+       ... do stuff you want to time...
+    }
+    ... do any cleanup needed...
+}
+
+BENCHMARK(CODE_TO_TIME);
+
+ */
+
+namespace benchmark {
+
+    /**
+     * Timing of one benchmark. The loop body is first run in batches of
+     * doubling size until a batch takes at least the sample time; that batch
+     * size is then timed nSamples times. Reporting the median of the samples
+     * keeps results comparable between runs on a busy machine.
+     */
+    class State {
+        int64_t nSampleMicros;
+        unsigned int nSamples;
+        bool fCalibrating;
+        uint64_t nBatch;
+        uint64_t nLeft;
+        int64_t nBatchStart;
+        uint64_t nIterations;
+        std::vector<double> vSampleNanos;
+
+    public:
+        State(int64_t nSampleMicrosIn, unsigned int nSamplesIn);
+        bool KeepRunning();
+
+        /** Timed iterations, calibration excluded */
+        uint64_t GetIterations() const { return nIterations; }
+        /** Nanoseconds per iteration of each sample */
+        const std::vector<double>& GetSamples() const { return vSampleNanos; }
+    };
+
+    typedef boost::function<void(State&)> BenchFunction;
+
+    class BenchRunner
+    {
+        typedef std::map<std::string, BenchFunction> BenchmarkMap;
+        static BenchmarkMap& benchmarks();
+
+    public:
+        BenchRunner(const std::string& name, BenchFunction func);
+
+        /** Names of all registered benchmarks, in the order they run */
+        static std::vector<std::string> List();
+
+        /**
+         * Run every benchmark whose name contains strFilter and return the
+         * results as a JSON array.
+         */
+        static UniValue RunAll(const std::string& strFilter, int64_t nSampleMicros, unsigned int nSamples);
+    };
+}
+
+// BENCHMARK(foo) expands to:  benchmark::BenchRunner bench_11foo("foo", foo);
+#define BENCHMARK(n) \
+    benchmark::BenchRunner BOOST_PP_CAT(bench_, BOOST_PP_CAT(__LINE__, n))(BOOST_PP_STRINGIZE(n), n);
+
+#endif // GROESTLCOIN_BENCH_BENCH_H
@@ -0,0 +1,79 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "key.h"
+#include "main.h"
+#include "ui_interface.h"
+#include "univalue/univalue.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <stdio.h>
+
+CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
+
+extern void noui_connect();
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+bool ShutdownRequested()
+{
+    return false;
+}
+
+static const unsigned int DEFAULT_BENCH_SAMPLES = 5;
+static const int64_t DEFAULT_BENCH_SAMPLE_TIME = 100;
+
+int main(int argc, char** argv)
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+
+    if (mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::string strUsage = _("Groestlcoin Core benchmarks") + " " + _("version") + " " + FormatFullVersion() + "\n\n" +
+            _("Usage:") + "\n" +
+            "  bench_groestlcoin [options]\n";
+        strUsage += "\n" + _("Options:") + "\n";
+        strUsage += HelpMessageOpt("-?", _("This help message"));
+        strUsage += HelpMessageOpt("-filter=<substring>", _("Only run benchmarks whose name contains <substring>"));
+        strUsage += HelpMessageOpt("-list", _("List the benchmarks and exit"));
+        strUsage += HelpMessageOpt("-samples=<n>", strprintf(_("Number of timed samples per benchmark (default: %u)"), DEFAULT_BENCH_SAMPLES));
+        strUsage += HelpMessageOpt("-sampletime=<ms>", strprintf(_("Minimum duration of one sample in milliseconds (default: %d)"), DEFAULT_BENCH_SAMPLE_TIME));
+        fprintf(stdout, "%s", strUsage.c_str());
+        return 0;
+    }
+
+    if (mapArgs.count("-list")) {
+        std::vector<std::string> vNames = benchmark::BenchRunner::List();
+        for (unsigned int i = 0; i < vNames.size(); i++)
+            fprintf(stdout, "%s\n", vNames[i].c_str());
+        return 0;
+    }
+
+    unsigned int nSamples = std::max(1, (int)GetArg("-samples", DEFAULT_BENCH_SAMPLES));
+    int64_t nSampleTime = std::max((int64_t)1, GetArg("-sampletime", DEFAULT_BENCH_SAMPLE_TIME));
+
+    fPrintToDebugLog = false;
+    ECC_Start();
+    ECCVerifyHandle verifyHandle;
+    SelectParams(CBaseChainParams::MAIN);
+    noui_connect();
+
+    UniValue report(UniValue::VOBJ);
+    report.push_back(Pair("version", FormatFullVersion()));
+    report.push_back(Pair("samples", (uint64_t)nSamples));
+    report.push_back(Pair("sampletime_ms", nSampleTime));
+    report.push_back(Pair("benchmarks", benchmark::BenchRunner::RunAll(GetArg("-filter", ""), nSampleTime * 1000, nSamples)));
+    fprintf(stdout, "%s\n", report.write(4).c_str());
+
+    ECC_Stop();
+    return 0;
+}
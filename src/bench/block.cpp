@@ -0,0 +1,70 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "chain.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "streams.h"
+#include "version.h"
+
+#include <assert.h>
+
+static void SerializeBlock1000(benchmark::State& state)
+{
+    benchmark::SpendFixture fixture(1000);
+    CBlock block = fixture.MakeBlock(uint256(), 1, 1400000000);
+
+    while (state.KeepRunning()) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+    }
+}
+
+static void DeserializeBlock1000(benchmark::State& state)
+{
+    benchmark::SpendFixture fixture(1000);
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << fixture.MakeBlock(uint256(), 1, 1400000000);
+
+    while (state.KeepRunning()) {
+        CDataStream ss(ssBlock);
+        CBlock block;
+        ss >> block;
+    }
+}
+
+/*
+ * Connecting a 1000 transaction block on top of the genesis block, with
+ * every script verified (the signature cache is left disabled).
+ */
+static void ConnectBlock1000(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    benchmark::SpendFixture fixture(1000);
+
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CBlock block = fixture.MakeBlock(pindexPrev->GetBlockHash(), pindexPrev->nHeight + 1, pindexPrev->nTime + 60);
+    CBlockIndex index(block);
+    index.pprev = pindexPrev;
+    index.nHeight = pindexPrev->nHeight + 1;
+
+    CCoinsViewCache viewBase(pcoinsTip);
+    fixture.AddFunding(viewBase, pindexPrev->nHeight);
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(&viewBase);
+        CValidationState validationState;
+        bool fConnected = ConnectBlock(block, validationState, &index, view, true);
+        assert(fConnected);
+    }
+}
+
+BENCHMARK(SerializeBlock1000);
+BENCHMARK(DeserializeBlock1000);
+BENCHMARK(ConnectBlock1000);
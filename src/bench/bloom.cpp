@@ -0,0 +1,34 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "bloom.h"
+#include "hash.h"
+#include "utilstrencodings.h"
+
+/* Matching a block's transactions against an SPV peer's filter */
+static void BloomIsRelevantAndUpdate(benchmark::State& state)
+{
+    benchmark::SpendFixture fixture(1000);
+    CBloomFilter filter(10000, 0.0001, 0, BLOOM_UPDATE_ALL);
+    for (unsigned int i = 0; i < 1000; i++) {
+        uint256 hash = Hash(BEGIN(i), END(i));
+        filter.insert(std::vector<unsigned char>(hash.begin(), hash.begin() + 20));
+    }
+    // One in ten transactions pays to a watched key, the rest only get scanned.
+    CMutableTransaction txWatched(fixture.vSpends[0]);
+    txWatched.vout[0].scriptPubKey = CScript() << ToByteVector(fixture.key.GetPubKey()) << OP_CHECKSIG;
+    filter.insert(ToByteVector(fixture.key.GetPubKey()));
+    for (unsigned int i = 0; i < fixture.vSpends.size(); i += 10)
+        fixture.vSpends[i] = txWatched;
+
+    while (state.KeepRunning()) {
+        for (unsigned int i = 0; i < fixture.vSpends.size(); i++)
+            filter.IsRelevantAndUpdate(fixture.vSpends[i]);
+    }
+}
+
+BENCHMARK(BloomIsRelevantAndUpdate);
@@ -0,0 +1,68 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "coins.h"
+#include "hash.h"
+#include "main.h"
+#include "utilstrencodings.h"
+
+#include <assert.h>
+#include <vector>
+
+static const unsigned int COINS_BATCH = 1000;
+
+/** COINS_BATCH outputs of unrelated transactions, added to view */
+static std::vector<COutPoint> AddCoins(CCoinsViewCache& view)
+{
+    std::vector<COutPoint> vOutPoint;
+    CTxOut out;
+    out.nValue = 50000;
+    out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x11) << OP_EQUALVERIFY << OP_CHECKSIG;
+    for (unsigned int i = 0; i < COINS_BATCH; i++) {
+        vOutPoint.push_back(COutPoint(Hash(BEGIN(i), END(i)), 0));
+        view.AddCoin(vOutPoint.back(), Coin(out, 1, false), false);
+    }
+    return vOutPoint;
+}
+
+/* Pulling COINS_BATCH coins from the chainstate cache into a block's view */
+static void CoinsViewCacheFetch(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    std::vector<COutPoint> vOutPoint = AddCoins(*pcoinsTip);
+
+    while (state.KeepRunning()) {
+        CCoinsViewCache view(pcoinsTip);
+        for (unsigned int i = 0; i < vOutPoint.size(); i++) {
+            const Coin& coin = view.AccessCoin(vOutPoint[i]);
+            assert(!coin.IsSpent());
+        }
+    }
+}
+
+/* Writing COINS_BATCH modified coins from the chainstate cache to the database */
+static void CoinsViewCacheFlush(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    std::vector<COutPoint> vOutPoint = AddCoins(*pcoinsTip);
+
+    CAmount nValue = 0;
+    while (state.KeepRunning()) {
+        nValue++;
+        for (unsigned int i = 0; i < vOutPoint.size(); i++) {
+            Coin coin;
+            pcoinsTip->SpendCoin(vOutPoint[i], &coin);
+            coin.out.nValue = nValue;
+            pcoinsTip->AddCoin(vOutPoint[i], coin, false);
+        }
+        bool fFlushed = pcoinsTip->Flush();
+        assert(fFlushed);
+    }
+}
+
+BENCHMARK(CoinsViewCacheFetch);
+BENCHMARK(CoinsViewCacheFlush);
@@ -0,0 +1,46 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "groestlcoin.h"
+#include "primitives/transaction.h"
+#include "uint256.h"
+
+#include <vector>
+
+/* Proof of work hash of a block header */
+static void HashGroestl80(benchmark::State& state)
+{
+    std::vector<unsigned char> vchHeader(80, 0x5a);
+    while (state.KeepRunning())
+        XCoin::HashGroestl(XCoin::ConstBuf(vchHeader));
+}
+
+static void HashGroestl1M(benchmark::State& state)
+{
+    std::vector<unsigned char> vchData(1000 * 1000, 0x5a);
+    while (state.KeepRunning())
+        XCoin::HashGroestl(XCoin::ConstBuf(vchData));
+}
+
+/* Serialization plus single SHA256 of a two-in two-out transaction */
+static void TxHashSHA256(benchmark::State& state)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < 2; i++) {
+        tx.vin[i].prevout = COutPoint(uint256S("0x1d2a3c"), i);
+        tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+        tx.vout[i].nValue = 100000000;
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0x11) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    while (state.KeepRunning())
+        tx.GetHash();
+}
+
+BENCHMARK(HashGroestl80);
+BENCHMARK(HashGroestl1M);
+BENCHMARK(TxHashSHA256);
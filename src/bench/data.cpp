@@ -0,0 +1,106 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "data.h"
+
+#include "amount.h"
+#include "coins.h"
+#include "hash.h"
+#include "keystore.h"
+#include "main.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "util.h"
+#include "utilstrencodings.h"
+
+#include <assert.h>
+
+#include <boost/filesystem/operations.hpp>
+
+benchmark::SpendFixture::SpendFixture(unsigned int nOutputs)
+{
+    unsigned char vchSecret[32];
+    for (unsigned int i = 0; i < sizeof(vchSecret); i++)
+        vchSecret[i] = i + 1;
+    key.Set(vchSecret, vchSecret + sizeof(vchSecret), true);
+    scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(Hash(vchSecret, vchSecret + sizeof(vchSecret)), 0);
+    txFund.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        txFund.vout[i].nValue = COIN;
+        txFund.vout[i].scriptPubKey = scriptPubKey;
+    }
+    txFunding = txFund;
+
+    CBasicKeyStore keystore;
+    keystore.AddKey(key);
+    vSpends.reserve(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(txFunding.GetHash(), i);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN - 10000;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+        bool fSigned = SignSignature(keystore, txFunding, tx, 0);
+        assert(fSigned);
+        vSpends.push_back(tx);
+    }
+}
+
+void benchmark::SpendFixture::AddFunding(CCoinsViewCache& view, int nHeight) const
+{
+    AddCoins(view, txFunding, nHeight);
+}
+
+CBlock benchmark::SpendFixture::MakeBlock(const uint256& hashPrev, int nHeight, unsigned int nTime) const
+{
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = 0;
+    txCoinbase.vout[0].scriptPubKey = scriptPubKey;
+
+    CBlock block;
+    block.nVersion = 2;
+    block.hashPrevBlock = hashPrev;
+    block.nTime = nTime;
+    block.vtx.push_back(txCoinbase);
+    block.vtx.insert(block.vtx.end(), vSpends.begin(), vSpends.end());
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+benchmark::ChainSetup::ChainSetup()
+{
+    ClearDatadirCache();
+    pathTemp = GetTempPath() / strprintf("bench_groestlcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    bool fInit = InitBlockIndex();
+    assert(fInit);
+}
+
+benchmark::ChainSetup::~ChainSetup()
+{
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    pcoinsTip = NULL;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pblocktree = NULL;
+    boost::filesystem::remove_all(pathTemp);
+    mapArgs.erase("-datadir");
+    ClearDatadirCache();
+}
@@ -0,0 +1,60 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GROESTLCOIN_BENCH_DATA_H
+#define GROESTLCOIN_BENCH_DATA_H
+
+#include "key.h"
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+class CCoinsViewCache;
+class CCoinsViewDB;
+
+namespace benchmark {
+
+/**
+ * Deterministic transactions for benchmarks: one funding transaction paying
+ * nOutputs coins to a fixed key, and a signed one-in one-out spend of each of
+ * them. The same inputs give byte-identical transactions on every run.
+ */
+class SpendFixture
+{
+public:
+    CKey key;
+    CScript scriptPubKey;
+    CTransaction txFunding;
+    std::vector<CTransaction> vSpends;
+
+    explicit SpendFixture(unsigned int nOutputs);
+
+    /** Make the funding outputs spendable in view */
+    void AddFunding(CCoinsViewCache& view, int nHeight) const;
+
+    /** A block on top of hashPrev holding a coinbase and all spends */
+    CBlock MakeBlock(const uint256& hashPrev, int nHeight, unsigned int nTime) const;
+};
+
+/**
+ * Temporary data directory with an in-memory block tree and chainstate
+ * holding only the genesis block, like the unit tests' TestingSetup.
+ */
+class ChainSetup
+{
+    boost::filesystem::path pathTemp;
+    CCoinsViewDB *pcoinsdbview;
+
+public:
+    ChainSetup();
+    ~ChainSetup();
+};
+
+}
+
+#endif // GROESTLCOIN_BENCH_DATA_H
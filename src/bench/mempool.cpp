@@ -0,0 +1,29 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "amount.h"
+#include "txmempool.h"
+
+#include <list>
+
+/* Accepting a block's worth of transactions into the pool, then mining them */
+static void MempoolAddRemoveForBlock(benchmark::State& state)
+{
+    benchmark::SpendFixture fixture(1000);
+
+    while (state.KeepRunning()) {
+        CTxMemPool pool(CFeeRate(1000));
+        for (unsigned int i = 0; i < fixture.vSpends.size(); i++) {
+            const CTransaction& tx = fixture.vSpends[i];
+            pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 10000, 1400000000 + i, 0.0, 1, true, 1));
+        }
+        std::list<CTransaction> conflicts;
+        pool.removeForBlock(fixture.vSpends, 2, conflicts);
+    }
+}
+
+BENCHMARK(MempoolAddRemoveForBlock);
@@ -0,0 +1,38 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "data.h"
+
+#include "coins.h"
+#include "main.h"
+#include "miner.h"
+#include "txmempool.h"
+
+#include <assert.h>
+
+/* Assembling and validating a template from a 1000 transaction mempool */
+static void CreateNewBlock1000(benchmark::State& state)
+{
+    benchmark::ChainSetup setup;
+    benchmark::SpendFixture fixture(1000);
+    {
+        LOCK(cs_main);
+        fixture.AddFunding(*pcoinsTip, 0);
+    }
+    for (unsigned int i = 0; i < fixture.vSpends.size(); i++) {
+        const CTransaction& tx = fixture.vSpends[i];
+        mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, 10000 + i, 1400000000 + i, 0.0, 0, true, 1));
+    }
+
+    while (state.KeepRunning()) {
+        CBlockTemplate *pblocktemplate = CreateNewBlock(fixture.scriptPubKey);
+        assert(pblocktemplate && pblocktemplate->block.vtx.size() == fixture.vSpends.size() + 1);
+        delete pblocktemplate;
+    }
+
+    mempool.clear();
+}
+
+BENCHMARK(CreateNewBlock1000);
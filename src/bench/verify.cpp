@@ -0,0 +1,33 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "key.h"
+#include "pubkey.h"
+#include "uint256.h"
+
+#include <assert.h>
+#include <vector>
+
+static void PubKeyVerify(benchmark::State& state)
+{
+    unsigned char vchSecret[32];
+    for (unsigned int i = 0; i < sizeof(vchSecret); i++)
+        vchSecret[i] = 0x40 + i;
+    CKey key;
+    key.Set(vchSecret, vchSecret + sizeof(vchSecret), true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = uint256S("0x7d4a1c22b5e3f08e9a66d1b0c4f2a7e9135b8c6d0e2f4a6b8c0d2e4f6a8b0c2d");
+    std::vector<unsigned char> vchSig;
+    bool fSigned = key.Sign(hash, vchSig);
+    assert(fSigned);
+
+    while (state.KeepRunning()) {
+        bool fValid = pubkey.Verify(hash, vchSig);
+        assert(fValid);
+    }
+}
+
+BENCHMARK(PubKeyVerify);
@@ -0,0 +1,124 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockstore.h"
+
+#include "memusage.h"
+#include "util.h"
+
+#include <vector>
+
+#include <boost/interprocess/file_mapping.hpp>
+
+CBlockFileMap::CBlockFileMap(size_t nMaxFilesIn) : nMaxFiles(nMaxFilesIn)
+{
+}
+
+CBlockFileMap::MappedFile CBlockFileMap::Get(int nFile, const boost::filesystem::path& path)
+{
+    boost::mutex::scoped_lock lock(cs);
+    std::map<int, MappedFile>::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end())
+        return it->second;
+
+    MappedFile region;
+    try {
+        boost::interprocess::file_mapping file(path.string().c_str(), boost::interprocess::read_only);
+        region.reset(new boost::interprocess::mapped_region(file, boost::interprocess::read_only));
+    } catch (const boost::interprocess::interprocess_exception& e) {
+        LogPrintf("%s: unable to map %s: %s\n", __func__, path.string(), e.what());
+        return MappedFile();
+    }
+    if (mapFiles.size() >= nMaxFiles)
+        mapFiles.erase(mapFiles.begin());
+    mapFiles.insert(std::make_pair(nFile, region));
+    return region;
+}
+
+void CBlockFileMap::Remove(int nFile)
+{
+    boost::mutex::scoped_lock lock(cs);
+    mapFiles.erase(nFile);
+}
+
+size_t CBlockFileMap::Size()
+{
+    boost::mutex::scoped_lock lock(cs);
+    return mapFiles.size();
+}
+
+CRawBlockCache::CRawBlockCache(size_t nMaxBytesIn) : nBytes(0), nMaxBytes(nMaxBytesIn), nHits(0), nMisses(0), nInserts(0), nEvictions(0)
+{
+}
+
+size_t CRawBlockCache::EntrySize(const CRawBlock& block)
+{
+    // The copied bytes and the vector holding them, plus (roughly) the
+    // shared_ptr control block and the list and map nodes.
+    return memusage::MallocUsage(block.size()) + memusage::MallocUsage(sizeof(std::vector<unsigned char>)) +
+        memusage::MallocUsage(4 * sizeof(void*)) +
+        memusage::MallocUsage(sizeof(BlockList::value_type) + 2 * sizeof(void*)) +
+        memusage::MallocUsage(sizeof(std::pair<const uint256, BlockList::iterator>) + 4 * sizeof(void*));
+}
+
+void CRawBlockCache::EvictTo(size_t nLimit)
+{
+    while (nBytes > nLimit && !listBlocks.empty()) {
+        nBytes -= EntrySize(listBlocks.back().second);
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+        nEvictions++;
+    }
+}
+
+bool CRawBlockCache::Get(const uint256& hash, CRawBlock& block)
+{
+    boost::mutex::scoped_lock lock(cs);
+    std::map<uint256, BlockList::iterator>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end()) {
+        nMisses++;
+        return false;
+    }
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    block = it->second->second;
+    nHits++;
+    return true;
+}
+
+void CRawBlockCache::Insert(const uint256& hash, const CRawBlock& block)
+{
+    boost::shared_ptr<std::vector<unsigned char> > vch(new std::vector<unsigned char>(block.begin(), block.end()));
+    CRawBlock copy(vch, vch->empty() ? NULL : &(*vch)[0], vch->size());
+    size_t nSize = EntrySize(copy);
+
+    boost::mutex::scoped_lock lock(cs);
+    if (nSize > nMaxBytes || mapBlocks.count(hash))
+        return;
+    EvictTo(nMaxBytes - nSize);
+    listBlocks.push_front(std::make_pair(hash, copy));
+    mapBlocks.insert(std::make_pair(hash, listBlocks.begin()));
+    nBytes += nSize;
+    nInserts++;
+}
+
+void CRawBlockCache::SetMaxBytes(size_t nMaxBytesIn)
+{
+    boost::mutex::scoped_lock lock(cs);
+    nMaxBytes = nMaxBytesIn;
+    EvictTo(nMaxBytes);
+}
+
+CRawBlockCacheStats CRawBlockCache::GetStats()
+{
+    boost::mutex::scoped_lock lock(cs);
+    CRawBlockCacheStats stats;
+    stats.nBytes = nBytes;
+    stats.nMaxBytes = nMaxBytes;
+    stats.nEntries = mapBlocks.size();
+    stats.nHits = nHits;
+    stats.nMisses = nMisses;
+    stats.nInserts = nInserts;
+    stats.nEvictions = nEvictions;
+    return stats;
+}
@@ -0,0 +1,152 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GROESTLCOIN_BLOCKSTORE_H
+#define GROESTLCOIN_BLOCKSTORE_H
+
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <boost/filesystem/path.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+//! -blockcachesize default (MiB)
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 16;
+
+//! Maximum number of block files kept mapped by a CBlockFileMap
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 1024 : 4;
+
+/**
+ * A block in its serialized form, as stored in a block file. It points into
+ * a memory mapped block file or into a buffer of its own, and keeps that
+ * memory alive for as long as it (or a copy of it) exists.
+ *
+ * Serializing a CRawBlock writes the bytes unchanged, so it can be passed to
+ * PushMessage() in place of a CBlock without a deserialize/serialize round
+ * trip.
+ */
+class CRawBlock
+{
+private:
+    boost::shared_ptr<const void> owner;
+    const unsigned char* pbegin;
+    size_t nSize;
+
+public:
+    CRawBlock() : pbegin(NULL), nSize(0) {}
+    CRawBlock(const boost::shared_ptr<const void>& ownerIn, const unsigned char* pbeginIn, size_t nSizeIn) :
+        owner(ownerIn), pbegin(pbeginIn), nSize(nSizeIn) {}
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pbegin + nSize; }
+    size_t size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return nSize;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        if (nSize)
+            s.write((const char*)pbegin, nSize);
+    }
+};
+
+/**
+ * Read-only memory mappings of block files that are no longer appended to.
+ *
+ * A file is mapped on first use, and the mapping is shared by every
+ * CRawBlock pointing into it. At most nMaxFiles are kept mapped; beyond that
+ * the lowest numbered file is dropped first, as peers catching up request
+ * blocks in ascending order.
+ */
+class CBlockFileMap : private boost::noncopyable
+{
+public:
+    typedef boost::shared_ptr<const boost::interprocess::mapped_region> MappedFile;
+
+private:
+    boost::mutex cs;
+    std::map<int, MappedFile> mapFiles;
+    size_t nMaxFiles;
+
+public:
+    explicit CBlockFileMap(size_t nMaxFilesIn = MAX_MAPPED_BLOCK_FILES);
+
+    /**
+     * Return the mapping of block file nFile, mapping it from path first if
+     * needed. The file must not be written to anymore. Returns an empty
+     * pointer if the file could not be mapped.
+     */
+    MappedFile Get(int nFile, const boost::filesystem::path& path);
+
+    /**
+     * Forget the mapping of block file nFile, e.g. before it is deleted. The
+     * memory stays mapped until the last CRawBlock pointing into it is gone.
+     */
+    void Remove(int nFile);
+
+    size_t Size();
+};
+
+struct CRawBlockCacheStats
+{
+    size_t nBytes;
+    size_t nMaxBytes;
+    size_t nEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+};
+
+/**
+ * Memory-bounded LRU cache of serialized blocks, keyed by block hash.
+ *
+ * Meant for the blocks many peers ask for at about the same time, i.e. the
+ * ones just relayed, so they are read and serialized once instead of once
+ * per peer. Blocks are copied in, so an entry never keeps a block file
+ * mapping alive.
+ */
+class CRawBlockCache : private boost::noncopyable
+{
+private:
+    typedef std::list<std::pair<uint256, CRawBlock> > BlockList;
+
+    boost::mutex cs;
+    //! Most recently used first
+    BlockList listBlocks;
+    std::map<uint256, BlockList::iterator> mapBlocks;
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+
+    //! Memory charged for one entry
+    static size_t EntrySize(const CRawBlock& block);
+    void EvictTo(size_t nLimit);
+
+public:
+    explicit CRawBlockCache(size_t nMaxBytesIn = DEFAULT_BLOCK_CACHE_SIZE << 20);
+
+    bool Get(const uint256& hash, CRawBlock& block);
+    void Insert(const uint256& hash, const CRawBlock& block);
+    //! Change the size limit (0 disables the cache), evicting entries as needed
+    void SetMaxBytes(size_t nMaxBytesIn);
+    CRawBlockCacheStats GetStats();
+};
+
+#endif // GROESTLCOIN_BLOCKSTORE_H
@@ -5,6 +5,8 @@
 #include "bloom.h"
 
 #include "primitives/transaction.h"
+#include "primitives/txview.h"
+#include "crypto/common.h"
 #include "hash.h"
 #include "script/script.h"
 #include "script/standard.h"
@@ -13,6 +15,7 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <boost/foreach.hpp>
 
@@ -52,40 +55,50 @@ CBloomFilter::CBloomFilter(unsigned int nElements, double nFPRate, unsigned int
 {
 }
 
-inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const std::vector<unsigned char>& vDataToHash) const
+inline unsigned int CBloomFilter::Hash(unsigned int nHashNum, const unsigned char* pDataToHash, size_t nDataSize) const
 {
     // 0xFBA4C795 chosen as it guarantees a reasonable bit difference between nHashNum values.
-    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, vDataToHash) % (vData.size() * 8);
+    return MurmurHash3(nHashNum * 0xFBA4C795 + nTweak, pDataToHash, nDataSize) % (vData.size() * 8);
 }
 
-void CBloomFilter::insert(const vector<unsigned char>& vKey)
+void CBloomFilter::insert(const unsigned char* pKey, size_t nKeySize)
 {
     if (isFull)
         return;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nKeySize);
         // Sets bit nIndex of vData
         vData[nIndex >> 3] |= (1 << (7 & nIndex));
     }
     isEmpty = false;
 }
 
+void CBloomFilter::insert(const vector<unsigned char>& vKey)
+{
+    insert(vKey.empty() ? NULL : &vKey[0], vKey.size());
+}
+
+/** An outpoint as serialized, which is what the filter holds */
+static void SerializeOutPoint(const COutPoint& outpoint, unsigned char* pch)
+{
+    memcpy(pch, outpoint.hash.begin(), 32);
+    WriteLE32(pch + 32, outpoint.n);
+}
+
 void CBloomFilter::insert(const COutPoint& outpoint)
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    insert(data);
+    unsigned char pch[36];
+    SerializeOutPoint(outpoint, pch);
+    insert(pch, sizeof(pch));
 }
 
 void CBloomFilter::insert(const uint256& hash)
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    insert(data);
+    insert(hash.begin(), hash.size());
 }
 
-bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+bool CBloomFilter::contains(const unsigned char* pKey, size_t nKeySize) const
 {
     if (isFull)
         return true;
@@ -93,7 +106,7 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
         return false;
     for (unsigned int i = 0; i < nHashFuncs; i++)
     {
-        unsigned int nIndex = Hash(i, vKey);
+        unsigned int nIndex = Hash(i, pKey, nKeySize);
         // Checks bit nIndex of vData
         if (!(vData[nIndex >> 3] & (1 << (7 & nIndex))))
             return false;
@@ -101,18 +114,21 @@ bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
     return true;
 }
 
+bool CBloomFilter::contains(const vector<unsigned char>& vKey) const
+{
+    return contains(vKey.empty() ? NULL : &vKey[0], vKey.size());
+}
+
 bool CBloomFilter::contains(const COutPoint& outpoint) const
 {
-    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
-    stream << outpoint;
-    vector<unsigned char> data(stream.begin(), stream.end());
-    return contains(data);
+    unsigned char pch[36];
+    SerializeOutPoint(outpoint, pch);
+    return contains(pch, sizeof(pch));
 }
 
 bool CBloomFilter::contains(const uint256& hash) const
 {
-    vector<unsigned char> data(hash.begin(), hash.end());
-    return contains(data);
+    return contains(hash.begin(), hash.size());
 }
 
 void CBloomFilter::clear()
@@ -203,6 +219,76 @@ bool CBloomFilter::IsRelevantAndUpdate(const CTransaction& tx)
     return false;
 }
 
+bool CBloomFilter::IsRelevantAndUpdate(const CTxView& tx)
+{
+    // Same matching as for a CTransaction, over the serialized transaction
+    bool fFound = false;
+    if (isFull)
+        return true;
+    if (isEmpty)
+        return false;
+    const uint256 hash = tx.GetHash();
+    if (contains(hash))
+        fFound = true;
+
+    const unsigned char* pcOut = tx.OutputsBegin();
+    for (unsigned int i = 0; i < tx.GetOutputCount(); i++)
+    {
+        const CTxOutView txout = CTxView::ReadOutput(pcOut);
+        const unsigned char* pc = txout.scriptPubKey.begin();
+        while (pc < txout.scriptPubKey.end())
+        {
+            opcodetype opcode;
+            const unsigned char* pdata;
+            unsigned int nDataSize;
+            if (!txout.scriptPubKey.GetOp(pc, opcode, pdata, nDataSize))
+                break;
+            if (nDataSize != 0 && contains(pdata, nDataSize))
+            {
+                fFound = true;
+                if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_ALL)
+                    insert(COutPoint(hash, i));
+                else if ((nFlags & BLOOM_UPDATE_MASK) == BLOOM_UPDATE_P2PUBKEY_ONLY)
+                {
+                    txnouttype type;
+                    vector<vector<unsigned char> > vSolutions;
+                    if (Solver(txout.scriptPubKey.ToScript(), type, vSolutions) &&
+                            (type == TX_PUBKEY || type == TX_MULTISIG))
+                        insert(COutPoint(hash, i));
+                }
+                break;
+            }
+        }
+    }
+
+    if (fFound)
+        return true;
+
+    const unsigned char* pcIn = tx.InputsBegin();
+    for (unsigned int i = 0; i < tx.GetInputCount(); i++)
+    {
+        const CTxInView txin = CTxView::ReadInput(pcIn);
+        // Match if the filter contains an outpoint tx spends
+        if (contains(txin.pprevout, CTxInView::PREVOUT_SIZE))
+            return true;
+
+        // Match if the filter contains any arbitrary script data element in any scriptSig in tx
+        const unsigned char* pc = txin.scriptSig.begin();
+        while (pc < txin.scriptSig.end())
+        {
+            opcodetype opcode;
+            const unsigned char* pdata;
+            unsigned int nDataSize;
+            if (!txin.scriptSig.GetOp(pc, opcode, pdata, nDataSize))
+                break;
+            if (nDataSize != 0 && contains(pdata, nDataSize))
+                return true;
+        }
+    }
+
+    return false;
+}
+
 void CBloomFilter::UpdateEmptyFull()
 {
     bool full = true;
@@ -148,6 +148,10 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Cached DarkGravityWave target for a child of this block, 0 until computed.
+    //! Protected by cs_main, which every GetNextWorkRequired() caller holds.
+    mutable unsigned int nBitsNext;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -162,6 +166,7 @@ public:
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        nBitsNext = 0;
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -5,10 +5,17 @@
 #ifndef BITCOIN_CHECKQUEUE_H
 #define BITCOIN_CHECKQUEUE_H
 
+#include "utiltime.h"
+
 #include <algorithm>
+#include <assert.h>
+#include <deque>
+#include <stdint.h>
 #include <vector>
 
 #include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
@@ -16,7 +23,27 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/** Counters of a CCheckQueue, see CCheckQueue::GetStats(). */
+struct CCheckQueueStats
+{
+    //! Worker threads (not counting masters waiting for their checks)
+    int nWorkers;
+    //! Checks queued and not picked up by any thread yet
+    unsigned int nQueued;
+    //! Sessions (e.g. blocks) whose checks are in progress
+    unsigned int nSessions;
+    //! Checks executed
+    uint64_t nChecks;
+    //! Batches taken, and how many of them were stolen from another thread's queue
+    uint64_t nBatches;
+    uint64_t nSteals;
+    //! Time spent executing checks, summed over all threads
+    int64_t nBusyMicros;
+    //! Time since the first worker thread started
+    int64_t nUptimeMicros;
+};
+
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,39 +52,75 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Every worker has its own deque of checks. Add() spreads new checks over
+  * all of them, a worker takes batches from the back of its own deque and,
+  * once that is empty, steals from the front of the others. Batches get
+  * smaller as the checks run out, and are sized so that a batch takes
+  * roughly TARGET_BATCH_MICROS to run.
+  *
+  * Checks belong to a session (one per CCheckQueueControl). Several sessions
+  * can be in progress at once, e.g. the checks of the next block can be
+  * queued while those of the current one are still running; a master only
+  * waits for, and gets the result of, its own session.
   */
 template <typename T>
 class CCheckQueue
 {
+public:
+    //! Sessions that can be in progress at the same time
+    static const unsigned int MAX_SESSIONS = 4;
+    //! Deques: one shared by masters, one per worker thread
+    static const unsigned int MAX_QUEUES = 65;
+    //! Batch duration that batch sizes are adapted to
+    static const int64_t TARGET_BATCH_MICROS = 1000;
+
 private:
-    //! Mutex to protect the inner state
+    struct CItem
+    {
+        T check;
+        unsigned int nSession;
+    };
+
+    struct CWorkerQueue : private boost::noncopyable
+    {
+        boost::mutex mutex;
+        std::deque<CItem> items;
+    };
+
+    struct CSession
+    {
+        bool fInUse;
+        //! Checks of this session that haven't completed yet, including those in workers' batches
+        unsigned int nTodo;
+        bool fAllOk;
+    };
+
+    //! Mutex to protect the inner state (the deques' contents have their own)
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
     boost::condition_variable condWorker;
 
-    //! Master thread blocks on this when out of work
+    //! Master threads block on this while the rest of their session's checks are running
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+    //! Deque 0 is filled for masters; deque i > 0 belongs to the i-th worker thread
+    std::vector<boost::shared_ptr<CWorkerQueue> > vQueues;
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of deques in use
+    unsigned int nQueues;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The deque Add() starts filling next, so small batches spread over all workers
+    unsigned int nNextQueue;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    CSession vSessions[MAX_SESSIONS];
 
-    /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
-     */
-    unsigned int nTodo;
+    //! The number of workers (including masters) that are idle.
+    int nIdle;
+
+    //! The total number of workers (including masters).
+    int nTotal;
 
     //! Whether we're shutting down.
     bool fQuit;
@@ -65,95 +128,254 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    uint64_t nChecks;
+    uint64_t nBatches;
+    uint64_t nSteals;
+    int64_t nBusyMicros;
+    int64_t nStartTime;
+
+    /** Move up to nMax checks from the back (own deque) or front (stolen) of a deque into vBatch. */
+    static void Take(CWorkerQueue& q, bool fFront, unsigned int nMax, std::vector<CItem>& vBatch)
+    {
+        boost::unique_lock<boost::mutex> lock(q.mutex);
+        unsigned int nNow = std::min(nMax, (unsigned int)q.items.size());
+        vBatch.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Swap instead of copying, to keep the lock short.
+            CItem& item = fFront ? q.items.front() : q.items.back();
+            vBatch[i].check.swap(item.check);
+            vBatch[i].nSession = item.nSession;
+            if (fFront)
+                q.items.pop_front();
+            else
+                q.items.pop_back();
+        }
+    }
+
+    /** Find work for the thread owning deque nQueue: its own first, then the others'. */
+    bool GetBatch(unsigned int nQueue, unsigned int nQueuesNow, unsigned int nAdaptive, std::vector<CItem>& vBatch)
+    {
+        {
+            CWorkerQueue& q = *vQueues[nQueue];
+            unsigned int nSize;
+            {
+                boost::unique_lock<boost::mutex> lock(q.mutex);
+                nSize = q.items.size();
+            }
+            if (nSize) {
+                // Leave half of what is left for threads that run out of work
+                Take(q, false, std::max(1U, std::min(nAdaptive, nSize / 2)), vBatch);
+                if (!vBatch.empty())
+                    return false;
+            }
+        }
+        for (unsigned int i = 1; i < nQueuesNow; i++) {
+            CWorkerQueue& q = *vQueues[(nQueue + i) % nQueuesNow];
+            unsigned int nSize;
+            {
+                boost::unique_lock<boost::mutex> lock(q.mutex);
+                nSize = q.items.size();
+            }
+            if (nSize) {
+                Take(q, true, std::max(1U, std::min(nAdaptive, (nSize + 1) / 2)), vBatch);
+                if (!vBatch.empty())
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    // requires lock on mutex
+    bool AnyQueued()
+    {
+        for (unsigned int i = 0; i < nQueues; i++) {
+            boost::unique_lock<boost::mutex> lock(vQueues[i]->mutex);
+            if (!vQueues[i]->items.empty())
+                return true;
+        }
+        return false;
+    }
+
+    // requires lock on mutex; called by a master leaving Loop()
+    bool EndSession(unsigned int nSession)
+    {
+        nTotal--;
+        bool fRet = vSessions[nSession].fAllOk;
+        vSessions[nSession].fInUse = false;
+        // Wake anyone waiting in StartSession() for a free slot
+        condMaster.notify_all();
+        return fRet;
+    }
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nQueue, bool fMaster = false, unsigned int nSession = 0)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
+        std::vector<CItem> vBatch;
+        vBatch.reserve(nBatchSize);
+        unsigned int vDone[MAX_SESSIONS] = {0};
+        bool vOk[MAX_SESSIONS];
+        bool vSkip[MAX_SESSIONS];
+        unsigned int nQueuesNow;
+        unsigned int nAdaptive = nBatchSize;
+        int64_t nCheckMicros = 0; // running average of the time one check takes
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nTotal++;
+            nQueuesNow = nQueues;
+        }
         do {
+            bool fStolen = GetBatch(nQueue, nQueuesNow, nAdaptive, vBatch);
             {
                 boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
+                while (vBatch.empty()) {
+                    if (fMaster && vSessions[nSession].nTodo == 0)
+                        return EndSession(nSession);
+                    if (fQuit && !fMaster) {
                         nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
+                        return false;
                     }
+                    // Checked under the lock, as Add() notifies while holding it
+                    if (AnyQueued())
+                        break;
                     nIdle++;
                     cond.wait(lock); // wait
                     nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+                nQueuesNow = nQueues;
+                if (vBatch.empty())
+                    continue;
+                // The sessions of the checks we hold can't end (and be reused) before we
+                // report them done, so their state read here is current.
+                for (unsigned int s = 0; s < MAX_SESSIONS; s++)
+                    vSkip[s] = !vSessions[s].fAllOk;
             }
+
             // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
+            for (unsigned int s = 0; s < MAX_SESSIONS; s++)
+                vOk[s] = true;
+            int64_t nTimeStart = GetTimeMicros();
+            BOOST_FOREACH (CItem& item, vBatch) {
+                unsigned int s = item.nSession;
+                // Once a session failed, its remaining checks are only counted
+                if (!vSkip[s] && vOk[s])
+                    vOk[s] = item.check();
+                vDone[s]++;
+            }
+            int64_t nElapsed = GetTimeMicros() - nTimeStart;
+            unsigned int nRun = vBatch.size();
+            vBatch.clear();
+
+            // Size the next batches to take about TARGET_BATCH_MICROS
+            nCheckMicros = (nCheckMicros * 3 + nElapsed / nRun) / 4;
+            nAdaptive = nCheckMicros > 0 ? std::max(1U, (unsigned int)std::min((int64_t)nBatchSize, TARGET_BATCH_MICROS / nCheckMicros)) : nBatchSize;
+
+            boost::unique_lock<boost::mutex> lock(mutex);
+            for (unsigned int s = 0; s < MAX_SESSIONS; s++) {
+                if (!vDone[s])
+                    continue;
+                vSessions[s].fAllOk &= vOk[s];
+                vSessions[s].nTodo -= vDone[s];
+                if (vSessions[s].nTodo == 0)
+                    // We processed the last element of a session; inform its master it can exit and return the result
+                    condMaster.notify_all();
+                vDone[s] = 0;
+            }
+            nChecks += nRun;
+            nBatches++;
+            nSteals += fStolen;
+            nBusyMicros += nElapsed;
+            if (fMaster && vSessions[nSession].nTodo == 0)
+                // Don't hold up our caller with checks of later sessions
+                return EndSession(nSession);
+            nQueuesNow = nQueues;
         } while (true);
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nQueues(1), nNextQueue(0), nIdle(0), nTotal(0), fQuit(false), nBatchSize(nBatchSizeIn),
+        nChecks(0), nBatches(0), nSteals(0), nBusyMicros(0), nStartTime(0)
+    {
+        for (unsigned int i = 0; i < MAX_QUEUES; i++)
+            vQueues.push_back(boost::shared_ptr<CWorkerQueue>(new CWorkerQueue()));
+        for (unsigned int s = 0; s < MAX_SESSIONS; s++) {
+            vSessions[s].fInUse = false;
+            vSessions[s].nTodo = 0;
+            vSessions[s].fAllOk = true;
+        }
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nQueue;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            assert(nQueues < MAX_QUEUES);
+            nQueue = nQueues++;
+            if (nStartTime == 0)
+                nStartTime = GetTimeMicros();
+        }
+        Loop(nQueue);
     }
 
-    //! Wait until execution finishes, and return whether all evaluations were successful.
-    bool Wait()
+    //! Reserve a session for a new set of checks
+    unsigned int StartSession()
     {
-        return Loop(true);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (true) {
+            for (unsigned int s = 0; s < MAX_SESSIONS; s++) {
+                if (!vSessions[s].fInUse) {
+                    vSessions[s].fInUse = true;
+                    vSessions[s].nTodo = 0;
+                    vSessions[s].fAllOk = true;
+                    return s;
+                }
+            }
+            condMaster.wait(lock);
+        }
+    }
+
+    //! Wait until execution of a session finishes, and return whether all its evaluations were successful.
+    //! This ends the session.
+    bool Wait(unsigned int nSession)
+    {
+        return Loop(0, true, nSession);
+    }
+
+    //! Skip the checks of a session that haven't started yet; its result will be failure
+    void Cancel(unsigned int nSession)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        vSessions[nSession].fAllOk = false;
     }
 
     //! Add a batch of checks to the queue
-    void Add(std::vector<T>& vChecks)
+    void Add(std::vector<T>& vChecks, unsigned int nSession)
     {
+        if (vChecks.empty())
+            return;
         boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+        assert(vSessions[nSession].fInUse);
+        vSessions[nSession].nTodo += vChecks.size();
+        // Contiguous runs per deque, so checks added together tend to run together
+        unsigned int nPer = (vChecks.size() + nQueues - 1) / nQueues;
+        unsigned int nQueue = nNextQueue % nQueues;
+        for (unsigned int i = 0; i < vChecks.size(); i += nPer) {
+            CWorkerQueue& q = *vQueues[nQueue];
+            boost::unique_lock<boost::mutex> lockQueue(q.mutex);
+            for (unsigned int j = i; j < std::min((unsigned int)vChecks.size(), i + nPer); j++) {
+                q.items.push_back(CItem());
+                q.items.back().check.swap(vChecks[j]);
+                q.items.back().nSession = nSession;
+            }
+            nQueue = (nQueue + 1) % nQueues;
         }
-        nTodo += vChecks.size();
+        nNextQueue = nQueue;
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
@@ -164,12 +386,35 @@ public:
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        for (unsigned int s = 0; s < MAX_SESSIONS; s++)
+            if (vSessions[s].fInUse)
+                return false;
+        return (nTotal == nIdle);
     }
 
+    CCheckQueueStats GetStats()
+    {
+        CCheckQueueStats stats;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        stats.nWorkers = nQueues - 1;
+        stats.nQueued = 0;
+        for (unsigned int i = 0; i < nQueues; i++) {
+            boost::unique_lock<boost::mutex> lockQueue(vQueues[i]->mutex);
+            stats.nQueued += vQueues[i]->items.size();
+        }
+        stats.nSessions = 0;
+        for (unsigned int s = 0; s < MAX_SESSIONS; s++)
+            stats.nSessions += vSessions[s].fInUse;
+        stats.nChecks = nChecks;
+        stats.nBatches = nBatches;
+        stats.nSteals = nSteals;
+        stats.nBusyMicros = nBusyMicros;
+        stats.nUptimeMicros = nStartTime ? GetTimeMicros() - nStartTime : 0;
+        return stats;
+    }
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
@@ -178,23 +423,24 @@ class CCheckQueueControl
 {
 private:
     CCheckQueue<T>* pqueue;
+    unsigned int nSession;
     bool fDone;
 
 public:
-    CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), fDone(false)
+    CCheckQueueControl(CCheckQueue<T>* pqueueIn) : pqueue(pqueueIn), nSession(0), fDone(false)
     {
-        // passed queue is supposed to be unused, or NULL
-        if (pqueue != NULL) {
-            bool isIdle = pqueue->IsIdle();
-            assert(isIdle);
-        }
+        // Each controller has its own session, so it is unaffected by other
+        // controllers of the same queue.
+        if (pqueue != NULL)
+            nSession = pqueue->StartSession();
     }
 
     bool Wait()
     {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
+        assert(!fDone);
+        bool fRet = pqueue->Wait(nSession);
         fDone = true;
         return fRet;
     }
@@ -202,7 +448,14 @@ public:
     void Add(std::vector<T>& vChecks)
     {
         if (pqueue != NULL)
-            pqueue->Add(vChecks);
+            pqueue->Add(vChecks, nSession);
+    }
+
+    //! Don't run checks that haven't started yet; Wait() will return false
+    void Cancel()
+    {
+        if (pqueue != NULL && !fDone)
+            pqueue->Cancel(nSession);
     }
 
     ~CCheckQueueControl()
@@ -93,7 +93,9 @@ size_t strnlen( const char *start, size_t max_len);
 #endif // HAVE_DECL_STRNLEN
 
 bool static inline IsSelectableSocket(SOCKET s) {
-#ifdef WIN32
+#if defined(WIN32) || defined(HAVE_EPOLL)
+    // Winsock's fd_set holds handles rather than a bitmap, and epoll and poll
+    // have no FD_SETSIZE limit at all.
     return true;
 #else
     return (s < FD_SETSIZE);
@@ -0,0 +1,514 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/groestl.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GROESTL_HAVE_AESNI 1
+#endif
+
+#ifdef GROESTL_HAVE_AESNI
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <wmmintrin.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GROESTL_TARGET
+#else
+#include <cpuid.h>
+#define GROESTL_TARGET __attribute__((target("aes,ssse3")))
+#endif
+
+// Internal implementation code.
+namespace
+{
+/// Internal Groestl-512 (AES-NI) implementation.
+namespace groestl
+{
+/**
+ * pshufb masks that rotate a row left by its ShiftBytes offset and apply
+ * InvShiftRows, so that AESENCLAST reduces to a plain SubBytes.
+ * P offsets are {0,1,2,3,4,5,6,11}, Q offsets are {1,3,5,11,0,2,4,6}.
+ */
+static const unsigned char SHIFT_P[8][16] = {
+    { 0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3},
+    { 1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4},
+    { 2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5},
+    { 3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6},
+    { 4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7},
+    { 5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8},
+    { 6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9},
+    {11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14},
+};
+
+static const unsigned char SHIFT_Q[8][16] = {
+    { 1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4},
+    { 3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6},
+    { 5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8},
+    {11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14},
+    { 0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3},
+    { 2, 15, 12,  9,  6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5},
+    { 4,  1, 14, 11,  8,  5,  2, 15, 12,  9,  6,  3,  0, 13, 10,  7},
+    { 6,  3,  0, 13, 10,  7,  4,  1, 14, 11,  8,  5,  2, 15, 12,  9},
+};
+
+/** Column index in the high nibble of every byte: the round constant base. */
+static const unsigned char COLUMN_NIBBLES[16] = {
+    0x00, 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70,
+    0x80, 0x90, 0xa0, 0xb0, 0xc0, 0xd0, 0xe0, 0xf0,
+};
+
+static const int ROUNDS = 14;
+
+enum Lane { LANE_P, LANE_Q };
+
+/** A 1024-bit state as eight rows of sixteen columns. */
+typedef __m128i State[8];
+
+GROESTL_TARGET inline __m128i Load(const unsigned char* p) { return _mm_loadu_si128((const __m128i*)p); }
+
+/** Multiply every byte by 2 in GF(2^8) modulo the AES polynomial. */
+GROESTL_TARGET inline __m128i Mul2(__m128i x)
+{
+    __m128i carry = _mm_and_si128(_mm_cmplt_epi8(x, _mm_setzero_si128()), _mm_set1_epi8(0x1b));
+    return _mm_xor_si128(_mm_add_epi8(x, x), carry);
+}
+
+/** One row of MixBytes, see MixBytes. */
+template <int I>
+GROESTL_TARGET inline __m128i MixRow(const State& a, const State& t)
+{
+    const __m128i c = _mm_xor_si128(t[(I + 3) & 7], t[(I + 6) & 7]);
+    const __m128i b = _mm_xor_si128(_mm_xor_si128(t[I], a[(I + 2) & 7]), _mm_xor_si128(a[(I + 5) & 7], a[(I + 7) & 7]));
+    const __m128i x = _mm_xor_si128(a[(I + 2) & 7], _mm_xor_si128(t[(I + 4) & 7], t[(I + 6) & 7]));
+    return _mm_xor_si128(x, Mul2(_mm_xor_si128(b, Mul2(c))));
+}
+
+/**
+ * MixBytes: multiply each column by circ(02, 02, 03, 04, 05, 03, 05, 07).
+ * With t[i] = a[i] ^ a[i+1] the coefficients split into a part times 1,
+ * one times 2 and one times 4, so only two doublings are needed per row.
+ */
+GROESTL_TARGET inline void MixBytes(State& a)
+{
+    State t;
+    t[0] = _mm_xor_si128(a[0], a[1]); t[1] = _mm_xor_si128(a[1], a[2]);
+    t[2] = _mm_xor_si128(a[2], a[3]); t[3] = _mm_xor_si128(a[3], a[4]);
+    t[4] = _mm_xor_si128(a[4], a[5]); t[5] = _mm_xor_si128(a[5], a[6]);
+    t[6] = _mm_xor_si128(a[6], a[7]); t[7] = _mm_xor_si128(a[7], a[0]);
+    const __m128i b0 = MixRow<0>(a, t), b1 = MixRow<1>(a, t), b2 = MixRow<2>(a, t), b3 = MixRow<3>(a, t);
+    const __m128i b4 = MixRow<4>(a, t), b5 = MixRow<5>(a, t), b6 = MixRow<6>(a, t), b7 = MixRow<7>(a, t);
+    a[0] = b0; a[1] = b1; a[2] = b2; a[3] = b3;
+    a[4] = b4; a[5] = b5; a[6] = b6; a[7] = b7;
+}
+
+/** SubBytes and ShiftBytes of one row; the shuffle mask also undoes AES ShiftRows. */
+GROESTL_TARGET inline __m128i SubShift(__m128i x, const unsigned char* mask)
+{
+    return _mm_aesenclast_si128(_mm_shuffle_epi8(x, Load(mask)), _mm_setzero_si128());
+}
+
+/** One round of P (AddRoundConstant on row 0) or Q (on all rows). */
+template <Lane L>
+GROESTL_TARGET inline void Round(State& x, __m128i rc)
+{
+    if (L == LANE_P) {
+        x[0] = _mm_xor_si128(x[0], rc);
+        x[0] = SubShift(x[0], SHIFT_P[0]); x[1] = SubShift(x[1], SHIFT_P[1]);
+        x[2] = SubShift(x[2], SHIFT_P[2]); x[3] = SubShift(x[3], SHIFT_P[3]);
+        x[4] = SubShift(x[4], SHIFT_P[4]); x[5] = SubShift(x[5], SHIFT_P[5]);
+        x[6] = SubShift(x[6], SHIFT_P[6]); x[7] = SubShift(x[7], SHIFT_P[7]);
+    } else {
+        const __m128i ones = _mm_set1_epi8((char)0xff);
+        x[0] = SubShift(_mm_xor_si128(x[0], ones), SHIFT_Q[0]);
+        x[1] = SubShift(_mm_xor_si128(x[1], ones), SHIFT_Q[1]);
+        x[2] = SubShift(_mm_xor_si128(x[2], ones), SHIFT_Q[2]);
+        x[3] = SubShift(_mm_xor_si128(x[3], ones), SHIFT_Q[3]);
+        x[4] = SubShift(_mm_xor_si128(x[4], ones), SHIFT_Q[4]);
+        x[5] = SubShift(_mm_xor_si128(x[5], ones), SHIFT_Q[5]);
+        x[6] = SubShift(_mm_xor_si128(x[6], ones), SHIFT_Q[6]);
+        x[7] = SubShift(_mm_xor_si128(x[7], _mm_xor_si128(rc, ones)), SHIFT_Q[7]);
+    }
+    MixBytes(x);
+}
+
+/** Run two independent permutations side by side, round by round. */
+template <Lane L1, Lane L2>
+GROESTL_TARGET inline void Permute2(State& a, State& b)
+{
+    const __m128i columns = Load(COLUMN_NIBBLES);
+    for (int r = 0; r < ROUNDS; r++) {
+        const __m128i rc = _mm_xor_si128(columns, _mm_set1_epi8((char)r));
+        Round<L1>(a, rc);
+        Round<L2>(b, rc);
+    }
+}
+
+template <Lane L>
+GROESTL_TARGET inline void Permute(State& a)
+{
+    const __m128i columns = Load(COLUMN_NIBBLES);
+    for (int r = 0; r < ROUNDS; r++)
+        Round<L>(a, _mm_xor_si128(columns, _mm_set1_epi8((char)r)));
+}
+
+/** Load a 128-byte block (column-major) into rows. */
+GROESTL_TARGET inline void LoadBlock(State& x, const unsigned char* block)
+{
+    const __m128i pair = _mm_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+    __m128i w[8];
+    for (int i = 0; i < 8; i++)
+        w[i] = _mm_shuffle_epi8(Load(block + 16 * i), pair);
+    // Transpose the 8x8 matrix of 16-bit (two column) units.
+    __m128i a0 = _mm_unpacklo_epi16(w[0], w[1]), a1 = _mm_unpackhi_epi16(w[0], w[1]);
+    __m128i a2 = _mm_unpacklo_epi16(w[2], w[3]), a3 = _mm_unpackhi_epi16(w[2], w[3]);
+    __m128i a4 = _mm_unpacklo_epi16(w[4], w[5]), a5 = _mm_unpackhi_epi16(w[4], w[5]);
+    __m128i a6 = _mm_unpacklo_epi16(w[6], w[7]), a7 = _mm_unpackhi_epi16(w[6], w[7]);
+    __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+    __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+    __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+    __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+    x[0] = _mm_unpacklo_epi64(b0, b4); x[1] = _mm_unpackhi_epi64(b0, b4);
+    x[2] = _mm_unpacklo_epi64(b1, b5); x[3] = _mm_unpackhi_epi64(b1, b5);
+    x[4] = _mm_unpacklo_epi64(b2, b6); x[5] = _mm_unpackhi_epi64(b2, b6);
+    x[6] = _mm_unpacklo_epi64(b3, b7); x[7] = _mm_unpackhi_epi64(b3, b7);
+}
+
+/** Write out the first nBytes bytes of columns 8..15, i.e. the Groestl-512 digest. */
+GROESTL_TARGET inline void StoreDigest(const State& x, unsigned char* out, size_t nBytes)
+{
+    unsigned char rows[8][16];
+    for (int i = 0; i < 8; i++)
+        _mm_storeu_si128((__m128i*)rows[i], x[i]);
+    for (size_t k = 0; k < nBytes; k++)
+        out[k] = rows[k & 7][8 + (k >> 3)];
+}
+
+GROESTL_TARGET inline void Initialize(State& h)
+{
+    for (int i = 0; i < 8; i++)
+        h[i] = _mm_setzero_si128();
+    // The 512-bit output length, big endian, in the last two bytes.
+    h[6] = _mm_insert_epi16(h[6], 0x0200, 7);
+}
+
+GROESTL_TARGET inline void Xor(State& r, const State& a, const State& b)
+{
+    for (int i = 0; i < 8; i++)
+        r[i] = _mm_xor_si128(a[i], b[i]);
+}
+
+/** Compression function: h = P(h ^ m) ^ Q(m) ^ h. */
+GROESTL_TARGET inline void Compress(State& h, const State& m)
+{
+    State p, q;
+    Xor(p, h, m);
+    for (int i = 0; i < 8; i++)
+        q[i] = m[i];
+    Permute2<LANE_P, LANE_Q>(p, q);
+    Xor(p, p, q);
+    Xor(h, h, p);
+}
+
+/** Output transformation: h = P(h) ^ h. */
+GROESTL_TARGET inline void Finalize(State& h)
+{
+    State p;
+    for (int i = 0; i < 8; i++)
+        p[i] = h[i];
+    Permute<LANE_P>(p);
+    Xor(h, h, p);
+}
+
+/** Output transformation of two states at once. */
+GROESTL_TARGET inline void Finalize2(State& h0, State& h1)
+{
+    State p0, p1;
+    for (int i = 0; i < 8; i++) {
+        p0[i] = h0[i];
+        p1[i] = h1[i];
+    }
+    Permute2<LANE_P, LANE_P>(p0, p1);
+    Xor(h0, h0, p0);
+    Xor(h1, h1, p1);
+}
+
+template <int N>
+GROESTL_TARGET inline void FinalizeLanes(State* h)
+{
+    if (N == 2)
+        Finalize2(h[0], h[N - 1]);
+    else
+        Finalize(h[0]);
+}
+
+/**
+ * Second half of the double hash for N headers whose padded first blocks are
+ * already in m. The second message is built straight from the rows of the
+ * first digest without leaving the row layout.
+ */
+template <int N>
+GROESTL_TARGET void DoubleHashBlocks(State* m, unsigned char* hashes)
+{
+    State h[N];
+    for (int n = 0; n < N; n++) {
+        Initialize(h[n]);
+        Compress(h[n], m[n]);
+    }
+    FinalizeLanes<N>(h);
+
+    // The 64-byte digest occupies columns 8..15; move it to columns 0..7
+    // and pad: 0x80 at byte 64 (column 8, row 0), block count 1 at byte 127.
+    for (int n = 0; n < N; n++) {
+        for (int i = 0; i < 8; i++)
+            m[n][i] = _mm_srli_si128(h[n][i], 8);
+        m[n][0] = _mm_insert_epi16(m[n][0], 0x0080, 4);
+        m[n][7] = _mm_insert_epi16(m[n][7], 0x0100, 7);
+        Initialize(h[n]);
+        Compress(h[n], m[n]);
+    }
+    FinalizeLanes<N>(h);
+    for (int n = 0; n < N; n++)
+        StoreDigest(h[n], hashes + 32 * n, 32);
+}
+
+/** Load an 80-byte header as its single padded message block. */
+GROESTL_TARGET inline void LoadHeader(State& m, const unsigned char* header)
+{
+    unsigned char block[128] = {0};
+    memcpy(block, header, 80);
+    block[80] = 0x80;
+    block[127] = 1;
+    LoadBlock(m, block);
+}
+
+template <int N>
+GROESTL_TARGET void DoubleHash80(const unsigned char* headers, unsigned char* hashes)
+{
+    State m[N];
+    for (int n = 0; n < N; n++)
+        LoadHeader(m[n], headers + 80 * n);
+    DoubleHashBlocks<N>(m, hashes);
+}
+
+/**
+ * The nonce is header bytes 76..79, i.e. column 9, rows 4..7 of the block.
+ * Overwrite it in a prepared block: word 4 of each of those rows holds
+ * column 8 (header bytes 68..71, constant) and column 9.
+ */
+GROESTL_TARGET inline void SetNonce(State& m, const State& tmpl, const unsigned char* header, uint32_t nNonce)
+{
+    for (int i = 0; i < 4; i++)
+        m[i] = tmpl[i];
+    m[4] = _mm_insert_epi16(tmpl[4], header[68] | (nNonce & 0xff) << 8, 4);
+    m[5] = _mm_insert_epi16(tmpl[5], header[69] | (nNonce >> 8 & 0xff) << 8, 4);
+    m[6] = _mm_insert_epi16(tmpl[6], header[70] | (nNonce >> 16 & 0xff) << 8, 4);
+    m[7] = _mm_insert_epi16(tmpl[7], header[71] | (nNonce >> 24) << 8, 4);
+}
+
+GROESTL_TARGET void DoubleHash80Nonces(const unsigned char* header, uint32_t nNonce, size_t n, unsigned char* hashes)
+{
+    State tmpl, m[2];
+    LoadHeader(tmpl, header);
+    for (; n >= 2; n -= 2, nNonce += 2, hashes += 64) {
+        SetNonce(m[0], tmpl, header, nNonce);
+        SetNonce(m[1], tmpl, header, nNonce + 1);
+        DoubleHashBlocks<2>(m, hashes);
+    }
+    if (n) {
+        SetNonce(m[0], tmpl, header, nNonce);
+        DoubleHashBlocks<1>(m, hashes);
+    }
+}
+
+/** Pad the last rest (< 128) bytes after nFull blocks, compress them and write the digest. */
+GROESTL_TARGET void HashTail(State& h, const unsigned char* data, size_t rest, uint64_t nFull, unsigned char* hash)
+{
+    State m;
+    // Pad the tail into one or two more blocks, ending in the block count.
+    unsigned char tail[256] = {0};
+    if (rest)
+        memcpy(tail, data, rest);
+    tail[rest] = 0x80;
+    const size_t tailSize = rest + 9 <= 128 ? 128 : 256;
+    const uint64_t blocks = nFull + tailSize / 128;
+    for (int i = 0; i < 8; i++)
+        tail[tailSize - 1 - i] = (unsigned char)(blocks >> (8 * i));
+    for (size_t off = 0; off < tailSize; off += 128) {
+        LoadBlock(m, tail + off);
+        Compress(h, m);
+    }
+    Finalize(h);
+    StoreDigest(h, hash, 64);
+}
+
+GROESTL_TARGET void Hash512(const unsigned char* data, size_t len, unsigned char* hash)
+{
+    State h, m;
+    Initialize(h);
+    const size_t nFull = len / 128;
+    for (size_t b = 0; b < nFull; b++) {
+        LoadBlock(m, data + 128 * b);
+        Compress(h, m);
+    }
+    HashTail(h, data + 128 * nFull, len - 128 * nFull, nFull, hash);
+}
+
+/** The incremental hasher keeps the chaining value in this layout between calls. */
+GROESTL_TARGET inline void LoadState(State& h, const unsigned char* p)
+{
+    for (int i = 0; i < 8; i++)
+        h[i] = Load(p + 16 * i);
+}
+
+GROESTL_TARGET inline void StoreState(const State& h, unsigned char* p)
+{
+    for (int i = 0; i < 8; i++)
+        _mm_storeu_si128((__m128i*)(p + 16 * i), h[i]);
+}
+
+GROESTL_TARGET void InitState(unsigned char* state)
+{
+    State h;
+    Initialize(h);
+    StoreState(h, state);
+}
+
+GROESTL_TARGET void CompressBlocks(unsigned char* state, const unsigned char* data, size_t nBlocks)
+{
+    State h, m;
+    LoadState(h, state);
+    for (size_t b = 0; b < nBlocks; b++) {
+        LoadBlock(m, data + 128 * b);
+        Compress(h, m);
+    }
+    StoreState(h, state);
+}
+
+GROESTL_TARGET void FinishState(const unsigned char* state, const unsigned char* data, size_t rest, uint64_t nFull, unsigned char* hash)
+{
+    State h;
+    LoadState(h, state);
+    HashTail(h, data, rest, nFull, hash);
+}
+
+bool Detect()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 25)) && (info[2] & (1 << 9));
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    return (ecx & bit_AES) && (ecx & bit_SSSE3);
+#endif
+}
+
+} // namespace groestl
+} // namespace
+
+#endif // GROESTL_HAVE_AESNI
+
+namespace GroestlAesni
+{
+bool Available()
+{
+#ifdef GROESTL_HAVE_AESNI
+    static const bool fAvailable = groestl::Detect();
+    return fAvailable;
+#else
+    return false;
+#endif
+}
+
+void Hash512(const unsigned char* data, size_t len, unsigned char hash[OUTPUT_SIZE])
+{
+    assert(Available());
+#ifdef GROESTL_HAVE_AESNI
+    groestl::Hash512(data, len, hash);
+#endif
+}
+
+Hasher512::Hasher512()
+{
+    Reset();
+}
+
+void Hasher512::Reset()
+{
+    nBuf = 0;
+    nBlocks = 0;
+#ifdef GROESTL_HAVE_AESNI
+    if (Available())
+        groestl::InitState(state);
+#endif
+}
+
+Hasher512& Hasher512::Write(const unsigned char* data, size_t len)
+{
+    assert(Available());
+#ifdef GROESTL_HAVE_AESNI
+    if (nBuf) {
+        size_t nCopy = std::min(len, BLOCK_SIZE - nBuf);
+        memcpy(buf + nBuf, data, nCopy);
+        nBuf += nCopy;
+        data += nCopy;
+        len -= nCopy;
+        if (nBuf < BLOCK_SIZE)
+            return *this;
+        groestl::CompressBlocks(state, buf, 1);
+        nBlocks++;
+        nBuf = 0;
+    }
+    size_t nFull = len / BLOCK_SIZE;
+    if (nFull) {
+        groestl::CompressBlocks(state, data, nFull);
+        nBlocks += nFull;
+        data += nFull * BLOCK_SIZE;
+        len -= nFull * BLOCK_SIZE;
+    }
+    if (len) {
+        memcpy(buf, data, len);
+        nBuf = len;
+    }
+#endif
+    return *this;
+}
+
+void Hasher512::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    assert(Available());
+#ifdef GROESTL_HAVE_AESNI
+    groestl::FinishState(state, buf, nBuf, nBlocks, hash);
+#endif
+}
+
+void DoubleHash80(const unsigned char* headers, size_t n, unsigned char* hashes)
+{
+    assert(Available());
+#ifdef GROESTL_HAVE_AESNI
+    for (; n >= 2; n -= 2, headers += 2 * HEADER_SIZE, hashes += 64)
+        groestl::DoubleHash80<2>(headers, hashes);
+    if (n)
+        groestl::DoubleHash80<1>(headers, hashes);
+#endif
+}
+
+void DoubleHash80Nonces(const unsigned char* header, uint32_t nNonce, size_t n, unsigned char* hashes)
+{
+    assert(Available());
+#ifdef GROESTL_HAVE_AESNI
+    groestl::DoubleHash80Nonces(header, nNonce, n, hashes);
+#endif
+}
+}
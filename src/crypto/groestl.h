@@ -0,0 +1,67 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GROESTLCOIN_CRYPTO_GROESTL_H
+#define GROESTLCOIN_CRYPTO_GROESTL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * Groestl-512 kernel built on AES-NI and SSSE3.
+ *
+ * The state is kept as eight 128-bit rows: ShiftBytes is a byte shuffle,
+ * SubBytes is AESENCLAST with a zero round key (its ShiftRows step is undone
+ * by the same shuffle) and MixBytes is done with SSE2 xtime arithmetic.
+ * Independent permutations (P and Q of a compression, or the output
+ * transformations of two headers in a batch) run interleaved round by round
+ * to keep the AES unit busy.
+ *
+ * The portable reference is sphlib's groestl.cpp; callers must check
+ * Available() before using any other function here.
+ */
+namespace GroestlAesni
+{
+static const size_t OUTPUT_SIZE = 64;
+static const size_t HEADER_SIZE = 80;
+
+/** Whether the running CPU has AES-NI and SSSE3. */
+bool Available();
+
+/** Groestl-512 of an arbitrary message. */
+void Hash512(const unsigned char* data, size_t len, unsigned char hash[OUTPUT_SIZE]);
+
+/**
+ * Groestl-512 of a message that is written in pieces. It can be constructed
+ * on any CPU; Write() and Finalize() require Available().
+ */
+class Hasher512
+{
+public:
+    static const size_t BLOCK_SIZE = 128;
+
+    Hasher512();
+    Hasher512& Write(const unsigned char* data, size_t len);
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+    void Reset();
+
+private:
+    unsigned char state[BLOCK_SIZE];
+    unsigned char buf[BLOCK_SIZE];
+    size_t nBuf;
+    uint64_t nBlocks;
+};
+
+/** Groestl-512 applied twice, truncated to 32 bytes, for n consecutive 80-byte headers. */
+void DoubleHash80(const unsigned char* headers, size_t n, unsigned char* hashes);
+
+/**
+ * Like DoubleHash80 for one header with its nonce (last four bytes, little
+ * endian) replaced by nNonce, nNonce + 1, ..., nNonce + n - 1. The message
+ * block is laid out once and only the nonce column is rewritten per hash.
+ */
+void DoubleHash80Nonces(const unsigned char* header, uint32_t nNonce, size_t n, unsigned char* hashes);
+}
+
+#endif // GROESTLCOIN_CRYPTO_GROESTL_H
@@ -7,8 +7,12 @@
 #include "groestlcoin.h"
 
 
+#include "arith_uint256.h"
 #include "hash.h"
 #include "crypto/common.h"
+#include "crypto/groestl.h"
+
+#include <boost/static_assert.hpp>
 
 
 
@@ -21,7 +25,32 @@ extern "C" {
 
 namespace XCoin {
 
-uint256 HashGroestl(const ConstBuf& cbuf) {
+static GroestlBackend DefaultGroestlBackend() {
+	return GroestlAesni::Available() ? GROESTL_BACKEND_AESNI : GROESTL_BACKEND_SPH;
+}
+
+static GroestlBackend s_groestlBackend = DefaultGroestlBackend();
+
+GroestlBackend GetGroestlBackend() {
+	return s_groestlBackend;
+}
+
+bool SetGroestlBackend(GroestlBackend backend) {
+	if (backend == GROESTL_BACKEND_AESNI && !GroestlAesni::Available())
+		return false;
+	s_groestlBackend = backend;
+	return true;
+}
+
+const char *GroestlBackendName(GroestlBackend backend) {
+	switch (backend) {
+	case GROESTL_BACKEND_SPH: return "sphlib";
+	case GROESTL_BACKEND_AESNI: return "aesni";
+	}
+	return "unknown";
+}
+
+static uint256 HashGroestlSph(const ConstBuf& cbuf) {
     sph_groestl512_context  ctx_gr[2];
     static unsigned char pblank[1];
     uint256 hash[4];
@@ -37,6 +66,112 @@ uint256 HashGroestl(const ConstBuf& cbuf) {
     return hash[2];
 }
 
+uint256 HashGroestl(const ConstBuf& cbuf) {
+	if (s_groestlBackend != GROESTL_BACKEND_AESNI)
+		return HashGroestlSph(cbuf);
+
+	unsigned char hash[2][GroestlAesni::OUTPUT_SIZE];
+	GroestlAesni::Hash512(cbuf.P, cbuf.Size, hash[0]);
+	GroestlAesni::Hash512(hash[0], sizeof(hash[0]), hash[1]);
+	uint256 r;
+	memcpy(r.begin(), hash[1], r.size());
+	return r;
+}
+
+GroestlHasher::GroestlHasher() {
+	BOOST_STATIC_ASSERT(sizeof(sph) >= sizeof(sph_groestl512_context));
+	Reset();
+}
+
+void GroestlHasher::Reset() {
+	backend = s_groestlBackend;
+	if (backend == GROESTL_BACKEND_AESNI)
+		aesni.Reset();
+	else
+		sph_groestl512_init(sph);
+}
+
+GroestlHasher& GroestlHasher::Write(const ConstBuf& cbuf) {
+	if (!cbuf.Size)
+		return *this;
+	if (backend == GROESTL_BACKEND_AESNI)
+		aesni.Write(cbuf.P, cbuf.Size);
+	else
+		sph_groestl512(sph, cbuf.P, cbuf.Size);
+	return *this;
+}
+
+uint256 GroestlHasher::Finalize() {
+	unsigned char hash[2][64];
+	if (backend == GROESTL_BACKEND_AESNI) {
+		aesni.Finalize(hash[0]);
+		GroestlAesni::Hash512(hash[0], sizeof(hash[0]), hash[1]);
+	} else {
+		sph_groestl512_close(sph, hash[0]);
+		sph_groestl512_context ctx;
+		sph_groestl512_init(&ctx);
+		sph_groestl512(&ctx, hash[0], sizeof(hash[0]));
+		sph_groestl512_close(&ctx, hash[1]);
+	}
+	uint256 r;
+	memcpy(r.begin(), hash[1], r.size());
+	return r;
+}
+
+void HashPowHeaders(const unsigned char *headers, size_t n, uint256 *hashes) {
+	if (s_groestlBackend == GROESTL_BACKEND_AESNI) {
+		GroestlAesni::DoubleHash80(headers, n, (unsigned char*)hashes);
+		return;
+	}
+	for (size_t i = 0; i < n; i++)
+		hashes[i] = HashGroestlSph(ConstBuf(headers + 80 * i, headers + 80 * (i + 1)));
+}
+
+static void HashPowNoncesSph(const unsigned char *header, uint32_t nNonce, size_t n, uint256 *hashes) {
+	// sphlib buffers the whole 128-byte block, so the midstate is simply the
+	// context with the 76 constant bytes already absorbed.
+	sph_groestl512_context ctxPrefix;
+	sph_groestl512_init(&ctxPrefix);
+	sph_groestl512(&ctxPrefix, header, 76);
+	for (size_t i = 0; i < n; i++, nNonce++) {
+		unsigned char nonce[4];
+		WriteLE32(nonce, nNonce);
+		uint256 hash[2];
+		sph_groestl512_context ctx = ctxPrefix;
+		sph_groestl512(&ctx, nonce, sizeof(nonce));
+		sph_groestl512_close(&ctx, static_cast<void*>(&hash[0]));
+		sph_groestl512_init(&ctx);
+		sph_groestl512(&ctx, static_cast<const void*>(&hash[0]), 64);
+		sph_groestl512_close(&ctx, static_cast<void*>(&hash[0]));
+		hashes[i] = hash[0];
+	}
+}
+
+size_t HashPowSweep(const unsigned char *header, uint32_t nNonceBegin, uint32_t nCount, const uint256& hashTarget,
+		std::vector<std::pair<uint32_t, uint256> >& vFound, size_t nMaxFound) {
+	static const uint32_t BATCH = 64;
+	const arith_uint256 target = UintToArith256(hashTarget);
+	uint256 hashes[BATCH];
+	size_t nFound = 0;
+	for (uint32_t nDone = 0; nDone < nCount; ) {
+		const uint32_t n = std::min(BATCH, nCount - nDone);
+		const uint32_t nNonce = nNonceBegin + nDone;
+		if (s_groestlBackend == GROESTL_BACKEND_AESNI)
+			GroestlAesni::DoubleHash80Nonces(header, nNonce, n, (unsigned char*)hashes);
+		else
+			HashPowNoncesSph(header, nNonce, n, hashes);
+		for (uint32_t i = 0; i < n; i++) {
+			if (UintToArith256(hashes[i]) <= target) {
+				vFound.push_back(std::make_pair(nNonce + i, hashes[i]));
+				if (++nFound >= nMaxFound)
+					return nDone + i + 1;
+			}
+		}
+		nDone += n;
+	}
+	return nCount;
+}
+
 uint256 HashFromTx(const ConstBuf& cbuf) {
 	CSHA256 sha;
 	sha.Write(cbuf.P, cbuf.Size);
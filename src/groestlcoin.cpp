@@ -6,6 +6,8 @@
 
 #include "groestlcoin.h"
 
+#include <algorithm>
+
 #include <boost/assign/list_of.hpp>
 
 #include "arith_uint256.h"
@@ -15,7 +17,6 @@
 #include "utilstrencodings.h"
 #include "crypto/sha256.h"
 
-#include "bignum.h"
 
 extern "C" {
 
@@ -123,7 +124,114 @@ CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 static const int64_t nTargetTimespan = 86400; //1 day
 static const int64_t nTargetSpacing = 1 * 60; // groestlcoin every 60 seconds
 
-//!!!BUG this function is non-deterministic  because FP-arithetics
+namespace {
+
+/**
+ * Positive IEEE 754 binary64 numbers with round-half-to-even, computed on
+ * integers. DarkGravityWave was specified with double arithmetic, whose
+ * results depend on the FPU (x87 extended precision rounds differently),
+ * so the few operations it needs are done here bit-exactly instead.
+ *
+ * The value is m * 2^e with 2^52 <= m < 2^53, or zero when m is 0.
+ */
+class CSoftDouble
+{
+private:
+    static const int MANTISSA_BITS = 53;
+
+    uint64_t m;
+    int e;
+
+    CSoftDouble(uint64_t mIn, int eIn) : m(mIn), e(eIn) {}
+
+    /** Round n * 2^exp to the nearest double; fSticky says bits below n were dropped. */
+    static CSoftDouble Round(arith_uint256 n, int exp, bool fSticky)
+    {
+        if (n == 0)
+            return CSoftDouble(0, 0);
+        int nBits = n.bits();
+        if (nBits <= MANTISSA_BITS) {
+            assert(!fSticky);
+            return CSoftDouble((n << (MANTISSA_BITS - nBits)).GetLow64(), exp - (MANTISSA_BITS - nBits));
+        }
+        int nShift = nBits - MANTISSA_BITS;
+        arith_uint256 half = arith_uint256(1) << (nShift - 1);
+        arith_uint256 rem = n - ((n >> nShift) << nShift);
+        uint64_t mRound = (n >> nShift).GetLow64();
+        if (rem > half || (rem == half && (fSticky || (mRound & 1))))
+            mRound++;
+        if (mRound >> MANTISSA_BITS) {
+            mRound >>= 1;
+            nShift++;
+        }
+        return CSoftDouble(mRound, exp + nShift);
+    }
+
+public:
+    explicit CSoftDouble(int64_t n)
+    {
+        assert(n >= 0);
+        *this = Round(arith_uint256((uint64_t)n), 0, false);
+    }
+
+    /** The double with bit pattern nBits (positive and normal). */
+    static CSoftDouble FromBits(uint64_t nBits)
+    {
+        return CSoftDouble((nBits & 0xfffffffffffffULL) | (1ULL << 52), (int)(nBits >> 52) - 1023 - 52);
+    }
+
+    /** Truncate towards zero, as a conversion to int64_t does. */
+    int64_t GetInt64() const
+    {
+        if (e >= 0)
+            return (int64_t)(m << e);
+        return e <= -64 ? 0 : (int64_t)(m >> -e);
+    }
+
+    bool operator<(const CSoftDouble& b) const
+    {
+        if (m == 0 || b.m == 0)
+            return b.m != 0;
+        return e != b.e ? e < b.e : m < b.m;
+    }
+
+    friend CSoftDouble operator+(const CSoftDouble& a, const CSoftDouble& b)
+    {
+        if (a.m == 0 || b.m == 0)
+            return a.m == 0 ? b : a;
+        if (a.e < b.e)
+            return b + a;
+        // Beyond this distance b only affects the sticky bit.
+        int nShift = std::min(a.e - b.e, MANTISSA_BITS + 2);
+        arith_uint256 n = (arith_uint256(a.m) << nShift) + (arith_uint256(b.m) >> (a.e - b.e - nShift));
+        return Round(n, a.e - nShift, nShift < a.e - b.e);
+    }
+
+    friend CSoftDouble operator*(const CSoftDouble& a, const CSoftDouble& b)
+    {
+        return Round(arith_uint256(a.m) * arith_uint256(b.m), a.e + b.e, false);
+    }
+
+    friend CSoftDouble operator/(const CSoftDouble& a, const CSoftDouble& b)
+    {
+        assert(b.m != 0);
+        static const int QUOTIENT_SHIFT = 2 * MANTISSA_BITS + 2;
+        arith_uint256 n = arith_uint256(a.m) << QUOTIENT_SHIFT;
+        arith_uint256 q = n / arith_uint256(b.m);
+        return Round(q, a.e - b.e - QUOTIENT_SHIFT, q * arith_uint256(b.m) != n);
+    }
+};
+
+/** Signed BIGNUM-style (truncating) nAverage + (nNext - nAverage) / nCount on unsigned targets. */
+arith_uint256 MoveAverage(const arith_uint256& nAverage, const arith_uint256& nNext, int64_t nCount)
+{
+    if (nNext >= nAverage)
+        return nAverage + (nNext - nAverage) / (uint64_t)nCount;
+    return nAverage - (nAverage - nNext) / (uint64_t)nCount;
+}
+
+}
+
 unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params& params) {
     /* current difficulty formula, darkcoin - DarkGravity, written by Evan Duffield - evan@darkcoin.io */
     const CBlockIndex *BlockLastSolved = pindexLast;
@@ -137,21 +245,20 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
     int64_t PastBlocksMin = 12;
     int64_t PastBlocksMax = 120;
     int64_t CountBlocks = 0;
-    CBigNum PastDifficultyAverage;
-    CBigNum PastDifficultyAveragePrev;
+    arith_uint256 PastDifficultyAverage;
 
     if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || BlockLastSolved->nHeight < PastBlocksMin) {
-		return UintToArith256(params.powLimit).GetCompact();
-	}
-        
+        return UintToArith256(params.powLimit).GetCompact();
+    }
+
     for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
         if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
         CountBlocks++;
 
         if(CountBlocks <= PastBlocksMin) {
-            if (CountBlocks == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-            else { PastDifficultyAverage = ((CBigNum().SetCompact(BlockReading->nBits) - PastDifficultyAveragePrev) / CountBlocks) + PastDifficultyAveragePrev; }
-            PastDifficultyAveragePrev = PastDifficultyAverage;
+            arith_uint256 bnReading = arith_uint256().SetCompact(BlockReading->nBits);
+            if (CountBlocks == 1) { PastDifficultyAverage = bnReading; }
+            else { PastDifficultyAverage = MoveAverage(PastDifficultyAverage, bnReading, CountBlocks); }
         }
 
         if(LastBlockTime > 0){
@@ -172,14 +279,18 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
         if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
         BlockReading = BlockReading->pprev;
     }
-    
-    CBigNum bnNew(PastDifficultyAverage);
-    if (nBlockTimeCount != 0 && nBlockTimeCount2 != 0) {
-            double SmartAverage = (((nBlockTimeAverage)*0.7)+((nBlockTimeSum2 / nBlockTimeCount2)*0.3));
-            if(SmartAverage < 1) SmartAverage = 1;
-            double Shift = nTargetSpacing/SmartAverage;
 
-            int64_t nActualTimespan = (CountBlocks*nTargetSpacing)/Shift;
+    arith_uint256 bnNew(PastDifficultyAverage);
+    if (nBlockTimeCount != 0 && nBlockTimeCount2 != 0) {
+            // SmartAverage = nBlockTimeAverage*0.7 + (nBlockTimeSum2 / nBlockTimeCount2)*0.3, in doubles
+            static const uint64_t DOUBLE_0_7 = 0x3fe6666666666666ULL;
+            static const uint64_t DOUBLE_0_3 = 0x3fd3333333333333ULL;
+            CSoftDouble SmartAverage = CSoftDouble(nBlockTimeAverage) * CSoftDouble::FromBits(DOUBLE_0_7) +
+                                       CSoftDouble(nBlockTimeSum2 / nBlockTimeCount2) * CSoftDouble::FromBits(DOUBLE_0_3);
+            if (SmartAverage < CSoftDouble(1)) SmartAverage = CSoftDouble(1);
+            CSoftDouble Shift = CSoftDouble(nTargetSpacing) / SmartAverage;
+
+            int64_t nActualTimespan = (CSoftDouble(CountBlocks*nTargetSpacing) / Shift).GetInt64();
             int64_t nTargetTimespan = (CountBlocks*nTargetSpacing);
             if (nActualTimespan < nTargetTimespan/3)
                 nActualTimespan = nTargetTimespan/3;
@@ -191,10 +302,10 @@ unsigned int static DarkGravityWave(const CBlockIndex* pindexLast, const CBlockH
             bnNew /= nTargetTimespan;
     }
 
-    if (bnNew > CBigNum(params.powLimit)){
-        bnNew = CBigNum(params.powLimit);
+    if (bnNew > UintToArith256(params.powLimit)){
+        bnNew = UintToArith256(params.powLimit);
     }
-     
+
     return bnNew.GetCompact();
 }
 
@@ -207,34 +318,33 @@ unsigned int static DarkGravityWave3(const CBlockIndex* pindexLast, const CBlock
     int64_t PastBlocksMin = 24;
     int64_t PastBlocksMax = 24;
     int64_t CountBlocks = 0;
-    CBigNum PastDifficultyAverage;
-    CBigNum PastDifficultyAveragePrev;
+    arith_uint256 PastDifficultyAverage;
 
-    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || BlockLastSolved->nHeight < PastBlocksMin) { 
-		return UintToArith256(params.powLimit).GetCompact();
+    if (BlockLastSolved == NULL || BlockLastSolved->nHeight == 0 || BlockLastSolved->nHeight < PastBlocksMin) {
+        return UintToArith256(params.powLimit).GetCompact();
     }
-        
+
     for (unsigned int i = 1; BlockReading && BlockReading->nHeight > 0; i++) {
         if (PastBlocksMax > 0 && i > PastBlocksMax) { break; }
         CountBlocks++;
 
         if(CountBlocks <= PastBlocksMin) {
-            if (CountBlocks == 1) { PastDifficultyAverage.SetCompact(BlockReading->nBits); }
-            else { PastDifficultyAverage = ((PastDifficultyAveragePrev * CountBlocks)+(CBigNum().SetCompact(BlockReading->nBits))) / (CountBlocks+1); }
-            PastDifficultyAveragePrev = PastDifficultyAverage;
+            arith_uint256 bnReading = arith_uint256().SetCompact(BlockReading->nBits);
+            if (CountBlocks == 1) { PastDifficultyAverage = bnReading; }
+            else { PastDifficultyAverage = ((PastDifficultyAverage * (uint32_t)CountBlocks) + bnReading) / (uint64_t)(CountBlocks+1); }
         }
 
         if(LastBlockTime > 0){
             int64_t Diff = (LastBlockTime - BlockReading->GetBlockTime());
             nActualTimespan += Diff;
         }
-        LastBlockTime = BlockReading->GetBlockTime();      
+        LastBlockTime = BlockReading->GetBlockTime();
 
         if (BlockReading->pprev == NULL) { assert(BlockReading); break; }
         BlockReading = BlockReading->pprev;
     }
-    
-    CBigNum bnNew(PastDifficultyAverage);
+
+    arith_uint256 bnNew(PastDifficultyAverage);
 
     int64_t nTargetTimespan = CountBlocks*nTargetSpacing;
 
@@ -247,9 +357,9 @@ unsigned int static DarkGravityWave3(const CBlockIndex* pindexLast, const CBlock
     bnNew *= nActualTimespan;
     bnNew /= nTargetTimespan;
 
-	if (bnNew > CBigNum(params.powLimit)) {
-		bnNew = CBigNum(params.powLimit);
-	}
+    if (bnNew > UintToArith256(params.powLimit)) {
+        bnNew = UintToArith256(params.powLimit);
+    }
     return bnNew.GetCompact();
 }
 //----------------------
@@ -265,9 +375,15 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
 			return UintToArith256(params.powLimit).GetCompact();
     }
 
-	if (pindexLast->nHeight >= (100000 - 1))
-		return DarkGravityWave3(pindexLast, pblock, params);
-    return DarkGravityWave(pindexLast, pblock, params);
+    // The retarget only depends on pindexLast and its ancestors, so it is
+    // computed once per block index.
+    if (pindexLast->nBitsNext == 0) {
+        if (pindexLast->nHeight >= (100000 - 1))
+            pindexLast->nBitsNext = DarkGravityWave3(pindexLast, pblock, params);
+        else
+            pindexLast->nBitsNext = DarkGravityWave(pindexLast, pblock, params);
+    }
+    return pindexLast->nBitsNext;
 }
 
 static CBlock CreateGenesisBlock(const char* pszTimestamp, const CScript& genesisOutputScript, uint32_t nTime, uint32_t nNonce, uint32_t nBits, int32_t nVersion, const CAmount& genesisReward) {
@@ -8,6 +8,7 @@
 
 #include "amount.h"
 #include "uint256.h"
+#include "crypto/groestl.h"
 
 
 namespace XCoin {
@@ -40,8 +41,48 @@ public:
 };
 
 
+/** Groestl-512 implementations HashGroestl can dispatch to. */
+enum GroestlBackend {
+	GROESTL_BACKEND_SPH,		//!< portable sphlib code, the reference
+	GROESTL_BACKEND_AESNI,		//!< AES-NI/SSSE3 kernel in crypto/groestl.cpp
+};
+
+/** The backend in use. Chosen at static initialization: AES-NI if the CPU has it. */
+GroestlBackend GetGroestlBackend();
+/** Force a backend (tests, benchmarks). Returns false if the CPU lacks it. */
+bool SetGroestlBackend(GroestlBackend backend);
+const char *GroestlBackendName(GroestlBackend backend);
+
 uint256 HashGroestl(const ConstBuf& cbuf);
 
+/** HashGroestl of data that arrives in pieces, such as a network message being received. */
+class GroestlHasher {
+public:
+	GroestlHasher();
+	GroestlHasher& Write(const ConstBuf& cbuf);
+	uint256 Finalize();
+	void Reset();
+
+private:
+	GroestlBackend backend;			//!< fixed for the whole message
+	GroestlAesni::Hasher512 aesni;
+	uint64_t sph[34];				//!< sph_groestl512_context
+};
+
+/** HashPow of n consecutive 80-byte serialized block headers. */
+void HashPowHeaders(const unsigned char *headers, size_t n, uint256 *hashes);
+
+/**
+ * Sweep the nonce of an 80-byte serialized header over nNonceBegin, ...,
+ * nNonceBegin + nCount - 1 (wrapping) and append every nonce whose HashPow
+ * is <= hashTarget, with that hash, to vFound. The constant 76-byte prefix
+ * is prepared once instead of being re-hashed for each nonce.
+ * Stops early once nMaxFound candidates were found; returns the number of
+ * nonces hashed.
+ */
+size_t HashPowSweep(const unsigned char *header, uint32_t nNonceBegin, uint32_t nCount, const uint256& hashTarget,
+		std::vector<std::pair<uint32_t, uint256> >& vFound, size_t nMaxFound = (size_t)-1);
+
 uint256 HashFromTx(const ConstBuf& cbuf);
 uint256 HashForSignature(const ConstBuf& cbuf);
 inline uint256 HashPow(const ConstBuf& cbuf) { return HashGroestl(cbuf); }
@@ -12,7 +12,6 @@
 #include "random.h"
 
 #include <secp256k1.h>
-#include "ecwrapper.h"
 
 static secp256k1_context_t* secp256k1_context = NULL;
 
@@ -184,9 +183,6 @@ void CExtKey::Decode(const unsigned char code[74]) {
 }
 
 bool ECC_InitSanityCheck() {
-    if (!CECKey::SanityCheck()) {
-        return false;
-    }
     CKey key;
     key.MakeNewKey(true);
     CPubKey pubkey = key.GetPubKey();
@@ -6,6 +6,8 @@
 
 #include "util.h"
 
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <leveldb/cache.h>
@@ -27,14 +29,53 @@ void HandleError(const leveldb::Status& status) throw(leveldb_error)
     throw leveldb_error("Unknown database error");
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/** Apply the -db* overrides to a database profile. */
+static CLevelDBTuning ApplyTuningArgs(CLevelDBTuning tuning)
+{
+    int64_t nWriteBuffer = GetArg("-dbwritebuffer", 0);
+    if (nWriteBuffer > 0)
+        tuning.nWriteBufferSize = nWriteBuffer << 20;
+    int64_t nBlockSize = GetArg("-dbblocksize", 0);
+    if (nBlockSize > 0)
+        tuning.nBlockSize = nBlockSize << 10;
+    tuning.nMaxOpenFiles = std::max((int)GetArg("-dbmaxopenfiles", tuning.nMaxOpenFiles), 16);
+    tuning.fCompression = GetBoolArg("-dbcompression", tuning.fCompression);
+    return tuning;
+}
+
+CLevelDBTuning CLevelDBTuning::ForChainstate(size_t nCacheSize)
+{
+    CLevelDBTuning tuning;
+    // Up to two write buffers may be held in memory simultaneously.
+    tuning.nWriteBufferSize = std::min(nCacheSize / 4, (size_t)64 << 20);
+    tuning.nBlockCacheSize = nCacheSize - 2 * tuning.nWriteBufferSize;
+    tuning.nBlockSize = 4 << 10;
+    tuning.nMaxOpenFiles = DEFAULT_DB_MAX_OPEN_FILES;
+    tuning.fCompression = false;
+    return ApplyTuningArgs(tuning);
+}
+
+CLevelDBTuning CLevelDBTuning::ForBlockIndex(size_t nCacheSize)
+{
+    CLevelDBTuning tuning;
+    tuning.nWriteBufferSize = nCacheSize / 4;
+    tuning.nBlockCacheSize = nCacheSize / 2;
+    tuning.nBlockSize = 16 << 10;
+    tuning.nMaxOpenFiles = DEFAULT_DB_MAX_OPEN_FILES;
+    tuning.fCompression = false;
+    return ApplyTuningArgs(tuning);
+}
+
+static leveldb::Options GetOptions(const CLevelDBTuning& tuning)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    options.block_cache = leveldb::NewLRUCache(tuning.nBlockCacheSize);
+    options.write_buffer_size = tuning.nWriteBufferSize;
+    options.block_size = tuning.nBlockSize;
     options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
+    // Falls back to storing blocks uncompressed if LevelDB was built without Snappy.
+    options.compression = tuning.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = tuning.nMaxOpenFiles;
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
         // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
         // on corruption in later versions.
@@ -44,13 +85,28 @@ static leveldb::Options GetOptions(size_t nCacheSize)
 }
 
 CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+{
+    tuning.nBlockCacheSize = nCacheSize / 2;
+    tuning.nWriteBufferSize = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
+    tuning.nBlockSize = 4 << 10;
+    tuning.nMaxOpenFiles = DEFAULT_DB_MAX_OPEN_FILES;
+    tuning.fCompression = false;
+    Open(path, fMemory, fWipe);
+}
+
+CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, const CLevelDBTuning& tuningIn, bool fMemory, bool fWipe) : tuning(tuningIn)
+{
+    Open(path, fMemory, fWipe);
+}
+
+void CLevelDBWrapper::Open(const boost::filesystem::path& path, bool fMemory, bool fWipe)
 {
     penv = NULL;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(tuning);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -65,7 +121,9 @@ CLevelDBWrapper::CLevelDBWrapper(const boost::filesystem::path& path, size_t nCa
     }
     leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
     HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    LogPrintf("Opened LevelDB successfully (block cache %.1fMiB, write buffer %.1fMiB, block size %uKiB, %d open files%s)\n",
+        tuning.nBlockCacheSize * (1.0 / 1024 / 1024), tuning.nWriteBufferSize * (1.0 / 1024 / 1024),
+        (unsigned int)(tuning.nBlockSize >> 10), tuning.nMaxOpenFiles, tuning.fCompression ? ", compressed" : "");
 }
 
 CLevelDBWrapper::~CLevelDBWrapper()
@@ -86,3 +144,12 @@ bool CLevelDBWrapper::WriteBatch(CLevelDBBatch& batch, bool fSync) throw(leveldb
     HandleError(status);
     return true;
 }
+
+uint64_t CLevelDBWrapper::EstimateSize() const
+{
+    // All keys start with a printable type character.
+    leveldb::Range range(leveldb::Slice("\x00", 1), leveldb::Slice("\xff", 1));
+    uint64_t nSize = 0;
+    pdb->GetApproximateSizes(&range, 1, &nSize);
+    return nSize;
+}
@@ -24,6 +24,39 @@ public:
 
 void HandleError(const leveldb::Status& status) throw(leveldb_error);
 
+//! -dbmaxopenfiles default
+static const int DEFAULT_DB_MAX_OPEN_FILES = 64;
+//! -dbcompactafteribd default
+static const bool DEFAULT_DB_COMPACT_AFTER_IBD = true;
+
+/**
+ * LevelDB settings of one database. The defaults depend on how the database
+ * is used and are sized from its share of -dbcache; the -db* options
+ * override them for all databases.
+ */
+struct CLevelDBTuning
+{
+    size_t nBlockCacheSize;
+    size_t nWriteBufferSize;
+    size_t nBlockSize;
+    int nMaxOpenFiles;
+    bool fCompression;
+
+    /**
+     * The chainstate: small values read at random, and overwritten or
+     * deleted soon after being written during initial block download.
+     * Memory goes to the block cache; the write buffer is capped, as a
+     * larger one only makes each level 0 compaction larger.
+     */
+    static CLevelDBTuning ForChainstate(size_t nCacheSize);
+
+    /**
+     * The block index: written once, then mostly read by one full scan at
+     * startup (and by point lookups with -txindex), so it uses larger blocks.
+     */
+    static CLevelDBTuning ForBlockIndex(size_t nCacheSize);
+};
+
 /** Batch of changes queued to be written to a CLevelDBWrapper */
 class CLevelDBBatch
 {
@@ -31,8 +64,17 @@ class CLevelDBBatch
 
 private:
     leveldb::WriteBatch batch;
+    size_t nSizeEstimate;
 
 public:
+    CLevelDBBatch() : nSizeEstimate(0) {}
+
+    void Clear()
+    {
+        batch.Clear();
+        nSizeEstimate = 0;
+    }
+
     template <typename K, typename V>
     void Write(const K& key, const V& value)
     {
@@ -47,6 +89,7 @@ public:
         leveldb::Slice slValue(&ssValue[0], ssValue.size());
 
         batch.Put(slKey, slValue);
+        nSizeEstimate += ssKey.size() + ssValue.size();
     }
 
     template <typename K>
@@ -58,7 +101,11 @@ public:
         leveldb::Slice slKey(&ssKey[0], ssKey.size());
 
         batch.Delete(slKey);
+        nSizeEstimate += ssKey.size();
     }
+
+    //! Approximate number of bytes of keys and values queued in this batch
+    size_t SizeEstimate() const { return nSizeEstimate; }
 };
 
 class CLevelDBWrapper
@@ -85,8 +132,14 @@ private:
     //! the database itself
     leveldb::DB* pdb;
 
+    //! settings the database was opened with
+    CLevelDBTuning tuning;
+
+    void Open(const boost::filesystem::path& path, bool fMemory, bool fWipe);
+
 public:
     CLevelDBWrapper(const boost::filesystem::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CLevelDBWrapper(const boost::filesystem::path& path, const CLevelDBTuning& tuningIn, bool fMemory = false, bool fWipe = false);
     ~CLevelDBWrapper();
 
     template <typename K, typename V>
@@ -163,6 +216,36 @@ public:
         return WriteBatch(batch, true);
     }
 
+    //! Compact the key range [keyBegin, keyEnd], e.g. after erasing most of it
+    template <typename K>
+    void CompactRange(const K& keyBegin, const K& keyEnd) const
+    {
+        CDataStream ssBegin(SER_DISK, CLIENT_VERSION);
+        CDataStream ssEnd(SER_DISK, CLIENT_VERSION);
+        ssBegin << keyBegin;
+        ssEnd << keyEnd;
+        leveldb::Slice slBegin(&ssBegin[0], ssBegin.size());
+        leveldb::Slice slEnd(&ssEnd[0], ssEnd.size());
+        pdb->CompactRange(&slBegin, &slEnd);
+    }
+
+    //! Compact the whole database
+    void CompactFull() const
+    {
+        pdb->CompactRange(NULL, NULL);
+    }
+
+    //! Read a LevelDB property such as "leveldb.stats"; false if it is unknown
+    bool GetProperty(const std::string& strName, std::string& strValue) const
+    {
+        return pdb->GetProperty(strName, &strValue);
+    }
+
+    //! Approximate size on disk of all keys, as known to the file system
+    uint64_t EstimateSize() const;
+
+    const CLevelDBTuning& GetTuning() const { return tuning; }
+
     // not exactly clean encapsulation, but it's easiest for now
     leveldb::Iterator* NewIterator()
     {
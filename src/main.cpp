@@ -9,11 +9,14 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockstore.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/common.h"
+#include "groestlcoin.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -22,6 +25,7 @@
 #include "pow.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "primitives/txview.h"
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
@@ -38,9 +42,11 @@
 #include <sstream>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -62,6 +68,8 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nHeaderCheckThreads = 0;
+bool fOverlapBlockChecks = DEFAULT_OVERLAP_BLOCK_CHECKS;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
@@ -142,6 +150,15 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Mappings of the block files before nLastBlockFile, for ReadRawBlockFromDisk. */
+    CBlockFileMap blockfilemap;
+    /** Recently relayed and requested blocks, as sent to peers. */
+    CRawBlockCache rawblockcache;
+    /** Complete "block" messages for the blocks near the tip that were sent last, oldest first. */
+    boost::mutex csRecentBlockMsgs;
+    std::deque<std::pair<uint256, CSerializedNetMsg> > vRecentBlockMsgs;
+    /** Blocks whose "block" message is kept for other peers to request */
+    const size_t MAX_RECENT_BLOCK_MSGS = 2;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -553,6 +570,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 
 CCoinsViewCache *pcoinsTip = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CCoinsViewDB *pcoinsdbview = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
 //
@@ -766,11 +784,11 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 
     if (fAllowFree)
     {
-        // There is a free transaction area in blocks created by most miners,
-        // * If we are relaying we allow transactions up to DEFAULT_BLOCK_PRIORITY_SIZE - 1000
+        // There is a free transaction area in blocks created by miners that set -blockprioritysize,
+        // * If we are relaying we allow transactions up to MAX_FREE_RELAY_TX_SIZE
         //   to be considered to fall into this category. We don't want to encourage sending
         //   multiple transactions instead of one big transaction to avoid fees.
-        if (nBytes < (DEFAULT_BLOCK_PRIORITY_SIZE - 1000))
+        if (nBytes < MAX_FREE_RELAY_TX_SIZE)
             nMinFee = 0;
     }
 
@@ -780,8 +798,20 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
 }
 
 
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age)
+{
+    std::vector<uint256> vRemoved;
+    int expired = pool.Expire(GetTime() - age, &vRemoved);
+    if (expired != 0)
+        LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
+
+    pool.TrimToSize(limit, &vRemoved);
+    BOOST_FOREACH(const uint256& hash, vRemoved)
+        GetMainSignals().RemovedFromMempool(hash);
+}
+
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee)
+                        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fOverrideMempoolLimit)
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -839,14 +869,16 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        if (view.HaveCoins(hash))
-            return false;
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            if (view.HaveCoin(COutPoint(hash, i)))
+                return false;
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
+        // Spent and missing outputs look the same in the UTXO set, so both
+        // end up in pfMissingInputs.
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false;
@@ -888,7 +920,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         CAmount nFees = nValueIn-nValueOut;
         double dPriority = view.GetPriority(tx, chainActive.Height());
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx));
+        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), mempool.HasNoInputsOf(tx), nSigOps);
         unsigned int nSize = entry.GetTxSize();
 
         // Don't accept it if it can't get into a block
@@ -898,8 +930,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                       hash.ToString(), nFees, txMinFee),
                              REJECT_INSUFFICIENTFEE, "insufficient fee");
 
-        // Require that free transactions have sufficient priority to be mined in the next block.
-        if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
+        // A full mempool raises the bar above the relay fee, and priority no
+        // longer buys a free transaction in.
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0 && nFees < mempoolRejectFee) {
+            return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                      hash.ToString(), nFees, mempoolRejectFee),
+                             REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        } else if (GetBoolArg("-relaypriority", true) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
+            // Require that free transactions have sufficient priority to be mined in the next block.
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
         }
 
@@ -933,6 +972,21 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                        nFees, ::minRelayTxFee.GetFee(nSize) * 10000),
                                  REJECT_HIGHFEE, "absurdly-high-fee");
 
+        // Calculate in-mempool ancestors, up to a limit.
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+        std::string errString;
+        {
+        LOCK(pool.cs);
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString)) {
+            return state.DoS(0, error("AcceptToMemoryPool: too-long-mempool-chain %s: %s", hash.ToString(), errString),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+        }
+        }
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
@@ -955,7 +1009,15 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
         }
 
         // Store transaction in memory
-        pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+
+        // trim mempool and check if tx was trimmed
+        if (!fOverrideMempoolLimit) {
+            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+            if (!pool.exists(hash))
+                return state.DoS(0, error("AcceptToMemoryPool: mempool full, %s evicted", hash.ToString()),
+                                 REJECT_INSUFFICIENTFEE, "mempool full");
+        }
     }
 
     SyncWithWallets(tx, NULL);
@@ -1000,10 +1062,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
             int nHeight = -1;
             {
-                CCoinsViewCache &view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
+                const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+                if (!coin.IsSpent())
+                    nHeight = coin.nHeight;
             }
             if (nHeight > 0)
                 pindexSlow = chainActive[nHeight];
@@ -1011,11 +1072,14 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     }
 
     if (pindexSlow) {
-        CBlock block;
-        if (ReadBlockFromDisk(block, pindexSlow)) {
-            BOOST_FOREACH(const CTransaction &tx, block.vtx) {
+        // Only the transaction looked for is deserialized
+        CRawBlock rawBlock;
+        CBlockView block;
+        if (ReadRawBlockFromDisk(rawBlock, pindexSlow) && block.Parse(rawBlock.begin(), rawBlock.end())) {
+            BOOST_FOREACH(const CTxView &tx, block.vtx) {
                 if (tx.GetHash() == hash) {
-                    txOut = tx;
+                    CDataStream ssTx((const char*)tx.begin(), (const char*)tx.end(), SER_NETWORK, PROTOCOL_VERSION);
+                    ssTx >> txOut;
                     hashBlock = pindexSlow->GetBlockHash();
                     return true;
                 }
@@ -1091,6 +1155,121 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex)
+{
+    return ReadRawBlockFromDisk(block, pindex->GetBlockPos(), pindex->GetBlockHash());
+}
+
+bool ReadRawBlockFromDisk(CRawBlock& block, const CDiskBlockPos& pos, const uint256& hash)
+{
+    block = CRawBlock();
+    if (pos.IsNull() || pos.nPos < 4)
+        return error("%s: invalid position %s", __func__, pos.ToString());
+
+    // Files that are no longer appended to are served from a read-only mapping.
+    CBlockFileMap::MappedFile file;
+    {
+        LOCK(cs_LastBlockFile);
+        if ((int)pos.nFile < nLastBlockFile)
+            file = blockfilemap.Get(pos.nFile, GetBlockPosFilename(pos, "blk"));
+    }
+    if (file) {
+        const unsigned char* pbegin = (const unsigned char*)file->get_address();
+        size_t nFileSize = file->get_size();
+        if (pos.nPos >= 4 && pos.nPos <= nFileSize) {
+            // The block is preceded by the message start and its size.
+            unsigned int nSize = ReadLE32(pbegin + pos.nPos - 4);
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+            if (nSize <= nFileSize - pos.nPos)
+                block = CRawBlock(file, pbegin + pos.nPos, nSize);
+        }
+    }
+
+    // Anything else is read with stdio, still without deserializing it.
+    if (block.empty()) {
+        CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - 4), true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+        try {
+            unsigned int nSize;
+            filein >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+            boost::shared_ptr<std::vector<unsigned char> > vch(new std::vector<unsigned char>(nSize));
+            filein.read((char*)&(*vch)[0], nSize);
+            block = CRawBlock(vch, &(*vch)[0], nSize);
+        } catch (const std::exception& e) {
+            return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    }
+
+    // The header leads the block; check it against the index.
+    if (block.size() < 80 || XCoin::HashPow(XCoin::ConstBuf(block.begin(), block.begin() + 80)) != hash)
+        return error("%s: block header doesn't match index for %s at %s", __func__, hash.ToString(), pos.ToString());
+    return true;
+}
+
+bool GetRawBlock(CRawBlock& block, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    // Peers catching up walk the whole chain one block at a time; only keep
+    // the blocks near the tip, which many peers are likely to ask for.
+    return GetRawBlock(block, pindex->GetBlockPos(), pindex->GetBlockHash(), pindex->nHeight + BLOCK_CACHE_DEPTH > chainActive.Height());
+}
+
+bool GetRawBlock(CRawBlock& block, const CDiskBlockPos& pos, const uint256& hash, bool fCache)
+{
+    if (rawblockcache.Get(hash, block))
+        return true;
+    if (!ReadRawBlockFromDisk(block, pos, hash))
+        return false;
+    if (fCache)
+        rawblockcache.Insert(hash, block);
+    return true;
+}
+
+/**
+ * Get the "block" message for a block near the tip. When a new block is
+ * relayed most peers ask for it at about the same time; they are all sent
+ * the same buffer, which is serialized and checksummed only once.
+ */
+static bool GetBlockNetMsg(CSerializedNetMsg& msg, const CDiskBlockPos& pos, const uint256& hash)
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csRecentBlockMsgs);
+        for (size_t i = 0; i < vRecentBlockMsgs.size(); i++) {
+            if (vRecentBlockMsgs[i].first == hash) {
+                msg = vRecentBlockMsgs[i].second;
+                return true;
+            }
+        }
+    }
+    CRawBlock block;
+    if (!GetRawBlock(block, pos, hash, true))
+        return false;
+    msg = MakeSerializedNetMsg("block", block);
+
+    boost::unique_lock<boost::mutex> lock(csRecentBlockMsgs);
+    for (size_t i = 0; i < vRecentBlockMsgs.size(); i++)
+        if (vRecentBlockMsgs[i].first == hash)
+            return true;
+    vRecentBlockMsgs.push_back(std::make_pair(hash, msg));
+    if (vRecentBlockMsgs.size() > MAX_RECENT_BLOCK_MSGS)
+        vRecentBlockMsgs.pop_front();
+    return true;
+}
+
+void SetRawBlockCacheSize(size_t nBytes)
+{
+    rawblockcache.SetMaxBytes(nBytes);
+}
+
+CRawBlockCacheStats GetRawBlockCacheStats()
+{
+    return rawblockcache.GetStats();
+}
+
 /*!!!GRS
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
@@ -1263,27 +1442,16 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 {
     // mark inputs spent
     if (!tx.IsCoinBase()) {
-        txundo.vprevout.reserve(tx.vin.size());
-        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
+        txundo.vprevout.resize(tx.vin.size());
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            bool fSpent = inputs.SpendCoin(tx.vin[i].prevout, &txundo.vprevout[i]);
+            assert(fSpent);
         }
     }
 
     // add outputs
-    inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight)
@@ -1320,20 +1488,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - (int)coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(
-                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight),
+                        error("CheckInputs(): tried to spend coinbase at depth %d", nSpendHeight - (int)coin.nHeight),
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase");
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, error("CheckInputs(): txin values out of range"),
                                  REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
@@ -1377,11 +1545,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1393,7 +1561,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check(*coins, tx, i,
+                        CScriptCheck check(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1491,42 +1659,39 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the coin spent by a transaction input from its undo data.
+ * @param undo The coin as it was before being spent.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(const Coin& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+
+    Coin coin = undo;
+    if (coin.nHeight == 0) {
+        // Undo data written by older versions only carries the height and
+        // coinbase flag for the last spent output of a transaction; take them
+        // from any other unspent output of the same transaction.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (alternate.IsSpent())
+            return error("%s: undo data adding output to missing transaction", __func__);
+        coin.nHeight = alternate.nHeight;
+        coin.fCoinBase = alternate.fCoinBase;
+    }
+    // The overwrite flag is set only when an unspent coin is being replaced,
+    // which is an inconsistency that was already reported above.
+    view.AddCoin(out, coin, !fClean);
 
     return fClean;
 }
 
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
 {
-    assert(pindex->GetBlockHash() == view.GetBestBlock());
-
     if (pfClean)
         *pfClean = false;
 
@@ -1549,21 +1714,14 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (unsigned int o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                view.SpendCoin(out, &coin);
+                if (tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || (i == 0) != coin.IsCoinBase())
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+            }
         }
 
         // restore inputs
@@ -1573,7 +1731,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
+                const Coin &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
             }
@@ -1623,6 +1781,493 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Script verification flags for a block, which depend on its time and on the versions of the blocks before it. */
+static unsigned int GetBlockScriptFlags(const CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+{
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+	//GRS
+	int32_t nVersion = block.nVersion;
+	if (nVersion == 112)
+		nVersion = 1;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks, when 75% of the network has upgraded:
+    if (nVersion >= 3 && IsSuperMajority(3, pindex->pprev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    return flags;
+}
+
+namespace {
+
+/**
+ * Script checks of the block to be connected after the current one, queued
+ * while the last checks of the current block are still running so the check
+ * threads don't sit idle between blocks. They only fill the signature cache:
+ * the next block is still verified in full, and in order, when connected.
+ */
+struct CSpeculativeChecks
+{
+    uint256 hash;
+    //! The checks point into the transactions of this block
+    CBlock block;
+    boost::scoped_ptr<CCheckQueueControl<CScriptCheck> > control;
+
+    /**
+     * End the checks. Those not started yet are skipped, connecting the block
+     * runs them anyway. If they were for hashConnecting, the block is handed
+     * over through pblockConnecting (when given) and true is returned.
+     */
+    bool Finish(const uint256& hashConnecting, CBlock* pblockConnecting)
+    {
+        if (!control)
+            return false;
+        control->Cancel();
+        // Waits for the checks already running, which point into block
+        control.reset();
+        bool fHandedOver = false;
+        if (pblockConnecting && hash == hashConnecting) {
+            static_cast<CBlockHeader&>(*pblockConnecting) = block;
+            pblockConnecting->vtx.swap(block.vtx);
+            fHandedOver = true;
+        }
+        block.SetNull();
+        hash.SetNull();
+        return fHandedOver;
+    }
+
+    ~CSpeculativeChecks()
+    {
+        Finish(uint256(), NULL);
+    }
+};
+
+/**
+ * The coins seen by the speculative checks of the next block. Outputs of
+ * the block being connected come from its cache, without fetching anything
+ * into it; all others are read from pcoinsTip. An output the current block
+ * spent may look unspent here, but a next block spending it fails when it
+ * is connected anyway.
+ */
+class CCoinsViewSpeculative : public CCoinsView
+{
+private:
+    const CCoinsViewCache& viewBlock;
+    CCoinsView& viewTip;
+
+public:
+    CCoinsViewSpeculative(const CCoinsViewCache& viewBlockIn, CCoinsView& viewTipIn) : viewBlock(viewBlockIn), viewTip(viewTipIn) {}
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
+    {
+        if (viewBlock.HaveCoinInCache(outpoint))
+            return viewBlock.GetCoin(outpoint, coin);
+        return viewTip.GetCoin(outpoint, coin);
+    }
+
+    bool HaveCoin(const COutPoint& outpoint) const
+    {
+        return viewBlock.HaveCoinInCache(outpoint) || viewTip.HaveCoin(outpoint);
+    }
+
+    uint256 GetBestBlock() const
+    {
+        return viewBlock.GetBestBlock();
+    }
+};
+
+/** Protected by cs_main */
+CSpeculativeChecks speculativeChecks;
+uint64_t nOverlappedBlocks = 0;
+
+} // anon namespace
+
+/**
+ * Queue the script checks of pindexNext, on top of view which has the
+ * current block applied. Stops at the first transaction that doesn't pass
+ * the cheap input checks; connecting pindexNext will report why. The block
+ * read here is kept for ConnectTip.
+ */
+static void StartSpeculativeChecks(const CBlockIndex* pindex, const CBlockIndex* pindexNext, CCoinsViewCache& view)
+{
+    AssertLockHeld(cs_main);
+    CSpeculativeChecks& spec = speculativeChecks;
+    assert(!spec.control);
+    if (pindexNext->pprev != pindex || !(pindexNext->nStatus & BLOCK_HAVE_DATA))
+        return;
+    if (!ReadBlockFromDisk(spec.block, pindexNext)) {
+        spec.block.SetNull();
+        return;
+    }
+    unsigned int flags = GetBlockScriptFlags(spec.block, pindexNext, Params().GetConsensus());
+    spec.hash = pindexNext->GetBlockHash();
+    spec.control.reset(new CCheckQueueControl<CScriptCheck>(&scriptcheckqueue));
+    nOverlappedBlocks++;
+
+    CCoinsViewSpeculative viewSpeculative(view, *pcoinsTip);
+    CCoinsViewCache viewNext(&viewSpeculative);
+    // Coinbase maturity is checked against the height of the block spending it.
+    viewNext.SetBestBlock(pindex->GetBlockHash());
+    CValidationState state;
+    BOOST_FOREACH(const CTransaction& tx, spec.block.vtx) {
+        if (!tx.IsCoinBase()) {
+            if (!viewNext.HaveInputs(tx))
+                break;
+            std::vector<CScriptCheck> vChecks;
+            if (!CheckInputs(tx, state, viewNext, true, flags, true, &vChecks))
+                break;
+            spec.control->Add(vChecks);
+        }
+        UpdateCoins(tx, state, viewNext, pindexNext->nHeight);
+    }
+}
+
+/**
+ * End the speculative checks before connecting the block hashConnecting.
+ * Returns true if they were for that block, which is then put in pblock.
+ */
+static bool FinishSpeculativeChecks(const uint256& hashConnecting, CBlock* pblock = NULL)
+{
+    AssertLockHeld(cs_main);
+    return speculativeChecks.Finish(hashConnecting, pblock);
+}
+
+namespace {
+
+/**
+ * Closure representing one run of consecutive headers whose Groestl hashes
+ * and proof of work are to be checked. The headers are kept serialized, so
+ * a run is hashed with a single HashPowHeaders call.
+ */
+class CHeaderHashCheck
+{
+public:
+    /** Size of a serialized block header */
+    static const size_t HEADER_SIZE = 80;
+
+private:
+    const unsigned char *pheaders;
+    size_t nHeaders;
+    CHeaderHashResult *presults;
+
+public:
+    CHeaderHashCheck(): pheaders(NULL), nHeaders(0), presults(NULL) {}
+    CHeaderHashCheck(const unsigned char *pheadersIn, size_t nHeadersIn, CHeaderHashResult *presultsIn) :
+        pheaders(pheadersIn), nHeaders(nHeadersIn), presults(presultsIn) {}
+
+    bool operator()() {
+        std::vector<uint256> vHashes(nHeaders);
+        XCoin::HashPowHeaders(pheaders, nHeaders, &vHashes[0]);
+        for (size_t i = 0; i < nHeaders; i++) {
+            // nBits is the fifth field of the header, after the two hashes.
+            unsigned int nBits = ReadLE32(pheaders + i * HEADER_SIZE + 72);
+            presults[i].hash = vHashes[i];
+            presults[i].fValidPoW = CheckProofOfWork(vHashes[i], nBits, Params().GetConsensus());
+        }
+        return true;
+    }
+
+    void swap(CHeaderHashCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        std::swap(nHeaders, check.nHeaders);
+        std::swap(presults, check.presults);
+    }
+};
+
+/** Number of headers handed to a header check thread at a time. */
+static const size_t HEADER_HASH_RUN = 16;
+
+CCheckQueue<CHeaderHashCheck> headercheckqueue(128);
+
+} // anon namespace
+
+void HashHeaders(const std::vector<CBlockHeader>& headers, std::vector<CHeaderHashResult>& results)
+{
+    results.resize(headers.size());
+    if (headers.empty())
+        return;
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(headers.size() * CHeaderHashCheck::HEADER_SIZE);
+    BOOST_FOREACH(const CBlockHeader& header, headers)
+        ss << header;
+    assert(ss.size() == headers.size() * CHeaderHashCheck::HEADER_SIZE);
+    const unsigned char *pdata = (const unsigned char*)&ss[0];
+
+    if (nHeaderCheckThreads == 0) {
+        CHeaderHashCheck check(pdata, headers.size(), &results[0]);
+        check();
+        return;
+    }
+
+    std::vector<CHeaderHashCheck> vChecks;
+    vChecks.reserve((headers.size() + HEADER_HASH_RUN - 1) / HEADER_HASH_RUN);
+    for (size_t i = 0; i < headers.size(); i += HEADER_HASH_RUN) {
+        size_t nRun = std::min(HEADER_HASH_RUN, headers.size() - i);
+        vChecks.push_back(CHeaderHashCheck(pdata + i * CHeaderHashCheck::HEADER_SIZE, nRun, &results[i]));
+    }
+    CCheckQueueControl<CHeaderHashCheck> control(&headercheckqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+void ThreadHeaderCheck() {
+    RenameThread("groestlcoin-hdrchk");
+    headercheckqueue.Thread();
+}
+
+namespace {
+
+/**
+ * Closure representing one run of outpoints to read from the chainstate
+ * database ahead of validation. A failed read leaves the coin spent; it is
+ * then simply not prefetched and will be read again by ConnectBlock.
+ */
+class CCoinsPrefetchCheck
+{
+private:
+    const CCoinsView *pview;
+    const COutPoint *poutpoints;
+    size_t nOutPoints;
+    Coin *pcoins;
+
+public:
+    CCoinsPrefetchCheck(): pview(NULL), poutpoints(NULL), nOutPoints(0), pcoins(NULL) {}
+    CCoinsPrefetchCheck(const CCoinsView *pviewIn, const COutPoint *poutpointsIn, size_t nOutPointsIn, Coin *pcoinsIn) :
+        pview(pviewIn), poutpoints(poutpointsIn), nOutPoints(nOutPointsIn), pcoins(pcoinsIn) {}
+
+    bool operator()() {
+        for (size_t i = 0; i < nOutPoints; i++) {
+            try {
+                if (!pview->GetCoin(poutpoints[i], pcoins[i]))
+                    pcoins[i].Clear();
+            } catch (const std::exception&) {
+                pcoins[i].Clear();
+            }
+        }
+        return true;
+    }
+
+    void swap(CCoinsPrefetchCheck &check) {
+        std::swap(pview, check.pview);
+        std::swap(poutpoints, check.poutpoints);
+        std::swap(nOutPoints, check.nOutPoints);
+        std::swap(pcoins, check.pcoins);
+    }
+};
+
+/** Number of outpoints handed to a prefetch thread at a time. */
+static const size_t COINS_PREFETCH_RUN = 8;
+
+CCheckQueue<CCoinsPrefetchCheck> prefetchcheckqueue(16);
+
+/**
+ * Reads the coins spent by the next block to be connected from the
+ * chainstate database while the current block is being validated, so that
+ * ConnectBlock finds them in pcoinsTip instead of waiting on one database
+ * read per input.
+ *
+ * One block is prefetched at a time. The validation thread queues it with
+ * Submit() and picks the coins up with Collect() right before connecting
+ * it. ThreadCoinsPrefetch reads the block, and the reads are spread over
+ * itself and the prefetch check threads.
+ *
+ * The coins are only inserted into pcoinsTip if the database has not been
+ * written to in the meantime: nFlushes must be the number of times pcoinsTip
+ * was flushed, and is compared between Submit() and Collect().
+ */
+class CCoinsPrefetcher
+{
+private:
+    enum State { IDLE, QUEUED, RUNNING, DONE };
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+
+    const CCoinsView *pview;
+    State state;
+    uint256 hashBlock;
+    CDiskBlockPos pos;
+    uint64_t nFlushesSubmitted;
+    std::vector<COutPoint> vOutPoints;
+    std::vector<Coin> vCoins;
+
+    /** Collect the outpoints spent by a block that are not created by the block itself. */
+    static void GetPrevouts(const CBlock& block, std::vector<COutPoint>& vPrevouts)
+    {
+        std::set<uint256> setTxids;
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+                    if (!setTxids.count(txin.prevout.hash))
+                        vPrevouts.push_back(txin.prevout);
+                }
+            }
+            setTxids.insert(tx.GetHash());
+        }
+    }
+
+public:
+    CCoinsPrefetcher() : pview(NULL), state(IDLE), nFlushesSubmitted(0) {}
+
+    /** Set the view to read from (NULL to stop prefetching). Waits for a running read to finish. */
+    void SetView(const CCoinsView *pviewIn)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (state == RUNNING)
+            cond.wait(lock);
+        pview = pviewIn;
+        state = IDLE;
+    }
+
+    /** Start reading the coins spent by a block. Does nothing if a read is still in progress. */
+    void Submit(const uint256& hash, const CDiskBlockPos& posIn, uint64_t nFlushes)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (pview == NULL || state == RUNNING || (state != IDLE && hashBlock == hash))
+                return;
+            state = QUEUED;
+            hashBlock = hash;
+            pos = posIn;
+            nFlushesSubmitted = nFlushes;
+        }
+        cond.notify_all();
+    }
+
+    /**
+     * If the coins of the given block are being read, wait for them and add
+     * them to cache. Returns the number of coins added.
+     */
+    unsigned int Collect(const uint256& hash, uint64_t nFlushes, CCoinsViewCache& cache)
+    {
+        std::vector<COutPoint> vOutPointsRead;
+        std::vector<Coin> vCoinsRead;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (state == IDLE || hashBlock != hash)
+                return 0;
+            if (state == QUEUED) {
+                // Not started yet; reading the coins ourselves is just as fast.
+                state = IDLE;
+                return 0;
+            }
+            while (state == RUNNING)
+                cond.wait(lock);
+            vOutPointsRead.swap(vOutPoints);
+            vCoinsRead.swap(vCoins);
+            state = IDLE;
+            if (nFlushesSubmitted != nFlushes)
+                return 0;
+        }
+        unsigned int nWarmed = 0;
+        for (size_t i = 0; i < vOutPointsRead.size(); i++) {
+            if (!vCoinsRead[i].IsSpent()) {
+                cache.WarmCoin(vOutPointsRead[i], vCoinsRead[i]);
+                nWarmed++;
+            }
+        }
+        return nWarmed;
+    }
+
+    void Thread()
+    {
+        while (true) {
+            CDiskBlockPos posRead;
+            const CCoinsView *pviewRead;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (state != QUEUED)
+                    cond.wait(lock);
+                state = RUNNING;
+                posRead = pos;
+                pviewRead = pview;
+            }
+
+            // Collect() may be waiting for this read: finish it even when interrupted.
+            boost::this_thread::disable_interruption di;
+            std::vector<COutPoint> vOutPointsRead;
+            std::vector<Coin> vCoinsRead;
+            CBlock block;
+            if (ReadBlockFromDisk(block, posRead))
+                GetPrevouts(block, vOutPointsRead);
+            vCoinsRead.resize(vOutPointsRead.size());
+
+            std::vector<CCoinsPrefetchCheck> vChecks;
+            vChecks.reserve((vOutPointsRead.size() + COINS_PREFETCH_RUN - 1) / COINS_PREFETCH_RUN);
+            for (size_t i = 0; i < vOutPointsRead.size(); i += COINS_PREFETCH_RUN) {
+                size_t nRun = std::min(COINS_PREFETCH_RUN, vOutPointsRead.size() - i);
+                vChecks.push_back(CCoinsPrefetchCheck(pviewRead, &vOutPointsRead[i], nRun, &vCoinsRead[i]));
+            }
+            {
+                CCheckQueueControl<CCoinsPrefetchCheck> control(&prefetchcheckqueue);
+                control.Add(vChecks);
+                control.Wait();
+            }
+
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                vOutPoints.swap(vOutPointsRead);
+                vCoins.swap(vCoinsRead);
+                state = DONE;
+            }
+            cond.notify_all();
+        }
+    }
+};
+
+CCoinsPrefetcher coinsprefetcher;
+
+/** Number of times pcoinsTip was flushed to the database. */
+uint64_t nCoinsTipFlushes = 0;
+
+} // anon namespace
+
+void ThreadCoinsPrefetch() {
+    RenameThread("groestlcoin-prefetch");
+    coinsprefetcher.Thread();
+}
+
+void ThreadCoinsPrefetchCheck() {
+    RenameThread("groestlcoin-prefchk");
+    prefetchcheckqueue.Thread();
+}
+
+void SetCoinsPrefetchView(const CCoinsView* pview) {
+    coinsprefetcher.SetView(pview);
+}
+
+void GetCheckQueueStats(std::vector<std::pair<std::string, CCheckQueueStats> >& vStats, uint64_t& nOverlappedBlocksOut) {
+    vStats.clear();
+    vStats.push_back(std::make_pair(std::string("script"), scriptcheckqueue.GetStats()));
+    vStats.push_back(std::make_pair(std::string("header"), headercheckqueue.GetStats()));
+    vStats.push_back(std::make_pair(std::string("prefetch"), prefetchcheckqueue.GetStats()));
+    LOCK(cs_main);
+    nOverlappedBlocksOut = nOverlappedBlocks;
+}
+
+void ThreadCompactDatabases() {
+    RenameThread("groestlcoin-dbcompact");
+    // A node that starts out synced has not churned its databases enough to need this.
+    if (!IsInitialBlockDownload())
+        return;
+    while (IsInitialBlockDownload())
+        MilliSleep(10000);
+
+    // During the download most chainstate entries were written and deleted
+    // again shortly after; compacting drops the dead entries from every level.
+    LogPrintf("Compacting databases after initial block download...\n");
+    int64_t nStart = GetTimeMillis();
+    pcoinsdbview->Compact();
+    pblocktree->CompactFull();
+    LogPrintf("Compacted databases in %dms\n", GetTimeMillis() - nStart);
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -1691,10 +2336,12 @@ static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck, const CBlockIndex* pindexNext)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
+    if (!fJustCheck)
+        FinishSpeculativeChecks(pindex->GetBlockHash());
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock(block, state, !fJustCheck, !fJustCheck))
         return false;
@@ -1737,28 +2384,16 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                            (pindex->nHeight==91880 && pindex->GetBlockHash() == uint256S("0x00000000000743f190a18c5577a3c2d2a1f610ae9601ac046a38084ccb7cd721")));
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o)))
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+            }
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-	//GRS
-	int32_t nVersion = block.nVersion;
-	if (nVersion == 112)
-		nVersion = 1;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks, when 75% of the network has upgraded:
-    if (nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
+    unsigned int flags = GetBlockScriptFlags(block, pindex, chainparams.GetConsensus());
+    bool fStrictPayToScriptHash = (flags & SCRIPT_VERIFY_P2SH) != 0;
 
     CBlockUndo blockundo;
 
@@ -1826,6 +2461,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                                block.vtx[0].GetValueOut(), blockReward),
                                REJECT_INVALID, "bad-cb-amount");
 
+    // Keep the check threads busy with the next block while this one's checks finish
+    if (fOverlapBlockChecks && pindexNext && !fJustCheck && fScriptChecks && nScriptCheckThreads)
+        StartSpeculativeChecks(pindex, pindexNext, view);
     if (!control.Wait())
         return state.DoS(100, false);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
@@ -1960,16 +2598,20 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Flush the chainstate (which may refer to block index entries). The
+        // write itself happens in the background; unless the cache has to
+        // make room, its clean entries stay resident.
+        bool fOk = (fCacheLarge || fCacheCritical) ? pcoinsTip->Flush() : pcoinsTip->Sync();
+        if (!fOk)
             return AbortNode(state, "Failed to write to coin database");
+        nCoinsTipFlushes++;
         nLastFlush = nNow;
     }
     if ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000) {
@@ -2047,6 +2689,7 @@ bool static DisconnectTip(CValidationState &state) {
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
+        assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
         if (!DisconnectBlock(block, state, pindexDelete, view))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
@@ -2056,13 +2699,25 @@ bool static DisconnectTip(CValidationState &state) {
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
     // Resurrect mempool transactions from the disconnected block.
+    std::vector<uint256> vHashUpdate;
     BOOST_FOREACH(const CTransaction &tx, block.vtx) {
         // ignore validation errors in resurrected transactions
         list<CTransaction> removed;
         CValidationState stateDummy;
-        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL))
+        if (tx.IsCoinBase() || !AcceptToMemoryPool(mempool, stateDummy, tx, false, NULL, false, true))
             mempool.remove(tx, removed, true);
-    }
+        else if (mempool.exists(tx.GetHash()))
+            vHashUpdate.push_back(tx.GetHash());
+    }
+    // AcceptToMemoryPool/addUnchecked all assume that new mempool entries have
+    // no in-mempool children, which is generally not true when adding
+    // previously-confirmed transactions back to the mempool.
+    // UpdateTransactionsFromBlock finds descendants of any transactions in this
+    // block that were added back and cleans up the mempool state.
+    mempool.UpdateTransactionsFromBlock(vHashUpdate);
+    // The resurrected transactions were let in over the size limit so that
+    // their descendants' state could be fixed up first; trim now.
+    LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     mempool.removeCoinbaseSpends(pcoinsTip, pindexDelete->nHeight);
     mempool.check(pcoinsTip);
     // Update chainActive and related variables.
@@ -2080,19 +2735,35 @@ static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
+static int64_t nTimePrefetch = 0;
+
+/**
+ * Add the coins prefetched for pindex to pcoinsTip, and start prefetching the
+ * coins of pindexNext (if not NULL) while pindex is connected.
+ */
+static void PrefetchCoins(const CBlockIndex *pindex, const CBlockIndex *pindexNext) {
+    int64_t nTime1 = GetTimeMicros();
+    unsigned int nWarmed = coinsprefetcher.Collect(pindex->GetBlockHash(), nCoinsTipFlushes, *pcoinsTip);
+    if (pindexNext && (pindexNext->nStatus & BLOCK_HAVE_DATA))
+        coinsprefetcher.Submit(pindexNext->GetBlockHash(), pindexNext->GetBlockPos(), nCoinsTipFlushes);
+    int64_t nTime2 = GetTimeMicros(); nTimePrefetch += nTime2 - nTime1;
+    LogPrint("bench", "  - Prefetched coins: %u (%.2fms) [%.2fs]\n", nWarmed, (nTime2 - nTime1) * 0.001, nTimePrefetch * 0.000001);
+}
 
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
+ * corresponding to pindexNew, to bypass loading it again from disk. pindexNext is the
+ * block expected to be connected next, if any.
  */
-bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CBlock *pblock) {
+bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CBlock *pblock, const CBlockIndex *pindexNext) {
     assert(pindexNew->pprev == chainActive.Tip());
     mempool.check(pcoinsTip);
     // Read block from disk.
     int64_t nTime1 = GetTimeMicros();
     CBlock block;
     if (!pblock) {
-        if (!ReadBlockFromDisk(block, pindexNew))
+        // The speculative checks of this block have read it already
+        if (!FinishSpeculativeChecks(pindexNew->GetBlockHash(), &block) && !ReadBlockFromDisk(block, pindexNew))
             return AbortNode(state, "Failed to read block");
         pblock = &block;
     }
@@ -2102,7 +2773,7 @@ bool static ConnectTip(CValidationState &state, CBlockIndex *pindexNew, const CB
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, false, pindexNext);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2248,7 +2919,9 @@ static bool ActivateBestChainStep(CValidationState &state, CBlockIndex *pindexMo
 
     // Connect new blocks.
     BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-        if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL)) {
+        const CBlockIndex *pindexNext = pindexConnect == pindexMostWork ? NULL : pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+        PrefetchCoins(pindexConnect, pindexNext);
+        if (!ConnectTip(state, pindexConnect, pindexConnect == pindexMostWork ? pblock : NULL, pindexNext)) {
             if (state.IsInvalid()) {
                 // The block violates a consensus rule.
                 if (!state.CorruptionPossible())
@@ -2326,6 +2999,7 @@ bool ActivateBestChain(CValidationState &state, const CBlock *pblock) {
                         pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
             }
             // Notify external listeners about the new tip.
+            GetMainSignals().UpdatedBlockTip(pindexNewTip);
             uiInterface.NotifyBlockTip(hashNewTip);
         }
     } while(pindexMostWork != chainActive.Tip());
@@ -2406,10 +3080,9 @@ bool ReconsiderBlock(CValidationState& state, CBlockIndex *pindex) {
     return true;
 }
 
-CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
+CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const uint256& hash)
 {
     // Check for duplicate
-    uint256 hash = block.GetHash();
     BlockMap::iterator it = mapBlockIndex.find(hash);
     if (it != mapBlockIndex.end())
         return it->second;
@@ -2588,6 +3261,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
 {
     // These are checks that are independent of context.
 
+    if (block.fChecked)
+        return true;
+
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
     if (!CheckBlockHeader(block, state, fCheckPOW))
@@ -2641,6 +3317,9 @@ bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW, bo
         return state.DoS(100, error("CheckBlock(): out-of-bounds SigOpCount"),
                          REJECT_INVALID, "bad-blk-sigops", true);
 
+    if (fCheckPOW && fCheckMerkleRoot)
+        block.fChecked = true;
+
     return true;
 }
 
@@ -2662,7 +3341,7 @@ bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& sta
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
     // Check proof of work
-    if (pindexPrev->nHeight >= (100000 - 1) && block.nBits != GetNextWorkRequired(pindexPrev, &block, consensusParams)) 	//GRS, GetNextWorkRequired() is non-deterministic for nHeight<100000
+    if (pindexPrev->nHeight >= (100000 - 1) && block.nBits != GetNextWorkRequired(pindexPrev, &block, consensusParams)) 	//GRS, blocks below 100000 were mined against the floating-point DarkGravityWave and are not checked
         return state.DoS(100, error("%s: incorrect proof of work", __func__),
                          REJECT_INVALID, "bad-diffbits");
 
@@ -2719,12 +3398,12 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, const uint256* phash)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
     // Check for duplicate
-    uint256 hash = block.GetHash();
+    uint256 hash = phash ? *phash : block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
@@ -2739,7 +3418,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
             return true;
         }
 
-        if (!CheckBlockHeader(block, state))
+        if (!CheckBlockHeader(block, state, phash == NULL))
             return false;
 
         // Get prev block index
@@ -2759,7 +3438,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
             return false;
     }
     if (pindex == NULL)
-        pindex = AddToBlockIndex(block);
+        pindex = AddToBlockIndex(block, hash);
 
     if (ppindex)
         *ppindex = pindex;
@@ -2852,6 +3531,7 @@ bool ProcessNewBlock(CValidationState &state, const CNode* pfrom, const CBlock*
 {
     // Preliminary checks
     bool checked = CheckBlock(*pblock, state);
+    bool fCache = false;
 
     {
         LOCK(cs_main);
@@ -2870,6 +3550,15 @@ bool ProcessNewBlock(CValidationState &state, const CNode* pfrom, const CBlock*
         CheckBlockIndex();
         if (!ret)
             return error("%s: AcceptBlock FAILED", __func__);
+        // New blocks are about to be announced and requested by our peers.
+        fCache = pindex && (pindex->nStatus & BLOCK_HAVE_DATA) && !dbp && !IsInitialBlockDownload();
+    }
+
+    if (fCache) {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss.reserve(::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION));
+        ss << *pblock;
+        rawblockcache.Insert(pblock->GetHash(), CRawBlock(boost::shared_ptr<const void>(), (const unsigned char*)&ss[0], ss.size()));
     }
 
     if (!ActivateBestChain(state, pblock))
@@ -2956,6 +3645,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        blockfilemap.Remove(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3077,6 +3767,94 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/** Apply the effects of a block to the coins view, ignoring that it may already have been applied. */
+static bool RollforwardBlock(const CBlockIndex* pindex, CCoinsViewCache& view)
+{
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pindex))
+        return error("%s: ReadBlockFromDisk failed at %d, hash=%s", __func__, pindex->nHeight, pindex->GetBlockHash().ToString());
+
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                view.SpendCoin(txin.prevout);
+        }
+        // Every addition may be an overwrite of an output that was already written.
+        AddCoins(view, tx, pindex->nHeight, true);
+    }
+    return true;
+}
+
+/**
+ * Bring the coins view back to a consistent state after a write to it was
+ * interrupted (see CCoinsView::GetHeadBlocks()): undo the blocks of the old
+ * tip's branch and reapply those leading to the new tip. Spending and adding
+ * outputs are idempotent, so this works however much of the write made it.
+ */
+static bool ReplayBlocks(CCoinsView* view)
+{
+    LOCK(cs_main);
+
+    std::vector<uint256> hashHeads = view->GetHeadBlocks();
+    if (hashHeads.empty())
+        return true;
+    if (hashHeads.size() != 2)
+        return error("%s: unknown inconsistent state", __func__);
+
+    uiInterface.ShowProgress(_("Replaying blocks..."), 0);
+    LogPrintf("Replaying blocks\n");
+
+    BlockMap::iterator it = mapBlockIndex.find(hashHeads[0]);
+    if (it == mapBlockIndex.end())
+        return error("%s: reorganization to unknown block requested", __func__);
+    CBlockIndex* pindexNew = it->second;
+    CBlockIndex* pindexOld = NULL;
+    CBlockIndex* pindexFork = NULL;
+    // The old tip is null if the interrupted write was the first one.
+    if (!hashHeads[1].IsNull()) {
+        it = mapBlockIndex.find(hashHeads[1]);
+        if (it == mapBlockIndex.end())
+            return error("%s: reorganization from unknown block requested", __func__);
+        pindexOld = it->second;
+        pindexFork = LastCommonAncestor(pindexOld, pindexNew);
+        assert(pindexFork != NULL);
+    }
+
+    CCoinsViewCache cache(view);
+
+    // Roll back along the old branch.
+    while (pindexOld != pindexFork) {
+        if (pindexOld->nHeight > 0) {
+            CBlock block;
+            if (!ReadBlockFromDisk(block, pindexOld))
+                return error("%s: ReadBlockFromDisk failed at %d, hash=%s", __func__, pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+            LogPrintf("Rolling back %s (%i)\n", pindexOld->GetBlockHash().ToString(), pindexOld->nHeight);
+            // An unclean result only means part of the block's changes never
+            // reached the database; its effects are still undone.
+            CValidationState state;
+            bool fClean;
+            if (!DisconnectBlock(block, state, pindexOld, cache, &fClean))
+                return error("%s: DisconnectBlock failed at %d, hash=%s", __func__, pindexOld->nHeight, pindexOld->GetBlockHash().ToString());
+        }
+        pindexOld = pindexOld->pprev;
+    }
+
+    // Roll forward from the fork point to the new tip.
+    int nForkHeight = pindexFork ? pindexFork->nHeight : 0;
+    for (int nHeight = nForkHeight + 1; nHeight <= pindexNew->nHeight; ++nHeight) {
+        const CBlockIndex* pindex = pindexNew->GetAncestor(nHeight);
+        LogPrintf("Rolling forward %s (%i)\n", pindex->GetBlockHash().ToString(), nHeight);
+        if (!RollforwardBlock(pindex, cache))
+            return false;
+    }
+
+    cache.SetBestBlock(pindexNew->GetBlockHash());
+    if (!cache.Flush())
+        return false;
+    uiInterface.ShowProgress("", 100);
+    return true;
+}
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
@@ -3171,6 +3949,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Finish a chainstate write that was cut short, and make the result durable
+    if (!ReplayBlocks(pcoinsTip) || !pcoinsTip->Flush())
+        return error("%s: unable to replay blocks", __func__);
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -3343,7 +4125,7 @@ bool InitBlockIndex() {
                 return error("LoadBlockIndex(): FindBlockPos failed");
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
-            CBlockIndex *pindex = AddToBlockIndex(block);
+            CBlockIndex *pindex = AddToBlockIndex(block, block.GetHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex(): genesis block not accepted");
             if (!ActivateBestChain(state, &block))
@@ -3360,106 +4142,417 @@ bool InitBlockIndex() {
 
 
 
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp)
+namespace {
+
+/** A block record found in a file being imported. */
+struct CImportBlock
 {
-    const CChainParams& chainparams = Params();
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
-    int64_t nStart = GetTimeMillis();
+    //! Where the block is stored, when reindexing the block files
+    CDiskBlockPos pos;
+    //! Offset of the serialized block in the file being imported
+    uint64_t nDataPos;
+    //! Size of the record, for bounding the memory used by read blocks
+    unsigned int nSize;
+    //! The serialized block, until it is decoded
+    CDataStream ssData;
+    CBlock block;
+    uint256 hash;
+    //! Why the block could not be deserialized, if it couldn't
+    std::string strError;
 
-    int nLoaded = 0;
-    try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
-            boost::this_thread::interruption_point();
+    CImportBlock() : nDataPos(0), nSize(0), ssData(SER_DISK, CLIENT_VERSION) {}
+};
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(Params().MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
+/**
+ * Closure deserializing one imported block and running the context-free
+ * checks on it. The outcome of CheckBlock is remembered in the block itself,
+ * failures are reported again when the block is processed.
+ */
+class CImportBlockCheck
+{
+private:
+    CImportBlock *pimport;
+
+public:
+    CImportBlockCheck(): pimport(NULL) {}
+    CImportBlockCheck(CImportBlock *pimportIn): pimport(pimportIn) {}
+
+    bool operator()() {
+        try {
+            pimport->ssData >> pimport->block;
+        } catch (const std::exception& e) {
+            pimport->strError = e.what();
+        }
+        // Free the serialized copy
+        CSerializeData vchEmpty;
+        pimport->ssData.swap_buffer(vchEmpty);
+        if (pimport->strError.empty()) {
+            pimport->hash = pimport->block.GetHash();
+            CValidationState state;
+            CheckBlock(pimport->block, state);
+        }
+        return true;
+    }
+
+    void swap(CImportBlockCheck &check) {
+        std::swap(pimport, check.pimport);
+    }
+};
+
+/** Number of files read at the same time, including the one whose blocks are being connected. */
+static const size_t IMPORT_FILES_AHEAD = 3;
+/** Blocks are handed to the decoding threads in batches of this many bytes (or IMPORT_BATCH_BLOCKS blocks). */
+static const size_t IMPORT_BATCH_BYTES = 1 << 20;
+static const size_t IMPORT_BATCH_BLOCKS = 256;
+/** Reading a file pauses while this many bytes of its blocks wait to be connected. */
+static const size_t MAX_IMPORT_QUEUED_BYTES = 16 << 20;
+
+/**
+ * Imports a list of block files in three stages: reader threads scan
+ * several files at once for block records, a pool of threads deserializes
+ * them and runs CheckBlock, and the calling thread hands the blocks to
+ * ProcessNewBlock in file order, exactly as a serial import would.
+ *
+ * When reindexing, blocks whose parent hasn't been seen yet are recorded in
+ * the block tree database by position and read back once the parent is
+ * connected.
+ */
+class CBlockImporter
+{
+private:
+    /** One file being imported, and the blocks read from it that haven't been processed yet. */
+    struct CImportFile
+    {
+        boost::filesystem::path path;
+        //! Block file number when reindexing, -1 for external files
+        int nFile;
+        std::deque<boost::shared_ptr<CImportBlock> > queue;
+        size_t nQueuedBytes;
+        bool fDone;
+    };
+
+    boost::mutex mutex;
+    //! Signalled whenever blocks are queued or taken, a file is finished, or the import stops
+    boost::condition_variable cond;
+    std::vector<CImportFile> vFiles;
+    //! The next file a reader picks up, and the file whose blocks are being processed
+    size_t nNextRead;
+    size_t nProcessing;
+    bool fStop;
+
+    CCheckQueue<CImportBlockCheck> checkqueue;
+    boost::thread_group threads;
+
+    //! Blocks waiting in the database for their parent, only used by the processing thread
+    uint64_t nUnknownParent;
+    int nLoaded;
+
+    /**
+     * Have a batch of blocks decoded and checked, and queue them for processing.
+     * A record that doesn't decode may have a bogus size covering good blocks,
+     * so it and the records after it are dropped, and nRescan is set to the
+     * byte after its magic for the file to be scanned again from there.
+     */
+    bool SubmitBatch(size_t nIndex, std::vector<boost::shared_ptr<CImportBlock> >& vBatch, uint64_t& nRescan)
+    {
+        {
+            std::vector<CImportBlockCheck> vChecks;
+            vChecks.reserve(vBatch.size());
+            for (size_t i = 0; i < vBatch.size(); i++)
+                vChecks.push_back(CImportBlockCheck(vBatch[i].get()));
+            CCheckQueueControl<CImportBlockCheck> control(&checkqueue);
+            control.Add(vChecks);
+            control.Wait();
+        }
+        nRescan = 0;
+        for (size_t i = 0; i < vBatch.size(); i++) {
+            if (!vBatch[i]->strError.empty()) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, vBatch[i]->strError);
+                nRescan = vBatch[i]->nDataPos - MESSAGE_START_SIZE - sizeof(unsigned int) + 1;
+                vBatch.resize(i);
                 break;
             }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
+        }
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        CImportFile& file = vFiles[nIndex];
+        for (size_t i = 0; i < vBatch.size(); i++) {
+            file.queue.push_back(vBatch[i]);
+            file.nQueuedBytes += vBatch[i]->nSize;
+        }
+        vBatch.clear();
+        cond.notify_all();
+        while (!fStop && file.nQueuedBytes > MAX_IMPORT_QUEUED_BYTES)
+            cond.wait(lock);
+        return !fStop;
+    }
+
+    /** Scan a file for blocks, the same way LoadExternalBlockFile always did. */
+    void ReadFile(size_t nIndex)
+    {
+        const CImportFile& file = vFiles[nIndex];
+        FILE *fileIn = file.nFile >= 0 ? OpenBlockFile(CDiskBlockPos(file.nFile, 0), true) : fopen(file.path.string().c_str(), "rb");
+        if (!fileIn) {
+            LogPrintf("Warning: Could not open blocks file %s\n", file.path.string());
+            return;
+        }
+
+        std::vector<boost::shared_ptr<CImportBlock> > vBatch;
+        size_t nBatchBytes = 0;
+        uint64_t nRescan = 0;
+        try {
+            // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+            CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+            uint64_t nRewind = blkdat.GetPos();
+            bool fEnd = false;
+            while (true) {
+                while (true) {
+                    if (blkdat.eof()) {
+                        fEnd = true;
+                        break;
+                    }
+                    blkdat.SetPos(nRewind);
+                    nRewind++; // start one byte further next time, in case of failure
+                    blkdat.SetLimit(); // remove former limit
+                    unsigned int nSize = 0;
+                    try {
+                        // locate a header
+                        unsigned char buf[MESSAGE_START_SIZE];
+                        blkdat.FindByte(Params().MessageStart()[0]);
+                        nRewind = blkdat.GetPos()+1;
+                        blkdat >> FLATDATA(buf);
+                        if (memcmp(buf, Params().MessageStart(), MESSAGE_START_SIZE))
+                            continue;
+                        // read size
+                        blkdat >> nSize;
+                        if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                            continue;
+                    } catch (const std::exception&) {
+                        // no valid block header found; don't complain
+                        fEnd = true;
+                        break;
+                    }
+                    try {
+                        // read the block; it is deserialized by the decoding threads
+                        uint64_t nBlockPos = blkdat.GetPos();
+                        blkdat.SetLimit(nBlockPos + nSize);
+                        boost::shared_ptr<CImportBlock> pimport(new CImportBlock());
+                        pimport->pos = CDiskBlockPos(file.nFile, nBlockPos);
+                        pimport->nDataPos = nBlockPos;
+                        pimport->nSize = nSize;
+                        pimport->ssData.resize(nSize);
+                        blkdat.read(&pimport->ssData[0], nSize);
+                        nRewind = blkdat.GetPos();
+                        vBatch.push_back(pimport);
+                        nBatchBytes += nSize;
+                    } catch (const std::exception& e) {
+                        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                    }
+                    if (nBatchBytes >= IMPORT_BATCH_BYTES || vBatch.size() >= IMPORT_BATCH_BLOCKS)
+                        break;
+                }
+                if (!SubmitBatch(nIndex, vBatch, nRescan))
+                    return;
+                nBatchBytes = 0;
+                if (nRescan == 0) {
+                    if (fEnd)
+                        return;
                     continue;
                 }
+                // The batch was read past the record that failed; go back to it
+                if (!blkdat.Seek(nRescan))
+                    throw std::runtime_error(strprintf("%s: cannot seek in %s", __func__, file.path.string()));
+                nRewind = nRescan;
+                fEnd = false;
+            }
+        } catch (const std::runtime_error& e) {
+            AbortNode(std::string("System error: ") + e.what());
+        }
+        SubmitBatch(nIndex, vBatch, nRescan);
+    }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    CValidationState state;
-                    if (ProcessNewBlock(state, NULL, &block, true, dbp))
+    void ThreadRead()
+    {
+        RenameThread("groestlcoin-loadread");
+        while (true) {
+            size_t nIndex;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!fStop && nNextRead < vFiles.size() && nNextRead >= nProcessing + IMPORT_FILES_AHEAD)
+                    cond.wait(lock);
+                if (fStop || nNextRead >= vFiles.size())
+                    return;
+                nIndex = nNextRead++;
+            }
+            ReadFile(nIndex);
+            boost::unique_lock<boost::mutex> lock(mutex);
+            vFiles[nIndex].fDone = true;
+            cond.notify_all();
+        }
+    }
+
+    void ThreadCheck()
+    {
+        RenameThread("groestlcoin-loadchk");
+        checkqueue.Thread();
+    }
+
+    /** Hand a block to ProcessNewBlock, or put it aside until its parent shows up. Returns false on a fatal error. */
+    bool ProcessBlock(const CImportBlock& import, const CImportFile& file)
+    {
+        const CChainParams& chainparams = Params();
+        const CBlock& block = import.block;
+        const uint256& hash = import.hash;
+        // Only reindexed blocks have a position in the block files
+        CDiskBlockPos pos = import.pos;
+        CDiskBlockPos *dbp = file.nFile >= 0 ? &pos : NULL;
+
+        bool fHaveParent, fHaveData;
+        int nHeight = 0;
+        {
+            LOCK(cs_main);
+            fHaveParent = mapBlockIndex.count(block.hashPrevBlock) != 0;
+            BlockMap::iterator it = mapBlockIndex.find(hash);
+            fHaveData = it != mapBlockIndex.end() && (it->second->nStatus & BLOCK_HAVE_DATA);
+            if (it != mapBlockIndex.end())
+                nHeight = it->second->nHeight;
+        }
+
+        // detect out of order blocks, and store them for later
+        if (hash != chainparams.GetConsensus().hashGenesisBlock && !fHaveParent) {
+            LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                    block.hashPrevBlock.ToString());
+            if (dbp) {
+                if (!pblocktree->WriteBlockUnknownParent(block.hashPrevBlock, *dbp))
+                    return AbortNode("Failed to write block position to database");
+                nUnknownParent++;
+            }
+            return true;
+        }
+
+        // process in case the block isn't known yet
+        if (!fHaveData) {
+            CValidationState state;
+            if (ProcessNewBlock(state, NULL, &block, true, dbp))
+                nLoaded++;
+            if (state.IsError())
+                return false;
+        } else if (hash != chainparams.GetConsensus().hashGenesisBlock && nHeight % 1000 == 0) {
+            LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), nHeight);
+        }
+
+        // Recursively process earlier encountered successors of this block
+        deque<uint256> queue;
+        queue.push_back(hash);
+        while (nUnknownParent > 0 && !queue.empty()) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            std::vector<CDiskBlockPos> vPos;
+            if (!pblocktree->TakeBlocksUnknownParent(head, vPos))
+                return AbortNode("Failed to read block positions from database");
+            nUnknownParent -= std::min(nUnknownParent, (uint64_t)vPos.size());
+            BOOST_FOREACH(CDiskBlockPos& posChild, vPos) {
+                CBlock blockChild;
+                if (ReadBlockFromDisk(blockChild, posChild))
+                {
+                    LogPrintf("%s: Processing out of order child %s of %s\n", __func__, blockChild.GetHash().ToString(),
+                            head.ToString());
+                    CValidationState dummy;
+                    if (ProcessNewBlock(dummy, NULL, &blockChild, true, &posChild))
+                    {
                         nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrintf("Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
+                        queue.push_back(blockChild.GetHash());
+                    }
                 }
+            }
+        }
+        return true;
+    }
 
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second))
-                        {
-                            LogPrintf("%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            CValidationState dummy;
-                            if (ProcessNewBlock(dummy, NULL, &block, true, &it->second))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
-                        }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                    }
+public:
+    CBlockImporter(const std::vector<boost::filesystem::path>& vPaths, bool fBlockFiles) :
+        nNextRead(0), nProcessing(0), fStop(false), checkqueue(8), nUnknownParent(0), nLoaded(0)
+    {
+        vFiles.resize(vPaths.size());
+        for (size_t i = 0; i < vPaths.size(); i++) {
+            vFiles[i].path = vPaths[i];
+            vFiles[i].nFile = fBlockFiles ? (int)i : -1;
+            vFiles[i].nQueuedBytes = 0;
+            vFiles[i].fDone = false;
+        }
+    }
+
+    ~CBlockImporter()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        threads.interrupt_all();
+        threads.join_all();
+    }
+
+    int Run(int nThreads)
+    {
+        for (size_t i = 0; i < std::min(IMPORT_FILES_AHEAD, vFiles.size()); i++)
+            threads.create_thread(boost::bind(&CBlockImporter::ThreadRead, this));
+        // The readers decode their own blocks too
+        for (int i = 0; i < nThreads - 1; i++)
+            threads.create_thread(boost::bind(&CBlockImporter::ThreadCheck, this));
+
+        for (size_t nIndex = 0; nIndex < vFiles.size(); nIndex++) {
+            CImportFile& file = vFiles[nIndex];
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nProcessing = nIndex;
+                cond.notify_all();
+            }
+            if (file.nFile >= 0)
+                LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)file.nFile);
+            else
+                LogPrintf("Importing blocks file %s...\n", file.path.string());
+            while (true) {
+                boost::this_thread::interruption_point();
+                boost::shared_ptr<CImportBlock> pimport;
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    while (file.queue.empty() && !file.fDone)
+                        cond.wait(lock);
+                    if (file.queue.empty())
+                        break;
+                    pimport = file.queue.front();
+                    file.queue.pop_front();
+                    file.nQueuedBytes -= pimport->nSize;
+                    cond.notify_all();
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                if (!ProcessBlock(*pimport, file))
+                    return nLoaded;
             }
         }
-    } catch (const std::runtime_error& e) {
-        AbortNode(std::string("System error: ") + e.what());
+        return nLoaded;
+    }
+};
+
+} // anon namespace
+
+bool LoadExternalBlockFiles(const std::vector<boost::filesystem::path>& vFiles, bool fBlockFiles, int nThreads)
+{
+    int64_t nStart = GetTimeMillis();
+
+    // Positions left over from an interrupted reindex point to blocks that are read again anyway
+    if (fBlockFiles && !pblocktree->EraseBlocksUnknownParent())
+        return AbortNode("Failed to write to block index database");
+    int nLoaded;
+    {
+        CBlockImporter importer(vFiles, fBlockFiles);
+        nLoaded = importer.Run(std::max(1, nThreads));
     }
+    if (fBlockFiles)
+        pblocktree->EraseBlocksUnknownParent();
+
     if (nLoaded > 0)
-        LogPrintf("Loaded %i blocks from external file in %dms\n", nLoaded, GetTimeMillis() - nStart);
+        LogPrintf("Loaded %i blocks from %u files in %dms\n", nLoaded, vFiles.size(), GetTimeMillis() - nStart);
     return nLoaded > 0;
 }
 
@@ -3738,7 +4831,8 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -3753,8 +4847,6 @@ void static ProcessGetData(CNode* pfrom)
 
     vector<CInv> vNotFound;
 
-    LOCK(cs_main);
-
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
         if (pfrom->nSendSize >= SendBufferSize())
@@ -3767,39 +4859,69 @@ void static ProcessGetData(CNode* pfrom)
 
             if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
             {
+                // Only look the block up under cs_main; it is read and sent without holding it.
                 bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
+                CDiskBlockPos pos;
+                bool fCache = false;
+                uint256 hashTip;
                 {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                    if (mi != mapBlockIndex.end())
+                    {
+                        if (chainActive.Contains(mi->second)) {
+                            send = true;
+                        } else {
+                            static const int nOneMonth = 30 * 24 * 60 * 60;
+                            // To prevent fingerprinting attacks, only send blocks outside of the active
+                            // chain if they are valid, and no more than a month older (both in time, and in
+                            // best equivalent proof of work) than the best header chain we know about.
+                            send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                                (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                                (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, Params().GetConsensus()) < nOneMonth);
+                            if (!send) {
+                                LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                            }
                         }
                     }
+                    // Pruned nodes may have deleted the block, so check whether
+                    // it's available before trying to send.
+                    send = send && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                    if (send) {
+                        pos = mi->second->GetBlockPos();
+                        fCache = mi->second->nHeight + BLOCK_CACHE_DEPTH > chainActive.Height();
+                        hashTip = chainActive.Tip()->GetBlockHash();
+                    }
+                }
+                CSerializedNetMsg msgBlock;
+                CRawBlock rawBlock;
+                if (send && !(inv.type == MSG_BLOCK && fCache ? GetBlockNetMsg(msgBlock, pos, inv.hash) : GetRawBlock(rawBlock, pos, inv.hash, fCache))) {
+                    // The block may have been pruned since it was looked up.
+                    LogPrintf("%s: cannot load block %s from disk for peer=%d\n", __func__, inv.hash.ToString(), pfrom->id);
+                    send = false;
                 }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                if (send)
                 {
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
                     if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    {
+                        // Sent as stored, without deserializing it first
+                        if (msgBlock)
+                            pfrom->PushSerializedMessage(msgBlock);
+                        else
+                            pfrom->PushMessage("block", rawBlock);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        // Merkle blocks depend on the peer's filter, so only
+                        // the block they are built from is shared. It is
+                        // matched in place, and the transactions are sent
+                        // as stored.
+                        CBlockView block;
+                        if (!block.Parse(rawBlock.begin(), rawBlock.end()))
+                            LogPrintf("%s: cannot parse block %s for peer=%d\n", __func__, inv.hash.ToString(), pfrom->id);
                         LOCK(pfrom->cs_filter);
-                        if (pfrom->pfilter)
+                        if (pfrom->pfilter && !block.vtx.empty())
                         {
                             CMerkleBlock merkleBlock(block, *pfrom->pfilter);
                             pfrom->PushMessage("merkleblock", merkleBlock);
@@ -3825,7 +4947,7 @@ void static ProcessGetData(CNode* pfrom)
                         // and we want it right after the last block so they don't
                         // wait for other stuff first.
                         vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
+                        vInv.push_back(CInv(MSG_BLOCK, hashTip));
                         pfrom->PushMessage("inv", vInv);
                         pfrom->hashContinue.SetNull();
                     }
@@ -3837,9 +4959,9 @@ void static ProcessGetData(CNode* pfrom)
                 bool pushed = false;
                 {
                     LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                    map<CInv, CSerializedNetMsg>::iterator mi = mapRelay.find(inv);
                     if (mi != mapRelay.end()) {
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+                        pfrom->PushSerializedMessage((*mi).second);
                         pushed = true;
                     }
                 }
@@ -3880,7 +5002,7 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
+bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived, const CBlock* pblockReceived)
 {
     const CChainParams& chainparams = Params();
     RandAddSeedPerfmon();
@@ -4112,6 +5234,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return error("message inv size() = %u", vInv.size());
         }
 
+        BOOST_FOREACH(const CInv& inv, vInv)
+            pfrom->AddInventoryKnown(inv);
+
         LOCK(cs_main);
 
         std::vector<CInv> vToFetch;
@@ -4121,7 +5246,6 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             const CInv &inv = vInv[nInv];
 
             boost::this_thread::interruption_point();
-            pfrom->AddInventoryKnown(inv);
 
             bool fAlreadyHave = AlreadyHave(inv);
             LogPrint("net", "got inv: %s  %s peer=%d\n", inv.ToString(), fAlreadyHave ? "have" : "new", pfrom->id);
@@ -4406,6 +5530,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Hashing dominates header validation, so do it for the whole batch,
+        // in parallel, before taking cs_main.
+        std::vector<CHeaderHashResult> vResults;
+        HashHeaders(headers, vResults);
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -4414,13 +5543,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
             if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, &pindexLast)) {
+            if (!vResults[n].fValidPoW) {
+                Misbehaving(pfrom->GetId(), 50);
+                return error("invalid header received: proof of work failed");
+            }
+            if (!AcceptBlockHeader(header, state, &pindexLast, &vResults[n].hash)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -4446,8 +5580,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
-        CBlock block;
-        vRecv >> block;
+        // Usually deserialized while it arrived
+        CBlock blockDeserialized;
+        if (!pblockReceived) {
+            vRecv >> blockDeserialized;
+            pblockReceived = &blockDeserialized;
+        }
+        const CBlock& block = *pblockReceived;
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -4481,7 +5620,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     // the getaddr message mitigates the attack.
     else if ((strCommand == "getaddr") && (pfrom->fInbound))
     {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -4598,12 +5740,20 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         vRecv >> alert;
 
         uint256 alertHash = alert.GetHash();
-        if (pfrom->setKnown.count(alertHash) == 0)
+        bool fKnown;
+        {
+            LOCK(pfrom->cs_inventory);
+            fKnown = pfrom->setKnown.count(alertHash) != 0;
+        }
+        if (!fKnown)
         {
             if (alert.ProcessAlert(Params().AlertKeys()))
             {
                 // Relay
-                pfrom->setKnown.insert(alertHash);
+                {
+                    LOCK(pfrom->cs_inventory);
+                    pfrom->setKnown.insert(alertHash);
+                }
                 {
                     LOCK(cs_vNodes);
                     BOOST_FOREACH(CNode* pnode, vNodes)
@@ -4722,11 +5872,16 @@ bool ProcessMessages(CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    if (!pfrom->vRecvGetData.empty()) {
         ProcessGetData(pfrom);
 
-    // this maintains the order of responses
-    if (!pfrom->vRecvGetData.empty()) return fOk;
+        // this maintains the order of responses
+        if (!pfrom->vRecvGetData.empty()) return fOk;
+
+        // Only the validation thread handles these; let the message handler hand the peer over
+        if (!pfrom->vRecvMsg.empty() && IsValidationMessage(pfrom->vRecvMsg.front()))
+            return fOk;
+    }
 
     std::deque<CNetMessage>::iterator it = pfrom->vRecvMsg.begin();
     while (!pfrom->fDisconnect && it != pfrom->vRecvMsg.end()) {
@@ -4770,8 +5925,7 @@ bool ProcessMessages(CNode* pfrom)
 
         // Checksum
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = XCoin::HashMessage(XCoin::ConstBuf(vRecv.begin(), vRecv.begin() + nMessageSize));
-        unsigned int nChecksum = ReadLE32((unsigned char*)&hash);
+        unsigned int nChecksum = ReadLE32(msg.hashData.begin());
         if (nChecksum != hdr.nChecksum)
         {
             LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR nChecksum=%08x hdr.nChecksum=%08x\n", __func__,
@@ -4783,7 +5937,7 @@ bool ProcessMessages(CNode* pfrom)
         bool fRet = false;
         try
         {
-            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
+            fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, msg.GetBlock());
             boost::this_thread::interruption_point();
         }
         catch (const std::ios_base::failure& e)
@@ -4816,6 +5970,8 @@ bool ProcessMessages(CNode* pfrom)
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
 
+        pfrom->RecordRecvLatency(SanitizeString(strCommand), GetTimeMicros() - msg.nTime);
+
         break;
     }
 
@@ -4876,8 +6032,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
                 // Periodically clear addrKnown to allow refresh broadcasts
-                if (nLastRebroadcast)
+                if (nLastRebroadcast) {
+                    LOCK(pnode->cs_vAddrToSend);
                     pnode->addrKnown.reset();
+                }
 
                 // Rebroadcast our address
                 AdvertizeLocal(pnode);
@@ -4892,24 +6050,23 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
         if (fSendTrickle)
         {
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                // Other peers' handlers push addresses to this peer concurrently
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage("addr", vAddr);
+            // receiver rejects addr messages larger than 1000
+            for (size_t nStart = 0; nStart < vAddr.size(); nStart += 1000)
+                pto->PushMessage("addr", vector<CAddress>(vAddr.begin() + nStart, vAddr.begin() + std::min(vAddr.size(), nStart + 1000)));
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -30,8 +30,12 @@
 
 class CBlockIndex;
 class CBlockTreeDB;
+class CCoinsViewDB;
 class CBloomFilter;
+struct CCheckQueueStats;
 class CInv;
+class CRawBlock;
+struct CRawBlockCacheStats;
 class CScriptCheck;
 class CTxMemPool;
 class CValidationInterface;
@@ -43,6 +47,18 @@ struct CNodeStateStats;
 static const bool DEFAULT_ALERTS = true;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
+static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -53,8 +69,24 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+/** Maximum number of threads reading and checking blocks during -reindex and -loadblock */
+static const int MAX_IMPORT_THREADS = 16;
+/** -importthreads default (0 = one per core) */
+static const int DEFAULT_IMPORT_THREADS = 0;
+/** -overlapblockchecks default: queue the script checks of the next block while the current one finishes */
+static const bool DEFAULT_OVERLAP_BLOCK_CHECKS = true;
+/** Maximum number of threads reading the inputs of the next block ahead of validation */
+static const int MAX_PREFETCH_THREADS = 16;
+/** -prefetchthreads default (0 = no prefetching) */
+static const int DEFAULT_PREFETCH_THREADS = 4;
+/** Maximum number of threads hashing the headers of headers messages */
+static const int MAX_HEADERCHECK_THREADS = 16;
+/** -headerthreads default (number of header hashing threads, 0 = auto) */
+static const int DEFAULT_HEADERCHECK_THREADS = 0;
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Blocks this close to the tip are kept in the raw block cache when they are read from disk. */
+static const int BLOCK_CACHE_DEPTH = 6;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
@@ -90,6 +122,8 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nHeaderCheckThreads;
+extern bool fOverlapBlockChecks;
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -151,8 +185,9 @@ FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 /** Translation to a filesystem path */
 boost::filesystem::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
-/** Import blocks from an external file */
-bool LoadExternalBlockFile(FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/** Import blocks from external files, or from the block files themselves when reindexing (fBlockFiles),
+ *  reading and checking them on nThreads threads */
+bool LoadExternalBlockFiles(const std::vector<boost::filesystem::path>& vFiles, bool fBlockFiles, int nThreads);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex();
 /** Load the block tree and coins database from disk */
@@ -170,6 +205,29 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Hash and proof-of-work result for one header of a headers message. */
+struct CHeaderHashResult
+{
+    uint256 hash;
+    bool fValidPoW;
+};
+/**
+ * Hash and check the proof of work of a batch of headers, spread over the
+ * header check threads. Needs no locks; the results line up with headers.
+ */
+void HashHeaders(const std::vector<CBlockHeader>& headers, std::vector<CHeaderHashResult>& results);
+/** Run an instance of the header hashing thread */
+void ThreadHeaderCheck();
+/** Run the thread reading the coins spent by the next block to connect */
+void ThreadCoinsPrefetch();
+/** Run an instance of the coins prefetch read thread */
+void ThreadCoinsPrefetchCheck();
+/** Set the chainstate database the coins are prefetched from (NULL to stop prefetching) */
+void SetCoinsPrefetchView(const CCoinsView* pview);
+/** Statistics of the script, header and prefetch check queues, and the number of blocks whose script checks were started early */
+void GetCheckQueueStats(std::vector<std::pair<std::string, CCheckQueueStats> >& vStats, uint64_t& nOverlappedBlocks);
+/** Compact the databases once an initial block download has finished */
+void ThreadCompactDatabases();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -217,7 +275,10 @@ void PruneAndFlush();
 
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+                        bool* pfMissingInputs, bool fRejectAbsurdFee=false, bool fOverrideMempoolLimit=false);
+
+/** Expire old transactions and trim the mempool down to limit bytes of memory usage. */
+void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age);
 
 
 struct CNodeStateStats {
@@ -315,8 +376,8 @@ private:
 
 public:
     CScriptCheck(): ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+        scriptPubKey(outIn.scriptPubKey),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
 
     bool operator()();
@@ -338,6 +399,16 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read a block in its serialized form, as it is stored on disk */
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex);
+bool ReadRawBlockFromDisk(CRawBlock& block, const CDiskBlockPos& pos, const uint256& hash);
+/** Get a serialized block from the raw block cache, or from disk (requires cs_main) */
+bool GetRawBlock(CRawBlock& block, const CBlockIndex* pindex);
+/** Get a serialized block by position, without cs_main; fCache adds it to the cache when read from disk */
+bool GetRawBlock(CRawBlock& block, const CDiskBlockPos& pos, const uint256& hash, bool fCache);
+/** Change the memory limit of the raw block cache (0 disables it) */
+void SetRawBlockCacheSize(size_t nBytes);
+CRawBlockCacheStats GetRawBlockCacheStats();
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -348,8 +419,10 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
 
-/** Apply the effects of this block (with given index) on the UTXO set represented by coins */
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false);
+/** Apply the effects of this block (with given index) on the UTXO set represented by coins.
+ *  If pindexNext is given (the block that will be connected after this one), its script checks
+ *  are queued while the last checks of this block run, to fill the signature cache. */
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins, bool fJustCheck = false, const CBlockIndex* pindexNext = NULL);
 
 /** Context-independent validity checks */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
@@ -364,7 +437,11 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
 
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
 bool AcceptBlock(const CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+/**
+ * Check a block header and add it to the block index. If phash is given, it is
+ * the header's hash and its proof of work has already been checked.
+ */
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, const uint256* phash = NULL);
 
 
 
@@ -448,6 +525,9 @@ extern CCoinsViewCache *pcoinsTip;
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Global variable that points to the chainstate database */
+extern CCoinsViewDB *pcoinsdbview;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -9,6 +9,7 @@
 #include "serialize.h"
 #include "uint256.h"
 #include "primitives/block.h"
+#include "primitives/txview.h"
 #include "bloom.h"
 
 #include <vector>
@@ -142,6 +143,10 @@ public:
     // Create from a CBlock, matching the txids in the set
     CMerkleBlock(const CBlock& block, const std::set<uint256>& txids);
 
+    // The same, from a block parsed in place
+    CMerkleBlock(const CBlockView& block, CBloomFilter& filter);
+    CMerkleBlock(const CBlockView& block, const std::set<uint256>& txids);
+
     CMerkleBlock() {}
 
     ADD_SERIALIZE_METHODS;
@@ -11,6 +11,7 @@
 #include "coins.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "groestlcoin.h"
 #include "hash.h"
 #include "main.h"
 #include "net.h"
@@ -24,8 +25,13 @@
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 
+#include <algorithm>
+#include <list>
+#include <queue>
+#include <set>
+
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 
 using namespace std;
 
@@ -36,51 +42,38 @@ using namespace std;
 
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. Selection walks the mempool by fee rate
+// (or priority, for the priority part of the block), so a transaction can
+// come up before its parents are in the block. Such transactions are parked
+// until their last parent has been added.
 //
-class COrphan
+
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
+// Coin age priority of a mempool entry, for the priority part of the block.
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+
+class TxCoinAgePriorityCompare
 {
 public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
-
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
     {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByScore()(*(b.second), *(a.second)); //Reverse order to make sort less than
+        return a.first < b.first;
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
-
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+// Heap order for parked transactions whose parents have since been added.
+class ScoreCompare
 {
-    bool byFee;
-
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
+    ScoreCompare() {}
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
     {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
-        }
-        else
-        {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
-        }
+        return CompareTxMemPoolEntryByScore()(*b, *a); // Convert to less than
     }
 };
 
@@ -99,6 +92,13 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     return nNewTime - nOldTime;
 }
 
+static unsigned int GetBlockMaxSize()
+{
+    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
+    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
+    return std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+}
+
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 {
     const CChainParams& chainparams = Params();
@@ -126,9 +126,7 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
     // Largest block you're willing to create:
-    unsigned int nBlockMaxSize = GetArg("-blockmaxsize", DEFAULT_BLOCK_MAX_SIZE);
-    // Limit to betweeen 1K and MAX_BLOCK_SIZE-1K for sanity:
-    nBlockMaxSize = std::max((unsigned int)1000, std::min((unsigned int)(MAX_BLOCK_SIZE-1000), nBlockMaxSize));
+    unsigned int nBlockMaxSize = GetBlockMaxSize();
 
     // How much of the block should be dedicated to high-priority transactions,
     // included regardless of the fees they pay
@@ -141,6 +139,22 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
     nBlockMinSize = std::min(nBlockMaxSize, nBlockMinSize);
 
     // Collect memory pool transactions into the block
+    CTxMemPool::setEntries inBlock;
+    CTxMemPool::setEntries waitSet;
+
+    // This vector will be sorted into a priority queue:
+    vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+    double actualPriority = -1;
+
+    std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
+    bool fPrintPriority = GetBoolArg("-printpriority", false);
+    uint64_t nBlockSize = 1000;
+    uint64_t nBlockTx = 0;
+    unsigned int nBlockSigOps = 100;
+    int lastFewTxs = 0;
     CAmount nFees = 0;
 
     {
@@ -150,107 +164,90 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         pblock->nTime = GetAdjustedTime();
         CCoinsViewCache view(pcoinsTip);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (map<uint256, CTxMemPoolEntry>::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->second.GetTx();
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, pblock->nTime))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
+        // Only the priority part of the block needs a separate ordering;
+        // everything else is taken straight off the mempool's fee rate index.
+        bool fPriorityBlock = nBlockPrioritySize > 0;
+        if (fPriorityBlock) {
+            vecPriority.reserve(mempool.mapTx.size());
+            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+                 mi != mempool.mapTx.end(); ++mi)
             {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx[txin.prevout.hash].GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
+                double dPriority = mi->GetPriority(nHeight);
+                CAmount dummy;
+                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+            }
+            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        }
 
-                int nConf = nHeight - coins->nHeight;
+        CTxMemPool::indexed_transaction_set::index<mining_score>::type::iterator mi = mempool.mapTx.get<mining_score>().begin();
+        CTxMemPool::txiter iter;
 
-                dPriority += (double)nValueIn * nConf;
+        while (mi != mempool.mapTx.get<mining_score>().end() || !clearedTxs.empty())
+        {
+            bool priorityTx = false;
+            if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
+                priorityTx = true;
+                iter = vecPriority.front().second;
+                actualPriority = vecPriority.front().first;
+                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                vecPriority.pop_back();
+            }
+            else if (clearedTxs.empty()) { // add tx with next highest score
+                iter = mempool.mapTx.project<0>(mi);
+                mi++;
+            }
+            else {  // try to add a previously postponed child tx
+                iter = clearedTxs.top();
+                clearedTxs.pop();
             }
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
 
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
+            if (inBlock.count(iter))
+                continue; // could have been added to the priorityBlock
 
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
+            const CTransaction& tx = iter->GetTx();
 
-            if (porphan)
+            bool fOrphan = false;
+            BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
             {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
+                if (!inBlock.count(parent)) {
+                    fOrphan = true;
+                    break;
+                }
+            }
+            if (fOrphan) {
+                if (priorityTx)
+                    waitPriMap.insert(std::make_pair(iter, actualPriority));
+                else
+                    waitSet.insert(iter);
+                continue;
             }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &mi->second.GetTx()));
-        }
-
-        // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
 
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+            unsigned int nTxSize = iter->GetTxSize();
+            if (fPriorityBlock &&
+                (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
+                fPriorityBlock = false;
+                waitPriMap.clear();
+            }
+            // The fee rate index is sorted, so once past the minimum block
+            // size nothing after the first free transaction can qualify.
+            if (!priorityTx &&
+                (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
+                break;
+            }
+            if (nBlockSize + nTxSize >= nBlockMaxSize) {
+                if (nBlockSize > nBlockMaxSize - 100 || lastFewTxs > 50) {
+                    break;
+                }
+                // Once we're within 1000 bytes of a full block, only look at 50 more txs
+                // to try to fill the remaining space.
+                if (nBlockSize > nBlockMaxSize - 1000) {
+                    lastFewTxs++;
+                }
+                continue;
+            }
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
+            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, pblock->nTime))
                 continue;
 
             // Legacy limits on sigOps:
@@ -258,24 +255,6 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
             if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
                 continue;
 
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
             if (!view.HaveInputs(tx))
                 continue;
 
@@ -305,23 +284,30 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
 
             if (fPrintPriority)
             {
+                double dPriority = iter->GetPriority(nHeight);
+                CAmount dummy;
+                mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
                 LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
+                    dPriority, CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
             }
 
+            inBlock.insert(iter);
+
             // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
+            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
             {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
+                if (fPriorityBlock) {
+                    waitPriIter wpiter = waitPriMap.find(child);
+                    if (wpiter != waitPriMap.end()) {
+                        vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                        waitPriMap.erase(wpiter);
+                    }
+                }
+                else {
+                    if (waitSet.count(child)) {
+                        clearedTxs.push(child);
+                        waitSet.erase(child);
                     }
                 }
             }
@@ -371,6 +357,448 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Block template builder
+//
+
+namespace {
+
+/**
+ * Keeps a block template for the current tip up to date in the background,
+ * so getblocktemplate can hand out the cached copy instead of walking the
+ * mempool under cs_main on every call.
+ *
+ * The template is only built from scratch, with CreateNewBlock(), when the
+ * tip changes. In between, the validation interface callbacks queue the
+ * transactions entering and leaving the mempool and the builder thread
+ * applies them as deltas: a new transaction is appended once all of its
+ * in-mempool parents are in the template, displacing cheaper childless
+ * transactions if the block is full, and a transaction that left the
+ * mempool is dropped along with its descendants in the template. Mempool
+ * transactions were fully checked on entry, so deltas are not re-verified.
+ *
+ * Deltas apply CreateNewBlock()'s fee policy, but transactions evicted or
+ * skipped for lack of room are only reconsidered at the next tip. Deltas
+ * can't keep up a priority or minimum size area, so with -blockprioritysize
+ * or -blockminsize set every change rebuilds the template instead.
+ *
+ * Nothing is built until the first template is requested, so nodes that
+ * never serve getblocktemplate don't pay for it.
+ */
+class CBlockTemplateBuilder : public CValidationInterface
+{
+private:
+    struct CTemplateTx
+    {
+        CTransaction tx;
+        CAmount nFee;
+        int64_t nSigOps;
+        unsigned int nSize;
+    };
+
+    // Queued events, filled by the callbacks and drained by the thread.
+    boost::mutex mutexQueue;
+    boost::condition_variable condQueue;
+    std::vector<uint256> vQueue;
+    bool fTipChanged;
+    bool fActive;
+    bool fStarted;
+    bool fBusy;
+    boost::condition_variable condIdle;
+
+    // The candidate block; lock order is cs_main, mempool.cs, cs.
+    CCriticalSection cs;
+    const CBlockIndex* pindexPrev;
+    CBlockHeader header;
+    CTransaction txCoinbase;
+    CAmount nSubsidy;
+    int64_t nCoinbaseSigOps;
+    std::list<CTemplateTx> lTx;
+    std::set<uint256> setInBlock;
+    uint64_t nBlockSize;
+    int64_t nBlockSigOps;
+    CAmount nFees;
+    boost::shared_ptr<const CBlockTemplate> ptemplate;
+
+    void Enqueue(const uint256& hash)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexQueue);
+        if (!fActive)
+            return;
+        vQueue.push_back(hash);
+        condQueue.notify_one();
+    }
+
+    /** Make a freshly created template the candidate. */
+    void Install(CBlockTemplate* pblocktemplate, const CBlockIndex* pindex)
+    {
+        AssertLockHeld(cs);
+        const CBlock& block = pblocktemplate->block;
+        pindexPrev = pindex;
+        header = block.GetBlockHeader();
+        txCoinbase = block.vtx[0];
+        nCoinbaseSigOps = pblocktemplate->vTxSigOps[0];
+        lTx.clear();
+        setInBlock.clear();
+        nBlockSize = 1000;
+        nBlockSigOps = 100;
+        nFees = 0;
+        for (unsigned int i = 1; i < block.vtx.size(); i++) {
+            CTemplateTx entry;
+            entry.tx = block.vtx[i];
+            entry.nFee = pblocktemplate->vTxFees[i];
+            entry.nSigOps = pblocktemplate->vTxSigOps[i];
+            entry.nSize = ::GetSerializeSize(entry.tx, SER_NETWORK, PROTOCOL_VERSION);
+            lTx.push_back(entry);
+            setInBlock.insert(entry.tx.GetHash());
+            nBlockSize += entry.nSize;
+            nBlockSigOps += entry.nSigOps;
+            nFees += entry.nFee;
+        }
+        nSubsidy = txCoinbase.vout[0].nValue - nFees;
+        ptemplate.reset(pblocktemplate);
+    }
+
+    /** Replace the handed out template with the current candidate. */
+    void Publish()
+    {
+        AssertLockHeld(cs);
+        CBlockTemplate* pblocktemplate = new CBlockTemplate();
+        CBlock& block = pblocktemplate->block;
+        block = header;
+        CMutableTransaction txNew(txCoinbase);
+        txNew.vout[0].nValue = nSubsidy + nFees;
+        block.vtx.reserve(lTx.size() + 1);
+        block.vtx.push_back(txNew);
+        pblocktemplate->vTxFees.push_back(-nFees);
+        pblocktemplate->vTxSigOps.push_back(nCoinbaseSigOps);
+        BOOST_FOREACH(const CTemplateTx& entry, lTx) {
+            block.vtx.push_back(entry.tx);
+            pblocktemplate->vTxFees.push_back(entry.nFee);
+            pblocktemplate->vTxSigOps.push_back(entry.nSigOps);
+        }
+        ptemplate.reset(pblocktemplate);
+    }
+
+    /**
+     * Evict childless transactions paying a lower fee rate than it, cheapest
+     * first, until the mempool transaction at it fits. Gives up without
+     * changing anything if that would not raise the template's fees.
+     */
+    bool MakeRoom(CTxMemPool::txiter it, unsigned int nBlockMaxSize)
+    {
+        AssertLockHeld(mempool.cs);
+        AssertLockHeld(cs);
+        CFeeRate feeRate(it->GetModifiedFee(), it->GetTxSize());
+        std::vector<std::pair<CFeeRate, std::list<CTemplateTx>::iterator> > vLeaves;
+        for (std::list<CTemplateTx>::iterator lit = lTx.begin(); lit != lTx.end(); ++lit) {
+            CTxMemPool::txiter txit = mempool.mapTx.find(lit->tx.GetHash());
+            if (txit == mempool.mapTx.end())
+                continue;
+            CFeeRate txFeeRate(txit->GetModifiedFee(), txit->GetTxSize());
+            if (!(txFeeRate < feeRate))
+                continue;
+            bool fLeaf = true;
+            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(txit)) {
+                if (setInBlock.count(child->GetTx().GetHash())) {
+                    fLeaf = false;
+                    break;
+                }
+            }
+            if (fLeaf)
+                vLeaves.push_back(std::make_pair(txFeeRate, lit));
+        }
+        std::sort(vLeaves.begin(), vLeaves.end(), CompareLeaves());
+
+        uint64_t nSize = nBlockSize + it->GetTxSize();
+        int64_t nSigOps = nBlockSigOps + it->GetSigOpCount();
+        CAmount nModFeesEvicted = 0;
+        size_t nEvict = 0;
+        while ((nSize >= nBlockMaxSize || nSigOps >= MAX_BLOCK_SIGOPS) && nEvict < vLeaves.size()) {
+            const CTemplateTx& entry = *vLeaves[nEvict].second;
+            nSize -= entry.nSize;
+            nSigOps -= entry.nSigOps;
+            nModFeesEvicted += mempool.mapTx.find(entry.tx.GetHash())->GetModifiedFee();
+            nEvict++;
+        }
+        if (nSize >= nBlockMaxSize || nSigOps >= MAX_BLOCK_SIGOPS || nModFeesEvicted >= it->GetModifiedFee())
+            return false;
+
+        for (size_t i = 0; i < nEvict; i++) {
+            const CTemplateTx& entry = *vLeaves[i].second;
+            setInBlock.erase(entry.tx.GetHash());
+            nBlockSize -= entry.nSize;
+            nBlockSigOps -= entry.nSigOps;
+            nFees -= entry.nFee;
+            lTx.erase(vLeaves[i].second);
+        }
+        return true;
+    }
+
+    struct CompareLeaves
+    {
+        bool operator()(const std::pair<CFeeRate, std::list<CTemplateTx>::iterator>& a,
+                        const std::pair<CFeeRate, std::list<CTemplateTx>::iterator>& b) const
+        {
+            return a.first < b.first;
+        }
+    };
+
+    /** Append the mempool transaction at it, and any of its children waiting for it. */
+    bool TryAdd(CTxMemPool::txiter it, unsigned int nBlockMaxSize)
+    {
+        AssertLockHeld(mempool.cs);
+        AssertLockHeld(cs);
+        const CTransaction& tx = it->GetTx();
+        if (setInBlock.count(tx.GetHash()))
+            return false;
+        BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+            if (!setInBlock.count(parent->GetTx().GetHash()))
+                return false;
+        }
+        if (!IsFinalTx(tx, pindexPrev->nHeight + 1, header.nTime))
+            return false;
+
+        unsigned int nTxSize = it->GetTxSize();
+        int64_t nTxSigOps = it->GetSigOpCount();
+        if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize))
+            return false;
+        if (nBlockSize + nTxSize >= nBlockMaxSize || nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS) {
+            if (!MakeRoom(it, nBlockMaxSize))
+                return false;
+        }
+
+        CTemplateTx entry;
+        entry.tx = tx;
+        entry.nFee = it->GetFee();
+        entry.nSigOps = nTxSigOps;
+        entry.nSize = nTxSize;
+        lTx.push_back(entry);
+        setInBlock.insert(tx.GetHash());
+        nBlockSize += nTxSize;
+        nBlockSigOps += nTxSigOps;
+        nFees += entry.nFee;
+
+        BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(it))
+            TryAdd(child, nBlockMaxSize);
+        return true;
+    }
+
+    /** Drop a transaction and everything in the template that spends it. */
+    void Remove(const uint256& hash)
+    {
+        AssertLockHeld(cs);
+        std::set<uint256> setRemove;
+        setRemove.insert(hash);
+        std::list<CTemplateTx>::iterator lit = lTx.begin();
+        while (lit != lTx.end()) {
+            bool fRemove = setRemove.count(lit->tx.GetHash()) != 0;
+            BOOST_FOREACH(const CTxIn& txin, lit->tx.vin) {
+                if (fRemove)
+                    break;
+                fRemove = setRemove.count(txin.prevout.hash) != 0;
+            }
+            if (!fRemove) {
+                ++lit;
+                continue;
+            }
+            setRemove.insert(lit->tx.GetHash());
+            setInBlock.erase(lit->tx.GetHash());
+            nBlockSize -= lit->nSize;
+            nBlockSigOps -= lit->nSigOps;
+            nFees -= lit->nFee;
+            lit = lTx.erase(lit);
+        }
+    }
+
+    void Apply(const std::vector<uint256>& vHashes)
+    {
+        unsigned int nBlockMaxSize = GetBlockMaxSize();
+        LOCK2(mempool.cs, cs);
+        if (!ptemplate)
+            return;
+        bool fChanged = false;
+        BOOST_FOREACH(const uint256& hash, vHashes) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it != mempool.mapTx.end()) {
+                if (TryAdd(it, nBlockMaxSize))
+                    fChanged = true;
+            } else if (setInBlock.count(hash)) {
+                Remove(hash);
+                fChanged = true;
+            }
+        }
+        if (fChanged)
+            Publish();
+    }
+
+    /** Whether the configured policy can be kept up by applying deltas. */
+    static bool DeltasFollowPolicy()
+    {
+        return GetArg("-blockprioritysize", DEFAULT_BLOCK_PRIORITY_SIZE) <= 0 &&
+               GetArg("-blockminsize", DEFAULT_BLOCK_MIN_SIZE) <= 0;
+    }
+
+    void Rebuild(bool fForce)
+    {
+        LOCK(cs_main);
+        {
+            LOCK(cs);
+            if (ptemplate && !fForce && pindexPrev == chainActive.Tip())
+                return;
+        }
+        CScript scriptDummy = CScript() << OP_TRUE;
+        CBlockTemplate* pblocktemplate = CreateNewBlock(scriptDummy);
+        if (pblocktemplate) {
+            LOCK(cs);
+            Install(pblocktemplate, chainActive.Tip());
+        }
+    }
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex)
+    {
+        boost::unique_lock<boost::mutex> lock(mutexQueue);
+        if (!fActive)
+            return;
+        // Whatever was queued is picked up by the rebuild.
+        vQueue.clear();
+        fTipChanged = true;
+        condQueue.notify_one();
+    }
+
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+    {
+        // Transactions confirmed or unconfirmed by a block come with a new
+        // tip, which rebuilds the template anyway.
+        if (pblock == NULL)
+            Enqueue(tx.GetHash());
+    }
+
+    void RemovedFromMempool(const uint256& hash)
+    {
+        Enqueue(hash);
+    }
+
+public:
+    CBlockTemplateBuilder() : fTipChanged(false), fActive(false), fStarted(false), fBusy(false), pindexPrev(NULL),
+        nSubsidy(0), nCoinbaseSigOps(0), nBlockSize(0), nBlockSigOps(0), nFees(0) {}
+
+    void Thread()
+    {
+        while (true) {
+            std::vector<uint256> vHashes;
+            bool fRebuild;
+            {
+                boost::unique_lock<boost::mutex> lock(mutexQueue);
+                fBusy = false;
+                condIdle.notify_all();
+                while (!fTipChanged && vQueue.empty())
+                    condQueue.wait(lock);
+                fBusy = true;
+                fRebuild = fTipChanged;
+                fTipChanged = false;
+                vHashes.swap(vQueue);
+            }
+            try {
+                bool fDeltas = DeltasFollowPolicy();
+                if (fRebuild || (!fDeltas && !vHashes.empty()))
+                    Rebuild(!fDeltas);
+                else if (!vHashes.empty())
+                    Apply(vHashes);
+            } catch (const std::runtime_error& e) {
+                // Served templates stay at the previous tip, which makes
+                // getblocktemplate build and report the failure itself.
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+        }
+    }
+
+    void Start(boost::thread_group& threadGroup)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexQueue);
+            fStarted = true;
+        }
+        RegisterValidationInterface(this);
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "gbt",
+                                              boost::function<void()>(boost::bind(&CBlockTemplateBuilder::Thread, this))));
+    }
+
+    void Stop()
+    {
+        UnregisterValidationInterface(this);
+        {
+            boost::unique_lock<boost::mutex> lock(mutexQueue);
+            fStarted = false;
+            fActive = false;
+            fTipChanged = false;
+            vQueue.clear();
+            condIdle.notify_all();
+        }
+        LOCK(cs);
+        ptemplate.reset();
+        pindexPrev = NULL;
+    }
+
+    void Sync()
+    {
+        boost::unique_lock<boost::mutex> lock(mutexQueue);
+        while (fStarted && (fBusy || fTipChanged || !vQueue.empty()))
+            condIdle.wait(lock);
+    }
+
+    boost::shared_ptr<const CBlockTemplate> Get()
+    {
+        AssertLockHeld(cs_main);
+        bool fKeepUpdated;
+        {
+            boost::unique_lock<boost::mutex> lock(mutexQueue);
+            fActive = fStarted;
+            fKeepUpdated = fStarted;
+        }
+        {
+            LOCK(cs);
+            if (fKeepUpdated && ptemplate && pindexPrev == chainActive.Tip())
+                return ptemplate;
+        }
+
+        // First request, or the builder has not caught up with the tip yet.
+        CScript scriptDummy = CScript() << OP_TRUE;
+        CBlockTemplate* pblocktemplate = CreateNewBlock(scriptDummy);
+        if (!pblocktemplate)
+            return boost::shared_ptr<const CBlockTemplate>();
+        LOCK(cs);
+        Install(pblocktemplate, chainActive.Tip());
+        return ptemplate;
+    }
+};
+
+CBlockTemplateBuilder templateBuilder;
+
+}
+
+void StartBlockTemplateBuilder(boost::thread_group& threadGroup)
+{
+    templateBuilder.Start(threadGroup);
+}
+
+void StopBlockTemplateBuilder()
+{
+    templateBuilder.Stop();
+}
+
+void SyncBlockTemplateBuilder()
+{
+    templateBuilder.Sync();
+}
+
+boost::shared_ptr<const CBlockTemplate> GetBlockTemplate()
+{
+    return templateBuilder.Get();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
@@ -384,28 +812,27 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 //
 bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
 {
-    // Write the first 76 bytes of the block header to a double-SHA256 state.
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
     ss << *pblock;
     assert(ss.size() == 80);
 
-	//GRS
-	uint32_t buf[20];
-	memcpy(buf, &ss.begin()[0], 80);
-    while (true) {
-        nNonce++;
-		buf[19] = nNonce;
-		*phash = XCoin::HashPow(XCoin::ConstBuf(buf, buf+20));
-
-        // Return the nonce if the hash has at least some zero bits,
-        // caller will check if it has enough to reach the target
-        if (((uint16_t*)phash)[15] == 0)
-            return true;
-
-        // If nothing found after trying for a while, return -1
-        if ((nNonce & 0xfff) == 0)
-            return false;
+    // Sweep the nonces up to the next multiple of 0x1000 in one go, so the
+    // constant 76-byte prefix of the header is only prepared once.
+    // A candidate is a hash with at least 16 zero bits, the caller will
+    // check if it has enough to reach the target.
+    static const uint256 hashCandidate = ArithToUint256(~arith_uint256() >> 16);
+    const uint32_t nCount = 0x1000 - (nNonce & 0xfff);
+    std::vector<std::pair<uint32_t, uint256> > vFound;
+    XCoin::HashPowSweep((const unsigned char*)&ss[0], nNonce + 1, nCount, hashCandidate, vFound, 1);
+    if (!vFound.empty()) {
+        nNonce = vFound[0].first;
+        *phash = vFound[0].second;
+        return true;
     }
+
+    // If nothing found after trying for a while, return -1
+    nNonce += nCount;
+    return false;
 }
 
 static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainparams)
@@ -525,8 +952,14 @@ void static BitcoinMiner(const CChainParams& chainparams)
                 if (pindexPrev != chainActive.Tip())
                     break;
 
-                // Update nTime every few seconds
-                if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
+                // Update nTime every few seconds. cs_main guards the
+                // retarget cache GetNextWorkRequired fills in pindexPrev.
+                int64_t nTimeChange;
+                {
+                    LOCK(cs_main);
+                    nTimeChange = UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
+                }
+                if (nTimeChange < 0)
                     break; // Recreate the block if the clock has run backwards,
                            // so that we can use the correct time.
                 if (chainparams.GetConsensus().fPowAllowMinDifficultyBlocks)
@@ -10,12 +10,17 @@
 
 #include <stdint.h>
 
+#include <boost/shared_ptr.hpp>
+
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
 class CScript;
 class CWallet;
 namespace Consensus { struct Params; };
+namespace boost {
+    class thread_group;
+} // namespace boost
 
 struct CBlockTemplate
 {
@@ -28,6 +33,17 @@ struct CBlockTemplate
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams);
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+/** Start keeping a block template for getblocktemplate up to date in the background */
+void StartBlockTemplateBuilder(boost::thread_group& threadGroup);
+/** Stop updating the template and forget it; the thread exits with its thread group */
+void StopBlockTemplateBuilder();
+/** Wait until the builder has applied every change queued so far (for tests) */
+void SyncBlockTemplateBuilder();
+/**
+ * Block template (with an OP_TRUE coinbase) on top of the current tip. Served
+ * from the background builder once it is running; requires cs_main.
+ */
+boost::shared_ptr<const CBlockTemplate> GetBlockTemplate();
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
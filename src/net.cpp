@@ -14,7 +14,9 @@
 #include "clientversion.h"
 #include "crypto/common.h"
 #include "hash.h"
+#include "primitives/block.h"
 #include "primitives/transaction.h"
+#include "primitives/txview.h"
 #include "scheduler.h"
 #include "ui_interface.h"
 #include "utilstrencodings.h"
@@ -23,6 +25,13 @@
 #include <string.h>
 #else
 #include <fcntl.h>
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #endif
 
 #ifdef USE_UPNP
@@ -87,7 +96,7 @@ std::string strSubVersion;
 
 vector<CNode*> vNodes;
 CCriticalSection cs_vNodes;
-map<CInv, CDataStream> mapRelay;
+map<CInv, CSerializedNetMsg> mapRelay;
 deque<pair<int64_t, CInv> > vRelayExpiration;
 CCriticalSection cs_mapRelay;
 limitedmap<CInv, int64_t> mapAlreadyAskedFor(MAX_INV_SZ);
@@ -106,6 +115,68 @@ CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
 boost::condition_variable messageHandlerCondition;
+/** Protects fMessageHandlerWake; message handler threads wait on messageHandlerCondition with it */
+static boost::mutex mutexMessageHandler;
+/** Set when there is new work, so a wakeup arriving while the handlers are busy is not lost */
+static bool fMessageHandlerWake = false;
+
+static void WakeMessageHandler()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(mutexMessageHandler);
+        fMessageHandlerWake = true;
+    }
+    messageHandlerCondition.notify_one();
+}
+
+#ifdef HAVE_EPOLL
+/** epoll instance all listening and peer sockets are registered with, once */
+static int hEpoll = -1;
+/** eventfd used to wake up the socket handler from other threads */
+static int hWakeEvent = -1;
+
+static void AddSocketEvents(CNode* pnode)
+{
+    // Edge-triggered: every peer costs nothing until its socket changes state.
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pnode;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, pnode->hSocket, &event) == SOCKET_ERROR) {
+        LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(WSAGetLastError()));
+        pnode->CloseSocketDisconnect();
+    }
+}
+
+/** Create the epoll instance and register the wakeup event and the listening sockets with it */
+static bool InitSocketEvents()
+{
+    hEpoll = epoll_create1(EPOLL_CLOEXEC);
+    hWakeEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (hEpoll == -1 || hWakeEvent == -1)
+        return false;
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &hWakeEvent;
+    if (epoll_ctl(hEpoll, EPOLL_CTL_ADD, hWakeEvent, &event) == SOCKET_ERROR)
+        return false;
+    // Level-triggered, so pending connections keep being reported until accepted.
+    event.data.ptr = NULL;
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        if (hListenSocket.socket != INVALID_SOCKET && epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket.socket, &event) == SOCKET_ERROR)
+            return false;
+    return true;
+}
+#endif
+
+void WakeSocketHandler()
+{
+#ifdef HAVE_EPOLL
+    uint64_t nOne = 1;
+    if (hWakeEvent != -1 && write(hWakeEvent, &nOne, sizeof(nOne)) != sizeof(nOne) && errno != EAGAIN)
+        LogPrintf("socket handler wakeup failed: %s\n", NetworkErrorString(errno));
+#endif
+}
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -405,6 +476,9 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
             LOCK(cs_vNodes);
             vNodes.push_back(pnode);
         }
+#ifdef HAVE_EPOLL
+        AddSocketEvents(pnode);
+#endif
 
         pnode->nTimeConnected = GetTime();
 
@@ -424,6 +498,11 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer=%d\n", id);
+#ifdef HAVE_EPOLL
+        // Closing is not enough if a child process inherited the socket.
+        if (hEpoll != -1)
+            epoll_ctl(hEpoll, EPOLL_CTL_DEL, hSocket, NULL);
+#endif
         CloseSocket(hSocket);
     }
 
@@ -633,6 +712,11 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_mapRecvLatency);
+        stats.mapRecvLatency = mapRecvLatency;
+    }
 }
 #undef X
 
@@ -652,8 +736,11 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         int handled;
         if (!msg.in_data)
             handled = msg.readHeader(pch, nBytes);
-        else
+        else {
             handled = msg.readData(pch, nBytes);
+            // Hash the payload while it is still in the cache
+            hasherRecv.Write(XCoin::ConstBuf(pch, pch + handled));
+        }
 
         if (handled < 0)
                 return false;
@@ -667,34 +754,105 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         nBytes -= handled;
 
         if (msg.complete()) {
+            msg.hashData = hasherRecv.Finalize();
+            hasherRecv.Reset();
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            WakeMessageHandler();
         }
     }
 
     return true;
 }
 
+/**
+ * Payload buffers of processed messages, kept by size class (powers of two)
+ * so that large messages are received into memory that is already allocated
+ * instead of a fresh allocation, and page faults, for each of them. Small
+ * buffers are left to malloc.
+ */
+class CRecvBufferPool
+{
+private:
+    static const int MIN_CLASS = 10; // 1 KiB
+    static const int MAX_CLASS = 21; // MAX_PROTOCOL_MESSAGE_LENGTH
+    static const size_t MAX_PER_CLASS = 16;
+    static const size_t MAX_POOLED_BYTES = 16 << 20;
+
+    boost::mutex cs;
+    std::vector<CSerializeData> vFree[MAX_CLASS + 1];
+    size_t nPooledBytes;
+
+public:
+    CRecvBufferPool() : nPooledBytes(0) {}
+
+    /** Get an empty buffer with room for at least nSize bytes. */
+    void Get(CSerializeData& buf, size_t nSize)
+    {
+        int nClass = MIN_CLASS;
+        while (nClass <= MAX_CLASS && ((size_t)1 << nClass) < nSize)
+            nClass++;
+        if (nSize < ((size_t)1 << MIN_CLASS) || nClass > MAX_CLASS) {
+            buf.reserve(nSize);
+            return;
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            if (!vFree[nClass].empty()) {
+                buf.swap(vFree[nClass].back());
+                vFree[nClass].pop_back();
+                nPooledBytes -= buf.capacity();
+                return;
+            }
+        }
+        buf.reserve((size_t)1 << nClass);
+    }
+
+    /** Keep buf's allocation for reuse if there is room for it. */
+    void Release(CSerializeData& buf)
+    {
+        size_t nCapacity = buf.capacity();
+        if (nCapacity < ((size_t)1 << MIN_CLASS) || nCapacity >= ((size_t)2 << MAX_CLASS))
+            return;
+        int nClass = MIN_CLASS;
+        while (((size_t)2 << nClass) <= nCapacity)
+            nClass++;
+        buf.clear();
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (vFree[nClass].size() >= MAX_PER_CLASS || nPooledBytes + nCapacity > MAX_POOLED_BYTES)
+            return;
+        vFree[nClass].push_back(CSerializeData());
+        vFree[nClass].back().swap(buf);
+        nPooledBytes += nCapacity;
+    }
+};
+
+static CRecvBufferPool recvBufferPool;
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData buf;
+    vRecv.swap_buffer(buf);
+    recvBufferPool.Release(buf);
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
-    // deserialize to CMessageHeader
-    try {
-        hdrbuf >> hdr;
-    }
-    catch (const std::exception&) {
-        return -1;
-    }
+    // unpack the CMessageHeader fields
+    memcpy(hdr.pchMessageStart, hdrbuf, MESSAGE_START_SIZE);
+    memcpy(hdr.pchCommand, hdrbuf + MESSAGE_START_SIZE, CMessageHeader::COMMAND_SIZE);
+    hdr.nMessageSize = ReadLE32((const unsigned char*)hdrbuf + CMessageHeader::MESSAGE_SIZE_OFFSET);
+    hdr.nChecksum = ReadLE32((const unsigned char*)hdrbuf + CMessageHeader::CHECKSUM_OFFSET);
 
     // reject messages larger than MAX_SIZE
     if (hdr.nMessageSize > MAX_SIZE)
@@ -703,6 +861,9 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     // switch state to reading message data
     in_data = true;
 
+    if (hdr.GetCommand() == "block")
+        pblock.reset(new CBlock());
+
     return nCopy;
 }
 
@@ -713,15 +874,75 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
     if (vRecv.size() < nDataPos + nCopy) {
         // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
+        unsigned int nSize = std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024);
+        if (vRecv.capacity() < nSize) {
+            // Move what was received so far to a pooled buffer that is large enough
+            CSerializeData buf;
+            recvBufferPool.Get(buf, nSize);
+            buf.insert(buf.end(), vRecv.begin(), vRecv.begin() + nDataPos);
+            vRecv.swap_buffer(buf);
+            recvBufferPool.Release(buf);
+        }
+        vRecv.resize(nSize);
     }
 
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
+    if (pblock)
+        ParseBlock();
+
     return nCopy;
 }
 
+/** Deserialize what has arrived of a block, up to the last complete transaction. */
+void CNetMessage::ParseBlock()
+{
+    const unsigned char* pbeginBuf = (const unsigned char*)&vRecv[0];
+    const unsigned char* pendBuf = pbeginBuf + nDataPos;
+    try {
+        if (nParsePos == 0) {
+            // The header and the transaction count, once they are surely there
+            const unsigned int nMaxPrefix = 80 + 9;
+            if (nDataPos < nMaxPrefix && !complete())
+                return;
+            const unsigned char* pendPrefix = pbeginBuf + std::min(nDataPos, nMaxPrefix);
+            CDataStream ss((const char*)pbeginBuf, (const char*)pendPrefix, vRecv.GetType(), vRecv.GetVersion());
+            CBlockHeader header;
+            ss >> header;
+            nParseTxLeft = ReadCompactSize(ss);
+            *pblock = CBlock(header);
+            nParsePos = (pendPrefix - pbeginBuf) - ss.size();
+        }
+        while (nParseTxLeft > 0) {
+            // Find where the next transaction ends without deserializing it
+            const unsigned char* pc = pbeginBuf + nParsePos;
+            CTxView txview;
+            if (!txview.Parse(pc, pendBuf))
+                break;
+            CDataStream ss((const char*)txview.begin(), (const char*)txview.end(), vRecv.GetType(), vRecv.GetVersion());
+            pblock->vtx.push_back(CTransaction());
+            ss >> pblock->vtx.back();
+            if (!ss.empty())
+                throw std::ios_base::failure("CNetMessage::ParseBlock: transaction size mismatch");
+            nParsePos = pc - pbeginBuf;
+            nParseTxLeft--;
+        }
+    } catch (const std::exception&) {
+        pblock.reset();
+        return;
+    }
+    if (complete() && nParseTxLeft > 0)
+        pblock.reset();
+}
+
+const CBlock* CNetMessage::GetBlock() const
+{
+    if (!pblock || !complete() || nParsePos == 0 || nParseTxLeft > 0)
+        return NULL;
+    return pblock.get();
+}
+
 
 
 
@@ -730,26 +951,60 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
 
 
 
+#ifndef WIN32
+/** Maximum number of queued messages handed to the kernel in one sendmsg() call */
+static const int MAX_SEND_IOV = 64;
+#endif
+
 // requires LOCK(cs_vSend)
 void SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CSerializedNetMsg>::iterator it = pnode->vSendMsg.begin();
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
-        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+        assert((*it)->size() > pnode->nSendOffset);
+#ifdef WIN32
+        const CSerializeData &data = **it;
+        size_t nAttempt = data.size() - pnode->nSendOffset;
+        int nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], nAttempt, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+        // Gather the queued messages straight from their (possibly shared) buffers
+        struct iovec vIov[MAX_SEND_IOV];
+        int nIov = 0;
+        size_t nAttempt = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (std::deque<CSerializedNetMsg>::iterator itIov = it; itIov != pnode->vSendMsg.end() && nIov < MAX_SEND_IOV; ++itIov) {
+            const CSerializeData &data = **itIov;
+            vIov[nIov].iov_base = (void*)&data[nOffset];
+            vIov[nIov].iov_len = data.size() - nOffset;
+            nAttempt += vIov[nIov].iov_len;
+            nOffset = 0;
+            nIov++;
+        }
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = vIov;
+        msg.msg_iovlen = nIov;
+        ssize_t nBytes = sendmsg(pnode->hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+            size_t nSent = nBytes;
+            while (nSent > 0) {
+                size_t nLeft = (*it)->size() - pnode->nSendOffset;
+                if (nSent < nLeft) {
+                    pnode->nSendOffset += nSent;
+                    break;
+                }
+                nSent -= nLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
+                pnode->nSendSize -= (*it)->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            if ((size_t)nBytes < nAttempt) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -776,327 +1031,511 @@ void SocketSendData(CNode *pnode)
 
 static list<CNode*> vNodesDisconnected;
 
-void ThreadSocketHandler()
+#ifdef HAVE_EPOLL
+/** Maximum number of socket events handled per epoll_wait call */
+static const int MAX_SOCKET_EVENTS = 256;
+
+/** Peers with readiness reported by epoll that has not been handled yet, each holding a reference */
+static vector<CNode*> vNodesReady;
+#endif
+
+static void DisconnectNodes()
 {
-    unsigned int nPrevNodeCount = 0;
-    while (true)
     {
-        //
-        // Disconnect nodes
-        //
+        LOCK(cs_vNodes);
+        // Disconnect unused nodes
+        vector<CNode*> vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
-            LOCK(cs_vNodes);
-            // Disconnect unused nodes
-            vector<CNode*> vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->fDisconnect ||
+                (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
             {
-                if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecvMsg.empty() && pnode->nSendSize == 0 && pnode->ssSend.empty()))
-                {
-                    // remove from vNodes
-                    vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+                // remove from vNodes
+                vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
 
-                    // release outbound grant (if any)
-                    pnode->grantOutbound.Release();
+                // release outbound grant (if any)
+                pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
-                    pnode->CloseSocketDisconnect();
+                // close socket and cleanup
+                pnode->CloseSocketDisconnect();
 
-                    // hold in disconnected pool until all refs are released
-                    if (pnode->fNetworkNode || pnode->fInbound)
-                        pnode->Release();
-                    vNodesDisconnected.push_back(pnode);
-                }
+                // hold in disconnected pool until all refs are released
+                if (pnode->fNetworkNode || pnode->fInbound)
+                    pnode->Release();
+                vNodesDisconnected.push_back(pnode);
             }
         }
+    }
+    {
+        // Delete disconnected nodes
+        list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
+        BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
         {
-            // Delete disconnected nodes
-            list<CNode*> vNodesDisconnectedCopy = vNodesDisconnected;
-            BOOST_FOREACH(CNode* pnode, vNodesDisconnectedCopy)
+            // wait until threads are done using it
+            if (pnode->GetRefCount() <= 0)
             {
-                // wait until threads are done using it
-                if (pnode->GetRefCount() <= 0)
+                bool fDelete = false;
                 {
-                    bool fDelete = false;
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
                     {
-                        TRY_LOCK(pnode->cs_vSend, lockSend);
-                        if (lockSend)
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        if (lockRecv)
                         {
-                            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                            if (lockRecv)
-                            {
-                                TRY_LOCK(pnode->cs_inventory, lockInv);
-                                if (lockInv)
-                                    fDelete = true;
-                            }
+                            TRY_LOCK(pnode->cs_inventory, lockInv);
+                            if (lockInv)
+                                fDelete = true;
                         }
                     }
-                    if (fDelete)
-                    {
-                        vNodesDisconnected.remove(pnode);
-                        delete pnode;
-                    }
+                }
+                if (fDelete)
+                {
+                    vNodesDisconnected.remove(pnode);
+                    delete pnode;
                 }
             }
         }
-        if(vNodes.size() != nPrevNodeCount) {
-            nPrevNodeCount = vNodes.size();
-            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
-        }
+    }
+}
 
-        //
-        // Find which sockets have data to receive
-        //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+static void AcceptConnection(const ListenSocket& hListenSocket)
+{
+    struct sockaddr_storage sockaddr;
+    socklen_t len = sizeof(sockaddr);
+    SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
+    CAddress addr;
+    int nInbound = 0;
+    int nMaxInbound = nMaxConnections - MAX_OUTBOUND_CONNECTIONS;
 
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+    if (hSocket != INVALID_SOCKET)
+        if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
+            LogPrintf("Warning: Unknown socket family\n");
+
+    bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+            if (pnode->fInbound)
+                nInbound++;
+    }
+
+    if (hSocket == INVALID_SOCKET)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK)
+            LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
+    }
+    else if (!IsSelectableSocket(hSocket))
+    {
+        LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else if (nInbound >= nMaxInbound)
+    {
+        LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else if (!whitelisted && (nInbound >= (nMaxInbound - nWhiteConnections)))
+    {
+        LogPrint("net", "connection from %s dropped (non-whitelisted)\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else if (CNode::IsBanned(addr) && !whitelisted)
+    {
+        LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
+        CloseSocket(hSocket);
+    }
+    else
+    {
+        CNode* pnode = new CNode(hSocket, addr, "", true);
+        pnode->AddRef();
+        pnode->fWhitelisted = whitelisted;
+
+        LogPrint("net", "connection from %s accepted\n", addr.ToString());
 
         {
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signalling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
+            vNodes.push_back(pnode);
         }
+#ifdef HAVE_EPOLL
+        AddSocketEvents(pnode);
+#endif
+    }
+}
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR)
+/**
+ * Receive what is available on a peer's socket, up to one buffer full.
+ * Returns whether more data may be waiting. Requires cs_vRecvMsg.
+ */
+static bool SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+    if (nBytes > 0)
+    {
+        if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
+            pnode->CloseSocketDisconnect();
+        pnode->nLastRecv = GetTime();
+        pnode->nRecvBytes += nBytes;
+        pnode->RecordBytesRecv(nBytes);
+        return nBytes == (int)sizeof(pchBuf);
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect)
+            LogPrint("net", "socket closed\n");
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
         }
+        return nErr == WSAEINTR;
+    }
+    return false;
+}
 
-        //
-        // Accept new connections
-        //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+static void InactivityCheck(CNode* pnode)
+{
+    int64_t nTime = GetTime();
+    if (nTime - pnode->nTimeConnected > 60)
+    {
+        if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                struct sockaddr_storage sockaddr;
-                socklen_t len = sizeof(sockaddr);
-                SOCKET hSocket = accept(hListenSocket.socket, (struct sockaddr*)&sockaddr, &len);
-                CAddress addr;
-                int nInbound = 0;
-                int nMaxInbound = nMaxConnections - MAX_OUTBOUND_CONNECTIONS;
+            LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
+        {
+            LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
+            pnode->fDisconnect = true;
+        }
+        else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
+        {
+            LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
+            pnode->fDisconnect = true;
+        }
+        else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
+        {
+            LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
+            pnode->fDisconnect = true;
+        }
+    }
+}
 
-                if (hSocket != INVALID_SOCKET)
-                    if (!addr.SetSockAddr((const struct sockaddr*)&sockaddr))
-                        LogPrintf("Warning: Unknown socket family\n");
+#ifdef HAVE_EPOLL
+/**
+ * Wait for socket events and service the peers they were reported for.
+ *
+ * Sockets are registered once, so the cost of a pass does not depend on the
+ * number of idle peers. Because readiness is edge-triggered, a peer stays in
+ * vNodesReady until its socket has been drained (or its send queue flushed);
+ * peers we stop reading from for flow control are picked up again when the
+ * message handler wakes us through hWakeEvent.
+ */
+static void SocketEvents()
+{
+    static int64_t nLastInactivityCheck = 0;
+    static bool fMoreWork = false;
 
-                bool whitelisted = hListenSocket.whitelisted || CNode::IsWhitelistedRange(addr);
-                {
-                    LOCK(cs_vNodes);
-                    BOOST_FOREACH(CNode* pnode, vNodes)
-                        if (pnode->fInbound)
-                            nInbound++;
-                }
+    struct epoll_event events[MAX_SOCKET_EVENTS];
+    int nEvents = epoll_wait(hEpoll, events, MAX_SOCKET_EVENTS, fMoreWork ? 0 : 50);
+    boost::this_thread::interruption_point();
 
-                if (hSocket == INVALID_SOCKET)
-                {
-                    int nErr = WSAGetLastError();
-                    if (nErr != WSAEWOULDBLOCK)
-                        LogPrintf("socket error accept failed: %s\n", NetworkErrorString(nErr));
-                }
-                else if (!IsSelectableSocket(hSocket))
-                {
-                    LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else if (nInbound >= nMaxInbound)
-                {
-                    LogPrint("net", "connection from %s dropped (full)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else if (!whitelisted && (nInbound >= (nMaxInbound - nWhiteConnections)))
-                {
-                    LogPrint("net", "connection from %s dropped (non-whitelisted)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else if (CNode::IsBanned(addr) && !whitelisted)
-                {
-                    LogPrintf("connection from %s dropped (banned)\n", addr.ToString());
-                    CloseSocket(hSocket);
-                }
-                else
-                {
-                    CNode* pnode = new CNode(hSocket, addr, "", true);
-                    pnode->AddRef();
-                    pnode->fWhitelisted = whitelisted;
+    if (nEvents == SOCKET_ERROR)
+    {
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEINTR) {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+            MilliSleep(50);
+        }
+        nEvents = 0;
+    }
 
-                    LogPrint("net", "connection from %s accepted\n", addr.ToString());
+    bool fAccept = false;
+    vector<CNode*> vNodesNew;
+    for (int i = 0; i < nEvents; i++)
+    {
+        if (events[i].data.ptr == &hWakeEvent) {
+            uint64_t nCount;
+            while (read(hWakeEvent, &nCount, sizeof(nCount)) > 0) {}
+            continue;
+        }
+        if (events[i].data.ptr == NULL) {
+            fAccept = true;
+            continue;
+        }
+        // Nodes are only deleted by this thread, after their socket has left the epoll set.
+        CNode* pnode = (CNode*)events[i].data.ptr;
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+            pnode->fPollRecv = true;
+        if (events[i].events & EPOLLOUT)
+            pnode->fPollSend = true;
+        if (!pnode->fPollQueued) {
+            pnode->fPollQueued = true;
+            vNodesNew.push_back(pnode);
+        }
+    }
+    if (!vNodesNew.empty())
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodesNew)
+            pnode->AddRef();
+        vNodesReady.insert(vNodesReady.end(), vNodesNew.begin(), vNodesNew.end());
+    }
 
-                    {
-                        LOCK(cs_vNodes);
-                        vNodes.push_back(pnode);
-                    }
-                }
+    //
+    // Accept new connections
+    //
+    if (fAccept)
+    {
+        // Listening sockets are non-blocking, so trying one that isn't ready is harmless.
+        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+            if (hListenSocket.socket != INVALID_SOCKET)
+                AcceptConnection(hListenSocket);
+    }
+
+    //
+    // Service the ready sockets
+    //
+    fMoreWork = false;
+    vector<CNode*> vNodesDone;
+    for (size_t i = 0; i < vNodesReady.size(); )
+    {
+        boost::this_thread::interruption_point();
+        CNode* pnode = vNodesReady[i];
+
+        if (pnode->hSocket != INVALID_SOCKET && pnode->fPollSend)
+        {
+            // A partial send leaves the socket unwritable, and it reports again once there is room.
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend) {
+                if (!pnode->vSendMsg.empty())
+                    SocketSendData(pnode);
+                pnode->fPollSend = false;
+            } else {
+                fMoreWork = true;
             }
         }
 
-        //
-        // Service each socket
-        //
-        vector<CNode*> vNodesCopy;
+        if (pnode->hSocket != INVALID_SOCKET && pnode->fPollRecv)
         {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
+            // Same flow control as the select() loop: flush pending sends before
+            // receiving more, and don't read past a full receive buffer.
+            bool fSendPending = false;
+            {
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                fSendPending = lockSend && !pnode->vSendMsg.empty();
+            }
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (!lockRecv) {
+                fMoreWork = true;
+            } else if (fSendPending || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg.front().complete() &&
+                                        pnode->GetTotalRecvSize() > ReceiveFloodSize())) {
+                pnode->fPauseRecv = !fSendPending;
+            } else {
+                pnode->fPauseRecv = false;
+                pnode->fPollRecv = SocketRecvData(pnode);
+                fMoreWork |= pnode->fPollRecv;
+            }
         }
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+
+        if (pnode->hSocket == INVALID_SOCKET || (!pnode->fPollRecv && !pnode->fPollSend))
         {
-            boost::this_thread::interruption_point();
+            pnode->fPollRecv = pnode->fPollSend = pnode->fPollQueued = false;
+            vNodesDone.push_back(pnode);
+            vNodesReady[i] = vNodesReady.back();
+            vNodesReady.pop_back();
+        } else {
+            i++;
+        }
+    }
 
-            //
-            // Receive
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
-            {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    {
-                        // typical socket buffer is 8K-64K
-                        char pchBuf[0x10000];
-                        int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
-                                pnode->CloseSocketDisconnect();
-                            pnode->nLastRecv = GetTime();
-                            pnode->nRecvBytes += nBytes;
-                            pnode->RecordBytesRecv(nBytes);
-                        }
-                        else if (nBytes == 0)
-                        {
-                            // socket closed gracefully
-                            if (!pnode->fDisconnect)
-                                LogPrint("net", "socket closed\n");
-                            pnode->CloseSocketDisconnect();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                if (!pnode->fDisconnect)
-                                    LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                    }
-                }
-            }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodesDone)
+            pnode->Release();
 
-            //
-            // Send
-            //
+        //
+        // Inactivity checking
+        //
+        int64_t nTime = GetTime();
+        if (nTime != nLastInactivityCheck) {
+            nLastInactivityCheck = nTime;
+            BOOST_FOREACH(CNode* pnode, vNodes)
+                if (pnode->hSocket != INVALID_SOCKET)
+                    InactivityCheck(pnode);
+        }
+    }
+}
+#else
+static void SocketEvents()
+{
+    //
+    // Find which sockets have data to receive
+    //
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodes)
+        {
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            FD_SET(pnode->hSocket, &fdsetError);
+            hSocketMax = max(hSocketMax, pnode->hSocket);
+            have_fds = true;
+
+            // Implement the following logic:
+            // * If there is data to send, select() for sending data. As this only
+            //   happens when optimistic write failed, we choose to first drain the
+            //   write buffer in this case before receiving more. This avoids
+            //   needlessly queueing received data, if the remote peer is not themselves
+            //   receiving data. This means properly utilizing TCP flow control signalling.
+            // * Otherwise, if there is no (complete) message in the receive buffer,
+            //   or there is space left in the buffer, select() for receiving data.
+            // * (if neither of the above applies, there is certainly one message
+            //   in the receiver buffer ready to be processed).
+            // Together, that means that at least one of the following is always possible,
+            // so we don't deadlock:
+            // * We send some data.
+            // * We wait for data to be received (and disconnect after timeout).
+            // * We process a message in the buffer (message handler thread).
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SocketSendData(pnode);
+                if (lockSend && !pnode->vSendMsg.empty()) {
+                    FD_SET(pnode->hSocket, &fdsetSend);
+                    continue;
+                }
             }
-
-            //
-            // Inactivity checking
-            //
-            int64_t nTime = GetTime();
-            if (nTime - pnode->nTimeConnected > 60)
             {
-                if (pnode->nLastRecv == 0 || pnode->nLastSend == 0)
-                {
-                    LogPrint("net", "socket no message in first 60 seconds, %d %d from %d\n", pnode->nLastRecv != 0, pnode->nLastSend != 0, pnode->id);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastSend > TIMEOUT_INTERVAL)
-                {
-                    LogPrintf("socket sending timeout: %is\n", nTime - pnode->nLastSend);
-                    pnode->fDisconnect = true;
-                }
-                else if (nTime - pnode->nLastRecv > (pnode->nVersion > BIP0031_VERSION ? TIMEOUT_INTERVAL : 90*60))
-                {
-                    LogPrintf("socket receive timeout: %is\n", nTime - pnode->nLastRecv);
-                    pnode->fDisconnect = true;
-                }
-                else if (pnode->nPingNonceSent && pnode->nPingUsecStart + TIMEOUT_INTERVAL * 1000000 < GetTimeMicros())
-                {
-                    LogPrintf("ping timeout: %fs\n", 0.000001 * (GetTimeMicros() - pnode->nPingUsecStart));
-                    pnode->fDisconnect = true;
-                }
+                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                if (lockRecv && (
+                    pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                    pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+                    FD_SET(pnode->hSocket, &fdsetRecv);
             }
         }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
         {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->Release();
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec/1000);
+    }
+
+    //
+    // Accept new connections
+    //
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+    {
+        if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            AcceptConnection(hListenSocket);
+    }
+
+    //
+    // Service each socket
+    //
+    vector<CNode*> vNodesCopy;
+    {
+        LOCK(cs_vNodes);
+        vNodesCopy = vNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->AddRef();
+    }
+    BOOST_FOREACH(CNode* pnode, vNodesCopy)
+    {
+        boost::this_thread::interruption_point();
+
+        //
+        // Receive
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+        {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+                SocketRecvData(pnode);
         }
+
+        //
+        // Send
+        //
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (FD_ISSET(pnode->hSocket, &fdsetSend))
+        {
+            TRY_LOCK(pnode->cs_vSend, lockSend);
+            if (lockSend)
+                SocketSendData(pnode);
+        }
+
+        //
+        // Inactivity checking
+        //
+        InactivityCheck(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            pnode->Release();
+    }
+}
+#endif
+
+void ThreadSocketHandler()
+{
+    unsigned int nPrevNodeCount = 0;
+    while (true)
+    {
+        //
+        // Disconnect nodes
+        //
+        DisconnectNodes();
+        if(vNodes.size() != nPrevNodeCount) {
+            nPrevNodeCount = vNodes.size();
+            uiInterface.NotifyNumConnectionsChanged(nPrevNodeCount);
+        }
+
+        SocketEvents();
     }
 }
 
@@ -1520,11 +1959,38 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+/** Peers whose next message changes chain state, in the order they are to be handled */
+static std::deque<CNode*> vValidationQueue;
+static boost::mutex mutexValidationQueue;
+static boost::condition_variable condValidationQueue;
+
+/**
+ * Messages that change the chain or the mempool. They are handled one at a
+ * time by the validation thread, so message handler threads are not held up
+ * waiting for cs_main behind them.
+ */
+bool IsValidationMessage(const CNetMessage& msg)
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    if (!msg.complete())
+        return false;
+    std::string strCommand = msg.hdr.GetCommand();
+    return strCommand == "block" || strCommand == "tx" || strCommand == "headers";
+}
+
+// requires LOCK(pnode->cs_msgHandler) and LOCK(pnode->cs_vRecvMsg)
+static void ProcessNodeMessages(CNode* pnode)
+{
+    if (!g_signals.ProcessMessages(pnode))
+        pnode->CloseSocketDisconnect();
+
+    // Let the socket handler resume reading from this peer once there is room
+    if (pnode->fPauseRecv && (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                              pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
+        WakeSocketHandler();
+}
 
+void ThreadMessageHandler()
+{
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (true)
     {
@@ -1549,19 +2015,41 @@ void ThreadMessageHandler()
             if (pnode->fDisconnect)
                 continue;
 
+            // Another thread is handling this peer
+            TRY_LOCK(pnode->cs_msgHandler, lockHandler);
+            if (!lockHandler)
+                continue;
+
             // Receive messages
+            if (!pnode->fValidationQueued)
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
                 {
-                    if (!g_signals.ProcessMessages(pnode))
-                        pnode->CloseSocketDisconnect();
-
-                    if (pnode->nSendSize < SendBufferSize())
+                    if (pnode->nSendSize < SendBufferSize() && pnode->vRecvGetData.empty() &&
+                        !pnode->vRecvMsg.empty() && IsValidationMessage(pnode->vRecvMsg.front()))
+                    {
+                        // Hand the peer over until its message has been validated; its
+                        // later messages wait, so they are still handled in order.
+                        pnode->fValidationQueued = true;
+                        {
+                            LOCK(cs_vNodes);
+                            pnode->AddRef();
+                        }
+                        boost::unique_lock<boost::mutex> lockQueue(mutexValidationQueue);
+                        vValidationQueue.push_back(pnode);
+                        condValidationQueue.notify_one();
+                    }
+                    else
                     {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                        ProcessNodeMessages(pnode);
+
+                        if (pnode->nSendSize < SendBufferSize())
                         {
-                            fSleep = false;
+                            if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                            {
+                                fSleep = false;
+                            }
                         }
                     }
                 }
@@ -1583,8 +2071,55 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        if (fSleep) {
+            boost::unique_lock<boost::mutex> lock(mutexMessageHandler);
+            if (!fMessageHandlerWake)
+                messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+            fMessageHandlerWake = false;
+        }
+    }
+}
+
+void ThreadValidation()
+{
+    while (true)
+    {
+        CNode* pnode;
+        {
+            boost::unique_lock<boost::mutex> lockQueue(mutexValidationQueue);
+            while (vValidationQueue.empty())
+                condValidationQueue.wait(lockQueue);
+            pnode = vValidationQueue.front();
+            vValidationQueue.pop_front();
+        }
+
+        bool fRequeue = false;
+        {
+            LOCK2(pnode->cs_msgHandler, pnode->cs_vRecvMsg);
+            if (!pnode->fDisconnect) {
+                ProcessNodeMessages(pnode);
+                // Keep the peer if its next message is for us as well, but behind the others
+                fRequeue = !pnode->fDisconnect && pnode->nSendSize < SendBufferSize() && pnode->vRecvGetData.empty() &&
+                           !pnode->vRecvMsg.empty() && IsValidationMessage(pnode->vRecvMsg.front());
+            }
+            if (!fRequeue)
+                pnode->fValidationQueued = false;
+        }
+        boost::this_thread::interruption_point();
+
+        if (fRequeue) {
+            boost::unique_lock<boost::mutex> lockQueue(mutexValidationQueue);
+            vValidationQueue.push_back(pnode);
+            continue;
+        }
+
+        {
+            LOCK(cs_vNodes);
+            pnode->Release();
+        }
+
+        // The peer's next message can be picked up again
+        WakeMessageHandler();
     }
 }
 
@@ -1737,7 +2272,7 @@ void static Discover(boost::thread_group& threadGroup)
 #endif
 }
 
-void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
+bool StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
     uiInterface.InitMessage(_("Loading addresses..."));
     // Load addresses for peers.dat
@@ -1785,6 +2320,11 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     // Map ports with UPnP
     MapPort(GetBoolArg("-upnp", DEFAULT_UPNP));
 
+#ifdef HAVE_EPOLL
+    if (!InitSocketEvents())
+        return error("%s: setting up the socket event loop failed: %s", __func__, NetworkErrorString(WSAGetLastError()));
+#endif
+
     // Send and receive from sockets, accept connections
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "net", &ThreadSocketHandler));
 
@@ -1795,10 +2335,16 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    int nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    LogPrintf("Using %d message handler threads\n", nMessageHandlerThreads);
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "validation", &ThreadValidation));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
+
+    return true;
 }
 
 bool StopNode()
@@ -1842,6 +2388,13 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_EPOLL
+        if (hEpoll != -1)
+            close(hEpoll);
+        if (hWakeEvent != -1)
+            close(hWakeEvent);
+        hEpoll = hWakeEvent = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1881,8 +2434,10 @@ void RelayTransaction(const CTransaction& tx, const CDataStream& ss)
             vRelayExpiration.pop_front();
         }
 
-        // Save original serialized message so newer versions are preserved
-        mapRelay.insert(std::make_pair(inv, ss));
+        // Save original serialized message so newer versions are preserved.
+        // Every peer that asks for it gets the same buffer.
+        if (!mapRelay.count(inv))
+            mapRelay.insert(std::make_pair(inv, MakeSerializedNetMsg(inv.GetCommand(), ss)));
         vRelayExpiration.push_back(std::make_pair(GetTime() + 15 * 60, inv));
     }
     LOCK(cs_vNodes);
@@ -2088,6 +2643,11 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = false;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fPollRecv = false;
+    fPollSend = false;
+    fPollQueued = false;
+    fPauseRecv = false;
+    fValidationQueued = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2128,6 +2688,28 @@ CNode::~CNode()
     GetNodeSignals().FinalizeNode(GetId());
 }
 
+void CMessageLatency::Add(int64_t nMicros)
+{
+    nMicros = std::max(nMicros, (int64_t)0);
+    nCount++;
+    nTotalMicros += nMicros;
+    nMaxMicros = std::max(nMaxMicros, nMicros);
+    int nBucket = 0;
+    for (int64_t nLimit = 1000; nBucket < BUCKETS - 1 && nMicros >= nLimit; nLimit *= 2)
+        nBucket++;
+    vBuckets[nBucket]++;
+}
+
+void CNode::RecordRecvLatency(const std::string& strCommand, int64_t nMicros)
+{
+    LOCK(cs_mapRecvLatency);
+    // Peers choose the commands they send; don't let them grow the map without bound.
+    std::map<std::string, CMessageLatency>::iterator it = mapRecvLatency.find(strCommand);
+    if (it == mapRecvLatency.end())
+        it = mapRecvLatency.insert(std::make_pair(mapRecvLatency.size() < 32 ? strCommand : std::string("*other*"), CMessageLatency())).first;
+    it->second.Add(nMicros);
+}
+
 void CNode::AskFor(const CInv& inv)
 {
     if (mapAskFor.size() > MAPASKFOR_MAX_SZ)
@@ -2162,7 +2744,7 @@ void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSen
 {
     ENTER_CRITICAL_SECTION(cs_vSend);
     assert(ssSend.size() == 0);
-    ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+    BeginSerializedNetMsg(ssSend, pszCommand);
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2194,30 +2776,58 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
     unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
-
-    // Set the checksum
-    uint256 hash = XCoin::HashMessage(XCoin::ConstBuf(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end()));
-    unsigned int nChecksum = 0;
-    memcpy(&nChecksum, &hash, sizeof(nChecksum));
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
-
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
 
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    vSendMsg.push_back(FinishSerializedNetMsg(ssSend));
+    nSendSize += vSendMsg.back()->size();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+void CNode::PushSerializedMessage(const CSerializedNetMsg& msg)
+{
+    // Shared buffers are never modified, so -dropmessagestest and
+    // -fuzzmessagestest only apply to messages built with BeginMessage.
+    LOCK(cs_vSend);
+    LogPrint("net", "sending: %s (%d bytes, shared) peer=%d\n",
+        SanitizeString(std::string(&(*msg)[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE).c_str()),
+        msg->size() - CMessageHeader::HEADER_SIZE, id);
+
+    vSendMsg.push_back(msg);
+    nSendSize += msg->size();
+
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
+void BeginSerializedNetMsg(CDataStream& ss, const char* pszCommand)
+{
+    ss << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+}
+
+CSerializedNetMsg FinishSerializedNetMsg(CDataStream& ss)
+{
+    // Set the size
+    unsigned int nSize = ss.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&ss[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
+    // Set the checksum
+    uint256 hash = XCoin::HashMessage(XCoin::ConstBuf(ss.begin() + CMessageHeader::HEADER_SIZE, ss.end()));
+    unsigned int nChecksum = 0;
+    memcpy(&nChecksum, &hash, sizeof(nChecksum));
+    assert(ss.size () >= CMessageHeader::CHECKSUM_OFFSET + sizeof(nChecksum));
+    memcpy((char*)&ss[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
+
+    boost::shared_ptr<CSerializeData> msg(new CSerializeData());
+    ss.GetAndClear(*msg);
+    return msg;
+}
+
 //
 // CBanDB
 //
@@ -8,6 +8,7 @@
 
 #include "bloom.h"
 #include "compat.h"
+#include "groestlcoin.h"
 #include "limitedmap.h"
 #include "mruset.h"
 #include "netbase.h"
@@ -26,10 +27,13 @@
 
 #include <boost/filesystem/path.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/signals2/signal.hpp>
 
 class CAddrMan;
+class CBlock;
 class CScheduler;
+class CNetMessage;
 class CNode;
 
 namespace boost {
@@ -58,6 +62,10 @@ static const bool DEFAULT_UPNP = false;
 #endif
 /** The maximum number of entries in mapAskFor */
 static const size_t MAPASKFOR_MAX_SZ = MAX_INV_SZ;
+/** -msghandlerthreads default (number of threads handling peer messages besides the validation thread) */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 2;
+/** Maximum number of message handler threads allowed */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
 /** The maximum number of peer connections to maintain. */
 static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 
@@ -75,9 +83,39 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
-void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
+bool StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
+/** Wake up the socket handler, e.g. when a peer it stopped reading from has room again */
+void WakeSocketHandler();
+/** Handle peer messages; those IsValidationMessage() selects are handed to ThreadValidation */
+void ThreadMessageHandler();
+/** Handle the messages handed over by ThreadMessageHandler, one peer at a time */
+void ThreadValidation();
+/** Whether a message changes the chain or the mempool, and is handled by ThreadValidation */
+bool IsValidationMessage(const CNetMessage& msg);
+
+/**
+ * A complete network message (header and payload). It is immutable once
+ * built, so the same buffer can be queued to any number of peers without
+ * serializing or copying it again.
+ */
+typedef boost::shared_ptr<const CSerializeData> CSerializedNetMsg;
+
+/** Write a message header for pszCommand with the size and checksum left blank */
+void BeginSerializedNetMsg(CDataStream& ss, const char* pszCommand);
+/** Fill in the size and checksum of a message started with BeginSerializedNetMsg, taking over its buffer */
+CSerializedNetMsg FinishSerializedNetMsg(CDataStream& ss);
+
+template<typename T>
+CSerializedNetMsg MakeSerializedNetMsg(const char* pszCommand, const T& payload)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(CMessageHeader::HEADER_SIZE + ::GetSerializeSize(payload, SER_NETWORK, PROTOCOL_VERSION));
+    BeginSerializedNetMsg(ss, pszCommand);
+    ss << payload;
+    return FinishSerializedNetMsg(ss);
+}
 
 typedef int NodeId;
 
@@ -159,7 +197,7 @@ extern int nWhiteConnections;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
-extern std::map<CInv, CDataStream> mapRelay;
+extern std::map<CInv, CSerializedNetMsg> mapRelay;
 extern std::deque<std::pair<int64_t, CInv> > vRelayExpiration;
 extern CCriticalSection cs_mapRelay;
 extern limitedmap<CInv, int64_t> mapAlreadyAskedFor;
@@ -181,6 +219,30 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/**
+ * Latency of one kind of received message, from the moment it was fully
+ * received until it was processed. Bucket i counts latencies below 2^i
+ * milliseconds (and at least half that), the last bucket everything longer.
+ */
+class CMessageLatency
+{
+public:
+    static const int BUCKETS = 14;
+
+    uint64_t nCount;
+    int64_t nTotalMicros;
+    int64_t nMaxMicros;
+    uint64_t vBuckets[BUCKETS];
+
+    CMessageLatency() : nCount(0), nTotalMicros(0), nMaxMicros(0)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            vBuckets[i] = 0;
+    }
+
+    void Add(int64_t nMicros);
+};
+
 class CNodeStats
 {
 public:
@@ -201,6 +263,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    std::map<std::string, CMessageLatency> mapRecvLatency;
 };
 
 
@@ -210,23 +273,33 @@ class CNetMessage {
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
     CDataStream vRecv;              // received message data
     unsigned int nDataPos;
+    uint256 hashData;               // HashMessage of the data, computed as it was received
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    // A "block" message is deserialized while it arrives, one transaction at a time.
+    // Reset if that fails; ProcessMessage then deserializes the payload as usual.
+    boost::shared_ptr<CBlock> pblock;
+    unsigned int nParsePos;         // payload bytes deserialized into pblock (0 until the header is)
+    uint64_t nParseTxLeft;          // transactions still to come
+
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
+        nParsePos = 0;
+        nParseTxLeft = 0;
     }
 
+    ~CNetMessage();
+
     bool complete() const
     {
         if (!in_data)
@@ -236,12 +309,17 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
+
+    /** The block in a complete "block" message, if it was deserialized as it arrived */
+    const CBlock* GetBlock() const;
+
+private:
+    void ParseBlock();
 };
 
 
@@ -317,7 +395,7 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CSerializedNetMsg> vSendMsg;
     CCriticalSection cs_vSend;
 
     std::deque<CInv> vRecvGetData;
@@ -325,6 +403,8 @@ public:
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
     int nRecvVersion;
+    /** Checksum of the message being received, protected by cs_vRecvMsg */
+    XCoin::GroestlHasher hasherRecv;
 
     int64_t nLastSend;
     int64_t nLastRecv;
@@ -346,6 +426,16 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // Readiness reported by the socket event loop and not handled yet (socket handler only)
+    bool fPollRecv;
+    bool fPollSend;
+    bool fPollQueued;
+    // Reading from the socket is paused until the receive buffer has room (protected by cs_vRecvMsg)
+    bool fPauseRecv;
+    // Held by the thread handling this peer's messages, so they are handled by one thread at a time
+    CCriticalSection cs_msgHandler;
+    // The next message is waiting for the validation thread (protected by cs_msgHandler)
+    bool fValidationQueued;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in its version message that we should not relay tx invs
@@ -379,8 +469,9 @@ public:
     // flood relay
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend; // protects vAddrToSend and addrKnown
     bool fGetAddr;
-    std::set<uint256> setKnown;
+    std::set<uint256> setKnown; // known alerts, protected by cs_inventory
 
     // inventory based relay
     mruset<CInv> setInventoryKnown;
@@ -398,6 +489,10 @@ public:
     // Whether a ping is requested.
     bool fPingQueued;
 
+    // Receive-to-processed latency per message command
+    std::map<std::string, CMessageLatency> mapRecvLatency;
+    CCriticalSection cs_mapRecvLatency;
+
     CNode(SOCKET hSocketIn, const CAddress &addrIn, const std::string &addrNameIn = "", bool fInboundIn = false);
     ~CNode();
 
@@ -458,6 +553,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
@@ -466,6 +562,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !addrKnown.contains(addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand() % vAddrToSend.size()] = addr;
@@ -495,6 +592,8 @@ public:
 
     void AskFor(const CInv& inv);
 
+    void RecordRecvLatency(const std::string& strCommand, int64_t nMicros);
+
     // TODO: Document the postcondition of this function.  Is cs_vSend locked?
     void BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSend);
 
@@ -504,6 +603,9 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    /** Queue a message that may also be queued to other peers. */
+    void PushSerializedMessage(const CSerializedNetMsg& msg);
+
     void PushVersion();
 
 
@@ -17,8 +17,14 @@ class CCoinsViewCache;
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = 750000;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
-/** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
-static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 50000;
+/**
+ * Default for -blockprioritysize, maximum space for zero/low-fee transactions.
+ * Off by default: ordering by priority means recomputing it for the whole
+ * mempool on every new template, as it changes with the chain height.
+ **/
+static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 0;
+/** Largest transaction relayed without a fee if its priority is high enough, for miners with a priority area **/
+static const unsigned int MAX_FREE_RELAY_TX_SIZE = 49000;
 /** The maximum size for transactions we're willing to relay/mine */
 static const unsigned int MAX_STANDARD_TX_SIZE = 100000;
 /** Maximum number of signature check operations in an IsStandard() P2SH script */
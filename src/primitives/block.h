@@ -79,6 +79,8 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    //! Set once CheckBlock() passed with all checks, so it isn't repeated
+    mutable bool fChecked;
 
     CBlock()
     {
@@ -97,6 +99,8 @@ public:
     inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
         READWRITE(*(CBlockHeader*)this);
         READWRITE(vtx);
+        if (ser_action.ForRead())
+            fChecked = false;
     }
 
     void SetNull()
@@ -104,6 +108,7 @@ public:
         CBlockHeader::SetNull();
         vtx.clear();
         vMerkleTree.clear();
+        fChecked = false;
     }
 
     CBlockHeader GetBlockHeader() const
@@ -129,6 +134,12 @@ public:
     std::string ToString() const;
 };
 
+/**
+ * Extend vMerkleTree, holding the transaction hashes, to the whole merkle tree
+ * as built by CBlock::BuildMerkleTree(), and return the merkle root.
+ */
+uint256 ComputeMerkleTree(std::vector<uint256>& vMerkleTree, bool* fMutated = NULL);
+
 
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
@@ -0,0 +1,276 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "primitives/txview.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "serialize.h"
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+
+/** Same rules as ReadCompactSize(), which throws where this returns false */
+bool ReadViewCompactSize(const unsigned char*& pc, const unsigned char* pend, uint64_t& nSizeRet)
+{
+    if (pend - pc < 1)
+        return false;
+    uint8_t chSize = *pc++;
+    if (chSize < 253) {
+        nSizeRet = chSize;
+    } else if (chSize == 253) {
+        if (pend - pc < 2)
+            return false;
+        nSizeRet = ReadLE16(pc);
+        pc += 2;
+        if (nSizeRet < 253)
+            return false;
+    } else if (chSize == 254) {
+        if (pend - pc < 4)
+            return false;
+        nSizeRet = ReadLE32(pc);
+        pc += 4;
+        if (nSizeRet < 0x10000u)
+            return false;
+    } else {
+        if (pend - pc < 8)
+            return false;
+        nSizeRet = ReadLE64(pc);
+        pc += 8;
+        if (nSizeRet < 0x100000000ULL)
+            return false;
+    }
+    return nSizeRet <= (uint64_t)MAX_SIZE;
+}
+
+/** Skip a script, or any other byte vector */
+bool SkipViewBytes(const unsigned char*& pc, const unsigned char* pend)
+{
+    uint64_t nSize;
+    if (!ReadViewCompactSize(pc, pend, nSize) || (uint64_t)(pend - pc) < nSize)
+        return false;
+    pc += nSize;
+    return true;
+}
+
+/** Read a compact size already known to be valid */
+uint64_t ReadValidCompactSize(const unsigned char*& pc)
+{
+    uint64_t nSize = 0;
+    ReadViewCompactSize(pc, pc + 9, nSize);
+    return nSize;
+}
+
+}
+
+bool CScriptView::GetOp(const unsigned char*& pc, opcodetype& opcodeRet, const unsigned char*& pdataRet, unsigned int& nDataSizeRet) const
+{
+    // Mirrors CScript::GetOp2()
+    opcodeRet = OP_INVALIDOPCODE;
+    pdataRet = NULL;
+    nDataSizeRet = 0;
+    if (pc >= pend)
+        return false;
+
+    // Read instruction
+    unsigned int opcode = *pc++;
+
+    // Immediate operand
+    if (opcode <= OP_PUSHDATA4)
+    {
+        unsigned int nSize = 0;
+        if (opcode < OP_PUSHDATA1)
+        {
+            nSize = opcode;
+        }
+        else if (opcode == OP_PUSHDATA1)
+        {
+            if (pend - pc < 1)
+                return false;
+            nSize = *pc++;
+        }
+        else if (opcode == OP_PUSHDATA2)
+        {
+            if (pend - pc < 2)
+                return false;
+            nSize = ReadLE16(pc);
+            pc += 2;
+        }
+        else if (opcode == OP_PUSHDATA4)
+        {
+            if (pend - pc < 4)
+                return false;
+            nSize = ReadLE32(pc);
+            pc += 4;
+        }
+        if (pend - pc < 0 || (unsigned int)(pend - pc) < nSize)
+            return false;
+        pdataRet = pc;
+        nDataSizeRet = nSize;
+        pc += nSize;
+    }
+
+    opcodeRet = (opcodetype)opcode;
+    return true;
+}
+
+uint256 CTxInView::GetPrevoutHash() const
+{
+    uint256 hash;
+    memcpy(hash.begin(), pprevout, 32);
+    return hash;
+}
+
+uint32_t CTxInView::GetPrevoutN() const
+{
+    return ReadLE32(pprevout + 32);
+}
+
+bool CTxInView::IsPrevoutNull() const
+{
+    // Same as COutPoint::IsNull(): a zero hash and n == -1
+    for (int i = 0; i < 32; i++)
+        if (pprevout[i] != 0)
+            return false;
+    return GetPrevoutN() == (uint32_t)-1;
+}
+
+CTxView::CTxView() : pbegin(NULL), pend(NULL), pinputs(NULL), poutputs(NULL), nInputs(0), nOutputs(0), nVersion(0), nLockTime(0)
+{
+}
+
+bool CTxView::Parse(const unsigned char*& pc, const unsigned char* pendBuf)
+{
+    const unsigned char* p = pc;
+    if (pendBuf - p < 4)
+        return false;
+    nVersion = ReadLE32(p);
+    p += 4;
+
+    uint64_t nCount;
+    if (!ReadViewCompactSize(p, pendBuf, nCount))
+        return false;
+    nInputs = nCount;
+    pinputs = p;
+    for (uint64_t i = 0; i < nCount; i++) {
+        if ((size_t)(pendBuf - p) < CTxInView::PREVOUT_SIZE)
+            return false;
+        p += CTxInView::PREVOUT_SIZE;
+        if (!SkipViewBytes(p, pendBuf) || pendBuf - p < 4)
+            return false;
+        p += 4;
+    }
+
+    if (!ReadViewCompactSize(p, pendBuf, nCount))
+        return false;
+    nOutputs = nCount;
+    poutputs = p;
+    for (uint64_t i = 0; i < nCount; i++) {
+        if (pendBuf - p < 8)
+            return false;
+        p += 8;
+        if (!SkipViewBytes(p, pendBuf))
+            return false;
+    }
+
+    if (pendBuf - p < 4)
+        return false;
+    nLockTime = ReadLE32(p);
+    p += 4;
+
+    pbegin = pc;
+    pend = p;
+    pc = p;
+    return true;
+}
+
+CTxInView CTxView::ReadInput(const unsigned char*& pc)
+{
+    CTxInView txin;
+    txin.pprevout = pc;
+    pc += CTxInView::PREVOUT_SIZE;
+    uint64_t nSize = ReadValidCompactSize(pc);
+    txin.scriptSig = CScriptView(pc, pc + nSize);
+    pc += nSize;
+    txin.nSequence = ReadLE32(pc);
+    pc += 4;
+    return txin;
+}
+
+CTxOutView CTxView::ReadOutput(const unsigned char*& pc)
+{
+    CTxOutView txout;
+    txout.nValue = (CAmount)ReadLE64(pc);
+    pc += 8;
+    uint64_t nSize = ReadValidCompactSize(pc);
+    txout.scriptPubKey = CScriptView(pc, pc + nSize);
+    pc += nSize;
+    return txout;
+}
+
+uint256 CTxView::GetHash() const
+{
+    // GRS uses single SHA256, see CTransaction::UpdateHash()
+    uint256 hash;
+    CSHA256().Write(pbegin, size()).Finalize(hash.begin());
+    return hash;
+}
+
+bool CTxView::IsCoinBase() const
+{
+    if (nInputs != 1)
+        return false;
+    const unsigned char* pc = pinputs;
+    return ReadInput(pc).IsPrevoutNull();
+}
+
+bool CBlockView::Parse(const unsigned char* pbeginBuf, const unsigned char* pendBuf)
+{
+    vtx.clear();
+    const unsigned char* pc = pbeginBuf;
+    if (pendBuf - pc < 80)
+        return false;
+    pc += 80;
+
+    uint64_t nCount;
+    if (!ReadViewCompactSize(pc, pendBuf, nCount))
+        return false;
+    // Every transaction takes at least 10 bytes; don't reserve more than could be there
+    vtx.reserve(std::min(nCount, (uint64_t)(pendBuf - pc) / 10));
+    for (uint64_t i = 0; i < nCount; i++) {
+        vtx.push_back(CTxView());
+        if (!vtx.back().Parse(pc, pendBuf)) {
+            vtx.clear();
+            return false;
+        }
+    }
+
+    pbegin = pbeginBuf;
+    pend = pc;
+    return true;
+}
+
+CBlockHeader CBlockView::GetBlockHeader() const
+{
+    CBlockHeader header;
+    const unsigned char* pc = pbegin;
+    header.nVersion = ReadLE32(pc);
+    memcpy(header.hashPrevBlock.begin(), pc + 4, 32);
+    memcpy(header.hashMerkleRoot.begin(), pc + 36, 32);
+    header.nTime = ReadLE32(pc + 68);
+    header.nBits = ReadLE32(pc + 72);
+    header.nNonce = ReadLE32(pc + 76);
+    return header;
+}
+
+uint256 CBlockView::ComputeMerkleRoot(bool* fMutated) const
+{
+    std::vector<uint256> vMerkleTree;
+    vMerkleTree.reserve(vtx.size() * 2 + 16);
+    for (size_t i = 0; i < vtx.size(); i++)
+        vMerkleTree.push_back(vtx[i].GetHash());
+    return ComputeMerkleTree(vMerkleTree, fMutated);
+}
@@ -0,0 +1,153 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GROESTLCOIN_PRIMITIVES_TXVIEW_H
+#define GROESTLCOIN_PRIMITIVES_TXVIEW_H
+
+#include "amount.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "uint256.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Read-only views of serialized transactions and blocks.
+ *
+ * Deserializing a CBlock allocates a vector for the inputs and outputs of
+ * every transaction and one for every script, and then serializes each
+ * transaction again to hash it. Code that only reads a block, such as the
+ * merkle block and REST servers, can instead parse it in place: the views
+ * only point into the buffer they were parsed from, which has to outlive
+ * them. They accept exactly what deserialization accepts.
+ */
+
+/** A script inside a serialized transaction */
+class CScriptView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+
+public:
+    CScriptView() : pbegin(NULL), pend(NULL) {}
+    CScriptView(const unsigned char* pbeginIn, const unsigned char* pendIn) : pbegin(pbeginIn), pend(pendIn) {}
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pend; }
+    size_t size() const { return pend - pbegin; }
+
+    /** Like CScript::GetOp, but pdataRet and nDataSizeRet give the pushed data in place */
+    bool GetOp(const unsigned char*& pc, opcodetype& opcodeRet, const unsigned char*& pdataRet, unsigned int& nDataSizeRet) const;
+
+    CScript ToScript() const { return CScript(pbegin, pend); }
+};
+
+/** An input of a CTxView */
+class CTxInView
+{
+public:
+    //! The serialized prevout: its hash followed by n
+    const unsigned char* pprevout;
+    CScriptView scriptSig;
+    uint32_t nSequence;
+
+    static const size_t PREVOUT_SIZE = 36;
+
+    uint256 GetPrevoutHash() const;
+    uint32_t GetPrevoutN() const;
+    COutPoint GetPrevout() const { return COutPoint(GetPrevoutHash(), GetPrevoutN()); }
+    bool IsPrevoutNull() const;
+};
+
+/** An output of a CTxView */
+class CTxOutView
+{
+public:
+    CAmount nValue;
+    CScriptView scriptPubKey;
+};
+
+/**
+ * A transaction parsed in place. Inputs and outputs are not indexed, they
+ * are read one after another:
+ *
+ *     const unsigned char* pc = tx.InputsBegin();
+ *     for (unsigned int i = 0; i < tx.GetInputCount(); i++) {
+ *         CTxInView txin = CTxView::ReadInput(pc);
+ *         ...
+ */
+class CTxView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+    const unsigned char* pinputs;
+    const unsigned char* poutputs;
+    unsigned int nInputs;
+    unsigned int nOutputs;
+
+public:
+    int32_t nVersion;
+    uint32_t nLockTime;
+
+    CTxView();
+
+    /** Parse the transaction starting at pc, and move pc past it. Returns false if it is malformed. */
+    bool Parse(const unsigned char*& pc, const unsigned char* pendBuf);
+
+    const unsigned char* begin() const { return pbegin; }
+    const unsigned char* end() const { return pend; }
+    size_t size() const { return pend - pbegin; }
+
+    unsigned int GetInputCount() const { return nInputs; }
+    unsigned int GetOutputCount() const { return nOutputs; }
+    const unsigned char* InputsBegin() const { return pinputs; }
+    const unsigned char* OutputsBegin() const { return poutputs; }
+    /** Read the (already validated) input or output at pc, and move pc to the next */
+    static CTxInView ReadInput(const unsigned char*& pc);
+    static CTxOutView ReadOutput(const unsigned char*& pc);
+
+    /** Same as CTransaction::GetHash(), computed over the bytes in place */
+    uint256 GetHash() const;
+    bool IsCoinBase() const;
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return size();
+    }
+
+    /** Serializes to the bytes it was parsed from, so it can be sent in place of a CTransaction */
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        s.write((const char*)pbegin, size());
+    }
+};
+
+/** A block parsed in place */
+class CBlockView
+{
+private:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+
+public:
+    std::vector<CTxView> vtx;
+
+    CBlockView() : pbegin(NULL), pend(NULL) {}
+
+    /** Parse the block at the start of the buffer. Returns false if it is malformed. */
+    bool Parse(const unsigned char* pbeginBuf, const unsigned char* pendBuf);
+
+    size_t size() const { return pend - pbegin; }
+
+    CBlockHeader GetBlockHeader() const;
+    /** Same as CBlock::BuildMerkleTree(), without keeping the tree */
+    uint256 ComputeMerkleRoot(bool* fMutated = NULL) const;
+};
+
+#endif // GROESTLCOIN_PRIMITIVES_TXVIEW_H
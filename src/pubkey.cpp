@@ -4,19 +4,194 @@
 
 #include "pubkey.h"
 
-#include "eccryptoverify.h"
+#include <secp256k1.h>
 
-#include "ecwrapper.h"
+namespace
+{
+/* Global secp256k1_context object used for verification. */
+secp256k1_context_t* secp256k1_context_verify = NULL;
+}
+
+/** This function is taken from the libsecp256k1 distribution and implements
+ *  DER parsing for ECDSA signatures, while supporting an arbitrary subset of
+ *  format violations.
+ *
+ *  Supported violations include excessive padding, garbage at the end, and
+ *  overly long length descriptors. This is safe to use in
+ *  Bitcoin because since the activation of BIP66, signatures are verified to be
+ *  strict DER before being passed to this module, and we know it supports all
+ *  violations present in the blockchain before that point.
+ *
+ *  On success the signature is returned as 64 bytes of big endian R and S.
+ *  Negative R or S never verified under OpenSSL and are rejected here.
+ */
+static bool ecdsa_signature_parse_der_lax(const unsigned char *input, size_t inputlen, unsigned char *sig64) {
+    size_t rpos, rlen, spos, slen;
+    size_t pos = 0;
+    size_t lenbyte;
+
+    memset(sig64, 0, 64);
+
+    /* Sequence tag byte */
+    if (pos == inputlen || input[pos] != 0x30) {
+        return false;
+    }
+    pos++;
+
+    /* Sequence length bytes */
+    if (pos == inputlen) {
+        return false;
+    }
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (pos + lenbyte > inputlen) {
+            return false;
+        }
+        pos += lenbyte;
+    }
+
+    /* Integer tag byte for R */
+    if (pos == inputlen || input[pos] != 0x02) {
+        return false;
+    }
+    pos++;
+
+    /* Integer length for R */
+    if (pos == inputlen) {
+        return false;
+    }
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (pos + lenbyte > inputlen) {
+            return false;
+        }
+        while (lenbyte > 0 && input[pos] == 0) {
+            pos++;
+            lenbyte--;
+        }
+        if (lenbyte >= sizeof(size_t)) {
+            return false;
+        }
+        rlen = 0;
+        while (lenbyte > 0) {
+            rlen = (rlen << 8) + input[pos];
+            pos++;
+            lenbyte--;
+        }
+    } else {
+        rlen = lenbyte;
+    }
+    if (rlen > inputlen - pos) {
+        return false;
+    }
+    rpos = pos;
+    pos += rlen;
+
+    /* Integer tag byte for S */
+    if (pos == inputlen || input[pos] != 0x02) {
+        return false;
+    }
+    pos++;
+
+    /* Integer length for S */
+    if (pos == inputlen) {
+        return false;
+    }
+    lenbyte = input[pos++];
+    if (lenbyte & 0x80) {
+        lenbyte -= 0x80;
+        if (pos + lenbyte > inputlen) {
+            return false;
+        }
+        while (lenbyte > 0 && input[pos] == 0) {
+            pos++;
+            lenbyte--;
+        }
+        if (lenbyte >= sizeof(size_t)) {
+            return false;
+        }
+        slen = 0;
+        while (lenbyte > 0) {
+            slen = (slen << 8) + input[pos];
+            pos++;
+            lenbyte--;
+        }
+    } else {
+        slen = lenbyte;
+    }
+    if (slen > inputlen - pos) {
+        return false;
+    }
+    spos = pos;
+
+    /* Negative values never verified */
+    if ((rlen > 0 && (input[rpos] & 0x80)) || (slen > 0 && (input[spos] & 0x80))) {
+        return false;
+    }
+
+    /* Ignore leading zeroes in R */
+    while (rlen > 0 && input[rpos] == 0) {
+        rlen--;
+        rpos++;
+    }
+    /* Copy R value */
+    if (rlen > 32) {
+        return false;
+    }
+    memcpy(sig64 + 32 - rlen, input + rpos, rlen);
+
+    /* Ignore leading zeroes in S */
+    while (slen > 0 && input[spos] == 0) {
+        slen--;
+        spos++;
+    }
+    /* Copy S value */
+    if (slen > 32) {
+        return false;
+    }
+    memcpy(sig64 + 64 - slen, input + spos, slen);
+
+    return true;
+}
+
+/** Serialize one 32-byte big endian integer as a minimal, positive DER INTEGER. */
+static size_t ecdsa_integer_serialize_der(const unsigned char *in32, unsigned char *out) {
+    size_t skip = 0;
+    while (skip < 31 && in32[skip] == 0) {
+        skip++;
+    }
+    size_t len = 32 - skip;
+    bool fPad = (in32[skip] & 0x80) != 0;
+    out[0] = 0x02;
+    out[1] = len + fPad;
+    out[2] = 0;
+    memcpy(out + 2 + fPad, in32 + skip, len);
+    return 2 + fPad + len;
+}
+
+/** Strict DER encoding of a 64-byte R/S signature, as libsecp256k1's parser expects. */
+static size_t ecdsa_signature_serialize_der(const unsigned char *sig64, unsigned char *out) {
+    size_t len = 2;
+    len += ecdsa_integer_serialize_der(sig64, out + len);
+    len += ecdsa_integer_serialize_der(sig64 + 32, out + len);
+    out[0] = 0x30;
+    out[1] = len - 2;
+    return len;
+}
 
 bool CPubKey::Verify(const uint256 &hash, const std::vector<unsigned char>& vchSig) const {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
+    if (vchSig.empty())
         return false;
-    if (!key.Verify(hash, vchSig))
+    unsigned char sig64[64];
+    if (!ecdsa_signature_parse_der_lax(&vchSig[0], vchSig.size(), sig64))
         return false;
-    return true;
+    unsigned char der[72];
+    size_t derlen = ecdsa_signature_serialize_der(sig64, der);
+    return secp256k1_ecdsa_verify(secp256k1_context_verify, hash.begin(), der, derlen, begin(), size()) == 1;
 }
 
 bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned char>& vchSig) {
@@ -24,33 +199,29 @@ bool CPubKey::RecoverCompact(const uint256 &hash, const std::vector<unsigned cha
         return false;
     int recid = (vchSig[0] - 27) & 3;
     bool fComp = ((vchSig[0] - 27) & 4) != 0;
-    CECKey key;
-    if (!key.Recover(hash, &vchSig[1], recid))
+    unsigned char pub[65];
+    int publen = 0;
+    if (!secp256k1_ecdsa_recover_compact(secp256k1_context_verify, hash.begin(), &vchSig[1], pub, &publen, fComp, recid))
         return false;
-    std::vector<unsigned char> pubkey;
-    key.GetPubKey(pubkey, fComp);
-    Set(pubkey.begin(), pubkey.end());
+    Set(pub, pub + publen);
     return true;
 }
 
 bool CPubKey::IsFullyValid() const {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
-        return false;
-    return true;
+    return secp256k1_ec_pubkey_verify(secp256k1_context_verify, begin(), size()) == 1;
 }
 
 bool CPubKey::Decompress() {
     if (!IsValid())
         return false;
-    CECKey key;
-    if (!key.SetPubKey(begin(), size()))
+    unsigned char pub[65];
+    int publen = size();
+    memcpy(pub, begin(), publen);
+    if (!secp256k1_ec_pubkey_decompress(secp256k1_context_verify, pub, &publen))
         return false;
-    std::vector<unsigned char> pubkey;
-    key.GetPubKey(pubkey, false);
-    Set(pubkey.begin(), pubkey.end());
+    Set(pub, pub + publen);
     return true;
 }
 
@@ -61,13 +232,12 @@ bool CPubKey::Derive(CPubKey& pubkeyChild, ChainCode &ccChild, unsigned int nChi
     unsigned char out[64];
     BIP32Hash(cc, nChild, *begin(), begin()+1, out);
     memcpy(ccChild.begin(), out+32, 32);
-    CECKey key;
-    bool ret = key.SetPubKey(begin(), size());
-    ret &= key.TweakPublic(out);
-    std::vector<unsigned char> pubkey;
-    key.GetPubKey(pubkey, true);
-    pubkeyChild.Set(pubkey.begin(), pubkey.end());
-    return ret;
+    unsigned char pub[33];
+    memcpy(pub, begin(), 33);
+    if (!secp256k1_ec_pubkey_tweak_add(secp256k1_context_verify, pub, 33, out))
+        return false;
+    pubkeyChild.Set(pub, pub + 33);
+    return true;
 }
 
 void CExtPubKey::Encode(unsigned char code[74]) const {
@@ -95,3 +265,25 @@ bool CExtPubKey::Derive(CExtPubKey &out, unsigned int nChild) const {
     out.nChild = nChild;
     return pubkey.Derive(out.pubkey, out.chaincode, nChild, chaincode);
 }
+
+/* static */ int ECCVerifyHandle::refcount = 0;
+
+ECCVerifyHandle::ECCVerifyHandle()
+{
+    if (refcount == 0) {
+        assert(secp256k1_context_verify == NULL);
+        secp256k1_context_verify = secp256k1_context_create(SECP256K1_CONTEXT_VERIFY);
+        assert(secp256k1_context_verify != NULL);
+    }
+    refcount++;
+}
+
+ECCVerifyHandle::~ECCVerifyHandle()
+{
+    refcount--;
+    if (refcount == 0) {
+        assert(secp256k1_context_verify != NULL);
+        secp256k1_context_destroy(secp256k1_context_verify);
+        secp256k1_context_verify = NULL;
+    }
+}
@@ -4,16 +4,21 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "amount.h"
+#include "blockstore.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coins.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "primitives/transaction.h"
+#include "primitives/txview.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -84,7 +89,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+static UniValue blockToJSON(const CBlockHeader& block, unsigned int nSize, const UniValue& txs, const CBlockIndex* blockindex)
 {
     UniValue result(UniValue::VOBJ);
     result.push_back(Pair("hash", block.GetHash().GetHex()));
@@ -93,22 +98,10 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     if (chainActive.Contains(blockindex))
         confirmations = chainActive.Height() - blockindex->nHeight + 1;
     result.push_back(Pair("confirmations", confirmations));
-    result.push_back(Pair("size", (int)::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION)));
+    result.push_back(Pair("size", (int)nSize));
     result.push_back(Pair("height", blockindex->nHeight));
     result.push_back(Pair("version", block.nVersion));
     result.push_back(Pair("merkleroot", block.hashMerkleRoot.GetHex()));
-    UniValue txs(UniValue::VARR);
-    BOOST_FOREACH(const CTransaction&tx, block.vtx)
-    {
-        if(txDetails)
-        {
-            UniValue objTx(UniValue::VOBJ);
-            TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
-        }
-        else
-            txs.push_back(tx.GetHash().GetHex());
-    }
     result.push_back(Pair("tx", txs));
     result.push_back(Pair("time", block.GetBlockTime()));
     result.push_back(Pair("nonce", (uint64_t)block.nNonce));
@@ -124,6 +117,31 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
     return result;
 }
 
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue txs(UniValue::VARR);
+    BOOST_FOREACH(const CTransaction&tx, block.vtx)
+    {
+        if(txDetails)
+        {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, uint256(), objTx);
+            txs.push_back(objTx);
+        }
+        else
+            txs.push_back(tx.GetHash().GetHex());
+    }
+    return blockToJSON(block, ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION), txs, blockindex);
+}
+
+UniValue blockToJSON(const CBlockView& block, const CBlockIndex* blockindex)
+{
+    UniValue txs(UniValue::VARR);
+    BOOST_FOREACH(const CTxView&tx, block.vtx)
+        txs.push_back(tx.GetHash().GetHex());
+    return blockToJSON(block.GetBlockHeader(), block.size(), txs, blockindex);
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -198,6 +216,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees of in-mempool descendants (including this one) in " + CURRENCY_UNIT + ", with prioritisetransaction deltas applied\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) fees of in-mempool ancestors (including this one) in " + CURRENCY_UNIT + ", with prioritisetransaction deltas applied\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -218,10 +242,9 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     {
         LOCK(mempool.cs);
         UniValue o(UniValue::VOBJ);
-        BOOST_FOREACH(const PAIRTYPE(uint256, CTxMemPoolEntry)& entry, mempool.mapTx)
+        BOOST_FOREACH(const CTxMemPoolEntry& e, mempool.mapTx)
         {
-            const uint256& hash = entry.first;
-            const CTxMemPoolEntry& e = entry.second;
+            const uint256& hash = e.GetTx().GetHash();
             UniValue info(UniValue::VOBJ);
             info.push_back(Pair("size", (int)e.GetTxSize()));
             info.push_back(Pair("fee", ValueFromAmount(e.GetFee())));
@@ -229,6 +252,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", ValueFromAmount(e.GetModFeesWithDescendants())));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", ValueFromAmount(e.GetModFeesWithAncestors())));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -390,23 +419,25 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
-
     if (!fVerbose)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        CRawBlock rawBlock;
+        if (!GetRawBlock(rawBlock, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        return HexStr(rawBlock.begin(), rawBlock.end());
     }
 
+    // Only the txids are listed, so the block is parsed in place
+    CRawBlock rawBlock;
+    CBlockView block;
+    if (!GetRawBlock(rawBlock, pblockindex) || !block.Parse(rawBlock.begin(), rawBlock.end()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
     return blockToJSON(block, pblockindex);
 }
 
@@ -473,7 +504,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -497,33 +527,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -768,6 +798,11 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for a transaction to be accepted\n"
+            "  \"evicted\": xxxxx             (numeric) Transactions evicted to keep the mempool within maxmempool\n"
+            "  \"evictedbytes\": xxxxx        (numeric) Sum of the sizes of evicted transactions\n"
+            "  \"expired\": xxxxx             (numeric) Transactions dropped after -mempoolexpiry\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -778,7 +813,196 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    ret.push_back(Pair("evicted", (int64_t) mempool.GetEvictedCount()));
+    ret.push_back(Pair("evictedbytes", (int64_t) mempool.GetEvictedSize()));
+    ret.push_back(Pair("expired", (int64_t) mempool.GetExpiredCount()));
+
+    return ret;
+}
+
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature verification cache.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bytes\": xxxxx               (numeric) Memory allocated to the cache\n"
+            "  \"capacity\": xxxxx            (numeric) Maximum number of entries\n"
+            "  \"size\": xxxxx                (numeric) Current number of entries\n"
+            "  \"hits\": xxxxx                (numeric) Lookups that found a cached signature\n"
+            "  \"misses\": xxxxx              (numeric) Lookups that had to verify the signature\n"
+            "  \"inserts\": xxxxx             (numeric) Signatures added to the cache\n"
+            "  \"evictions\": xxxxx           (numeric) Entries overwritten to make room\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
 
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bytes", (int64_t) stats.nBytes));
+    ret.push_back(Pair("capacity", (int64_t) stats.nCapacity));
+    ret.push_back(Pair("size", (int64_t) stats.nEntries));
+    ret.push_back(Pair("hits", (int64_t) stats.nHits));
+    ret.push_back(Pair("misses", (int64_t) stats.nMisses));
+    ret.push_back(Pair("inserts", (int64_t) stats.nInserts));
+    ret.push_back(Pair("evictions", (int64_t) stats.nEvictions));
+
+    return ret;
+}
+
+UniValue getblockcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblockcacheinfo\n"
+            "\nReturns details on the cache of recently relayed and requested blocks.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bytes\": xxxxx               (numeric) Memory used by the cached blocks\n"
+            "  \"maxbytes\": xxxxx            (numeric) Maximum memory usage (-blockcachesize)\n"
+            "  \"size\": xxxxx                (numeric) Current number of blocks\n"
+            "  \"hits\": xxxxx                (numeric) Requests served from the cache\n"
+            "  \"misses\": xxxxx              (numeric) Requests that had to read the block from disk\n"
+            "  \"inserts\": xxxxx             (numeric) Blocks added to the cache\n"
+            "  \"evictions\": xxxxx           (numeric) Least recently used blocks dropped to make room\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockcacheinfo", "")
+            + HelpExampleRpc("getblockcacheinfo", "")
+        );
+
+    CRawBlockCacheStats stats = GetRawBlockCacheStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bytes", (int64_t) stats.nBytes));
+    ret.push_back(Pair("maxbytes", (int64_t) stats.nMaxBytes));
+    ret.push_back(Pair("size", (int64_t) stats.nEntries));
+    ret.push_back(Pair("hits", (int64_t) stats.nHits));
+    ret.push_back(Pair("misses", (int64_t) stats.nMisses));
+    ret.push_back(Pair("inserts", (int64_t) stats.nInserts));
+    ret.push_back(Pair("evictions", (int64_t) stats.nEvictions));
+
+    return ret;
+}
+
+UniValue getcheckqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcheckqueueinfo\n"
+            "\nReturns details on the queues that spread block validation work over threads.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"overlapblockchecks\": true|false  (boolean) Whether the next block's script checks start early (-overlapblockchecks)\n"
+            "  \"overlappedblocks\": xxxxx      (numeric) Blocks whose script checks were started before the previous block finished\n"
+            "  \"queues\": {                    (json object) One entry per queue: script, header and prefetch\n"
+            "    \"name\": {\n"
+            "      \"workers\": xxxxx           (numeric) Worker threads\n"
+            "      \"queued\": xxxxx            (numeric) Checks waiting to be picked up\n"
+            "      \"sessions\": xxxxx          (numeric) Sets of checks (e.g. blocks) in progress\n"
+            "      \"checks\": xxxxx            (numeric) Checks executed\n"
+            "      \"batches\": xxxxx           (numeric) Batches of checks taken by a thread\n"
+            "      \"steals\": xxxxx            (numeric) Batches taken from another thread's queue\n"
+            "      \"busytime\": xxxxx          (numeric) Seconds spent executing checks, over all threads\n"
+            "      \"utilization\": xxxxx       (numeric) Busy time divided by the time the workers have been running\n"
+            "    }, ...\n"
+            "  }\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getcheckqueueinfo", "")
+            + HelpExampleRpc("getcheckqueueinfo", "")
+        );
+
+    std::vector<std::pair<std::string, CCheckQueueStats> > vStats;
+    uint64_t nOverlappedBlocks;
+    GetCheckQueueStats(vStats, nOverlappedBlocks);
+
+    UniValue queues(UniValue::VOBJ);
+    for (size_t i = 0; i < vStats.size(); i++) {
+        const CCheckQueueStats& stats = vStats[i].second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("workers", stats.nWorkers));
+        obj.push_back(Pair("queued", (int64_t) stats.nQueued));
+        obj.push_back(Pair("sessions", (int64_t) stats.nSessions));
+        obj.push_back(Pair("checks", (int64_t) stats.nChecks));
+        obj.push_back(Pair("batches", (int64_t) stats.nBatches));
+        obj.push_back(Pair("steals", (int64_t) stats.nSteals));
+        obj.push_back(Pair("busytime", stats.nBusyMicros * 0.000001));
+        double dUtilization = 0;
+        if (stats.nWorkers > 0 && stats.nUptimeMicros > 0)
+            dUtilization = (double) stats.nBusyMicros / ((double) stats.nUptimeMicros * stats.nWorkers);
+        obj.push_back(Pair("utilization", dUtilization));
+        queues.push_back(Pair(vStats[i].first, obj));
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("overlapblockchecks", fOverlapBlockChecks));
+    ret.push_back(Pair("overlappedblocks", (int64_t) nOverlappedBlocks));
+    ret.push_back(Pair("queues", queues));
+
+    return ret;
+}
+
+/** Report the settings, size and LevelDB statistics of one database. */
+static UniValue DBInfoToJSON(const CLevelDBWrapper& db)
+{
+    const CLevelDBTuning& tuning = db.GetTuning();
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("approximate_size", (int64_t) db.EstimateSize()));
+    UniValue files(UniValue::VARR);
+    for (int nLevel = 0; nLevel < 7; nLevel++) {
+        std::string strFiles;
+        if (!db.GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), strFiles))
+            break;
+        files.push_back((int64_t) atoi64(strFiles));
+    }
+    obj.push_back(Pair("files_per_level", files));
+    obj.push_back(Pair("block_cache", (int64_t) tuning.nBlockCacheSize));
+    obj.push_back(Pair("write_buffer", (int64_t) tuning.nWriteBufferSize));
+    obj.push_back(Pair("block_size", (int64_t) tuning.nBlockSize));
+    obj.push_back(Pair("max_open_files", tuning.nMaxOpenFiles));
+    obj.push_back(Pair("compression", tuning.fCompression));
+    std::string strStats;
+    if (db.GetProperty("leveldb.stats", strStats))
+        obj.push_back(Pair("stats", strStats));
+    return obj;
+}
+
+UniValue getdbinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getdbinfo\n"
+            "\nReturns the settings and LevelDB statistics of the chainstate and block index databases.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"chainstate\": {              (object) The chainstate database\n"
+            "    \"approximate_size\": xxxxx  (numeric) Size on disk in bytes, as estimated by LevelDB\n"
+            "    \"files_per_level\": [n,...] (array) Number of table files in each level\n"
+            "    \"block_cache\": xxxxx       (numeric) Size of the block cache in bytes\n"
+            "    \"write_buffer\": xxxxx      (numeric) Size of the write buffer in bytes\n"
+            "    \"block_size\": xxxxx        (numeric) Size of the table blocks in bytes\n"
+            "    \"max_open_files\": xxxxx    (numeric) Number of table files kept open\n"
+            "    \"compression\": true|false  (boolean) Whether table blocks are compressed\n"
+            "    \"stats\": \"...\"            (string) Compaction statistics (the leveldb.stats property)\n"
+            "  },\n"
+            "  \"blockindex\": { ... }        (object) The block index database, same fields\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getdbinfo", "")
+            + HelpExampleRpc("getdbinfo", "")
+        );
+
+    LOCK(cs_main);
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("chainstate", DBInfoToJSON(pcoinsdbview->GetDB())));
+    ret.push_back(Pair("blockindex", DBInfoToJSON(*pblocktree)));
     return ret;
 }
 
@@ -10,6 +10,7 @@
 #include "net.h"
 #include "netbase.h"
 #include "rpcserver.h"
+#include "sync.h"
 #include "timedata.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -18,6 +19,7 @@
 #include "wallet/walletdb.h"
 #endif
 
+#include <algorithm>
 #include <stdint.h>
 
 #include <boost/assign/list_of.hpp>
@@ -395,3 +397,123 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
 
     return NullUniValue;
 }
+
+UniValue dumpdebuglog(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "dumpdebuglog ( clear )\n"
+            "\nReturns the log output kept in memory by -debuglogbuffer, oldest first.\n"
+            "\nArguments:\n"
+            "1. clear      (boolean, optional, default=false) Empty the buffer afterwards\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bytes\": xxxxx               (numeric) Size of the kept output\n"
+            "  \"maxbytes\": xxxxx            (numeric) Size of the buffer (0 when -debuglogbuffer is off)\n"
+            "  \"discarded\": xxxxx           (numeric) Messages pushed out of the buffer since it was last cleared\n"
+            "  \"lines\": [                   (array of string) The kept messages\n"
+            "    \"message\"\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpdebuglog", "")
+            + HelpExampleCli("dumpdebuglog", "true")
+            + HelpExampleRpc("dumpdebuglog", "true")
+        );
+
+    bool fClear = false;
+    if (params.size() > 0)
+        fClear = params[0].get_bool();
+
+    std::vector<std::string> vLines;
+    CDebugLogBufferInfo info = GetDebugLogBuffer(vLines, fClear);
+    UniValue lines(UniValue::VARR);
+    BOOST_FOREACH(const std::string& strLine, vLines)
+        lines.push_back(strLine);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bytes", (int64_t) info.nBytes));
+    ret.push_back(Pair("maxbytes", (int64_t) info.nMaxBytes));
+    ret.push_back(Pair("discarded", (int64_t) info.nDiscarded));
+    ret.push_back(Pair("lines", lines));
+
+    return ret;
+}
+
+static bool CompareLockWait(const CLockSiteStats& a, const CLockSiteStats& b)
+{
+    return a.nWaitMicros > b.nWaitMicros || (a.nWaitMicros == b.nWaitMicros && a.nHoldMicros > b.nHoldMicros);
+}
+
+static UniValue LockHistogramToJSON(const uint64_t* vHistogram)
+{
+    int nBuckets = LOCK_HISTOGRAM_BUCKETS;
+    while (nBuckets > 0 && vHistogram[nBuckets - 1] == 0)
+        nBuckets--;
+    UniValue ret(UniValue::VARR);
+    for (int i = 0; i < nBuckets; i++)
+        ret.push_back((int64_t) vHistogram[i]);
+    return ret;
+}
+
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockstats ( reset )\n"
+            "\nReturns how long each lock call site waited for and held its lock, most waiting first (requires -lockprofiling).\n"
+            "Histogram entry 0 counts times under 1us, entry i times from 2^(i-1) up to 2^i us; trailing zeros are left out.\n"
+            "\nArguments:\n"
+            "1. reset      (boolean, optional, default=false) Start counting from zero afterwards\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"lock\": \"name\",               (string) The lock as written at the call site\n"
+            "    \"location\": \"file:line\",      (string) The call site\n"
+            "    \"locks\": n,                   (numeric) Times it was taken here, not counting recursive re-entry\n"
+            "    \"contended\": n,               (numeric) Times it had to be waited for\n"
+            "    \"wait_us\": n,                 (numeric) Total time waited\n"
+            "    \"max_wait_us\": n,             (numeric) Longest wait\n"
+            "    \"hold_us\": n,                 (numeric) Total time held\n"
+            "    \"max_hold_us\": n,             (numeric) Longest hold\n"
+            "    \"wait_histogram\": [n,...],    (array of numeric) Waits by duration\n"
+            "    \"hold_histogram\": [n,...]     (array of numeric) Holds by duration\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleCli("getlockstats", "true")
+            + HelpExampleRpc("getlockstats", "true")
+        );
+
+    if (!fLockProfiling)
+        throw JSONRPCError(RPC_MISC_ERROR, "Lock profiling is off, restart with -lockprofiling");
+
+    bool fReset = false;
+    if (params.size() > 0)
+        fReset = params[0].get_bool();
+
+    std::vector<CLockSiteStats> vStats;
+    GetLockStats(vStats, fReset);
+    std::sort(vStats.begin(), vStats.end(), CompareLockWait);
+
+    UniValue ret(UniValue::VARR);
+    BOOST_FOREACH(const CLockSiteStats& stats, vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("lock", stats.pszName));
+        obj.push_back(Pair("location", strprintf("%s:%d", stats.pszFile, stats.nLine)));
+        obj.push_back(Pair("locks", (int64_t) stats.nLocks));
+        obj.push_back(Pair("contended", (int64_t) stats.nContended));
+        obj.push_back(Pair("wait_us", stats.nWaitMicros));
+        obj.push_back(Pair("max_wait_us", stats.nMaxWaitMicros));
+        obj.push_back(Pair("hold_us", stats.nHoldMicros));
+        obj.push_back(Pair("max_hold_us", stats.nMaxHoldMicros));
+        obj.push_back(Pair("wait_histogram", LockHistogramToJSON(stats.vWaitHistogram)));
+        obj.push_back(Pair("hold_histogram", LockHistogramToJSON(stats.vHoldHistogram)));
+        ret.push_back(obj);
+    }
+
+    return ret;
+}
@@ -107,7 +107,16 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"msglatency\": {            (json object) Time from receipt to completed processing, per message type\n"
+            "      \"command\": {\n"
+            "        \"count\": n,            (numeric) Number of messages processed\n"
+            "        \"avg\": n,              (numeric) Average latency in seconds\n"
+            "        \"max\": n,              (numeric) Largest latency in seconds\n"
+            "        \"histogram\": [ n, ... ] (array) Message counts below 1, 2, 4, ... ms; the last entry counts the rest\n"
+            "      }, ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -159,6 +168,20 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        UniValue latency(UniValue::VOBJ);
+        for (std::map<std::string, CMessageLatency>::const_iterator it = stats.mapRecvLatency.begin(); it != stats.mapRecvLatency.end(); ++it) {
+            const CMessageLatency& lat = it->second;
+            UniValue entry(UniValue::VOBJ);
+            entry.push_back(Pair("count", (uint64_t)lat.nCount));
+            entry.push_back(Pair("avg", lat.nCount ? ((double)lat.nTotalMicros / lat.nCount) / 1e6 : 0.0));
+            entry.push_back(Pair("max", (double)lat.nMaxMicros / 1e6));
+            UniValue histogram(UniValue::VARR);
+            for (int i = 0; i < CMessageLatency::BUCKETS; i++)
+                histogram.push_back((uint64_t)lat.vBuckets[i]);
+            entry.push_back(Pair("histogram", histogram));
+            latency.push_back(Pair(it->first, entry));
+        }
+        obj.push_back(Pair("msglatency", latency));
 
         ret.push_back(obj);
     }
@@ -112,7 +112,7 @@ public:
     bool connect(const std::string& server, const std::string& port)
     {
         using namespace boost::asio::ip;
-        tcp::resolver resolver(stream.get_io_service());
+        tcp::resolver resolver(static_cast<boost::asio::io_service&>(stream.get_executor().context()));
         tcp::resolver::iterator endpoint_iterator;
 #if BOOST_VERSION >= 104300
         try {
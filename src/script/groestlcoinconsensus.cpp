@@ -6,6 +6,7 @@
 #include "groestlcoinconsensus.h"
 
 #include "primitives/transaction.h"
+#include "pubkey.h"
 #include "script/interpreter.h"
 #include "version.h"
 
@@ -53,6 +54,14 @@ private:
     size_t m_remaining;
 };
 
+/** Keeps the secp256k1 verification context alive for the lifetime of the library. */
+class ECCryptoClosure
+{
+    ECCVerifyHandle handle;
+};
+
+ECCryptoClosure instance_of_eccryptoclosure;
+
 inline int set_error(bitcoinconsensus_error* ret, bitcoinconsensus_error serror)
 {
     if (ret)
@@ -5,13 +5,18 @@
 
 #include "sigcache.h"
 
+#include "crypto/common.h"
+#include "crypto/sha256.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
+#include <algorithm>
+#include <new>
+
+#include <boost/atomic.hpp>
+#include <boost/static_assert.hpp>
 
 namespace {
 
@@ -19,65 +24,245 @@ namespace {
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Entries are a salted SHA256 of (signature hash, public key, signature),
+ * stored in a fixed-size open addressing table of cache-line sized buckets.
+ * The salt keeps bucket placement unpredictable to peers, so they cannot
+ * aim collisions at the entries of a block they are about to relay.
+ *
+ * Each bucket has a sequence number which writers make odd while they
+ * rewrite it. Readers copy the bucket and treat a sequence change as a miss,
+ * so lookups never take a lock or wait for a writer; a writer that finds its
+ * bucket claimed by another one just drops its entry.
+ *
+ * Eviction is generational: every entry records the generation it was
+ * inserted in, the generation advances every 1/8th of the table's capacity
+ * in inserts, and a full probe window gives up its oldest entry.
  */
 class CSignatureCache
 {
 private:
-     //! sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, CPubKey> sigdata_type;
-    std::set< sigdata_type> setValid;
-    boost::shared_mutex cs_sigcache;
+    static const unsigned int SLOTS_PER_BUCKET = 2;
+    static const unsigned int KEY_WORDS = 3;
+    static const unsigned int PROBE_BUCKETS = 4;
+    static const unsigned int GENERATIONS = 255;
+
+    /**
+     * One cache line. meta holds the sequence number in its low 32 bits and
+     * the generation of each slot (0 = empty) in the bytes above it; each
+     * slot keeps 192 bits of the entry hash.
+     */
+    struct Bucket
+    {
+        boost::atomic<uint64_t> meta;
+        boost::atomic<uint64_t> key[SLOTS_PER_BUCKET][KEY_WORDS];
+        uint64_t padding;
+    };
+    BOOST_STATIC_ASSERT(sizeof(Bucket) == 64);
+    BOOST_STATIC_ASSERT(sizeof(Bucket) / SLOTS_PER_BUCKET == SIG_CACHE_ENTRY_SIZE);
+
+    struct Entry
+    {
+        uint64_t key[KEY_WORDS];
+        size_t nBucket;
+    };
+
+    std::vector<unsigned char> vchStorage;
+    Bucket* buckets;
+    size_t nBuckets;
+    size_t nBucketMask;
+    size_t nGenerationSize;
+    CSHA256 hasherSalted;
+
+    boost::atomic<uint64_t> nInserts;
+    boost::atomic<uint64_t> nHits;
+    boost::atomic<uint64_t> nMisses;
+    boost::atomic<uint64_t> nEvictions;
+    boost::atomic<size_t> nEntries;
+
+    static unsigned int SlotGeneration(uint64_t meta, unsigned int nSlot)
+    {
+        return (meta >> (32 + 8 * nSlot)) & 0xff;
+    }
+
+    void ComputeEntry(const uint256& hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey, Entry& entry) const
+    {
+        unsigned char out[CSHA256::OUTPUT_SIZE];
+        CSHA256 hasher(hasherSalted);
+        hasher.Write(hash.begin(), 32).Write(pubKey.begin(), pubKey.size());
+        if (!vchSig.empty())
+            hasher.Write(&vchSig[0], vchSig.size());
+        hasher.Finalize(out);
+        for (unsigned int i = 0; i < KEY_WORDS; i++)
+            entry.key[i] = ReadLE64(out + 8 * i);
+        entry.nBucket = ReadLE64(out + 24) & nBucketMask;
+    }
+
+    bool Contains(const Entry& entry) const
+    {
+        for (unsigned int i = 0; i < PROBE_BUCKETS; i++) {
+            const Bucket& bucket = buckets[(entry.nBucket + i) & nBucketMask];
+            uint64_t meta = bucket.meta.load(boost::memory_order_acquire);
+            if (meta & 1)
+                continue;
+            uint64_t key[SLOTS_PER_BUCKET][KEY_WORDS];
+            for (unsigned int s = 0; s < SLOTS_PER_BUCKET; s++)
+                for (unsigned int w = 0; w < KEY_WORDS; w++)
+                    key[s][w] = bucket.key[s][w].load(boost::memory_order_relaxed);
+            boost::atomic_thread_fence(boost::memory_order_acquire);
+            if (bucket.meta.load(boost::memory_order_relaxed) != meta)
+                continue;
+            for (unsigned int s = 0; s < SLOTS_PER_BUCKET; s++) {
+                if (SlotGeneration(meta, s) != 0 && key[s][0] == entry.key[0] &&
+                    key[s][1] == entry.key[1] && key[s][2] == entry.key[2])
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    void Insert(const Entry& entry)
+    {
+        unsigned int nGeneration = 1 + (nInserts.fetch_add(1, boost::memory_order_relaxed) / nGenerationSize) % GENERATIONS;
+
+        // Pick an empty slot if there is one, otherwise the oldest entry.
+        Bucket* pbucket = NULL;
+        unsigned int nSlot = 0;
+        unsigned int nBestAge = 0;
+        uint64_t metaOld = 0;
+        for (unsigned int i = 0; i < PROBE_BUCKETS && nBestAge <= GENERATIONS; i++) {
+            Bucket& bucket = buckets[(entry.nBucket + i) & nBucketMask];
+            uint64_t meta = bucket.meta.load(boost::memory_order_relaxed);
+            if (meta & 1)
+                continue;
+            for (unsigned int s = 0; s < SLOTS_PER_BUCKET; s++) {
+                unsigned int nSlotGeneration = SlotGeneration(meta, s);
+                unsigned int nAge = nSlotGeneration == 0 ? GENERATIONS + 1 : (nGeneration + GENERATIONS - nSlotGeneration) % GENERATIONS;
+                if (pbucket == NULL || nAge > nBestAge) {
+                    pbucket = &bucket;
+                    nSlot = s;
+                    nBestAge = nAge;
+                    metaOld = meta;
+                }
+            }
+        }
+        if (pbucket == NULL)
+            return;
+
+        uint64_t metaClaimed = metaOld + 1;
+        if (!pbucket->meta.compare_exchange_strong(metaOld, metaClaimed, boost::memory_order_acquire, boost::memory_order_relaxed))
+            return;
+        boost::atomic_thread_fence(boost::memory_order_release);
+        for (unsigned int w = 0; w < KEY_WORDS; w++)
+            pbucket->key[nSlot][w].store(entry.key[w], boost::memory_order_relaxed);
+        uint64_t nShift = 32 + 8 * nSlot;
+        uint64_t metaNew = (metaOld & ~(uint64_t)0xffffffff & ~((uint64_t)0xff << nShift)) |
+                           ((uint64_t)nGeneration << nShift) | ((metaOld + 2) & 0xffffffff);
+        pbucket->meta.store(metaNew, boost::memory_order_release);
+
+        if (SlotGeneration(metaOld, nSlot) == 0)
+            nEntries.fetch_add(1, boost::memory_order_relaxed);
+        else
+            nEvictions.fetch_add(1, boost::memory_order_relaxed);
+    }
 
 public:
-    bool
-    Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    CSignatureCache() : buckets(NULL), nBuckets(0), nBucketMask(0), nGenerationSize(1), nInserts(0), nHits(0), nMisses(0), nEvictions(0), nEntries(0) {}
+
+    void Resize(size_t nBytes)
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        nBuckets = 1;
+        while (nBuckets * 2 * sizeof(Bucket) <= nBytes)
+            nBuckets *= 2;
+        if (nBuckets * sizeof(Bucket) > nBytes || nBuckets < PROBE_BUCKETS)
+            nBuckets = 0;
+
+        std::vector<unsigned char>().swap(vchStorage);
+        buckets = NULL;
+        nBucketMask = 0;
+        if (nBuckets > 0) {
+            vchStorage.resize(nBuckets * sizeof(Bucket) + sizeof(Bucket) - 1);
+            uintptr_t nAligned = ((uintptr_t)&vchStorage[0] + sizeof(Bucket) - 1) & ~(uintptr_t)(sizeof(Bucket) - 1);
+            buckets = (Bucket*)nAligned;
+            for (size_t i = 0; i < nBuckets; i++) {
+                new (&buckets[i]) Bucket();
+                buckets[i].meta.store(0, boost::memory_order_relaxed);
+            }
+            nBucketMask = nBuckets - 1;
+        }
+        nGenerationSize = std::max<size_t>(1, nBuckets * SLOTS_PER_BUCKET / 8);
+
+        unsigned char salt[32];
+        GetRandBytes(salt, sizeof(salt));
+        hasherSalted.Reset().Write(salt, sizeof(salt));
 
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if (mi != setValid.end())
+        nInserts.store(0);
+        nHits.store(0);
+        nMisses.store(0);
+        nEvictions.store(0);
+        nEntries.store(0);
+    }
+
+    bool Get(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
+    {
+        if (buckets == NULL)
+            return false;
+        Entry entry;
+        ComputeEntry(hash, vchSig, pubKey, entry);
+        if (Contains(entry)) {
+            nHits.fetch_add(1, boost::memory_order_relaxed);
             return true;
+        }
+        nMisses.fetch_add(1, boost::memory_order_relaxed);
         return false;
     }
 
     void Set(const uint256 &hash, const std::vector<unsigned char>& vchSig, const CPubKey& pubKey)
     {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64_t nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-
-        while (static_cast<int64_t>(setValid.size()) > nMaxCacheSize)
-        {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if (it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
-        }
+        if (buckets == NULL)
+            return;
+        Entry entry;
+        ComputeEntry(hash, vchSig, pubKey, entry);
+        Insert(entry);
+    }
 
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
+    CSignatureCacheStats GetStats() const
+    {
+        CSignatureCacheStats stats;
+        stats.nBytes = nBuckets * sizeof(Bucket);
+        stats.nCapacity = nBuckets * SLOTS_PER_BUCKET;
+        stats.nEntries = nEntries.load(boost::memory_order_relaxed);
+        stats.nHits = nHits.load(boost::memory_order_relaxed);
+        stats.nMisses = nMisses.load(boost::memory_order_relaxed);
+        stats.nInserts = nInserts.load(boost::memory_order_relaxed);
+        stats.nEvictions = nEvictions.load(boost::memory_order_relaxed);
+        return stats;
     }
 };
 
+CSignatureCache signatureCache;
+
 }
 
-bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+void InitSignatureCache()
 {
-    static CSignatureCache signatureCache;
+    int64_t nMaxCacheSize = GetArg("-sigcachesize", DEFAULT_SIG_CACHE_SIZE);
+    if (!mapArgs.count("-sigcachesize") && mapArgs.count("-maxsigcachesize")) {
+        // -maxsigcachesize counted entries: round their memory up to whole megabytes
+        int64_t nEntries = std::max((int64_t)0, std::min(GetArg("-maxsigcachesize", 0), ((int64_t)MAX_SIG_CACHE_SIZE << 20) / SIG_CACHE_ENTRY_SIZE));
+        nMaxCacheSize = ((nEntries * SIG_CACHE_ENTRY_SIZE) + (1 << 20) - 1) >> 20;
+    }
+    nMaxCacheSize = std::max((int64_t)0, std::min(nMaxCacheSize, (int64_t)MAX_SIG_CACHE_SIZE));
+    signatureCache.Resize((size_t)nMaxCacheSize << 20);
+}
 
+CSignatureCacheStats GetSignatureCacheStats()
+{
+    return signatureCache.GetStats();
+}
+
+bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
+{
     if (signatureCache.Get(sighash, vchSig, pubkey))
         return true;
 
@@ -8,10 +8,40 @@
 
 #include "script/interpreter.h"
 
+#include <stdint.h>
 #include <vector>
 
+/** Default for -sigcachesize, in megabytes */
+static const unsigned int DEFAULT_SIG_CACHE_SIZE = 32;
+/** Largest -sigcachesize accepted, in megabytes */
+static const unsigned int MAX_SIG_CACHE_SIZE = 1024;
+/** Memory taken by one cached signature */
+static const unsigned int SIG_CACHE_ENTRY_SIZE = 32;
+
 class CPubKey;
 
+/** Counters and geometry of the signature cache, as reported by getsigcacheinfo. */
+struct CSignatureCacheStats
+{
+    size_t nBytes;
+    size_t nCapacity;
+    size_t nEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions;
+};
+
+/**
+ * (Re)allocate the signature cache according to -sigcachesize, or to the
+ * entry count given by the deprecated -maxsigcachesize. Must be
+ * called before any script verification threads are started; until it is, the
+ * cache is empty and every lookup misses.
+ */
+void InitSignatureCache();
+
+CSignatureCacheStats GetSignatureCacheStats();
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
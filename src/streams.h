@@ -119,6 +119,9 @@ public:
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
     void clear()                                     { vch.clear(); nReadPos = 0; }
+    size_type capacity() const                       { return vch.capacity() - nReadPos; }
+    /** Exchange the whole underlying buffer with vchOther (e.g. to reuse its allocation) and rewind */
+    void swap_buffer(vector_type& vchOther)          { vch.swap(vchOther); nReadPos = 0; }
     iterator insert(iterator it, const char& x=char()) { return vch.insert(it, x); }
     void insert(iterator it, size_type n, const char& x) { vch.insert(it, n, x); }
 
@@ -261,6 +264,11 @@ public:
         return (*this);
     }
 
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return vch.size();
+    }
+
     template<typename Stream>
     void Serialize(Stream& s, int nType, int nVersion) const
     {
@@ -293,6 +301,12 @@ public:
     }
 
     void GetAndClear(CSerializeData &data) {
+        if (data.empty() && nReadPos == 0) {
+            // Hand over the buffer instead of copying it
+            data.swap(vch);
+            vch.clear();
+            return;
+        }
         data.insert(data.end(), begin(), end());
         clear();
     }
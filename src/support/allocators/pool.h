@@ -0,0 +1,195 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef GROESTLCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define GROESTLCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+/**
+ * A memory resource for node-based containers that allocate their elements
+ * one at a time (such as the coins cache map).
+ *
+ * Single-element allocations of up to MAX_POOLED_BYTES bytes are carved out of
+ * CHUNK_SIZE byte chunks and recycled through one free list per block size,
+ * so filling and draining a container does not go through malloc for every
+ * element. Everything else (bucket arrays, oversized elements) is forwarded
+ * to operator new.
+ *
+ * Chunks are only returned to the system by Release(), when no pooled block
+ * is in use anymore, or when the resource is destroyed.
+ */
+class CPoolResource : private boost::noncopyable
+{
+public:
+    static const size_t ALIGN_BYTES = 8;
+    static const size_t MAX_POOLED_BYTES = 128;
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+private:
+    struct ListNode
+    {
+        ListNode* next;
+    };
+
+    ListNode* vFreeLists[MAX_POOLED_BYTES / ALIGN_BYTES + 1];
+    std::vector<char*> vChunks;
+    char* pChunkPos;
+    char* pChunkEnd;
+    size_t nBlocksInUse;
+
+    static size_t NumAlignments(size_t bytes)
+    {
+        return (bytes + ALIGN_BYTES - 1) / ALIGN_BYTES;
+    }
+
+    void AllocateChunk()
+    {
+        char* chunk = static_cast<char*>(malloc(CHUNK_SIZE));
+        if (!chunk)
+            throw std::bad_alloc();
+        vChunks.push_back(chunk);
+        pChunkPos = chunk;
+        pChunkEnd = chunk + CHUNK_SIZE;
+    }
+
+    void FreeChunks()
+    {
+        for (size_t i = 0; i < vChunks.size(); i++)
+            free(vChunks[i]);
+        vChunks.clear();
+        memset(vFreeLists, 0, sizeof(vFreeLists));
+        pChunkPos = pChunkEnd = NULL;
+    }
+
+public:
+    CPoolResource() : pChunkPos(NULL), pChunkEnd(NULL), nBlocksInUse(0)
+    {
+        memset(vFreeLists, 0, sizeof(vFreeLists));
+    }
+
+    ~CPoolResource()
+    {
+        FreeChunks();
+    }
+
+    static bool IsPooled(size_t bytes, size_t n)
+    {
+        return n == 1 && bytes <= MAX_POOLED_BYTES;
+    }
+
+    /** Allocate n contiguous objects of the given size. */
+    void* Allocate(size_t bytes, size_t n)
+    {
+        if (!IsPooled(bytes, n))
+            return ::operator new(bytes * n);
+
+        size_t nAlign = NumAlignments(bytes);
+        nBlocksInUse++;
+        if (vFreeLists[nAlign]) {
+            ListNode* node = vFreeLists[nAlign];
+            vFreeLists[nAlign] = node->next;
+            return node;
+        }
+        size_t nBlockBytes = nAlign * ALIGN_BYTES;
+        if ((size_t)(pChunkEnd - pChunkPos) < nBlockBytes)
+            AllocateChunk();
+        void* p = pChunkPos;
+        pChunkPos += nBlockBytes;
+        return p;
+    }
+
+    /** Return memory obtained from Allocate() with the same size and count. */
+    void Deallocate(void* p, size_t bytes, size_t n)
+    {
+        if (!IsPooled(bytes, n)) {
+            ::operator delete(p);
+            return;
+        }
+        assert(nBlocksInUse > 0);
+        size_t nAlign = NumAlignments(bytes);
+        ListNode* node = static_cast<ListNode*>(p);
+        node->next = vFreeLists[nAlign];
+        vFreeLists[nAlign] = node;
+        nBlocksInUse--;
+    }
+
+    /** Give all chunks back to the system if none of their blocks are in use. */
+    void Release()
+    {
+        if (nBlocksInUse == 0)
+            FreeChunks();
+    }
+
+    size_t NumChunks() const { return vChunks.size(); }
+    size_t BlocksInUse() const { return nBlocksInUse; }
+};
+
+/**
+ * Allocator handing out memory from a CPoolResource. Copies (including
+ * rebound copies) share the resource, which lives as long as any of them.
+ * A default-constructed allocator creates a fresh resource.
+ */
+template <typename T>
+class PoolAllocator
+{
+    template <typename U>
+    friend class PoolAllocator;
+
+    boost::shared_ptr<CPoolResource> resource;
+
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U> other;
+    };
+
+    PoolAllocator() : resource(new CPoolResource()) {}
+    explicit PoolAllocator(const boost::shared_ptr<CPoolResource>& resourceIn) : resource(resourceIn) {}
+    PoolAllocator(const PoolAllocator& other) : resource(other.resource) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>& other) : resource(other.resource) {}
+
+    T* allocate(size_type n, const void* hint = 0)
+    {
+        return static_cast<T*>(resource->Allocate(sizeof(T), n));
+    }
+
+    void deallocate(T* p, size_type n)
+    {
+        resource->Deallocate(p, sizeof(T), n);
+    }
+
+    void construct(T* p, const T& val) { new ((void*)p) T(val); }
+    void destroy(T* p) { p->~T(); }
+    size_type max_size() const { return size_type(-1) / sizeof(T); }
+    T* address(T& x) const { return &x; }
+    const T* address(const T& x) const { return &x; }
+
+    CPoolResource* GetResource() const { return resource.get(); }
+
+    template <typename U>
+    bool operator==(const PoolAllocator<U>& other) const { return resource == other.resource; }
+    template <typename U>
+    bool operator!=(const PoolAllocator<U>& other) const { return resource != other.resource; }
+};
+
+#endif // GROESTLCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -8,6 +8,10 @@
 #include "utilstrencodings.h"
 
 #include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <set>
 
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
@@ -20,6 +24,211 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+bool fLockProfiling = DEFAULT_LOCK_PROFILING;
+
+CLockSiteStats::CLockSiteStats(const char* pszNameIn, const char* pszFileIn, int nLineIn) : pszName(pszNameIn), pszFile(pszFileIn), nLine(nLineIn)
+{
+    Reset();
+}
+
+void CLockSiteStats::Reset()
+{
+    nLocks = 0;
+    nContended = 0;
+    nWaitMicros = 0;
+    nMaxWaitMicros = 0;
+    nHoldMicros = 0;
+    nMaxHoldMicros = 0;
+    memset(vWaitHistogram, 0, sizeof(vWaitHistogram));
+    memset(vHoldHistogram, 0, sizeof(vHoldHistogram));
+}
+
+void CLockSiteStats::Add(const CLockSiteStats& stats)
+{
+    nLocks += stats.nLocks;
+    nContended += stats.nContended;
+    nWaitMicros += stats.nWaitMicros;
+    nMaxWaitMicros = std::max(nMaxWaitMicros, stats.nMaxWaitMicros);
+    nHoldMicros += stats.nHoldMicros;
+    nMaxHoldMicros = std::max(nMaxHoldMicros, stats.nMaxHoldMicros);
+    for (int i = 0; i < LOCK_HISTOGRAM_BUCKETS; i++) {
+        vWaitHistogram[i] += stats.vWaitHistogram[i];
+        vHoldHistogram[i] += stats.vHoldHistogram[i];
+    }
+}
+
+namespace {
+
+typedef std::pair<const char*, int> LockSiteKey;
+
+/** A lock the thread holds, and where its hold time goes (NULL for recursive re-entry) */
+struct CLockHeld
+{
+    void* cs;
+    CLockSiteStats* pstats;
+    int64_t nLockedMicros;
+};
+
+/** One thread's statistics; its mutex is only ever contended by GetLockStats */
+struct CLockThreadStats
+{
+    boost::mutex mutex;
+    std::map<LockSiteKey, CLockSiteStats> mapSites;
+    std::vector<CLockHeld> vHeld;
+};
+
+/**
+ * Like the debug log's state in util.cpp these are created once and
+ * leaked, as locks may still be taken by global destructors.
+ */
+boost::once_flag lockProfileInitFlag = BOOST_ONCE_INIT;
+boost::mutex* pmutexLockThreads = NULL;
+std::set<CLockThreadStats*>* psetLockThreads = NULL;
+/** Statistics of threads that have exited */
+CLockThreadStats* plockStatsExited = NULL;
+boost::thread_specific_ptr<CLockThreadStats>* plockStatsThread = NULL;
+
+int LockHistogramBucket(int64_t nMicros)
+{
+    int nBucket = 0;
+    while (nMicros > 0 && nBucket < LOCK_HISTOGRAM_BUCKETS - 1) {
+        nMicros >>= 1;
+        nBucket++;
+    }
+    return nBucket;
+}
+
+void MergeLockSites(std::map<LockSiteKey, CLockSiteStats>& mapTo, const std::map<LockSiteKey, CLockSiteStats>& mapFrom)
+{
+    for (std::map<LockSiteKey, CLockSiteStats>::const_iterator it = mapFrom.begin(); it != mapFrom.end(); ++it) {
+        std::map<LockSiteKey, CLockSiteStats>::iterator itTo = mapTo.find(it->first);
+        if (itTo == mapTo.end())
+            itTo = mapTo.insert(std::make_pair(it->first, CLockSiteStats(it->second.pszName, it->second.pszFile, it->second.nLine))).first;
+        itTo->second.Add(it->second);
+    }
+}
+
+void LockThreadExit(CLockThreadStats* pthreadStats)
+{
+    boost::mutex::scoped_lock lock(*pmutexLockThreads);
+    psetLockThreads->erase(pthreadStats);
+    MergeLockSites(plockStatsExited->mapSites, pthreadStats->mapSites);
+    delete pthreadStats;
+}
+
+void LockProfileInit()
+{
+    pmutexLockThreads = new boost::mutex();
+    psetLockThreads = new std::set<CLockThreadStats*>();
+    plockStatsExited = new CLockThreadStats();
+    plockStatsThread = new boost::thread_specific_ptr<CLockThreadStats>(&LockThreadExit);
+}
+
+CLockThreadStats* GetLockThreadStats()
+{
+    boost::call_once(&LockProfileInit, lockProfileInitFlag);
+    CLockThreadStats* pthreadStats = plockStatsThread->get();
+    if (pthreadStats == NULL) {
+        pthreadStats = new CLockThreadStats();
+        plockStatsThread->reset(pthreadStats);
+        boost::mutex::scoped_lock lock(*pmutexLockThreads);
+        psetLockThreads->insert(pthreadStats);
+    }
+    return pthreadStats;
+}
+
+}
+
+void LockProfileEnter(const char* pszName, const char* pszFile, int nLine, void* cs, int64_t nWaitMicros)
+{
+    CLockThreadStats* pthreadStats = GetLockThreadStats();
+    CLockHeld held;
+    held.cs = cs;
+    held.pstats = NULL;
+    held.nLockedMicros = 0;
+    for (std::vector<CLockHeld>::const_iterator it = pthreadStats->vHeld.begin(); it != pthreadStats->vHeld.end(); ++it) {
+        if (it->cs == cs) {
+            pthreadStats->vHeld.push_back(held);
+            return;
+        }
+    }
+
+    {
+        boost::mutex::scoped_lock lock(pthreadStats->mutex);
+        std::map<LockSiteKey, CLockSiteStats>::iterator it = pthreadStats->mapSites.find(LockSiteKey(pszFile, nLine));
+        if (it == pthreadStats->mapSites.end())
+            it = pthreadStats->mapSites.insert(std::make_pair(LockSiteKey(pszFile, nLine), CLockSiteStats(pszName, pszFile, nLine))).first;
+        CLockSiteStats& stats = it->second;
+        stats.nLocks++;
+        if (nWaitMicros > 0) {
+            stats.nContended++;
+            stats.nWaitMicros += nWaitMicros;
+            stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, nWaitMicros);
+        }
+        stats.vWaitHistogram[LockHistogramBucket(nWaitMicros)]++;
+        held.pstats = &stats; // map entries are only ever reset, never erased
+    }
+    held.nLockedMicros = GetTimeMicros();
+    pthreadStats->vHeld.push_back(held);
+}
+
+void LockProfileLeave(void* cs)
+{
+    CLockThreadStats* pthreadStats = GetLockThreadStats();
+    std::vector<CLockHeld>& vHeld = pthreadStats->vHeld;
+    // Normally the last one, but LEAVE_CRITICAL_SECTION need not be in order.
+    // Not finding it at all means profiling was switched on while it was held.
+    for (std::vector<CLockHeld>::iterator it = vHeld.end(); it != vHeld.begin(); ) {
+        --it;
+        if (it->cs != cs)
+            continue;
+        if (it->pstats) {
+            int64_t nHoldMicros = GetTimeMicros() - it->nLockedMicros;
+            boost::mutex::scoped_lock lock(pthreadStats->mutex);
+            it->pstats->nHoldMicros += nHoldMicros;
+            it->pstats->nMaxHoldMicros = std::max(it->pstats->nMaxHoldMicros, nHoldMicros);
+            it->pstats->vHoldHistogram[LockHistogramBucket(nHoldMicros)]++;
+        }
+        vHeld.erase(it);
+        return;
+    }
+}
+
+void GetLockStats(std::vector<CLockSiteStats>& vStats, bool fReset)
+{
+    boost::call_once(&LockProfileInit, lockProfileInitFlag);
+    std::map<LockSiteKey, CLockSiteStats> mapSites;
+    {
+        boost::mutex::scoped_lock lock(*pmutexLockThreads);
+        MergeLockSites(mapSites, plockStatsExited->mapSites);
+        if (fReset)
+            plockStatsExited->mapSites.clear();
+        BOOST_FOREACH(CLockThreadStats* pthreadStats, *psetLockThreads) {
+            boost::mutex::scoped_lock lockThread(pthreadStats->mutex);
+            MergeLockSites(mapSites, pthreadStats->mapSites);
+            if (fReset) {
+                for (std::map<LockSiteKey, CLockSiteStats>::iterator it = pthreadStats->mapSites.begin(); it != pthreadStats->mapSites.end(); ++it)
+                    it->second.Reset();
+            }
+        }
+    }
+
+    // The same source line can show up under several copies of its file name, e.g. from a header
+    std::map<std::pair<std::string, int>, CLockSiteStats> mapByLine;
+    for (std::map<LockSiteKey, CLockSiteStats>::const_iterator it = mapSites.begin(); it != mapSites.end(); ++it) {
+        std::pair<std::string, int> key(it->second.pszFile, it->second.nLine);
+        std::map<std::pair<std::string, int>, CLockSiteStats>::iterator itLine = mapByLine.find(key);
+        if (itLine == mapByLine.end())
+            itLine = mapByLine.insert(std::make_pair(key, CLockSiteStats(it->second.pszName, it->second.pszFile, it->second.nLine))).first;
+        itLine->second.Add(it->second);
+    }
+
+    vStats.clear();
+    for (std::map<std::pair<std::string, int>, CLockSiteStats>::const_iterator it = mapByLine.begin(); it != mapByLine.end(); ++it)
+        if (it->second.nLocks > 0)
+            vStats.push_back(it->second);
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
@@ -7,6 +7,11 @@
 #define BITCOIN_SYNC_H
 
 #include "threadsafety.h"
+#include "utiltime.h"
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
 
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -99,6 +104,59 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/** Default for -lockprofiling */
+static const bool DEFAULT_LOCK_PROFILING = false;
+/** Histogram buckets: under 1us, then doubling up to the last one, which also holds anything longer */
+static const int LOCK_HISTOGRAM_BUCKETS = 24;
+
+/** Wait and hold times of the locks taken at one LOCK (or ENTER_CRITICAL_SECTION) call site */
+struct CLockSiteStats
+{
+    const char* pszName;
+    const char* pszFile;
+    int nLine;
+    uint64_t nLocks;
+    uint64_t nContended;
+    int64_t nWaitMicros;
+    int64_t nMaxWaitMicros;
+    int64_t nHoldMicros;
+    int64_t nMaxHoldMicros;
+    uint64_t vWaitHistogram[LOCK_HISTOGRAM_BUCKETS];
+    uint64_t vHoldHistogram[LOCK_HISTOGRAM_BUCKETS];
+
+    CLockSiteStats(const char* pszNameIn = "", const char* pszFileIn = "", int nLineIn = 0);
+    void Reset();
+    void Add(const CLockSiteStats& stats);
+};
+
+/**
+ * Set by -lockprofiling. Each thread counts the locks it takes in its own
+ * table, so the only extra cost is taking the time and an uncontended mutex.
+ * Recursive re-entry of a lock the thread already holds is not counted.
+ */
+extern bool fLockProfiling;
+void LockProfileEnter(const char* pszName, const char* pszFile, int nLine, void* cs, int64_t nWaitMicros);
+void LockProfileLeave(void* cs);
+/** Lock statistics of all threads by call site, optionally reset afterwards */
+void GetLockStats(std::vector<CLockSiteStats>& vStats, bool fReset);
+
+/** Lock a mutex or a unique_lock, timing the wait if it is contended */
+template <typename Lockable>
+void static inline LockProfiled(Lockable& lockable, const char* pszName, const char* pszFile, int nLine, void* cs)
+{
+    int64_t nWaitMicros = 0;
+    if (!lockable.try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
+        PrintLockContention(pszName, pszFile, nLine);
+#endif
+        int64_t nStart = GetTimeMicros();
+        lockable.lock();
+        // A contended lock counts as waiting at least 1us, that is how LockProfileEnter tells
+        nWaitMicros = std::max(GetTimeMicros() - nStart, (int64_t)1);
+    }
+    LockProfileEnter(pszName, pszFile, nLine, cs, nWaitMicros);
+}
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -109,6 +167,10 @@ private:
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+        if (fLockProfiling) {
+            LockProfiled(lock, pszName, pszFile, nLine, (void*)(lock.mutex()));
+            return;
+        }
 #ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
             PrintLockContention(pszName, pszFile, nLine);
@@ -125,6 +187,8 @@ private:
         lock.try_lock();
         if (!lock.owns_lock())
             LeaveCritical();
+        else if (fLockProfiling)
+            LockProfileEnter(pszName, pszFile, nLine, (void*)(lock.mutex()), 0);
         return lock.owns_lock();
     }
 
@@ -150,8 +214,11 @@ public:
 
     ~CMutexLock() UNLOCK_FUNCTION()
     {
-        if (lock.owns_lock())
+        if (lock.owns_lock()) {
+            if (fLockProfiling)
+                LockProfileLeave((void*)(lock.mutex()));
             LeaveCritical();
+        }
     }
 
     operator bool()
@@ -166,16 +233,21 @@ typedef CMutexLock<CCriticalSection> CCriticalBlock;
 #define LOCK2(cs1, cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__), criticalblock2(cs2, #cs2, __FILE__, __LINE__)
 #define TRY_LOCK(cs, name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
 
-#define ENTER_CRITICAL_SECTION(cs)                            \
-    {                                                         \
-        EnterCritical(#cs, __FILE__, __LINE__, (void*)(&cs)); \
-        (cs).lock();                                          \
+#define ENTER_CRITICAL_SECTION(cs)                                   \
+    {                                                                \
+        EnterCritical(#cs, __FILE__, __LINE__, (void*)(&cs));        \
+        if (fLockProfiling)                                          \
+            LockProfiled(cs, #cs, __FILE__, __LINE__, (void*)(&cs)); \
+        else                                                         \
+            (cs).lock();                                             \
     }
 
-#define LEAVE_CRITICAL_SECTION(cs) \
-    {                              \
-        (cs).unlock();             \
-        LeaveCritical();           \
+#define LEAVE_CRITICAL_SECTION(cs)           \
+    {                                        \
+        if (fLockProfiling)                  \
+            LockProfileLeave((void*)(&cs));  \
+        (cs).unlock();                       \
+        LeaveCritical();                     \
     }
 
 class CSemaphore
@@ -0,0 +1,121 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "blockstore.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "main.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockstore_tests, TestingSetup)
+
+static boost::filesystem::path WriteTestFile(const boost::filesystem::path& dir, int n, const std::vector<unsigned char>& vch)
+{
+    boost::filesystem::path path = dir / strprintf("map%d.dat", n);
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(&vch[0], 1, vch.size(), file), vch.size());
+    fclose(file);
+    return path;
+}
+
+BOOST_AUTO_TEST_CASE(blockfilemap)
+{
+    std::vector<unsigned char> vch;
+    for (int i = 0; i < 1000; i++)
+        vch.push_back((unsigned char)i);
+    boost::filesystem::path path0 = WriteTestFile(pathTemp, 0, vch);
+    boost::filesystem::path path1 = WriteTestFile(pathTemp, 1, vch);
+
+    CBlockFileMap map(1);
+    CBlockFileMap::MappedFile file0 = map.Get(0, path0);
+    BOOST_REQUIRE(file0);
+    BOOST_CHECK_EQUAL(file0->get_size(), vch.size());
+    BOOST_CHECK(memcmp(file0->get_address(), &vch[0], vch.size()) == 0);
+    // A second request shares the mapping.
+    BOOST_CHECK(map.Get(0, path0) == file0);
+
+    // Mapping another file drops the oldest one, but what points into it stays valid.
+    CRawBlock raw(file0, (const unsigned char*)file0->get_address() + 10, 20);
+    file0.reset();
+    BOOST_CHECK(map.Get(1, path1));
+    BOOST_CHECK_EQUAL(map.Size(), 1U);
+    BOOST_CHECK(std::equal(raw.begin(), raw.end(), vch.begin() + 10));
+    map.Remove(1);
+    BOOST_CHECK_EQUAL(map.Size(), 0U);
+
+    BOOST_CHECK(!map.Get(2, pathTemp / "missing.dat"));
+}
+
+BOOST_AUTO_TEST_CASE(read_raw_block)
+{
+    // The raw form of a block read from disk is exactly its serialization.
+    CRawBlock raw;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(raw, chainActive.Genesis()));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << Params().GenesisBlock();
+    BOOST_CHECK_EQUAL(raw.size(), ssBlock.size());
+    BOOST_CHECK(std::equal(raw.begin(), raw.end(), (const unsigned char*)&ssBlock[0]));
+
+    // And it serializes back to the same bytes.
+    CDataStream ssRaw(SER_NETWORK, PROTOCOL_VERSION);
+    ssRaw << raw;
+    BOOST_CHECK(ssRaw.str() == ssBlock.str());
+    BOOST_CHECK_EQUAL(GetSerializeSize(raw, SER_NETWORK, PROTOCOL_VERSION), ssBlock.size());
+}
+
+static CRawBlock MakeRawBlock(size_t nSize, unsigned char ch)
+{
+    boost::shared_ptr<std::vector<unsigned char> > vch(new std::vector<unsigned char>(nSize, ch));
+    return CRawBlock(vch, &(*vch)[0], nSize);
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_cache)
+{
+    // Room for three 1000 byte blocks, but not four.
+    CRawBlockCache cache(0);
+    cache.Insert(ArithToUint256(1), MakeRawBlock(1000, 1));
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 0U);
+    cache.SetMaxBytes(1 << 20);
+    cache.Insert(ArithToUint256(1), MakeRawBlock(1000, 1));
+    size_t nEntryBytes = cache.GetStats().nBytes;
+    BOOST_CHECK(nEntryBytes >= 1000);
+    cache.SetMaxBytes(nEntryBytes * 3);
+    cache.Insert(ArithToUint256(2), MakeRawBlock(1000, 2));
+    cache.Insert(ArithToUint256(3), MakeRawBlock(1000, 3));
+
+    // Touching the oldest block makes block 2 the next to go.
+    CRawBlock raw;
+    BOOST_CHECK(cache.Get(ArithToUint256(1), raw));
+    BOOST_CHECK_EQUAL(raw.size(), 1000U);
+    BOOST_CHECK(raw.begin()[999] == 1);
+    cache.Insert(ArithToUint256(4), MakeRawBlock(1000, 4));
+    BOOST_CHECK(!cache.Get(ArithToUint256(2), raw));
+    BOOST_CHECK(cache.Get(ArithToUint256(1), raw));
+    BOOST_CHECK(cache.Get(ArithToUint256(3), raw));
+    BOOST_CHECK(cache.Get(ArithToUint256(4), raw));
+
+    CRawBlockCacheStats stats = cache.GetStats();
+    BOOST_CHECK_EQUAL(stats.nEntries, 3U);
+    BOOST_CHECK(stats.nBytes <= stats.nMaxBytes);
+    BOOST_CHECK_EQUAL(stats.nHits, 4U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 1U);
+    BOOST_CHECK_EQUAL(stats.nInserts, 4U);
+    BOOST_CHECK_EQUAL(stats.nEvictions, 1U);
+
+    // Shrinking the cache drops the least recently used blocks.
+    cache.SetMaxBytes(nEntryBytes);
+    BOOST_CHECK_EQUAL(cache.GetStats().nEntries, 1U);
+    BOOST_CHECK(cache.Get(ArithToUint256(4), raw));
+    BOOST_CHECK(raw.begin()[0] == 4);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
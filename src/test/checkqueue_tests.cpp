@@ -0,0 +1,138 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+namespace {
+
+/** Counts its executions; every check has its own counter, so no locking is needed. */
+class CCountCheck
+{
+    int *pnRuns;
+    bool fResult;
+
+public:
+    CCountCheck() : pnRuns(NULL), fResult(true) {}
+    CCountCheck(int *pnRunsIn, bool fResultIn) : pnRuns(pnRunsIn), fResult(fResultIn) {}
+
+    bool operator()() {
+        (*pnRuns)++;
+        return fResult;
+    }
+
+    void swap(CCountCheck &check) {
+        std::swap(pnRuns, check.pnRuns);
+        std::swap(fResult, check.fResult);
+    }
+};
+
+typedef CCheckQueue<CCountCheck> CCountCheckQueue;
+
+void RunWorker(CCountCheckQueue *pqueue) {
+    pqueue->Thread();
+}
+
+/** Run one check per counter in vRuns, failing the one at nFail (if any), added in small batches as a block would. */
+bool RunSession(CCountCheckQueue *pqueue, std::vector<int>& vRuns, int nFail) {
+    CCheckQueueControl<CCountCheck> control(pqueue);
+    for (size_t i = 0; i < vRuns.size(); i += 7) {
+        std::vector<CCountCheck> vChecks;
+        for (size_t j = i; j < std::min(vRuns.size(), i + 7); j++)
+            vChecks.push_back(CCountCheck(&vRuns[j], (int)j != nFail));
+        control.Add(vChecks);
+    }
+    return control.Wait();
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_checks_run)
+{
+    CCountCheckQueue queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&RunWorker, &queue));
+
+    for (int n = 0; n < 50; n++) {
+        std::vector<int> vRuns(n * 37);
+        BOOST_CHECK(RunSession(&queue, vRuns, -1));
+        BOOST_CHECK(std::count(vRuns.begin(), vRuns.end(), 1) == (int)vRuns.size());
+    }
+
+    CCheckQueueStats stats = queue.GetStats();
+    BOOST_CHECK_EQUAL(stats.nWorkers, 3);
+    BOOST_CHECK_EQUAL(stats.nQueued, 0U);
+    BOOST_CHECK_EQUAL(stats.nSessions, 0U);
+    BOOST_CHECK(stats.nChecks == 37 * 49 * 50 / 2);
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCountCheckQueue queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&RunWorker, &queue));
+
+    for (int nFail = 0; nFail < 300; nFail += 29) {
+        std::vector<int> vRuns(300);
+        BOOST_CHECK(!RunSession(&queue, vRuns, nFail));
+        // Checks after a failure may be skipped, but none runs twice
+        BOOST_CHECK_EQUAL(vRuns[nFail], 1);
+        BOOST_CHECK(*std::max_element(vRuns.begin(), vRuns.end()) == 1);
+    }
+
+    // Cancelled checks aren't run, and make the session fail
+    CCheckQueueControl<CCountCheck> control(&queue);
+    control.Cancel();
+    std::vector<int> vRuns(100);
+    std::vector<CCountCheck> vChecks;
+    for (size_t i = 0; i < vRuns.size(); i++)
+        vChecks.push_back(CCountCheck(&vRuns[i], true));
+    control.Add(vChecks);
+    BOOST_CHECK(!control.Wait());
+    BOOST_CHECK(std::count(vRuns.begin(), vRuns.end(), 0) == 100);
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_concurrent_sessions)
+{
+    // A failing session must not affect one running at the same time
+    CCountCheckQueue queue(16);
+    boost::thread_group threads;
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(boost::bind(&RunWorker, &queue));
+
+    for (int n = 0; n < 20; n++) {
+        std::vector<int> vRunsBad(500), vRunsGood(500);
+        CCheckQueueControl<CCountCheck> controlBad(&queue);
+        std::vector<CCountCheck> vChecks;
+        for (size_t i = 0; i < vRunsBad.size(); i++)
+            vChecks.push_back(CCountCheck(&vRunsBad[i], i != 250));
+        controlBad.Add(vChecks);
+
+        BOOST_CHECK(RunSession(&queue, vRunsGood, -1));
+        BOOST_CHECK(std::count(vRunsGood.begin(), vRunsGood.end(), 1) == 500);
+        BOOST_CHECK(!controlBad.Wait());
+    }
+    BOOST_CHECK_EQUAL(queue.GetStats().nSessions, 0U);
+
+    threads.interrupt_all();
+    threads.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
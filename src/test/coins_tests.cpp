@@ -3,41 +3,50 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "coins.h"
+#include "clientversion.h"
+#include "pubkey.h"
 #include "random.h"
+#include "script/standard.h"
+#include "streams.h"
+#include "txdb.h"
 #include "uint256.h"
+#include "util.h"
+#include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
 #include <vector>
 #include <map>
 
+#include <boost/bind.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 namespace
 {
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -45,15 +54,18 @@ public:
     bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
-            map_[it->first] = it->second.coins;
-            if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
-                // Randomly delete empty entries on write.
-                map_.erase(it->first);
+            if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+                // Same optimization used in CCoinsViewDB is to only write dirty entries.
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
+                    // Randomly delete empty entries on write.
+                    map_.erase(it->first);
+                }
             }
             mapCoins.erase(it++);
         }
-        mapCoins.clear();
-        hashBestBlock_ = hashBlock;
+        if (!hashBlock.IsNull())
+            hashBestBlock_ = hashBlock;
         return true;
     }
 
@@ -70,11 +82,29 @@ public:
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    size_t PoolChunks() const { return cacheCoins.get_allocator().GetResource()->NumChunks(); }
+};
+
+/** An in-memory chainstate database that legacy per-transaction records can be written to. */
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true, true) {}
+
+    void WriteLegacy(const uint256& txid, std::vector<unsigned char> vch)
+    {
+        db.Write(std::make_pair('c', txid), CFlatData(vch));
+    }
+
+    bool HaveLegacy(const uint256& txid) const
+    {
+        return db.Exists(std::make_pair('c', txid));
+    }
 };
 
 }
@@ -86,7 +116,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -98,13 +128,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -122,36 +154,47 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    // Random sizes so we can test memory usage accounting
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+                    if (coin.IsSpent())
+                        added_an_entry = true;
+                    else
+                        updated_an_entry = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), newcoin, !coin.IsSpent() || (insecure_rand() & 1));
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -159,14 +202,26 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
             }
         }
 
+        if (insecure_rand() % 100 == 0) {
+            // Every 100 iterations, flush an intermediate cache
+            if (stack.size() > 1 && insecure_rand() % 2 == 0) {
+                unsigned int flushIndex = insecure_rand() % (stack.size() - 1);
+                stack[flushIndex]->Flush();
+                // A flushed cache hands its pooled memory back.
+                BOOST_CHECK_EQUAL(stack[flushIndex]->PoolChunks(), 0U);
+                uncached_an_entry = true;
+            }
+        }
         if (insecure_rand() % 100 == 0) {
             // Every 100 iterations, change the cache stack.
             if (stack.size() > 0 && insecure_rand() % 2 == 0) {
+                //Remove the top cache
                 stack.back()->Flush();
                 delete stack.back();
                 stack.pop_back();
             }
             if (stack.size() == 0 || (stack.size() < 4 && insecure_rand() % 2)) {
+                //Add a new cache
                 CCoinsView* tip = &base;
                 if (stack.size() > 0) {
                     tip = stack.back();
@@ -191,10 +246,191 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_warm)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    COutPoint outpoint(GetRandHash(), 0);
+    CTxOut out;
+    out.nValue = 1000;
+    out.scriptPubKey = CScript() << OP_TRUE;
+
+    // A warmed coin is visible but not dirty: flushing does not write it back.
+    cache.WarmCoin(outpoint, Coin(out, 10, false));
+    BOOST_CHECK(cache.HaveCoinInCache(outpoint));
+    BOOST_CHECK_EQUAL((int)cache.AccessCoin(outpoint).nHeight, 10);
+    cache.SelfTest();
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.HaveCoin(outpoint));
+
+    // It never replaces what the cache already has.
+    cache.AddCoin(outpoint, Coin(out, 20, false), false);
+    cache.WarmCoin(outpoint, Coin(out, 10, false));
+    BOOST_CHECK_EQUAL((int)cache.AccessCoin(outpoint).nHeight, 20);
+    cache.SelfTest();
+}
+
+BOOST_AUTO_TEST_CASE(coin_serialization)
+{
+    // Good example
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin c1;
+    ss1 >> c1;
+    BOOST_CHECK_EQUAL(c1.IsCoinBase(), false);
+    BOOST_CHECK_EQUAL((int)c1.nHeight, 203998);
+    BOOST_CHECK_EQUAL(c1.out.nValue, 60000000000LL);
+    BOOST_CHECK_EQUAL(HexStr(c1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+
+    // Round trip, and the coinbase flag in the low bit of the code
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << c1;
+    BOOST_CHECK_EQUAL(HexStr(ss2.begin(), ss2.end()), "97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35");
+    CDataStream ss3(SER_DISK, CLIENT_VERSION);
+    ss3 << Coin(c1.out, 120891, true);
+    BOOST_CHECK_EQUAL(HexStr(ss3.begin(), ss3.begin() + 3), "8ddf77");
+    Coin c3;
+    ss3 >> c3;
+    BOOST_CHECK_EQUAL(c3.IsCoinBase(), true);
+    BOOST_CHECK_EQUAL((int)c3.nHeight, 120891);
+    BOOST_CHECK(c3.out == c1.out);
+
+    // Spent coins compare equal regardless of their other fields
+    Coin c4(c1.out, 1, true);
+    c4.Clear();
+    BOOST_CHECK(c4.IsSpent());
+    BOOST_CHECK(c4 == Coin());
+}
+
+BOOST_AUTO_TEST_CASE(coins_upgrade)
+{
+    CCoinsViewDBTest db;
+    uint256 txid1 = uint256S("0x1111111111111111111111111111111111111111111111111111111111111111");
+    uint256 txid2 = uint256S("0x2222222222222222222222222222222222222222222222222222222222222222");
+
+    // vout[1] unspent, height 203998
+    db.WriteLegacy(txid1, ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"));
+    // coinbase with vout[4] and vout[16] unspent, height 120891
+    db.WriteLegacy(txid2, ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"));
+
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacy(txid1));
+    BOOST_CHECK(!db.HaveLegacy(txid2));
+
+    Coin coin;
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid1, 0)));
+    BOOST_CHECK(db.GetCoin(COutPoint(txid1, 1), coin));
+    BOOST_CHECK_EQUAL(coin.IsCoinBase(), false);
+    BOOST_CHECK_EQUAL((int)coin.nHeight, 203998);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 60000000000LL);
+    BOOST_CHECK_EQUAL(HexStr(coin.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txid1, 2)));
+
+    for (unsigned int n = 0; n < 20; n++) {
+        BOOST_CHECK_EQUAL(db.HaveCoin(COutPoint(txid2, n)), n == 4 || n == 16);
+    }
+    BOOST_CHECK(db.GetCoin(COutPoint(txid2, 4), coin));
+    BOOST_CHECK_EQUAL(coin.IsCoinBase(), true);
+    BOOST_CHECK_EQUAL((int)coin.nHeight, 120891);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 234925952);
+    BOOST_CHECK(db.GetCoin(COutPoint(txid2, 16), coin));
+    BOOST_CHECK_EQUAL(coin.IsCoinBase(), true);
+    BOOST_CHECK_EQUAL((int)coin.nHeight, 120891);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 110397);
+
+    // Nothing is left to convert the second time around
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(db.GetCoin(COutPoint(txid2, 16), coin));
+}
+
+BOOST_AUTO_TEST_CASE(coins_sync_write_behind)
+{
+    // Write every coin in a batch of its own.
+    mapArgs["-dbbatchsize"] = "1";
+    CCoinsViewDBTest db;
+    CCoinsViewWriteBehind writer(&db);
+    CCoinsViewCacheTest cache(&writer);
+    CTxOut out;
+    out.nValue = 1000;
+    out.scriptPubKey = CScript() << OP_TRUE;
+
+    std::vector<COutPoint> outpoints;
+    for (unsigned int i = 0; i < 20; i++) {
+        outpoints.push_back(COutPoint(GetRandHash(), i));
+        cache.AddCoin(outpoints.back(), Coin(out, i, false), false);
+    }
+    uint256 hashBlock1 = GetRandHash();
+    cache.SetBestBlock(hashBlock1);
+
+    // Without the thread, a sync writes through; the unspent entries stay resident.
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(db.GetBestBlock() == hashBlock1);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(db.HaveCoin(outpoints[5]));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 20U);
+    cache.SelfTest();
+
+    // Spent entries are dropped once the base has them.
+    BOOST_CHECK(cache.SpendCoin(outpoints[5]));
+    BOOST_CHECK(cache.Sync());
+    BOOST_CHECK(!db.HaveCoin(outpoints[5]));
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 19U);
+    cache.SelfTest();
+
+    // With the thread, pending changes are visible before they reach the database.
+    boost::thread thread(boost::bind(&CCoinsViewWriteBehind::Thread, &writer));
+    uint256 hashBlock2 = GetRandHash();
+    COutPoint added(GetRandHash(), 0);
+    cache.AddCoin(added, Coin(out, 30, false), false);
+    BOOST_CHECK(cache.SpendCoin(outpoints[6]));
+    cache.SetBestBlock(hashBlock2);
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(writer.HaveCoin(added));
+    BOOST_CHECK(!writer.HaveCoin(outpoints[6]));
+    BOOST_CHECK(writer.GetBestBlock() == hashBlock2);
+    writer.Wait();
+    BOOST_CHECK(db.GetBestBlock() == hashBlock2);
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(db.HaveCoin(added));
+    BOOST_CHECK(!db.HaveCoin(outpoints[6]));
+    BOOST_CHECK(db.HaveCoin(outpoints[7]));
+    thread.interrupt();
+    thread.join();
+
+    mapArgs.erase("-dbbatchsize");
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_tuning)
+{
+    // Small caches are split as before; large ones keep the write buffer bounded.
+    CLevelDBTuning small = CLevelDBTuning::ForChainstate(8 << 20);
+    BOOST_CHECK_EQUAL(small.nWriteBufferSize, 2U << 20);
+    BOOST_CHECK_EQUAL(small.nBlockCacheSize, 4U << 20);
+    CLevelDBTuning large = CLevelDBTuning::ForChainstate(1024 << 20);
+    BOOST_CHECK_EQUAL(large.nWriteBufferSize, 64U << 20);
+    BOOST_CHECK_EQUAL(large.nBlockCacheSize, 896U << 20);
+    BOOST_CHECK(CLevelDBTuning::ForBlockIndex(8 << 20).nBlockSize > small.nBlockSize);
+
+    mapArgs["-dbwritebuffer"] = "16";
+    mapArgs["-dbmaxopenfiles"] = "1";
+    CLevelDBTuning overridden = CLevelDBTuning::ForChainstate(8 << 20);
+    BOOST_CHECK_EQUAL(overridden.nWriteBufferSize, 16U << 20);
+    BOOST_CHECK_EQUAL(overridden.nMaxOpenFiles, 16);
+    mapArgs.erase("-dbwritebuffer");
+    mapArgs.erase("-dbmaxopenfiles");
+
+    CCoinsViewDBTest db;
+    std::string strStats;
+    BOOST_CHECK(db.GetDB().GetProperty("leveldb.stats", strStats));
+    BOOST_CHECK(!db.GetDB().GetProperty("leveldb.nonexistent", strStats));
+    BOOST_CHECK_EQUAL(db.GetDB().GetTuning().nWriteBufferSize, 256U << 10);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,12 +2,16 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
+#include "crypto/common.h"
+#include "crypto/groestl.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "groestlcoin.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -17,6 +21,10 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/test/unit_test.hpp>
 
+extern "C" {
+#include <sphlib/sph_groestl.h>
+}
+
 BOOST_FIXTURE_TEST_SUITE(crypto_tests, BasicTestingSetup)
 
 template<typename Hasher, typename In, typename Out>
@@ -248,4 +256,128 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+static std::vector<unsigned char> SphGroestl512(const std::vector<unsigned char>& in) {
+    std::vector<unsigned char> out(64);
+    sph_groestl512_context ctx;
+    sph_groestl512_init(&ctx);
+    sph_groestl512(&ctx, in.empty() ? NULL : &in[0], in.size());
+    sph_groestl512_close(&ctx, &out[0]);
+    return out;
+}
+
+static std::vector<unsigned char> RandomBytes(size_t len) {
+    std::vector<unsigned char> v(len);
+    for (size_t i = 0; i < len; i++)
+        v[i] = insecure_rand();
+    return v;
+}
+
+BOOST_AUTO_TEST_CASE(groestl512_testvectors) {
+    BOOST_CHECK(SphGroestl512(std::vector<unsigned char>()) ==
+                ParseHex("6d3ad29d279110eef3adbd66de2a0345a77baede1557f5d099fce0c03d6dc2ba"
+                         "8e6d4a6633dfbd66053c20faa87d1a11f39a7fbe4a6c2f009801370308fc4ad8"));
+    if (!GroestlAesni::Available())
+        return;
+    std::vector<unsigned char> hash(64);
+    GroestlAesni::Hash512(NULL, 0, &hash[0]);
+    BOOST_CHECK(hash == SphGroestl512(std::vector<unsigned char>()));
+    // Every tail length, block boundaries and multi-block messages.
+    for (size_t len = 1; len < 400; len++) {
+        std::vector<unsigned char> in = RandomBytes(len);
+        GroestlAesni::Hash512(&in[0], in.size(), &hash[0]);
+        BOOST_CHECK_MESSAGE(hash == SphGroestl512(in), "length " << len);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(groestl_backends) {
+    const XCoin::GroestlBackend backend = XCoin::GetGroestlBackend();
+    const bool fAesni = GroestlAesni::Available();
+    BOOST_CHECK(XCoin::SetGroestlBackend(XCoin::GROESTL_BACKEND_AESNI) == fAesni);
+
+    // Batches of every size up to two full lanes plus a remainder.
+    std::vector<unsigned char> headers = RandomBytes(80 * 7);
+    for (size_t n = 0; n <= 7; n++) {
+        std::vector<uint256> sph(n), batch(n);
+        BOOST_CHECK(XCoin::SetGroestlBackend(XCoin::GROESTL_BACKEND_SPH));
+        if (n)
+            XCoin::HashPowHeaders(&headers[0], n, &sph[0]);
+        for (size_t i = 0; i < n; i++)
+            BOOST_CHECK(sph[i] == XCoin::HashPow(XCoin::ConstBuf(&headers[80 * i], &headers[80 * (i + 1)])));
+        if (!fAesni)
+            continue;
+        BOOST_CHECK(XCoin::SetGroestlBackend(XCoin::GROESTL_BACKEND_AESNI));
+        if (n)
+            XCoin::HashPowHeaders(&headers[0], n, &batch[0]);
+        BOOST_CHECK(batch == sph);
+        for (size_t i = 0; i < n; i++)
+            BOOST_CHECK(sph[i] == XCoin::HashPow(XCoin::ConstBuf(&headers[80 * i], &headers[80 * (i + 1)])));
+    }
+
+    // HashGroestl on messages of arbitrary length.
+    for (size_t len = 0; len < 300 && fAesni; len += 7) {
+        std::vector<unsigned char> in = RandomBytes(len);
+        BOOST_CHECK(XCoin::SetGroestlBackend(XCoin::GROESTL_BACKEND_SPH));
+        uint256 sph = XCoin::HashGroestl(XCoin::ConstBuf(in));
+        BOOST_CHECK(XCoin::SetGroestlBackend(XCoin::GROESTL_BACKEND_AESNI));
+        BOOST_CHECK(sph == XCoin::HashGroestl(XCoin::ConstBuf(in)));
+    }
+
+    BOOST_CHECK(XCoin::SetGroestlBackend(backend));
+}
+
+BOOST_AUTO_TEST_CASE(groestl_nonce_sweep) {
+    const XCoin::GroestlBackend backend = XCoin::GetGroestlBackend();
+    std::vector<unsigned char> header = RandomBytes(80);
+    // Roughly one in sixteen hashes passes; start just below the nonce wrap.
+    const uint256 hashTarget = uint256S("0fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    const uint32_t nBegin = 0xffffffc0, nCount = 301;
+
+    std::vector<std::pair<uint32_t, uint256> > vExpected;
+    for (uint32_t i = 0; i < nCount; i++) {
+        WriteLE32(&header[76], nBegin + i);
+        uint256 hash = XCoin::HashPow(XCoin::ConstBuf(header));
+        if (UintToArith256(hash) <= UintToArith256(hashTarget))
+            vExpected.push_back(std::make_pair(nBegin + i, hash));
+    }
+    BOOST_CHECK(!vExpected.empty());
+
+    for (int b = XCoin::GROESTL_BACKEND_SPH; b <= XCoin::GROESTL_BACKEND_AESNI; b++) {
+        if (!XCoin::SetGroestlBackend(XCoin::GroestlBackend(b)))
+            continue;
+        // The nonce bytes of the input header are ignored.
+        WriteLE32(&header[76], insecure_rand());
+        std::vector<std::pair<uint32_t, uint256> > vFound;
+        BOOST_CHECK_EQUAL(XCoin::HashPowSweep(&header[0], nBegin, nCount, hashTarget, vFound), nCount);
+        BOOST_CHECK(vFound == vExpected);
+
+        vFound.clear();
+        size_t nHashed = XCoin::HashPowSweep(&header[0], nBegin, nCount, hashTarget, vFound, 1);
+        BOOST_CHECK_EQUAL(vFound.size(), 1U);
+        BOOST_CHECK(vFound[0] == vExpected[0]);
+        BOOST_CHECK_EQUAL(nHashed, vExpected[0].first - nBegin + 1);
+    }
+    BOOST_CHECK(XCoin::SetGroestlBackend(backend));
+}
+
+BOOST_AUTO_TEST_CASE(groestl_incremental) {
+    const XCoin::GroestlBackend backend = XCoin::GetGroestlBackend();
+    for (int b = XCoin::GROESTL_BACKEND_SPH; b <= XCoin::GROESTL_BACKEND_AESNI; b++) {
+        if (!XCoin::SetGroestlBackend(XCoin::GroestlBackend(b)))
+            continue;
+        XCoin::GroestlHasher hasher;
+        for (size_t len = 0; len < 700; len += 1 + insecure_rand() % 20) {
+            std::vector<unsigned char> in = RandomBytes(len);
+            // Written in random pieces, crossing block boundaries at any offset.
+            for (size_t pos = 0; pos < len; ) {
+                size_t n = std::min(len - pos, (size_t)(insecure_rand() % 300));
+                hasher.Write(XCoin::ConstBuf(in.begin() + pos, in.begin() + pos + n));
+                pos += n;
+            }
+            BOOST_CHECK_MESSAGE(hasher.Finalize() == XCoin::HashGroestl(XCoin::ConstBuf(in)), "length " << len);
+            hasher.Reset();
+        }
+    }
+    BOOST_CHECK(XCoin::SetGroestlBackend(backend));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
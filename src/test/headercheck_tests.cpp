@@ -0,0 +1,131 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chain.h"
+#include "arith_uint256.h"
+#include "chainparams.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "pow.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/**
+ * A short chain of headers on top of the genesis block, each with valid
+ * proof of work. Mining one takes a few seconds, so they are mined once.
+ */
+const std::vector<CBlockHeader>& MinedHeaders()
+{
+    static std::vector<CBlockHeader> headers;
+    if (!headers.empty())
+        return headers;
+    const CBlockHeader& genesis = Params().GenesisBlock();
+    uint256 hashPrev = genesis.GetHash();
+    for (int i = 0; i < 3; i++) {
+        CBlockHeader header;
+        header.nVersion = 3;
+        header.hashPrevBlock = hashPrev;
+        header.hashMerkleRoot = GetRandHash();
+        header.nTime = genesis.nTime + 60 * (i + 1);
+        header.nBits = UintToArith256(Params().GetConsensus().powLimit).GetCompact();
+        header.nNonce = 0;
+        while (!CheckProofOfWork(header.GetHash(), header.nBits, Params().GetConsensus()))
+            header.nNonce++;
+        headers.push_back(header);
+        hashPrev = header.GetHash();
+    }
+    return headers;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(headercheck_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(hash_headers_matches_check_block_header)
+{
+    // Valid headers, the same with other nonces (which almost surely fail),
+    // and one whose target is below the minimum work; not a multiple of the
+    // run handed to each thread
+    std::vector<CBlockHeader> headers(1, Params().GenesisBlock());
+    for (int i = 0; i < 50; i++) {
+        CBlockHeader header = MinedHeaders()[i % 3];
+        if (i >= 3)
+            header.nNonce = insecure_rand();
+        headers.push_back(header);
+    }
+    CBlockHeader bad = MinedHeaders()[0];
+    bad.nBits = 0x207fffff;
+    headers.push_back(bad);
+
+    BOOST_CHECK(nHeaderCheckThreads > 0);
+    std::vector<CHeaderHashResult> vResults;
+    HashHeaders(headers, vResults);
+    BOOST_REQUIRE_EQUAL(vResults.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        CValidationState state;
+        BOOST_CHECK(vResults[i].hash == headers[i].GetHash());
+        BOOST_CHECK_EQUAL(vResults[i].fValidPoW, CheckBlockHeader(headers[i], state, true));
+    }
+    for (size_t i = 0; i < 4; i++)
+        BOOST_CHECK(vResults[i].fValidPoW);
+    BOOST_CHECK(!vResults.back().fValidPoW);
+
+    // Hashing in the calling thread gives the same results
+    int nThreads = nHeaderCheckThreads;
+    nHeaderCheckThreads = 0;
+    std::vector<CHeaderHashResult> vResultsSerial;
+    HashHeaders(headers, vResultsSerial);
+    nHeaderCheckThreads = nThreads;
+    BOOST_REQUIRE_EQUAL(vResultsSerial.size(), headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        BOOST_CHECK(vResultsSerial[i].hash == vResults[i].hash);
+        BOOST_CHECK_EQUAL(vResultsSerial[i].fValidPoW, vResults[i].fValidPoW);
+    }
+
+    headers.clear();
+    HashHeaders(headers, vResults);
+    BOOST_CHECK(vResults.empty());
+}
+
+BOOST_AUTO_TEST_CASE(accept_headers_with_precomputed_hash)
+{
+    const std::vector<CBlockHeader>& headers = MinedHeaders();
+    std::vector<CHeaderHashResult> vResults;
+    HashHeaders(headers, vResults);
+
+    LOCK(cs_main);
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    for (size_t i = 0; i < headers.size(); i++) {
+        CValidationState state;
+        CBlockIndex* pindex = NULL;
+        BOOST_REQUIRE(vResults[i].fValidPoW);
+        BOOST_REQUIRE(AcceptBlockHeader(headers[i], state, &pindex, &vResults[i].hash));
+        BOOST_CHECK(pindex->GetBlockHash() == headers[i].GetHash());
+        BOOST_CHECK(pindex->pprev == pindexPrev);
+        BOOST_CHECK_EQUAL(pindex->nHeight, (int)i + 1);
+        pindexPrev = pindex;
+
+        // Accepting it again, hashed or not, finds the same index
+        CBlockIndex* pindexAgain = NULL;
+        BOOST_CHECK(AcceptBlockHeader(headers[i], state, &pindexAgain));
+        BOOST_CHECK(pindexAgain == pindex);
+    }
+
+    // A header that doesn't connect is still rejected
+    CBlockHeader orphan = headers.back();
+    orphan.hashPrevBlock = GetRandHash();
+    uint256 hash = orphan.GetHash();
+    CValidationState state;
+    BOOST_CHECK(!AcceptBlockHeader(orphan, state, NULL, &hash));
+    BOOST_CHECK(mapBlockIndex.count(hash) == 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,179 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "miner.h"
+#include "pow.h"
+#include "script/script.h"
+#include "streams.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/**
+ * Two blocks on top of the genesis block, each with valid proof of work.
+ * Mining one takes a few seconds, so they are mined once.
+ */
+const std::vector<CBlock>& MinedBlocks()
+{
+    static std::vector<CBlock> blocks;
+    if (!blocks.empty())
+        return blocks;
+    CBlockTemplate* pblocktemplate = CreateNewBlock(CScript() << OP_TRUE);
+    BOOST_REQUIRE(pblocktemplate);
+    CBlock block = pblocktemplate->block;
+    delete pblocktemplate;
+    block.nBits = UintToArith256(Params().GetConsensus().powLimit).GetCompact();
+    for (int nHeight = 1; nHeight <= 2; nHeight++) {
+        CMutableTransaction txCoinbase(block.vtx[0]);
+        txCoinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+        txCoinbase.vout[0].nValue = GetBlockSubsidy(nHeight, Params().GetConsensus());
+        block.vtx[0] = txCoinbase;
+        block.hashMerkleRoot = block.BuildMerkleTree();
+        block.nNonce = 0;
+        while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+            ++block.nNonce;
+        blocks.push_back(block);
+        block.hashPrevBlock = block.GetHash();
+        block.nTime += 60;
+    }
+    return blocks;
+}
+
+void WriteRecord(CAutoFile& file, const CBlock& block)
+{
+    file << FLATDATA(Params().MessageStart());
+    file << (unsigned int)::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+    file << block;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(import_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(unknown_parent_positions)
+{
+    uint256 hashA = uint256S("0x0a");
+    uint256 hashB = uint256S("0x0b");
+    BOOST_CHECK(pblocktree->WriteBlockUnknownParent(hashA, CDiskBlockPos(0, 100)));
+    BOOST_CHECK(pblocktree->WriteBlockUnknownParent(hashA, CDiskBlockPos(3, 8)));
+    BOOST_CHECK(pblocktree->WriteBlockUnknownParent(hashB, CDiskBlockPos(1, 200)));
+
+    std::vector<CDiskBlockPos> vPos;
+    BOOST_CHECK(pblocktree->TakeBlocksUnknownParent(hashA, vPos));
+    BOOST_CHECK_EQUAL(vPos.size(), 2U);
+    BOOST_CHECK(std::find(vPos.begin(), vPos.end(), CDiskBlockPos(0, 100)) != vPos.end());
+    BOOST_CHECK(std::find(vPos.begin(), vPos.end(), CDiskBlockPos(3, 8)) != vPos.end());
+
+    // Taking forgets them
+    BOOST_CHECK(pblocktree->TakeBlocksUnknownParent(hashA, vPos));
+    BOOST_CHECK(vPos.empty());
+
+    BOOST_CHECK(pblocktree->EraseBlocksUnknownParent());
+    BOOST_CHECK(pblocktree->TakeBlocksUnknownParent(hashB, vPos));
+    BOOST_CHECK(vPos.empty());
+}
+
+BOOST_AUTO_TEST_CASE(import_skips_junk)
+{
+    // Junk, a record that doesn't deserialize and blocks we already have are skipped without loading anything
+    boost::filesystem::path path = pathTemp / "import.dat";
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        std::vector<unsigned char> vJunk(5000, 0x42);
+        file.write((const char*)&vJunk[0], vJunk.size());
+        for (int i = 0; i < 3; i++) {
+            file << FLATDATA(Params().MessageStart());
+            file << (unsigned int)::GetSerializeSize(Params().GenesisBlock(), SER_DISK, CLIENT_VERSION);
+            file << Params().GenesisBlock();
+            file.write((const char*)&vJunk[0], vJunk.size());
+        }
+        file << FLATDATA(Params().MessageStart());
+        file << (unsigned int)1000;
+        file.write((const char*)&vJunk[0], vJunk.size());
+    }
+
+    std::vector<boost::filesystem::path> vFiles(2, path);
+    BOOST_CHECK(!LoadExternalBlockFiles(vFiles, false, 3));
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == Params().GenesisBlock().GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(import_rescans_undecodable_record)
+{
+    // A record whose size is garbage but covers a good block: it doesn't
+    // deserialize, and the block inside it is found by scanning again
+    fCheckpointsEnabled = false;
+    const CBlock& block = MinedBlocks()[0];
+    boost::filesystem::path path = pathTemp / "import.dat";
+    {
+        CAutoFile file(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        // Fills the header, then a transaction count too large to read
+        std::vector<unsigned char> vHeader(80, 0x42);
+        std::vector<unsigned char> vCount(9, 0xff);
+        std::vector<unsigned char> vJunk(100, 0x42);
+        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+        file << FLATDATA(Params().MessageStart());
+        file << (unsigned int)(vHeader.size() + vCount.size() + 8 + nBlockSize + vJunk.size());
+        file.write((const char*)&vHeader[0], vHeader.size());
+        file.write((const char*)&vCount[0], vCount.size());
+        WriteRecord(file, block);
+        file.write((const char*)&vJunk[0], vJunk.size());
+    }
+
+    std::vector<boost::filesystem::path> vFiles(1, path);
+    BOOST_CHECK(LoadExternalBlockFiles(vFiles, false, 3));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    }
+    fCheckpointsEnabled = true;
+}
+
+BOOST_AUTO_TEST_CASE(reindex_out_of_order)
+{
+    // A child stored before its parent is put aside by position while
+    // reindexing, and connected once the parent is
+    fCheckpointsEnabled = false;
+    const std::vector<CBlock>& blocks = MinedBlocks();
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(0, 0), "blk");
+    {
+        CAutoFile file(fopen(path.string().c_str(), "ab"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!file.IsNull());
+        WriteRecord(file, blocks[1]);
+        WriteRecord(file, blocks[0]);
+    }
+
+    std::vector<boost::filesystem::path> vFiles(1, path);
+    BOOST_CHECK(LoadExternalBlockFiles(vFiles, true, 3));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(chainActive.Height(), 2);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == blocks[1].GetHash());
+        BOOST_CHECK(chainActive.Tip()->GetBlockPos().nFile == 0);
+    }
+    // Nothing is left waiting for a parent
+    std::vector<CDiskBlockPos> vPos;
+    BOOST_CHECK(pblocktree->TakeBlocksUnknownParent(blocks[0].GetHash(), vPos));
+    BOOST_CHECK(vPos.empty());
+    fCheckpointsEnabled = true;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
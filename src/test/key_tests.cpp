@@ -188,4 +188,62 @@ BOOST_AUTO_TEST_CASE(key_test1)
     BOOST_CHECK(detsigc == ParseHex("2052d8a32079c11e79db95af63bb9600c5b04f21a9ca33dc129c2bfa8ac9dc1cd561d8ae5e0f6c1a16bde3719c64c2fd70e404b6428ab9a69566962e8771b5944d"));
 }
 
+BOOST_AUTO_TEST_CASE(key_signature_encodings)
+{
+    // Signatures are parsed leniently, the way OpenSSL did before BIP66.
+    const unsigned char vchSecret[32] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16,
+                                         17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32};
+    CKey key;
+    key.Set(vchSecret, vchSecret + 32, true);
+    CPubKey pubkey = key.GetPubKey();
+    BOOST_CHECK(pubkey.IsFullyValid());
+
+    string strMsg = "Lax signature encodings";
+    uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hashMsg, vchSig));
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchSig));
+    BOOST_CHECK(!pubkey.Verify(hashMsg, std::vector<unsigned char>()));
+    BOOST_CHECK(!pubkey.Verify(uint256S("1"), vchSig));
+
+    const size_t nLenR = vchSig[3];
+    std::vector<unsigned char> vchR(vchSig.begin() + 4, vchSig.begin() + 4 + nLenR);
+    std::vector<unsigned char> vchS(vchSig.begin() + 6 + nLenR, vchSig.end());
+
+    // Trailing garbage after the sequence.
+    std::vector<unsigned char> vchGarbage(vchSig);
+    vchGarbage.push_back(0x01);
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchGarbage));
+
+    // Excess zero padding in R and a long form length for S.
+    std::vector<unsigned char> vchPadded;
+    vchPadded.push_back(0x30);
+    vchPadded.push_back(vchSig[1] + 3);
+    vchPadded.push_back(0x02);
+    vchPadded.push_back(nLenR + 2);
+    vchPadded.push_back(0x00);
+    vchPadded.push_back(0x00);
+    vchPadded.insert(vchPadded.end(), vchR.begin(), vchR.end());
+    vchPadded.push_back(0x02);
+    vchPadded.push_back(0x81);
+    vchPadded.push_back(vchS.size());
+    vchPadded.insert(vchPadded.end(), vchS.begin(), vchS.end());
+    BOOST_CHECK(pubkey.Verify(hashMsg, vchPadded));
+
+    // A negative S never verified.
+    std::vector<unsigned char> vchNegative(vchSig);
+    vchNegative[6 + nLenR] |= 0x80;
+    BOOST_CHECK(!pubkey.Verify(hashMsg, vchNegative));
+
+    // Truncated signatures are rejected without reading past the end.
+    for (size_t i = 0; i < vchSig.size(); i++)
+        BOOST_CHECK(!pubkey.Verify(hashMsg, std::vector<unsigned char>(vchSig.begin(), vchSig.begin() + i)));
+
+    CPubKey pubkeyFull(pubkey);
+    BOOST_CHECK(pubkeyFull.Decompress());
+    BOOST_CHECK(!pubkeyFull.IsCompressed());
+    BOOST_CHECK(pubkeyFull.Verify(hashMsg, vchSig));
+    BOOST_CHECK(pubkeyFull.GetID() != pubkey.GetID());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
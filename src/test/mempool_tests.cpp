@@ -2,6 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "random.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -100,4 +101,154 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+
+    // A parent with two outputs, a child spending each, and a grandchild
+    // spending the first child.
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(2);
+    for (int i = 0; i < 2; i++)
+    {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 33000LL;
+    }
+    CMutableTransaction txChild[2];
+    for (int i = 0; i < 2; i++)
+    {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout.hash = txParent.GetHash();
+        txChild[i].vin[0].prevout.n = i;
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 11000LL;
+    }
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(1);
+    txGrandChild.vin[0].scriptSig = CScript() << OP_11;
+    txGrandChild.vin[0].prevout.hash = txChild[0].GetHash();
+    txGrandChild.vin[0].prevout.n = 0;
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 11000LL;
+
+    unsigned int nSize = ::GetSerializeSize(CTransaction(txParent), SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int nChildSize = ::GetSerializeSize(CTransaction(txChild[0]), SER_NETWORK, PROTOCOL_VERSION);
+    unsigned int nGrandChildSize = ::GetSerializeSize(CTransaction(txGrandChild), SER_NETWORK, PROTOCOL_VERSION);
+
+    // Children go in before their parent, as after a reorg.
+    pool.addUnchecked(txGrandChild.GetHash(), CTxMemPoolEntry(txGrandChild, 40000LL, 3, 0.0, 1));
+    pool.addUnchecked(txChild[0].GetHash(), CTxMemPoolEntry(txChild[0], 100LL, 1, 0.0, 1));
+    pool.addUnchecked(txChild[1].GetHash(), CTxMemPoolEntry(txChild[1], 10000LL, 2, 0.0, 1));
+    std::vector<uint256> vHashUpdate;
+    vHashUpdate.push_back(txChild[0].GetHash());
+    vHashUpdate.push_back(txChild[1].GetHash());
+    pool.UpdateTransactionsFromBlock(vHashUpdate);
+    pool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 1000LL, 0, 0.0, 1));
+    vHashUpdate.clear();
+    vHashUpdate.push_back(txParent.GetHash());
+    pool.UpdateTransactionsFromBlock(vHashUpdate);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    CTxMemPool::txiter it = pool.mapTx.find(txParent.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 4U);
+    BOOST_CHECK_EQUAL(it->GetSizeWithDescendants(), nSize + 2 * nChildSize + nGrandChildSize);
+    BOOST_CHECK_EQUAL(it->GetModFeesWithDescendants(), 51100LL);
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 1U);
+
+    it = pool.mapTx.find(txGrandChild.GetHash());
+    BOOST_CHECK_EQUAL(it->GetCountWithDescendants(), 1U);
+    BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), 3U);
+    BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), nSize + nChildSize + nGrandChildSize);
+    BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), 41100LL);
+
+    // Mining order is by the entry's own fee rate.
+    std::vector<uint256> vOrder;
+    BOOST_FOREACH(const CTxMemPoolEntry& e, pool.mapTx.get<mining_score>())
+        vOrder.push_back(e.GetTx().GetHash());
+    BOOST_CHECK(vOrder[0] == txGrandChild.GetHash());
+    BOOST_CHECK(vOrder[1] == txChild[1].GetHash());
+    BOOST_CHECK(vOrder[2] == txParent.GetHash());
+    BOOST_CHECK(vOrder[3] == txChild[0].GetHash());
+
+    // Entry time order, oldest first.
+    BOOST_CHECK(pool.mapTx.get<entry_time>().begin()->GetTx().GetHash() == txParent.GetHash());
+    BOOST_CHECK(pool.mapTx.get<entry_time>().rbegin()->GetTx().GetHash() == txGrandChild.GetHash());
+
+    // Descendant score is the eviction order, lowest first; the cheap first
+    // child is carried by its grandchild.
+    vOrder.clear();
+    BOOST_FOREACH(const CTxMemPoolEntry& e, pool.mapTx.get<descendant_score>())
+        vOrder.push_back(e.GetTx().GetHash());
+    BOOST_CHECK(vOrder[0] == txChild[1].GetHash());
+    BOOST_CHECK(vOrder[1] == txParent.GetHash());
+    BOOST_CHECK(vOrder[2] == txChild[0].GetHash());
+    BOOST_CHECK(vOrder[3] == txGrandChild.GetHash());
+
+    // Prioritising a transaction updates its relatives' aggregates and its position.
+    pool.PrioritiseTransaction(txChild[0].GetHash(), txChild[0].GetHash().ToString(), 0.0, 100000LL);
+    BOOST_CHECK(pool.mapTx.get<mining_score>().begin()->GetTx().GetHash() == txChild[0].GetHash());
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txParent.GetHash())->GetModFeesWithDescendants(), 151100LL);
+    BOOST_CHECK_EQUAL(pool.mapTx.find(txGrandChild.GetHash())->GetModFeesWithAncestors(), 141100LL);
+
+    // Removing the parent takes its descendants along.
+    std::list<CTransaction> removed;
+    pool.remove(txParent, removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 4);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+
+    CMutableTransaction tx[3];
+    CAmount nFee[3] = { 300000LL, 100000LL, 200000LL };
+    for (int i = 0; i < 3; i++)
+    {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vin[0].prevout.hash = GetRandHash();
+        tx[i].vin[0].prevout.n = 0;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(tx[i].GetHash(), CTxMemPoolEntry(tx[i], nFee[i], i, 0.0, 1));
+    }
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(0));
+
+    // Trimming evicts the package with the lowest fee rate and raises the
+    // minimum fee above it.
+    unsigned int nSize = ::GetSerializeSize(CTransaction(tx[1]), SER_NETWORK, PROTOCOL_VERSION);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK(pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(!pool.exists(tx[1].GetHash()));
+    BOOST_CHECK(pool.exists(tx[2].GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetEvictedCount(), 1U);
+    BOOST_CHECK_EQUAL(pool.GetEvictedSize(), nSize);
+    CAmount nMinFee = CFeeRate(nFee[1], nSize).GetFeePerK() + 1000;
+    BOOST_CHECK(pool.GetMinFee(1) == CFeeRate(nMinFee));
+
+    // The minimum fee only starts to decay once a block has been seen, and
+    // decays four times as fast with the pool under a quarter full.
+    SetMockTime(42);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(std::vector<CTransaction>(), 1, conflicts);
+    SetMockTime(42 + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(pool.DynamicMemoryUsage() * 5) == CFeeRate(nMinFee / 16));
+    SetMockTime(42 + 10 * CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK(pool.GetMinFee(pool.DynamicMemoryUsage() * 5) == CFeeRate(0));
+
+    // Expiry takes entries that entered the pool before the cutoff.
+    BOOST_CHECK_EQUAL(pool.Expire(1), 1);
+    BOOST_CHECK(!pool.exists(tx[0].GetHash()));
+    BOOST_CHECK(pool.exists(tx[2].GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetExpiredCount(), 1U);
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,17 +2,20 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "chainparams.h"
 #include "coins.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "miner.h"
+#include "pow.h"
 #include "pubkey.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "validationinterface.h"
 
 #include "test/test_bitcoin.h"
 
@@ -185,7 +188,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     hash = tx.GetHash();
     mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
     tx.vin[0].prevout.hash = hash;
-    tx.vin[0].scriptSig = CScript() << (std::vector<unsigned char>)script;
+    tx.vin[0].scriptSig = CScript() << ToByteVector(script);
     tx.vout[0].nValue -= 1000000;
     hash = tx.GetHash();
     mempool.addUnchecked(hash, CTxMemPoolEntry(tx, 11, GetTime(), 111.0, 11));
@@ -274,4 +277,199 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+namespace {
+
+/** A transaction spending prevout to an OP_TRUE output, paying nFee */
+CMutableTransaction SpendingTx(const COutPoint& prevout, CAmount nValueIn, CAmount nFee)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = nValueIn - nFee;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    return tx;
+}
+
+void AddToMempool(const CTransaction& tx, CAmount nFee)
+{
+    mempool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(tx, nFee, GetTime(), 0.0, 1));
+    GetMainSignals().SyncTransaction(tx, NULL);
+}
+
+std::set<uint256> TemplateTxids(const CBlockTemplate& blocktemplate)
+{
+    std::set<uint256> setTxids;
+    for (unsigned int i = 1; i < blocktemplate.block.vtx.size(); i++)
+        setTxids.insert(blocktemplate.block.vtx[i].GetHash());
+    return setTxids;
+}
+
+/** The builder's template, after checking it is valid and agrees with its own bookkeeping */
+boost::shared_ptr<const CBlockTemplate> CheckedBuilderTemplate()
+{
+    SyncBlockTemplateBuilder();
+    LOCK(cs_main);
+    boost::shared_ptr<const CBlockTemplate> ptemplate = GetBlockTemplate();
+    BOOST_REQUIRE(ptemplate);
+    const CBlock& block = ptemplate->block;
+    BOOST_CHECK(block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_REQUIRE_EQUAL(block.vtx.size(), ptemplate->vTxFees.size());
+    CAmount nFees = 0;
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        nFees += ptemplate->vTxFees[i];
+    BOOST_CHECK_EQUAL(ptemplate->vTxFees[0], -nFees);
+    CValidationState state;
+    BOOST_CHECK(TestBlockValidity(state, block, chainActive.Tip(), false, false));
+    return ptemplate;
+}
+
+/** Check the builder's template holds the same transactions as a template built from scratch */
+void CheckMatchesNewBlock(const CBlockTemplate& blocktemplate)
+{
+    CBlockTemplate* pblocktemplate = CreateNewBlock(CScript() << OP_TRUE);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK(TemplateTxids(blocktemplate) == TemplateTxids(*pblocktemplate));
+    BOOST_CHECK_EQUAL(blocktemplate.vTxFees[0], pblocktemplate->vTxFees[0]);
+    BOOST_CHECK_EQUAL(blocktemplate.block.vtx[0].vout[0].nValue, pblocktemplate->block.vtx[0].vout[0].nValue);
+    delete pblocktemplate;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(BlockTemplateBuilder_deltas)
+{
+    fCheckpointsEnabled = false;
+
+    // Coins to spend, straight in the chainstate
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.resize(8);
+    for (unsigned int i = 0; i < txFund.vout.size(); i++) {
+        txFund.vout[i].nValue = COIN;
+        txFund.vout[i].scriptPubKey = CScript() << OP_TRUE;
+    }
+    uint256 hashFund = CTransaction(txFund).GetHash();
+    {
+        LOCK(cs_main);
+        AddCoins(*pcoinsTip, txFund, 0);
+    }
+
+    StartBlockTemplateBuilder(threadGroup);
+    BOOST_CHECK(TemplateTxids(*CheckedBuilderTemplate()).empty());
+
+    // A child that arrives first waits for its parent, which brings it in
+    CTransaction txParent = SpendingTx(COutPoint(hashFund, 0), COIN, 2000000);
+    CTransaction txChild = SpendingTx(COutPoint(txParent.GetHash(), 0), COIN - 2000000, 2000000);
+    mempool.addUnchecked(txParent.GetHash(), CTxMemPoolEntry(txParent, 2000000, GetTime(), 0.0, 1));
+    AddToMempool(txChild, 2000000);
+    BOOST_CHECK(TemplateTxids(*CheckedBuilderTemplate()).empty());
+    GetMainSignals().SyncTransaction(txParent, NULL);
+    boost::shared_ptr<const CBlockTemplate> ptemplate = CheckedBuilderTemplate();
+    BOOST_REQUIRE_EQUAL(ptemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(ptemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(ptemplate->block.vtx[2].GetHash() == txChild.GetHash());
+    {
+        LOCK(cs_main);
+        CheckMatchesNewBlock(*ptemplate);
+    }
+
+    // Under the fee policy a transaction paying less than the relay fee stays out
+    CTransaction txFree = SpendingTx(COutPoint(hashFund, 1), COIN, 0);
+    AddToMempool(txFree, 0);
+    ptemplate = CheckedBuilderTemplate();
+    BOOST_CHECK(!TemplateTxids(*ptemplate).count(txFree.GetHash()));
+    {
+        LOCK(cs_main);
+        CheckMatchesNewBlock(*ptemplate);
+    }
+    {
+        LOCK(mempool.cs);
+        std::list<CTransaction> removed;
+        mempool.remove(txFree, removed);
+    }
+
+    // Fill the block exactly, then a better paying transaction evicts the
+    // cheapest one without children
+    CTransaction txCheap = SpendingTx(COutPoint(hashFund, 2), COIN, 100000);
+    CTransaction txBetter = SpendingTx(COutPoint(hashFund, 3), COIN, 1000000);
+    BOOST_REQUIRE_EQUAL(::GetSerializeSize(txCheap, SER_NETWORK, PROTOCOL_VERSION), ::GetSerializeSize(txBetter, SER_NETWORK, PROTOCOL_VERSION));
+    unsigned int nBlockMaxSize = 1000 + 1 + ::GetSerializeSize(txParent, SER_NETWORK, PROTOCOL_VERSION) +
+        ::GetSerializeSize(txChild, SER_NETWORK, PROTOCOL_VERSION) + ::GetSerializeSize(txCheap, SER_NETWORK, PROTOCOL_VERSION);
+    mapArgs["-blockmaxsize"] = strprintf("%u", nBlockMaxSize);
+    AddToMempool(txCheap, 100000);
+    BOOST_CHECK(CheckedBuilderTemplate()->block.vtx.size() == 4);
+    AddToMempool(txBetter, 1000000);
+    ptemplate = CheckedBuilderTemplate();
+    std::set<uint256> setTxids = TemplateTxids(*ptemplate);
+    BOOST_CHECK_EQUAL(setTxids.size(), 3U);
+    BOOST_CHECK(setTxids.count(txBetter.GetHash()) && !setTxids.count(txCheap.GetHash()));
+    {
+        LOCK(cs_main);
+        CheckMatchesNewBlock(*ptemplate);
+    }
+
+    // Confirming a block starts over from the new tip, with what is left in the mempool
+    CBlock block = ptemplate->block;
+    {
+        LOCK(cs_main);
+        unsigned int nExtraNonce = 0;
+        IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+        block.nBits = UintToArith256(Params().GetConsensus().powLimit).GetCompact();
+    }
+    while (!CheckProofOfWork(block.GetHash(), block.nBits, Params().GetConsensus()))
+        ++block.nNonce;
+    CValidationState state;
+    BOOST_CHECK(ProcessNewBlock(state, NULL, &block, true, NULL));
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    }
+    ptemplate = CheckedBuilderTemplate();
+    setTxids = TemplateTxids(*ptemplate);
+    BOOST_CHECK_EQUAL(setTxids.size(), 1U);
+    BOOST_CHECK(setTxids.count(txCheap.GetHash()));
+    {
+        LOCK(cs_main);
+        CheckMatchesNewBlock(*ptemplate);
+    }
+    mapArgs.erase("-blockmaxsize");
+
+    // A transaction leaving the mempool takes its descendants in the template along
+    CTransaction txParent2 = SpendingTx(COutPoint(hashFund, 4), COIN, 2000000);
+    CTransaction txChild2 = SpendingTx(COutPoint(txParent2.GetHash(), 0), COIN - 2000000, 2000000);
+    AddToMempool(txParent2, 2000000);
+    AddToMempool(txChild2, 2000000);
+    BOOST_CHECK_EQUAL(TemplateTxids(*CheckedBuilderTemplate()).size(), 3U);
+    {
+        LOCK(mempool.cs);
+        std::list<CTransaction> removed;
+        mempool.remove(txParent2, removed, true);
+        BOOST_CHECK_EQUAL(removed.size(), 2U);
+    }
+    GetMainSignals().RemovedFromMempool(txParent2.GetHash());
+    ptemplate = CheckedBuilderTemplate();
+    setTxids = TemplateTxids(*ptemplate);
+    BOOST_CHECK_EQUAL(setTxids.size(), 1U);
+    BOOST_CHECK(setTxids.count(txCheap.GetHash()));
+
+    // With a priority area, which deltas can't keep up, changes rebuild the template
+    mapArgs["-blockprioritysize"] = "10000";
+    CTransaction txFree2 = SpendingTx(COutPoint(hashFund, 5), COIN, 0);
+    mempool.addUnchecked(txFree2.GetHash(), CTxMemPoolEntry(txFree2, 0, GetTime(), 1e12, 1));
+    GetMainSignals().SyncTransaction(txFree2, NULL);
+    ptemplate = CheckedBuilderTemplate();
+    BOOST_CHECK(TemplateTxids(*ptemplate).count(txFree2.GetHash()));
+    {
+        LOCK(cs_main);
+        CheckMatchesNewBlock(*ptemplate);
+    }
+    mapArgs.erase("-blockprioritysize");
+
+    StopBlockTemplateBuilder();
+    mempool.clear();
+    fCheckpointsEnabled = true;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,387 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "net.h"
+#include "crypto/common.h"
+#include "main.h"
+#include "chainparams.h"
+#include "netbase.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "rpcserver.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** A message as seen by the handler: the peer, its command and the thread handling it */
+struct CHandledMessage
+{
+    CNode* pnode;
+    std::string strCommand;
+    boost::thread::id threadId;
+};
+
+boost::mutex mutexHandled;
+std::vector<CHandledMessage> vHandled;
+//! Threads currently handling each peer
+std::map<CNode*, int> mapBusy;
+bool fOverlap = false;
+
+/** Hooked in for main's ProcessMessages, recording which thread handles what */
+bool TrackedProcessMessages(CNode* pnode)
+{
+    if (pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete())
+        return ProcessMessages(pnode);
+    CHandledMessage handled;
+    handled.pnode = pnode;
+    handled.strCommand = pnode->vRecvMsg.front().hdr.GetCommand();
+    handled.threadId = boost::this_thread::get_id();
+    {
+        boost::unique_lock<boost::mutex> lock(mutexHandled);
+        if (mapBusy[pnode]++ > 0)
+            fOverlap = true;
+    }
+    // Give another thread the chance to pick up the same peer
+    MilliSleep(1);
+    size_t nQueued = pnode->vRecvMsg.size();
+    bool fRet = ProcessMessages(pnode);
+    boost::unique_lock<boost::mutex> lock(mutexHandled);
+    mapBusy[pnode]--;
+    // Only answering a getdata leaves the message where it was
+    if (pnode->vRecvMsg.size() < nQueued)
+        vHandled.push_back(handled);
+    return fRet;
+}
+
+/**
+ * Run the validation thread and three message handler threads over the
+ * peers in vNodes until nMessages messages have been handled and no peer
+ * is left waiting for validation. Returns the validation thread's id.
+ */
+boost::thread::id RunMessageThreads(size_t nMessages)
+{
+    vHandled.clear();
+    mapBusy.clear();
+    fOverlap = false;
+    GetNodeSignals().ProcessMessages.disconnect(&ProcessMessages);
+    GetNodeSignals().ProcessMessages.connect(&TrackedProcessMessages);
+
+    boost::thread_group threads;
+    boost::thread::id validationId = threads.create_thread(&ThreadValidation)->get_id();
+    for (int i = 0; i < 3; i++)
+        threads.create_thread(&ThreadMessageHandler);
+    for (int i = 0; i < 1000; i++) {
+        {
+            boost::unique_lock<boost::mutex> lock(mutexHandled);
+            if (vHandled.size() >= nMessages)
+                break;
+        }
+        MilliSleep(10);
+    }
+    // Wait for the validation thread to let go of the peers, then stop
+    std::vector<CNode*> vPeers;
+    {
+        LOCK(cs_vNodes);
+        vPeers = vNodes;
+    }
+    for (int i = 0; i < 1000; i++) {
+        bool fQueued = false;
+        BOOST_FOREACH(CNode* pnode, vPeers) {
+            LOCK(pnode->cs_msgHandler);
+            fQueued |= pnode->fValidationQueued;
+        }
+        if (!fQueued)
+            break;
+        MilliSleep(10);
+    }
+    threads.interrupt_all();
+    threads.join_all();
+
+    GetNodeSignals().ProcessMessages.disconnect(&TrackedProcessMessages);
+    GetNodeSignals().ProcessMessages.connect(&ProcessMessages);
+    return validationId;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(net_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(receive_message_pieces)
+{
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    std::vector<CSerializedNetMsg> vMsgs;
+    vMsgs.push_back(MakeSerializedNetMsg("verack", std::vector<unsigned char>()));
+    vMsgs.push_back(MakeSerializedNetMsg("ping", (uint64_t)42));
+    vMsgs.push_back(MakeSerializedNetMsg("tx", std::vector<unsigned char>(700000, 0x5a)));
+    vMsgs.push_back(MakeSerializedNetMsg("tx", std::vector<unsigned char>(3000, 0xa5)));
+    std::vector<char> vStream;
+    for (size_t i = 0; i < vMsgs.size(); i++)
+        vStream.insert(vStream.end(), vMsgs[i]->begin(), vMsgs[i]->end());
+
+    // Fed in pieces of random size, as they come off the socket
+    LOCK(node.cs_vRecvMsg);
+    for (size_t pos = 0; pos < vStream.size(); ) {
+        size_t n = std::min(vStream.size() - pos, (size_t)(1 + insecure_rand() % 70000));
+        BOOST_CHECK(node.ReceiveMsgBytes(&vStream[pos], n));
+        pos += n;
+    }
+    BOOST_REQUIRE_EQUAL(node.vRecvMsg.size(), vMsgs.size());
+    for (size_t i = 0; i < vMsgs.size(); i++) {
+        const CNetMessage& msg = node.vRecvMsg[i];
+        const CSerializeData& data = *vMsgs[i];
+        BOOST_CHECK(msg.complete());
+        BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), std::string(&data[MESSAGE_START_SIZE], strnlen(&data[MESSAGE_START_SIZE], CMessageHeader::COMMAND_SIZE)));
+        BOOST_CHECK_EQUAL(msg.hdr.nMessageSize, data.size() - CMessageHeader::HEADER_SIZE);
+        BOOST_CHECK(std::equal(msg.vRecv.begin(), msg.vRecv.end(), data.begin() + CMessageHeader::HEADER_SIZE));
+        // The checksum computed while receiving matches the one that was sent
+        BOOST_CHECK_EQUAL(ReadLE32(msg.hashData.begin()), msg.hdr.nChecksum);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(receive_block_pieces)
+{
+    // Transactions of varied sizes, a few of them larger than the read-ahead
+    CBlock block(Params().GenesisBlock());
+    for (int i = 0; i < 300; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1 + insecure_rand() % 3);
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            tx.vin[j].prevout = COutPoint(GetRandHash(), j);
+            tx.vin[j].scriptSig = CScript() << std::vector<unsigned char>(i % 100 == 0 ? 100000 : insecure_rand() % 200, (unsigned char)i);
+        }
+        tx.vout.resize(1 + insecure_rand() % 3);
+        tx.nLockTime = i;
+        block.vtx.push_back(tx);
+    }
+    CSerializedNetMsg msgBlock = MakeSerializedNetMsg("block", block);
+    const CSerializeData& data = *msgBlock;
+
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    LOCK(node.cs_vRecvMsg);
+    size_t nHalf = data.size() / 2;
+    BOOST_CHECK(node.ReceiveMsgBytes(&data[0], nHalf));
+    // Transactions are deserialized before the rest of the block arrives
+    BOOST_REQUIRE(node.vRecvMsg.back().pblock);
+    BOOST_CHECK(node.vRecvMsg.back().pblock->vtx.size() > 10);
+    BOOST_CHECK(node.vRecvMsg.back().GetBlock() == NULL);
+    for (size_t pos = nHalf; pos < data.size(); ) {
+        size_t n = std::min(data.size() - pos, (size_t)(1 + insecure_rand() % 70000));
+        BOOST_CHECK(node.ReceiveMsgBytes(&data[pos], n));
+        pos += n;
+    }
+    BOOST_REQUIRE_EQUAL(node.vRecvMsg.size(), 1U);
+    const CBlock* pblock = node.vRecvMsg.front().GetBlock();
+    BOOST_REQUIRE(pblock);
+    BOOST_CHECK(pblock->GetHash() == block.GetHash());
+    BOOST_REQUIRE_EQUAL(pblock->vtx.size(), block.vtx.size());
+    for (size_t i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(pblock->vtx[i] == block.vtx[i]);
+
+    // Anything that doesn't deserialize is left to ProcessMessage
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    BeginSerializedNetMsg(ss, "block");
+    ss << block.GetBlockHeader();
+    WriteCompactSize(ss, 3);
+    ss << block.vtx[1] << FLATDATA("\xff\xff\xff\xff\xff");
+    CSerializedNetMsg msgBad = FinishSerializedNetMsg(ss);
+    BOOST_CHECK(node.ReceiveMsgBytes(&(*msgBad)[0], msgBad->size()));
+    BOOST_REQUIRE_EQUAL(node.vRecvMsg.size(), 2U);
+    BOOST_CHECK(node.vRecvMsg.back().complete());
+    BOOST_CHECK(node.vRecvMsg.back().GetBlock() == NULL);
+
+    // Other messages aren't touched
+    CSerializedNetMsg msgTx = MakeSerializedNetMsg("tx", block.vtx[1]);
+    BOOST_CHECK(node.ReceiveMsgBytes(&(*msgTx)[0], msgTx->size()));
+    BOOST_CHECK(!node.vRecvMsg.back().pblock);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(shared_message_send)
+{
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    // A small send buffer forces messages to be split across several sends
+    int nSendBuf = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &nSendBuf, sizeof(nSendBuf));
+
+    CNode node(fds[0], CAddress(CService("127.0.0.1", 0)), "", true);
+    CSerializedNetMsg msgTx = MakeSerializedNetMsg("tx", std::vector<unsigned char>(100000, 0x5a));
+    CSerializedNetMsg msgPing = MakeSerializedNetMsg("ping", (uint64_t)42);
+
+    std::vector<unsigned char> vExpected;
+    for (int i = 0; i < 3; i++) {
+        node.PushSerializedMessage(msgTx);
+        node.PushMessage("ping", (uint64_t)42);
+        vExpected.insert(vExpected.end(), msgTx->begin(), msgTx->end());
+        vExpected.insert(vExpected.end(), msgPing->begin(), msgPing->end());
+    }
+    // The queued messages share the buffer instead of copying it
+    BOOST_CHECK_EQUAL(msgTx.use_count(), 4);
+
+    std::vector<unsigned char> vReceived;
+    for (int i = 0; i < 10000 && vReceived.size() < vExpected.size(); i++) {
+        char buf[8192];
+        ssize_t nBytes = recv(fds[1], buf, sizeof(buf), MSG_DONTWAIT);
+        if (nBytes > 0)
+            vReceived.insert(vReceived.end(), buf, buf + nBytes);
+        LOCK(node.cs_vSend);
+        SocketSendData(&node);
+    }
+    BOOST_CHECK(vReceived == vExpected);
+    BOOST_CHECK(node.vSendMsg.empty());
+    BOOST_CHECK_EQUAL(node.nSendSize, 0U);
+    BOOST_CHECK_EQUAL(node.nSendOffset, 0U);
+    BOOST_CHECK_EQUAL(msgTx.use_count(), 1);
+
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(validation_messages)
+{
+    const char* pszValidation[] = {"block", "tx", "headers"};
+    const char* pszOther[] = {"ping", "inv", "getdata", "getheaders", "version"};
+    for (size_t i = 0; i < sizeof(pszValidation) / sizeof(pszValidation[0]); i++) {
+        CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+        CSerializedNetMsg msg = MakeSerializedNetMsg(pszValidation[i], (uint64_t)42);
+        LOCK(node.cs_vRecvMsg);
+        // Not before it is complete
+        BOOST_CHECK(node.ReceiveMsgBytes(&(*msg)[0], msg->size() - 1));
+        BOOST_CHECK(!IsValidationMessage(node.vRecvMsg.front()));
+        BOOST_CHECK(node.ReceiveMsgBytes(&(*msg)[msg->size() - 1], 1));
+        BOOST_CHECK(IsValidationMessage(node.vRecvMsg.front()));
+    }
+    for (size_t i = 0; i < sizeof(pszOther) / sizeof(pszOther[0]); i++) {
+        CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+        CSerializedNetMsg msg = MakeSerializedNetMsg(pszOther[i], (uint64_t)42);
+        LOCK(node.cs_vRecvMsg);
+        BOOST_CHECK(node.ReceiveMsgBytes(&(*msg)[0], msg->size()));
+        BOOST_CHECK(!IsValidationMessage(node.vRecvMsg.front()));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(message_handler_threads)
+{
+    // The peers never sent "version", so main rejects every message without
+    // side effects, but still records its latency
+    const char* pszCommands[] = {"ping", "block", "tx", "headers", "ping", "tx", "inv", "tx", "ping", "block"};
+    const size_t nCommands = sizeof(pszCommands) / sizeof(pszCommands[0]);
+    std::vector<CNode*> vPeers;
+    for (int i = 0; i < 4; i++) {
+        CNode* pnode = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+        {
+            LOCK(pnode->cs_vRecvMsg);
+            for (size_t j = 0; j < nCommands; j++) {
+                CSerializedNetMsg msg = MakeSerializedNetMsg(pszCommands[j], (uint64_t)j);
+                BOOST_CHECK(pnode->ReceiveMsgBytes(&(*msg)[0], msg->size()));
+            }
+        }
+        vPeers.push_back(pnode);
+    }
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vPeers)
+            vNodes.push_back(pnode);
+    }
+    boost::thread::id validationId = RunMessageThreads(vPeers.size() * nCommands);
+
+    // Every message was handled once, in order, and each by the right thread
+    BOOST_CHECK(!fOverlap);
+    BOOST_CHECK_EQUAL(vHandled.size(), vPeers.size() * nCommands);
+    BOOST_FOREACH(CNode* pnode, vPeers) {
+        std::vector<std::string> vCommands;
+        BOOST_FOREACH(const CHandledMessage& handled, vHandled) {
+            if (handled.pnode != pnode)
+                continue;
+            vCommands.push_back(handled.strCommand);
+            std::string strCommand = handled.strCommand;
+            BOOST_CHECK_EQUAL(handled.threadId == validationId, strCommand == "block" || strCommand == "tx" || strCommand == "headers");
+        }
+        BOOST_CHECK(vCommands == std::vector<std::string>(pszCommands, pszCommands + nCommands));
+        LOCK(pnode->cs_vRecvMsg);
+        BOOST_CHECK(pnode->vRecvMsg.empty());
+    }
+
+    // getpeerinfo reports the latency of each command
+    UniValue peers = getpeerinfo(UniValue(UniValue::VARR), false);
+    BOOST_CHECK_EQUAL(peers.size(), vPeers.size());
+    for (size_t i = 0; i < peers.size(); i++) {
+        const UniValue& latency = find_value(peers[i].get_obj(), "msglatency");
+        BOOST_CHECK_EQUAL(latency.size(), 5U);
+        const UniValue& tx = find_value(latency.get_obj(), "tx");
+        BOOST_CHECK_EQUAL(find_value(tx.get_obj(), "count").get_int(), 3);
+        const UniValue& histogram = find_value(tx.get_obj(), "histogram");
+        BOOST_CHECK_EQUAL(histogram.size(), (size_t)CMessageLatency::BUCKETS);
+        int nTotal = 0;
+        for (size_t j = 0; j < histogram.size(); j++)
+            nTotal += histogram[j].get_int();
+        BOOST_CHECK_EQUAL(nTotal, 3);
+    }
+
+    {
+        LOCK(cs_vNodes);
+        BOOST_FOREACH(CNode* pnode, vPeers)
+            vNodes.erase(std::find(vNodes.begin(), vNodes.end(), pnode));
+    }
+    BOOST_FOREACH(CNode* pnode, vPeers)
+        delete pnode;
+}
+
+BOOST_AUTO_TEST_CASE(validation_message_after_getdata)
+{
+    // A block queued behind a pending getdata is handed to the validation
+    // thread once the getdata is answered, not handled along with it
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), "", true);
+    // An unknown block, so nothing is sent back to the socketless peer
+    pnode->vRecvGetData.push_back(CInv(MSG_BLOCK, GetRandHash()));
+    {
+        LOCK(pnode->cs_vRecvMsg);
+        CSerializedNetMsg msgBlock = MakeSerializedNetMsg("block", (uint64_t)0);
+        CSerializedNetMsg msgPing = MakeSerializedNetMsg("ping", (uint64_t)1);
+        BOOST_CHECK(pnode->ReceiveMsgBytes(&(*msgBlock)[0], msgBlock->size()));
+        BOOST_CHECK(pnode->ReceiveMsgBytes(&(*msgPing)[0], msgPing->size()));
+    }
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(pnode);
+    }
+
+    boost::thread::id validationId = RunMessageThreads(2);
+
+    BOOST_CHECK(!fOverlap);
+    BOOST_CHECK(pnode->vRecvGetData.empty());
+    std::vector<CHandledMessage> vBlock, vPing;
+    BOOST_FOREACH(const CHandledMessage& handled, vHandled) {
+        if (handled.strCommand == "block")
+            vBlock.push_back(handled);
+        else if (handled.strCommand == "ping")
+            vPing.push_back(handled);
+    }
+    BOOST_REQUIRE_EQUAL(vBlock.size(), 1U);
+    BOOST_CHECK(vBlock[0].threadId == validationId);
+    BOOST_REQUIRE_EQUAL(vPing.size(), 1U);
+    BOOST_CHECK(vPing[0].threadId != validationId);
+    {
+        LOCK(pnode->cs_vRecvMsg);
+        BOOST_CHECK(pnode->vRecvMsg.empty());
+    }
+
+    {
+        LOCK(cs_vNodes);
+        vNodes.erase(std::find(vNodes.begin(), vNodes.end(), pnode));
+    }
+    delete pnode;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
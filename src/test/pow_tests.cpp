@@ -95,4 +95,31 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* DarkGravityWave targets, as computed by the former CBigNum and double implementation */
+BOOST_AUTO_TEST_CASE(dark_gravity_wave)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    for (int nBase = 0; nBase <= 99900; nBase += 99900) {
+        std::vector<CBlockIndex> blocks(200);
+        for (int i = 0; i < 200; i++) {
+            blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+            blocks[i].nHeight = nBase + i;
+            blocks[i].nTime = 1400000000 + i * 61 + (i % 3) * 17 - (i % 7) * 23;
+            blocks[i].nBits = i % 5 ? 0x1c0fffff : 0x1c0ccccc;
+        }
+        if (nBase == 0) {
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[10], NULL, params), 0x1e0fffffU);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[158], NULL, params), 0x1c10723aU);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[195], NULL, params), 0x1c0ce508U);
+        } else {
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[47], NULL, params), 0x1c101c70U);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[158], NULL, params), 0x1c0ed65aU); // DarkGravityWave3
+            BOOST_CHECK_EQUAL(blocks[158].nBitsNext, 0x1c0ed65aU);
+            BOOST_CHECK_EQUAL(GetNextWorkRequired(&blocks[195], NULL, params), 0x1c0e2c98U);
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,259 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "prevector.h"
+#include "random.h"
+#include "serialize.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(prevector_tests, BasicTestingSetup)
+
+namespace {
+
+/** Applies every operation to a prevector and a std::vector and checks they stay equal. */
+template<unsigned int N, typename T>
+class prevector_tester {
+    typedef std::vector<T> realtype;
+    realtype real_vector;
+
+    typedef prevector<N, T> pretype;
+    pretype pre_vector;
+
+    void test() {
+        const pretype& const_pre_vector = pre_vector;
+        BOOST_CHECK_EQUAL(real_vector.size(), pre_vector.size());
+        BOOST_CHECK_EQUAL(real_vector.empty(), pre_vector.empty());
+        BOOST_CHECK(pre_vector.size() > N ? pre_vector.allocated_memory() > 0 : pre_vector.allocated_memory() == 0 || pre_vector.capacity() > N);
+        for (size_t s = 0; s < real_vector.size(); s++) {
+            BOOST_CHECK(real_vector[s] == pre_vector[s]);
+            BOOST_CHECK(&(pre_vector[s]) == &(pre_vector.begin()[s]));
+            BOOST_CHECK(&(pre_vector[s]) == &*(pre_vector.begin() + s));
+            BOOST_CHECK(&(pre_vector[s]) == &*((pre_vector.end() + s) - real_vector.size()));
+        }
+        size_t pos = 0;
+        for (typename pretype::const_iterator it = const_pre_vector.begin(); it != const_pre_vector.end(); ++it) {
+            BOOST_CHECK(*it == real_vector[pos++]);
+        }
+        pos = 0;
+        for (typename pretype::const_reverse_iterator it = const_pre_vector.rbegin(); it != const_pre_vector.rend(); ++it) {
+            BOOST_CHECK(*it == real_vector[real_vector.size() - 1 - pos++]);
+        }
+        pretype pre_copy(pre_vector);
+        BOOST_CHECK(pre_copy == pre_vector);
+        BOOST_CHECK(!(pre_copy != pre_vector));
+
+        CDataStream ss1(SER_DISK, 0);
+        CDataStream ss2(SER_DISK, 0);
+        ss1 << real_vector;
+        ss2 << pre_vector;
+        BOOST_CHECK_EQUAL(ss1.size(), ss2.size());
+        BOOST_CHECK(ss1.str() == ss2.str());
+        pretype pre_read;
+        ss2 >> pre_read;
+        BOOST_CHECK(pre_read == pre_vector);
+    }
+
+public:
+    void resize(size_t s) {
+        real_vector.resize(s);
+        BOOST_CHECK_EQUAL(real_vector.size(), s);
+        pre_vector.resize(s);
+        BOOST_CHECK_EQUAL(pre_vector.size(), s);
+        test();
+    }
+
+    void reserve(size_t s) {
+        real_vector.reserve(s);
+        BOOST_CHECK(real_vector.capacity() >= s);
+        pre_vector.reserve(s);
+        BOOST_CHECK(pre_vector.capacity() >= s);
+        test();
+    }
+
+    void insert(size_t position, const T& value) {
+        real_vector.insert(real_vector.begin() + position, value);
+        pre_vector.insert(pre_vector.begin() + position, value);
+        test();
+    }
+
+    void insert(size_t position, size_t count, const T& value) {
+        real_vector.insert(real_vector.begin() + position, count, value);
+        pre_vector.insert(pre_vector.begin() + position, count, value);
+        test();
+    }
+
+    void insert_range(size_t position, const std::vector<T>& values) {
+        real_vector.insert(real_vector.begin() + position, values.begin(), values.end());
+        pre_vector.insert(pre_vector.begin() + position, values.begin(), values.end());
+        test();
+    }
+
+    void insert_self(size_t position, size_t first, size_t last) {
+        // Inserting a range of the vector into itself must see the old contents.
+        realtype copy(real_vector.begin() + first, real_vector.begin() + last);
+        real_vector.insert(real_vector.begin() + position, copy.begin(), copy.end());
+        pre_vector.insert(pre_vector.begin() + position, pre_vector.begin() + first, pre_vector.begin() + last);
+        test();
+    }
+
+    void erase(size_t position) {
+        real_vector.erase(real_vector.begin() + position);
+        pre_vector.erase(pre_vector.begin() + position);
+        test();
+    }
+
+    void erase(size_t first, size_t last) {
+        real_vector.erase(real_vector.begin() + first, real_vector.begin() + last);
+        pre_vector.erase(pre_vector.begin() + first, pre_vector.begin() + last);
+        test();
+    }
+
+    void update(size_t pos, const T& value) {
+        real_vector[pos] = value;
+        pre_vector[pos] = value;
+        test();
+    }
+
+    void push_back(const T& value) {
+        real_vector.push_back(value);
+        pre_vector.push_back(value);
+        test();
+    }
+
+    void pop_back() {
+        real_vector.pop_back();
+        pre_vector.pop_back();
+        test();
+    }
+
+    void clear() {
+        real_vector.clear();
+        pre_vector.clear();
+    }
+
+    void assign(size_t n, const T& value) {
+        real_vector.assign(n, value);
+        pre_vector.assign(n, value);
+    }
+
+    void shrink_to_fit() {
+        pre_vector.shrink_to_fit();
+        test();
+    }
+
+    void swap() {
+        realtype real_other;
+        pretype pre_other;
+        for (size_t i = insecure_rand() % 40; i > 0; i--) {
+            T v = insecure_rand();
+            real_other.push_back(v);
+            pre_other.push_back(v);
+        }
+        real_vector.swap(real_other);
+        pre_vector.swap(pre_other);
+        test();
+    }
+
+    size_t size() const {
+        return real_vector.size();
+    }
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(PrevectorTestInt)
+{
+    seed_insecure_rand(true);
+    for (int j = 0; j < 64; j++) {
+        prevector_tester<8, int> test;
+        for (int i = 0; i < 2048; i++) {
+            int r = insecure_rand();
+            if ((r % 4) == 0) {
+                test.insert(insecure_rand() % (test.size() + 1), insecure_rand());
+            }
+            if (test.size() > 0 && ((r >> 2) % 4) == 1) {
+                test.erase(insecure_rand() % test.size());
+            }
+            if (((r >> 4) % 8) == 2) {
+                int new_size = std::max<int>(0, std::min<int>(30, test.size() + (insecure_rand() % 5) - 2));
+                test.resize(new_size);
+            }
+            if (((r >> 7) % 8) == 3) {
+                test.insert(insecure_rand() % (test.size() + 1), 1 + (insecure_rand() % 2), insecure_rand());
+            }
+            if (((r >> 10) % 8) == 4) {
+                int del = std::min<int>(test.size(), 1 + (insecure_rand() % 2));
+                int beg = insecure_rand() % (test.size() + 1 - del);
+                test.erase(beg, beg + del);
+            }
+            if (((r >> 13) % 16) == 5) {
+                test.push_back(insecure_rand());
+            }
+            if (test.size() > 0 && ((r >> 17) % 16) == 6) {
+                test.pop_back();
+            }
+            if (((r >> 21) % 32) == 7) {
+                std::vector<int> values(insecure_rand() % 5);
+                for (size_t k = 0; k < values.size(); k++) {
+                    values[k] = insecure_rand();
+                }
+                test.insert_range(insecure_rand() % (test.size() + 1), values);
+            }
+            if (test.size() > 0 && ((r >> 26) % 16) == 8) {
+                size_t first = insecure_rand() % test.size();
+                size_t last = first + insecure_rand() % (test.size() - first + 1);
+                test.insert_self(insecure_rand() % (test.size() + 1), first, last);
+            }
+            if (((r >> 5) % 64) == 9) {
+                test.reserve(insecure_rand() % 32);
+            }
+            if (((r >> 11) % 64) == 10) {
+                test.shrink_to_fit();
+            }
+            if (test.size() > 0) {
+                test.update(insecure_rand() % test.size(), insecure_rand());
+            }
+            if (((r >> 15) % 512) == 11) {
+                test.clear();
+            }
+            if (((r >> 19) % 512) == 12) {
+                test.assign(insecure_rand() % 32, insecure_rand());
+            }
+            if (((r >> 23) % 256) == 13) {
+                test.swap();
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(PrevectorSerialization)
+{
+    // Byte prevectors serialize as one blob, exactly like std::vector<unsigned char>.
+    for (unsigned int n = 0; n < 300; n += 7) {
+        std::vector<unsigned char> real(n);
+        for (unsigned int i = 0; i < n; i++)
+            real[i] = (unsigned char)(i * 37);
+        prevector<28, unsigned char> pre(real.begin(), real.end());
+        BOOST_CHECK_EQUAL(pre.allocated_memory() == 0, n <= 28);
+
+        CDataStream ss1(SER_NETWORK, PROTOCOL_VERSION);
+        CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+        ss1 << real;
+        ss2 << pre;
+        BOOST_CHECK(ss1.str() == ss2.str());
+        BOOST_CHECK_EQUAL(GetSerializeSize(pre, SER_NETWORK, PROTOCOL_VERSION), ss1.size());
+
+        std::vector<unsigned char> real_read;
+        ss2 >> real_read;
+        BOOST_CHECK(real_read == real);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
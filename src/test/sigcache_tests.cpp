@@ -0,0 +1,114 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "pubkey.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_store)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    CPubKey pubkey = key.GetPubKey();
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    CTransaction tx;
+    CachingTransactionSignatureChecker checkerNoStore(&tx, 0, false);
+    CachingTransactionSignatureChecker checker(&tx, 0);
+
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    BOOST_CHECK(stats.nBytes > 0 && stats.nBytes <= ((size_t)DEFAULT_SIG_CACHE_SIZE << 20));
+    BOOST_CHECK_EQUAL(stats.nCapacity, stats.nBytes / 32);
+
+    // Lookups that are told not to store leave the cache alone.
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    CSignatureCacheStats stats2 = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats2.nMisses, stats.nMisses + 2);
+    BOOST_CHECK_EQUAL(stats2.nInserts, stats.nInserts);
+
+    // Invalid signatures are never cached.
+    BOOST_CHECK(!checker.VerifySignature(vchSig, pubkey, GetRandHash()));
+    stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nInserts, stats2.nInserts);
+
+    BOOST_CHECK(checker.VerifySignature(vchSig, pubkey, hash));
+    stats2 = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats2.nInserts, stats.nInserts + 1);
+    BOOST_CHECK_EQUAL(stats2.nEntries, stats.nEntries + 1);
+
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, pubkey, hash));
+    stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nHits, stats2.nHits + 1);
+
+    // The same signature under another key or hash is a different entry.
+    CKey key2;
+    key2.MakeNewKey(false);
+    BOOST_CHECK(!checker.VerifySignature(vchSig, key2.GetPubKey(), hash));
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nHits, stats.nHits);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_disabled)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 hash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+
+    mapArgs["-sigcachesize"] = "0";
+    InitSignatureCache();
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nBytes, 0U);
+
+    CTransaction tx;
+    CachingTransactionSignatureChecker checker(&tx, 0);
+    BOOST_CHECK(checker.VerifySignature(vchSig, key.GetPubKey(), hash));
+    BOOST_CHECK(checker.VerifySignature(vchSig, key.GetPubKey(), hash));
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nHits, 0U);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+
+    mapArgs.erase("-sigcachesize");
+    InitSignatureCache();
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_size_options)
+{
+    mapArgs["-sigcachesize"] = "1";
+    InitSignatureCache();
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nBytes, 1U << 20);
+
+    mapArgs["-sigcachesize"] = "100000";
+    InitSignatureCache();
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nBytes, (size_t)MAX_SIG_CACHE_SIZE << 20);
+
+    // The old entry count takes just enough megabytes to hold that many entries
+    mapArgs.erase("-sigcachesize");
+    mapArgs["-maxsigcachesize"] = "50000";
+    InitSignatureCache();
+    CSignatureCacheStats stats = GetSignatureCacheStats();
+    BOOST_CHECK(stats.nCapacity >= 50000);
+    BOOST_CHECK_EQUAL(stats.nBytes, 2U << 20);
+
+    // -sigcachesize wins over it
+    mapArgs["-sigcachesize"] = "4";
+    InitSignatureCache();
+    BOOST_CHECK_EQUAL(GetSignatureCacheStats().nBytes, 4U << 20);
+
+    mapArgs.erase("-sigcachesize");
+    mapArgs.erase("-maxsigcachesize");
+    InitSignatureCache();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
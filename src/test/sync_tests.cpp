@@ -0,0 +1,87 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sync.h"
+#include "utiltime.h"
+#include "test/test_bitcoin.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sync_tests, BasicTestingSetup)
+
+namespace {
+
+CCriticalSection cs_profiled;
+
+void HoldProfiled(CSemaphore* psemLocked)
+{
+    LOCK(cs_profiled);
+    psemLocked->post();
+    MilliSleep(50);
+}
+
+const CLockSiteStats* FindLockStats(const std::vector<CLockSiteStats>& vStats, const char* pszName)
+{
+    for (size_t i = 0; i < vStats.size(); i++)
+        if (strcmp(vStats[i].pszName, pszName) == 0)
+            return &vStats[i];
+    return NULL;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(lock_profiling)
+{
+    fLockProfiling = true;
+    std::vector<CLockSiteStats> vStats;
+    GetLockStats(vStats, true);
+
+    // Recursive re-entry isn't counted
+    for (int i = 0; i < 5; i++) {
+        LOCK2(cs_profiled, cs_profiled);
+    }
+    GetLockStats(vStats, false);
+    const CLockSiteStats* pstats = FindLockStats(vStats, "cs_profiled");
+    BOOST_REQUIRE(pstats);
+    BOOST_CHECK_EQUAL(pstats->nLocks, 5U);
+    BOOST_CHECK_EQUAL(pstats->nContended, 0U);
+    BOOST_CHECK_EQUAL(pstats->vWaitHistogram[0], 5U);
+
+    // Waiting for another thread, whose stats survive it
+    CSemaphore semLocked(0);
+    boost::thread thread(HoldProfiled, &semLocked);
+    semLocked.wait();
+    {
+        LOCK(cs_profiled);
+    }
+    thread.join();
+    GetLockStats(vStats, true);
+    int64_t nWaitMicros = 0, nMaxHoldMicros = 0;
+    uint64_t nLocks = 0, nContended = 0;
+    for (size_t i = 0; i < vStats.size(); i++) {
+        if (strcmp(vStats[i].pszName, "cs_profiled") != 0)
+            continue;
+        nLocks += vStats[i].nLocks;
+        nContended += vStats[i].nContended;
+        nWaitMicros += vStats[i].nWaitMicros;
+        nMaxHoldMicros = std::max(nMaxHoldMicros, vStats[i].nMaxHoldMicros);
+    }
+    BOOST_CHECK_EQUAL(nLocks, 7U);
+    BOOST_CHECK_EQUAL(nContended, 1U);
+    BOOST_CHECK(nWaitMicros >= 10000);
+    BOOST_CHECK(nMaxHoldMicros >= 40000);
+
+    // Reset
+    GetLockStats(vStats, false);
+    BOOST_CHECK(FindLockStats(vStats, "cs_profiled") == NULL);
+    fLockProfiling = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
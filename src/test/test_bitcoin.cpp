@@ -14,6 +14,7 @@
 #include "miner.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "txdb.h"
 #include "ui_interface.h"
 #include "util.h"
@@ -39,6 +40,7 @@ BasicTestingSetup::BasicTestingSetup(CBaseChainParams::Network network)
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
         SelectParams(network);
+        InitSignatureCache();
         noui_connect();
 }
 
@@ -69,6 +71,9 @@ TestingSetup::TestingSetup(CBaseChainParams::Network network) : BasicTestingSetu
         nScriptCheckThreads = 3;
         for (int i=0; i < nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        nHeaderCheckThreads = 3;
+        for (int i=0; i < nHeaderCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadHeaderCheck);
         RegisterNodeSignals(GetNodeSignals());
 }
 
@@ -0,0 +1,173 @@
+// Copyright (c) 2015 The Groestlcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bloom.h"
+#include "clientversion.h"
+#include "merkleblock.h"
+#include "primitives/block.h"
+#include "primitives/txview.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(txview_tests, BasicTestingSetup)
+
+namespace {
+
+CScript RandomScript()
+{
+    CScript script;
+    int nOps = insecure_rand() % 6;
+    for (int i = 0; i < nOps; i++) {
+        switch (insecure_rand() % 4) {
+        case 0: script << OP_DUP; break;
+        case 1: script << std::vector<unsigned char>(insecure_rand() % 80, (unsigned char)insecure_rand()); break;
+        case 2: script << std::vector<unsigned char>(300 + insecure_rand() % 100, 0x42); break;
+        case 3: script << OP_CHECKSIG; break;
+        }
+    }
+    return script;
+}
+
+CBlock RandomBlock(int nTx)
+{
+    CBlock block;
+    block.nVersion = 3;
+    block.hashPrevBlock = GetRandHash();
+    block.nTime = insecure_rand();
+    block.nBits = insecure_rand();
+    block.nNonce = insecure_rand();
+    for (int n = 0; n < nTx; n++) {
+        CMutableTransaction tx;
+        tx.nVersion = insecure_rand();
+        tx.nLockTime = insecure_rand();
+        tx.vin.resize(n == 0 ? 1 : 1 + insecure_rand() % 4);
+        for (size_t i = 0; i < tx.vin.size(); i++) {
+            if (n > 0)
+                tx.vin[i].prevout = COutPoint(GetRandHash(), insecure_rand() % 8);
+            tx.vin[i].scriptSig = RandomScript();
+            tx.vin[i].nSequence = insecure_rand();
+        }
+        tx.vout.resize(insecure_rand() % 4);
+        for (size_t i = 0; i < tx.vout.size(); i++) {
+            tx.vout[i].nValue = insecure_rand();
+            tx.vout[i].scriptPubKey = RandomScript();
+        }
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+}
+
+BOOST_AUTO_TEST_CASE(txview_matches_deserialization)
+{
+    for (int n = 0; n < 20; n++) {
+        CBlock block = RandomBlock(1 + n * 7);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+        std::vector<unsigned char> vch(ss.begin(), ss.end());
+
+        CBlockView view;
+        BOOST_REQUIRE(view.Parse(&vch[0], &vch[0] + vch.size()));
+        BOOST_CHECK_EQUAL(view.size(), vch.size());
+        BOOST_CHECK(view.GetBlockHeader().GetHash() == block.GetHash());
+        BOOST_CHECK(view.ComputeMerkleRoot() == block.hashMerkleRoot);
+        BOOST_REQUIRE_EQUAL(view.vtx.size(), block.vtx.size());
+
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            const CTransaction& tx = block.vtx[i];
+            const CTxView& txview = view.vtx[i];
+            BOOST_CHECK(txview.GetHash() == tx.GetHash());
+            BOOST_CHECK_EQUAL(txview.nVersion, tx.nVersion);
+            BOOST_CHECK_EQUAL(txview.nLockTime, tx.nLockTime);
+            BOOST_CHECK_EQUAL(txview.IsCoinBase(), tx.IsCoinBase());
+            BOOST_REQUIRE_EQUAL(txview.GetInputCount(), tx.vin.size());
+            BOOST_REQUIRE_EQUAL(txview.GetOutputCount(), tx.vout.size());
+            const unsigned char* pc = txview.InputsBegin();
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                CTxInView txin = CTxView::ReadInput(pc);
+                BOOST_CHECK(txin.GetPrevout() == tx.vin[j].prevout);
+                BOOST_CHECK(txin.scriptSig.ToScript() == tx.vin[j].scriptSig);
+                BOOST_CHECK_EQUAL(txin.nSequence, tx.vin[j].nSequence);
+            }
+            pc = txview.OutputsBegin();
+            for (size_t j = 0; j < tx.vout.size(); j++) {
+                CTxOutView txout = CTxView::ReadOutput(pc);
+                BOOST_CHECK_EQUAL(txout.nValue, tx.vout[j].nValue);
+                BOOST_CHECK(txout.scriptPubKey.ToScript() == tx.vout[j].scriptPubKey);
+            }
+
+            // Serializing a view gives back the transaction
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << txview;
+            CTransaction tx2;
+            ssTx >> tx2;
+            BOOST_CHECK(tx2 == tx);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(txview_rejects_malformed)
+{
+    CBlock block = RandomBlock(5);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    std::vector<unsigned char> vch(ss.begin(), ss.end());
+
+    // Any truncation fails
+    CBlockView view;
+    for (size_t nSize = 0; nSize < vch.size(); nSize += 1 + insecure_rand() % 7)
+        BOOST_CHECK(!view.Parse(&vch[0], &vch[0] + nSize));
+
+    // A non-canonical transaction count fails, as it does deserializing
+    std::vector<unsigned char> vchBad(vch.begin(), vch.begin() + 80);
+    vchBad.push_back(253);
+    vchBad.push_back(5);
+    vchBad.push_back(0);
+    vchBad.insert(vchBad.end(), vch.begin() + 81, vch.end());
+    BOOST_CHECK(!view.Parse(&vchBad[0], &vchBad[0] + vchBad.size()));
+    CDataStream ssBad(vchBad, SER_NETWORK, PROTOCOL_VERSION);
+    CBlock blockBad;
+    BOOST_CHECK_THROW(ssBad >> blockBad, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(txview_bloom_merkleblock)
+{
+    // Filtering a view matches and updates the filter just like filtering the block
+    for (int n = 0; n < 10; n++) {
+        CBlock block = RandomBlock(30);
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << block;
+        std::vector<unsigned char> vch(ss.begin(), ss.end());
+        CBlockView view;
+        BOOST_REQUIRE(view.Parse(&vch[0], &vch[0] + vch.size()));
+
+        CBloomFilter filter(100, 0.01, insecure_rand(), n % 3);
+        filter.insert(block.vtx[insecure_rand() % 30].GetHash());
+        filter.insert(block.vtx[1 + insecure_rand() % 29].vin[0].prevout);
+        for (int i = 0; i < 30; i++) {
+            const CTransaction& tx = block.vtx[insecure_rand() % 30];
+            if (!tx.vout.empty() && tx.vout[0].scriptPubKey.size() > 10)
+                filter.insert(std::vector<unsigned char>(tx.vout[0].scriptPubKey.begin() + 2, tx.vout[0].scriptPubKey.begin() + 6));
+        }
+        CBloomFilter filterView = filter;
+
+        CMerkleBlock merkleBlock(block, filter);
+        CMerkleBlock merkleBlockView(view, filterView);
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION), ssView(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << merkleBlock << filter;
+        ssView << merkleBlockView << filterView;
+        BOOST_CHECK(ssBlock.str() == ssView.str());
+        BOOST_CHECK(merkleBlock.vMatchedTxn == merkleBlockView.vMatchedTxn);
+        BOOST_CHECK(!merkleBlockView.vMatchedTxn.empty());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -15,10 +15,19 @@
 #include <stdint.h>
 #include <vector>
 
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 using namespace std;
 
+static void LogLines(int nThread, int nLines)
+{
+    for (int i = 0; i < nLines; i++)
+        LogPrintStr(strprintf("thread %d line %d\n", nThread, i), true);
+}
+
 BOOST_FIXTURE_TEST_SUITE(util_tests, BasicTestingSetup)
 
 BOOST_AUTO_TEST_CASE(util_criticalsection)
@@ -484,4 +493,107 @@ BOOST_AUTO_TEST_CASE(test_ParseFixedPoint)
     BOOST_CHECK(!ParseFixedPoint("1.", 8, &amount));
 }
 
+BOOST_AUTO_TEST_CASE(test_DebugLogBuffer)
+{
+    // -debug category output only goes to the buffer, which keeps the newest messages that fit
+    bool fPrintToDebugLogSaved = fPrintToDebugLog;
+    bool fLogTimestampsSaved = fLogTimestamps;
+    fPrintToDebugLog = true;
+    fLogTimestamps = false;
+    SetDebugLogBufferSize(20);
+    for (int i = 0; i < 10; i++)
+        BOOST_CHECK_EQUAL(LogPrintStr(strprintf("line %d\n", i), true), 0);
+
+    std::vector<std::string> vLines;
+    CDebugLogBufferInfo info = GetDebugLogBuffer(vLines, true);
+    BOOST_CHECK_EQUAL(vLines.size(), 2U);
+    BOOST_CHECK_EQUAL(vLines.back(), "line 9\n");
+    BOOST_CHECK_EQUAL(info.nBytes, 14U);
+    BOOST_CHECK_EQUAL(info.nMaxBytes, 20U);
+    BOOST_CHECK_EQUAL(info.nDiscarded, 8U);
+
+    info = GetDebugLogBuffer(vLines, false);
+    BOOST_CHECK(vLines.empty());
+    BOOST_CHECK_EQUAL(info.nBytes, 0U);
+
+    SetDebugLogBufferSize(0);
+    fPrintToDebugLog = fPrintToDebugLogSaved;
+    fLogTimestamps = fLogTimestampsSaved;
+}
+
+BOOST_AUTO_TEST_CASE(test_LogPrintToConsole)
+{
+    // Console output is written as is; only the buffered copy is timestamped
+    bool fPrintToDebugLogSaved = fPrintToDebugLog;
+    bool fPrintToConsoleSaved = fPrintToConsole;
+    bool fLogTimestampsSaved = fLogTimestamps;
+    fPrintToDebugLog = true;
+    fLogTimestamps = true;
+    SetDebugLogBufferSize(1000);
+    std::vector<std::string> vLines;
+    GetDebugLogBuffer(vLines, true);
+
+    fPrintToConsole = true;
+    BOOST_CHECK_EQUAL(LogPrintStr("console\n"), 8);
+    fPrintToConsole = false;
+    BOOST_CHECK_EQUAL(LogPrintStr("buffered\n", true), 0);
+
+    GetDebugLogBuffer(vLines, true);
+    BOOST_REQUIRE_EQUAL(vLines.size(), 1U);
+    BOOST_CHECK_EQUAL(vLines[0].size(), 20U + 9U);
+    BOOST_CHECK(boost::algorithm::ends_with(vLines[0], " buffered\n"));
+
+    SetDebugLogBufferSize(0);
+    fPrintToDebugLog = fPrintToDebugLogSaved;
+    fPrintToConsole = fPrintToConsoleSaved;
+    fLogTimestamps = fLogTimestampsSaved;
+}
+
+BOOST_AUTO_TEST_CASE(test_DebugLogWriter)
+{
+    // Messages from several threads go through the writer thread's queue,
+    // and the writer is stopped while they are still logging
+    bool fPrintToDebugLogSaved = fPrintToDebugLog;
+    bool fLogTimestampsSaved = fLogTimestamps;
+    fPrintToDebugLog = true;
+    fLogTimestamps = false;
+    SetDebugLogBufferSize(1 << 20);
+    std::vector<std::string> vLines;
+    GetDebugLogBuffer(vLines, true);
+
+    StartDebugLogWriter();
+    // Queued rather than written
+    BOOST_CHECK_EQUAL(LogPrintStr("first\n", true), 6);
+    const int nThreads = 4;
+    const int nLines = 5000;
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads; i++)
+        threads.create_thread(boost::bind(&LogLines, i, nLines));
+    MilliSleep(5);
+    StopDebugLogWriter();
+    threads.join_all();
+    BOOST_CHECK_EQUAL(LogPrintStr("last\n", true), 0);
+
+    // Every line arrived once, and each thread's lines in the order they were logged
+    CDebugLogBufferInfo info = GetDebugLogBuffer(vLines, true);
+    BOOST_CHECK_EQUAL(info.nDiscarded, 0U);
+    BOOST_REQUIRE_EQUAL(vLines.size(), (size_t)(nThreads * nLines + 2));
+    BOOST_CHECK_EQUAL(vLines.front(), "first\n");
+    BOOST_CHECK_EQUAL(vLines.back(), "last\n");
+    std::vector<int> vNext(nThreads, 0);
+    for (size_t i = 1; i + 1 < vLines.size(); i++) {
+        int nThread, nLine;
+        BOOST_REQUIRE(sscanf(vLines[i].c_str(), "thread %d line %d", &nThread, &nLine) == 2);
+        BOOST_REQUIRE(nThread >= 0 && nThread < nThreads);
+        BOOST_CHECK_EQUAL(nLine, vNext[nThread]);
+        vNext[nThread] = nLine + 1;
+    }
+    for (int i = 0; i < nThreads; i++)
+        BOOST_CHECK_EQUAL(vNext[i], nLines);
+
+    SetDebugLogBufferSize(0);
+    fPrintToDebugLog = fPrintToDebugLogSaved;
+    fLogTimestamps = fLogTimestampsSaved;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
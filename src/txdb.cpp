@@ -8,47 +8,126 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
+#include <map>
 #include <stdint.h>
 
 #include <boost/thread.hpp>
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
 
 static const char DB_BEST_BLOCK = 'B';
+static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_BLOCK_UNKNOWN_PARENT = 'o';
 
 
-void static BatchWriteCoins(CLevelDBBatch &batch, const uint256 &hash, const CCoins &coins) {
-    if (coins.IsPruned())
-        batch.Erase(make_pair(DB_COINS, hash));
-    else
-        batch.Write(make_pair(DB_COINS, hash), coins);
-}
+namespace {
+
+/** Database key of one unspent output: 'C', txid, VARINT(output index). */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * Unspent outputs of one transaction, as stored in the chainstate before
+ * outputs were keyed individually. Only used by CCoinsViewDB::Upgrade().
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 1: IsCoinBase()
+ * - bit 2: vout[0] is not spent
+ * - bit 4: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 2 and bit 4 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CLegacyCoins
+{
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), nHeight(0) {}
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nTxVersion = 0;
+        ::Unserialize(s, VARINT(nTxVersion), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
 
-void static BatchWriteHashBestChain(CLevelDBBatch &batch, const uint256 &hash) {
-    batch.Write(DB_BEST_BLOCK, hash);
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) {
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", CLevelDBTuning::ForChainstate(nCacheSize), fMemory, fWipe) {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -58,27 +137,161 @@ uint256 CCoinsViewDB::GetBestBlock() const {
     return hashBestChain;
 }
 
-bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    std::vector<uint256> vhashHeadBlocks;
+    if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks))
+        return std::vector<uint256>();
+    return vhashHeadBlocks;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CLevelDBBatch batch;
     size_t count = 0;
     size_t changed = 0;
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    size_t nBatchSize = (size_t)GetArg("-dbbatchsize", nDefaultDbBatchSize);
+
+    // A large write is split over several LevelDB batches. While it is under
+    // way the database holds a mix of old and new state, so the best block
+    // marker is replaced by the pair (new tip, old tip) first and only
+    // restored at the end; ReplayBlocks() uses it to finish an interrupted
+    // write after a crash.
+    if (!hashBlock.IsNull()) {
+        uint256 old_tip = GetBestBlock();
+        if (old_tip.IsNull()) {
+            // A previous write was interrupted; keep its old tip as the start of the replay.
+            std::vector<uint256> old_heads = GetHeadBlocks();
+            if (old_heads.size() == 2) {
+                assert(old_heads[0] == hashBlock);
+                old_tip = old_heads[1];
+            }
+        }
+        std::vector<uint256> vhashHeadBlocks;
+        vhashHeadBlocks.push_back(hashBlock);
+        vhashHeadBlocks.push_back(old_tip);
+        batch.Erase(DB_BEST_BLOCK);
+        batch.Write(DB_HEAD_BLOCKS, vhashHeadBlocks);
+    }
+
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            BatchWriteCoins(batch, it->first, it->second.coins);
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
+        if (batch.SizeEstimate() > nBatchSize) {
+            LogPrint("coindb", "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
+            if (!db.WriteBatch(batch))
+                return false;
+            batch.Clear();
+        }
+    }
+
+    if (!hashBlock.IsNull()) {
+        batch.Erase(DB_HEAD_BLOCKS);
+        batch.Write(DB_BEST_BLOCK, hashBlock);
     }
-    if (!hashBlock.IsNull())
-        BatchWriteHashBestChain(batch, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    bool fOk = WriteCoins(mapCoins, hashBlock);
+    mapCoins.clear();
+    return fOk;
+}
+
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(db.NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_COINS, uint256());
+    pcursor->Seek(ssKeySet.str());
+    if (!pcursor->Valid() || pcursor->key().size() == 0 || pcursor->key()[0] != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database..."), 0);
+    static const size_t nBatchSize = 16 << 20;
+    CLevelDBBatch batch;
+    int64_t nTransactions = 0;
+    int64_t nOutputs = 0;
+    int nReportDone = 0;
+    pair<char, uint256> key(DB_COINS, uint256());
+    pair<char, uint256> prevKey = key;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            ssKey >> key;
+            if (key.first != DB_COINS)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            CLegacyCoins coins;
+            ssValue >> coins;
+
+            if (nTransactions++ % 256 == 0) {
+                // Keys are ordered by txid, so its leading bytes tell how far along we are.
+                uint32_t nHigh = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int nPercentageDone = (int)(nHigh * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database..."), nPercentageDone);
+                if (nReportDone < nPercentageDone / 10) {
+                    LogPrintf("[%d%%]...", nPercentageDone);
+                    nReportDone = nPercentageDone / 10;
+                }
+            }
+
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < coins.vout.size(); i++) {
+                if (!coins.vout[i].IsNull() && !coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    outpoint.n = i;
+                    batch.Write(CoinEntry(&outpoint), Coin(coins.vout[i], coins.nHeight, coins.fCoinBase));
+                    nOutputs++;
+                }
+            }
+            batch.Erase(key);
+            if (batch.SizeEstimate() > nBatchSize) {
+                db.WriteBatch(batch);
+                batch.Clear();
+                db.CompactRange(prevKey, key);
+                prevKey = key;
+            }
+            pcursor->Next();
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    db.WriteBatch(batch);
+    db.CompactRange(make_pair(DB_COINS, uint256()), key);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s]. Converted %d transactions into %d outputs.\n", ShutdownRequested() ? "CANCELLED" : "DONE", nTransactions, nOutputs);
+    return !ShutdownRequested();
+}
+
+void CCoinsViewDB::Compact() const {
+    // Coin keys are spread evenly over the txid's leading byte.
+    for (unsigned int i = 0; i < 256; i += 16) {
+        boost::this_thread::interruption_point();
+        std::pair<char, unsigned char> keyBegin(DB_COIN, i);
+        if (i + 16 < 256)
+            db.CompactRange(keyBegin, std::make_pair(DB_COIN, (unsigned char)(i + 16)));
+        else
+            db.CompactRange(keyBegin, std::make_pair((char)(DB_COIN + 1), (unsigned char)0));
+    }
+    boost::this_thread::interruption_point();
+    // Everything else (best block marker, leftovers of the old format) is small.
+    db.CompactRange(std::make_pair((char)0, (unsigned char)0), std::make_pair(DB_COIN, (unsigned char)0));
+    db.CompactRange(std::make_pair((char)(DB_COIN + 1), (unsigned char)0), std::make_pair((char)0x7f, (unsigned char)0));
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CLevelDBWrapper(GetDataDir() / "blocks" / "index", CLevelDBTuning::ForBlockIndex(nCacheSize), fMemory, fWipe) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -101,62 +314,257 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+bool CBlockTreeDB::WriteBlockUnknownParent(const uint256 &hashPrev, const CDiskBlockPos &pos) {
+    return Write(make_pair(DB_BLOCK_UNKNOWN_PARENT, make_pair(hashPrev, pos)), '1');
+}
+
+bool CBlockTreeDB::TakeBlocksUnknownParent(const uint256 &hashPrev, std::vector<CDiskBlockPos> &vPos) {
+    vPos.clear();
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << make_pair(DB_BLOCK_UNKNOWN_PARENT, hashPrev);
+    pcursor->Seek(ssKeySet.str());
+
+    CLevelDBBatch batch;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0 || slKey[0] != DB_BLOCK_UNKNOWN_PARENT)
+                break;
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            std::pair<char, std::pair<uint256, CDiskBlockPos> > key;
+            ssKey >> key;
+            if (key.second.first != hashPrev)
+                break;
+            vPos.push_back(key.second.second);
+            batch.Erase(key);
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return vPos.empty() || WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseBlocksUnknownParent() {
+    boost::scoped_ptr<leveldb::Iterator> pcursor(NewIterator());
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_BLOCK_UNKNOWN_PARENT;
+    pcursor->Seek(ssKeySet.str());
+
+    CLevelDBBatch batch;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        try {
+            leveldb::Slice slKey = pcursor->key();
+            if (slKey.size() == 0 || slKey[0] != DB_BLOCK_UNKNOWN_PARENT)
+                break;
+            CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
+            std::pair<char, std::pair<uint256, CDiskBlockPos> > key;
+            ssKey >> key;
+            batch.Erase(key);
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+        }
+    }
+    return WriteBatch(batch);
+}
+
+/** Add the unspent outputs of one transaction to the UTXO set hash and statistics. */
+static void ApplyStats(CCoinsStats &stats, CHashWriter &ss, const uint256 &hash, const std::map<uint32_t, Coin> &outputs)
+{
+    assert(!outputs.empty());
+    const Coin& first = outputs.begin()->second;
+    uint32_t nCode = first.nHeight * 2 + first.fCoinBase;
+    ss << hash;
+    ss << VARINT(nCode);
+    stats.nTransactions++;
+    for (std::map<uint32_t, Coin>::const_iterator it = outputs.begin(); it != outputs.end(); ++it) {
+        ss << VARINT(it->first + 1);
+        ss << it->second.out;
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += it->second.out.nValue;
+    }
+    ss << VARINT(0);
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<leveldb::Iterator> pcursor(const_cast<CLevelDBWrapper*>(&db)->NewIterator());
-    pcursor->SeekToFirst();
+    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
+    ssKeySet << DB_COIN;
+    pcursor->Seek(ssKeySet.str());
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
+    // Outputs of one transaction are adjacent in the database; group them
+    // so the hash commits to the set per transaction.
+    uint256 prevkey;
+    std::map<uint32_t, Coin> outputs;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
         try {
             leveldb::Slice slKey = pcursor->key();
             CDataStream ssKey(slKey.data(), slKey.data()+slKey.size(), SER_DISK, CLIENT_VERSION);
-            char chType;
-            ssKey >> chType;
-            if (chType == DB_COINS) {
-                leveldb::Slice slValue = pcursor->value();
-                CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
-                CCoins coins;
-                ssValue >> coins;
-                uint256 txhash;
-                ssKey >> txhash;
-                ss << txhash;
-                ss << VARINT(coins.nVersion);
-                ss << (coins.fCoinBase ? 'c' : 'n');
-                ss << VARINT(coins.nHeight);
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
-                }
-                stats.nSerializedSize += 32 + slValue.size();
-                ss << VARINT(0);
+            COutPoint outpoint;
+            CoinEntry entry(&outpoint);
+            ssKey >> entry;
+            if (entry.key != DB_COIN)
+                break;
+            leveldb::Slice slValue = pcursor->value();
+            CDataStream ssValue(slValue.data(), slValue.data()+slValue.size(), SER_DISK, CLIENT_VERSION);
+            Coin coin;
+            ssValue >> coin;
+            if (!outputs.empty() && outpoint.hash != prevkey) {
+                ApplyStats(stats, ss, prevkey, outputs);
+                outputs.clear();
             }
+            prevkey = outpoint.hash;
+            outputs[outpoint.n] = coin;
+            stats.nSerializedSize += slKey.size() + slValue.size();
             pcursor->Next();
         } catch (const std::exception& e) {
             return error("%s: Deserialize or I/O error - %s", __func__, e.what());
         }
     }
+    if (!outputs.empty())
+        ApplyStats(stats, ss, prevkey, outputs);
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
     }
     stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
     return true;
 }
 
+CCoinsViewWriteBehind::CCoinsViewWriteBehind(CCoinsViewDB *dbIn) : db(dbIn), fPending(false), fThreadRunning(false), fFailed(false) {
+}
+
+void CCoinsViewWriteBehind::WaitForWrite(boost::unique_lock<boost::mutex> &lock) const {
+    // The write always completes, so there is no point in being interrupted here.
+    boost::this_thread::disable_interruption di;
+    while (fPending && !fFailed)
+        cond.wait(lock);
+}
+
+void CCoinsViewWriteBehind::Wait() const {
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitForWrite(lock);
+}
+
+bool CCoinsViewWriteBehind::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(outpoint);
+            if (it != mapPending.end()) {
+                if (it->second.coin.IsSpent())
+                    return false;
+                coin = it->second.coin;
+                return true;
+            }
+        }
+    }
+    return db->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewWriteBehind::HaveCoin(const COutPoint &outpoint) const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending) {
+            CCoinsMap::const_iterator it = mapPending.find(outpoint);
+            if (it != mapPending.end())
+                return !it->second.coin.IsSpent();
+        }
+    }
+    return db->HaveCoin(outpoint);
+}
+
+uint256 CCoinsViewWriteBehind::GetBestBlock() const {
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (fPending && !hashPending.IsNull())
+            return hashPending;
+    }
+    return db->GetBestBlock();
+}
+
+std::vector<uint256> CCoinsViewWriteBehind::GetHeadBlocks() const {
+    Wait();
+    return db->GetHeadBlocks();
+}
+
+bool CCoinsViewWriteBehind::GetStats(CCoinsStats &stats) const {
+    Wait();
+    return db->GetStats(stats);
+}
+
+bool CCoinsViewWriteBehind::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    boost::unique_lock<boost::mutex> lock(cs);
+    WaitForWrite(lock);
+    if (fFailed)
+        return false;
+    if (!fThreadRunning)
+        return db->BatchWrite(mapCoins, hashBlock);
+
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY)
+            mapPending.insert(*it);
+    }
+    mapCoins.clear();
+    hashPending = hashBlock;
+    fPending = true;
+    cond.notify_all();
+    return true;
+}
+
+void CCoinsViewWriteBehind::WritePending(boost::unique_lock<boost::mutex> &lock) {
+    // Nothing modifies mapPending while fPending is set, so it can be read
+    // without holding the lock.
+    lock.unlock();
+    bool fOk = false;
+    try {
+        fOk = db->WriteCoins(mapPending, hashPending);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+    lock.lock();
+    if (fOk) {
+        mapPending.clear();
+        mapPending.get_allocator().GetResource()->Release();
+        hashPending.SetNull();
+        fPending = false;
+    } else {
+        // Keep the batch so lookups stay correct until the node has shut down.
+        fFailed = true;
+        LogPrintf("*** Failed to write to coin database\n");
+        uiInterface.ThreadSafeMessageBox(_("Error: A fatal internal error occured, see debug.log for details"), "", CClientUIInterface::MSG_ERROR);
+        StartShutdown();
+    }
+    cond.notify_all();
+}
+
+void CCoinsViewWriteBehind::Thread() {
+    RenameThread("groestlcoin-coinsflush");
+    boost::unique_lock<boost::mutex> lock(cs);
+    fThreadRunning = true;
+    try {
+        while (true) {
+            while (!fPending || fFailed)
+                cond.wait(lock);
+            WritePending(lock);
+        }
+    } catch (const boost::thread_interrupted&) {
+        // From here on BatchWrite() writes synchronously; finish what was
+        // handed over before the interruption.
+        fThreadRunning = false;
+        if (fPending && !fFailed)
+            WritePending(lock);
+        throw;
+    }
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CLevelDBBatch batch;
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
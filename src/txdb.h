@@ -14,8 +14,12 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 class CBlockFileInfo;
 class CBlockIndex;
+struct CDiskBlockPos;
 struct CDiskTxPos;
 class uint256;
 
@@ -25,6 +29,8 @@ static const int64_t nDefaultDbCache = 100;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache in (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbbatchsize default (bytes)
+static const int64_t nDefaultDbBatchSize = 16 << 20;
 
 /** CCoinsView backed by the LevelDB coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
@@ -34,11 +40,78 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    std::vector<uint256> GetHeadBlocks() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Write the dirty entries of mapCoins, in batches of at most -dbbatchsize
+     * bytes, without modifying the map. A write interrupted halfway leaves
+     * the head blocks marker behind (see GetHeadBlocks()).
+     */
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+
+    /**
+     * Convert records of the old per-transaction format to per-output
+     * records, in place. Safe to interrupt: each batch converts whole
+     * transactions, and the next call picks up where this one stopped.
+     * Returns false on error or when interrupted by a shutdown request.
+     */
+    bool Upgrade();
+
+    /**
+     * Compact the whole database, in slices so that a shutdown request is
+     * noticed in between. Throws boost::thread_interrupted when interrupted.
+     */
+    void Compact() const;
+
+    //! The underlying database, for statistics
+    const CLevelDBWrapper& GetDB() const { return db; }
+};
+
+/**
+ * Write-behind stage in front of the coin database.
+ *
+ * While Thread() runs, BatchWrite() only takes a copy of the dirty entries and
+ * returns; the thread writes them to the database, and lookups are answered
+ * from that copy until the write has finished. One batch is in flight at a
+ * time: a BatchWrite() arriving while the previous one is still being written
+ * waits for it. Without the thread, writes go straight to the database.
+ */
+class CCoinsViewWriteBehind : public CCoinsView
+{
+private:
+    CCoinsViewDB *db;
+    mutable boost::mutex cs;
+    mutable boost::condition_variable cond;
+    //! Batch handed over by BatchWrite() that is not in the database yet
+    CCoinsMap mapPending;
+    uint256 hashPending;
+    bool fPending;
+    bool fThreadRunning;
+    bool fFailed;
+
+    void WaitForWrite(boost::unique_lock<boost::mutex> &lock) const;
+    void WritePending(boost::unique_lock<boost::mutex> &lock);
+
+public:
+    CCoinsViewWriteBehind(CCoinsViewDB *dbIn);
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
+    std::vector<uint256> GetHeadBlocks() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Block until the batch in flight (if any) is in the database
+    void Wait() const;
+
+    //! Write batches as they are handed over, until interrupted
+    void Thread();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -55,6 +128,12 @@ public:
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
+    /** Remember where a block whose parent is not known yet is stored (while reindexing) */
+    bool WriteBlockUnknownParent(const uint256 &hashPrev, const CDiskBlockPos &pos);
+    /** Read and forget the positions of the blocks waiting for their parent hashPrev */
+    bool TakeBlocksUnknownParent(const uint256 &hashPrev, std::vector<CDiskBlockPos> &vPos);
+    /** Forget all blocks waiting for their parent */
+    bool EraseBlocksUnknownParent();
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
@@ -18,6 +18,8 @@
 
 #include <stdarg.h>
 
+#include <deque>
+
 #if (defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__DragonFly__))
 #include <pthread.h>
 #include <pthread_np.h>
@@ -75,6 +77,7 @@
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
+#include <boost/atomic.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/foreach.hpp>
@@ -176,18 +179,109 @@ instance_of_cinit;
 
 static boost::once_flag debugPrintInitFlag = BOOST_ONCE_INIT;
 
+/** A log message waiting for the writer thread. Recycled once written, see plogFree. */
+struct CLogMessage
+{
+    CLogMessage* pnext;
+    int64_t nTime;
+    bool fDebugCategory;
+    std::string str;
+};
+
+/** Messages a logging thread took from plogFree, for its own use only */
+struct CLogMessageCache
+{
+    CLogMessage* pfirst;
+
+    CLogMessageCache() : pfirst(NULL) {}
+    ~CLogMessageCache()
+    {
+        while (pfirst) {
+            CLogMessage* pnext = pfirst->pnext;
+            delete pfirst;
+            pfirst = pnext;
+        }
+    }
+};
+
+/** Messages kept in memory when -debuglogbuffer is set, oldest first */
+struct CLogRingBuffer
+{
+    boost::mutex mutex;
+    std::deque<std::string> deqLines;
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nDiscarded;
+
+    CLogRingBuffer() : nBytes(0), nMaxBytes(0), nDiscarded(0) {}
+
+    void Trim()
+    {
+        while (nBytes > nMaxBytes) {
+            nBytes -= deqLines.front().size();
+            deqLines.pop_front();
+            nDiscarded++;
+        }
+    }
+
+    /** Returns false if the buffer is off */
+    bool Add(const char* pch, size_t nSize)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if (nMaxBytes == 0)
+            return false;
+        deqLines.push_back(std::string(pch, nSize));
+        nBytes += nSize;
+        Trim();
+        return true;
+    }
+};
+
 /**
- * We use boost::call_once() to make sure mutexDebugLog and
- * vMsgsBeforeOpenLog are initialized in a thread-safe manner.
+ * We use boost::call_once() to make sure mutexDebugLog,
+ * vMsgsBeforeOpenLog and the writer thread's state are initialized
+ * in a thread-safe manner.
  *
- * NOTE: fileout, mutexDebugLog and sometimes vMsgsBeforeOpenLog
- * are leaked on exit. This is ugly, but will be cleaned up by
- * the OS/libc. When the shutdown sequence is fully audited and
- * tested, explicit destruction of these objects can be implemented.
+ * NOTE: fileout, mutexDebugLog, the writer thread's state and
+ * sometimes vMsgsBeforeOpenLog are leaked on exit. This is ugly, but
+ * will be cleaned up by the OS/libc. When the shutdown sequence is fully
+ * audited and tested, explicit destruction of these objects can be implemented.
  */
 static FILE* fileout = NULL;
 static boost::mutex* mutexDebugLog = NULL;
 static list<string> *vMsgsBeforeOpenLog;
+static bool fStartedNewLine = true;
+static CLogRingBuffer* pringDebugLog = NULL;
+static std::string* pstrLogBatch = NULL;
+
+/**
+ * While the writer thread runs, LogPrintStr only pushes onto plogQueue
+ * (newest first, with a compare-and-swap) and the writer takes the whole
+ * list at once, so logging threads never wait for the disk or each other.
+ * The producer that finds the queue empty wakes the writer up.
+ *
+ * Written messages go back onto plogFree. A logging thread takes that
+ * whole list into its own cache when its cache runs dry (taking the whole
+ * list avoids the ABA problem of popping single entries), so once the
+ * queue has been as long as it gets, logging allocates nothing.
+ */
+static boost::atomic<CLogMessage*> plogQueue(NULL);
+static boost::atomic<CLogMessage*> plogFree(NULL);
+static boost::thread_specific_ptr<CLogMessageCache>* pcacheLogMessages = NULL;
+static boost::atomic<bool> fLogWriterRunning(false);
+static boost::atomic<size_t> nLogQueuedBytes(0);
+static boost::atomic<uint64_t> nLogDropped(0);
+static boost::mutex* mutexLogWriter = NULL;
+static boost::condition_variable* condLogWriter = NULL;
+static bool fLogWriterStop = false;
+static boost::thread* pthreadLogWriter = NULL;
+
+/** Messages are dropped (and counted) rather than queued beyond this, should the disk fall far behind */
+static const size_t MAX_LOG_QUEUED_BYTES = 32 * 1024 * 1024;
+/** Lets a batch from the writer thread reach debug.log in one write */
+static const size_t LOG_FILE_BUFFER_SIZE = 64 * 1024;
+/** Recycled messages give back any memory beyond this, after an unusually long line */
+static const size_t MAX_LOG_MESSAGE_CAPACITY = 4096;
 
 static int FileWriteStr(const std::string &str, FILE *fp)
 {
@@ -199,6 +293,136 @@ static void DebugPrintInit()
     assert(mutexDebugLog == NULL);
     mutexDebugLog = new boost::mutex();
     vMsgsBeforeOpenLog = new list<string>;
+    pringDebugLog = new CLogRingBuffer();
+    pstrLogBatch = new std::string();
+    mutexLogWriter = new boost::mutex();
+    condLogWriter = new boost::condition_variable();
+    pcacheLogMessages = new boost::thread_specific_ptr<CLogMessageCache>();
+}
+
+/**
+ * fStartedNewLine is a state variable held by the calling context that will
+ * suppress printing of the timestamp when multiple calls are made that don't
+ * end in a newline. Initialize it to true, and hold it, in the calling context.
+ */
+static void LogTimestampStr(std::string &strOut, const std::string &str, bool *fStartedNewLine, int64_t nTime)
+{
+    // Lines mostly come many to the second; requires mutexDebugLog
+    static int64_t nTimeFormatted = -1;
+    static string strTimeFormatted;
+
+    if (fLogTimestamps && *fStartedNewLine) {
+        if (nTime != nTimeFormatted) {
+            strTimeFormatted = DateTimeStrFormat("%Y-%m-%d %H:%M:%S", nTime);
+            nTimeFormatted = nTime;
+        }
+        strOut += strTimeFormatted;
+        strOut += ' ';
+    }
+    strOut += str;
+
+    if (!str.empty() && str[str.size()-1] == '\n')
+        *fStartedNewLine = true;
+    else
+        *fStartedNewLine = false;
+}
+
+/** Append a timestamped message to strOut, unless it is only kept in the ring buffer. Requires mutexDebugLog. */
+static void LogPrepareStr(std::string &strOut, const std::string &str, bool fDebugCategory, int64_t nTime)
+{
+    size_t nStart = strOut.size();
+    LogTimestampStr(strOut, str, &fStartedNewLine, nTime);
+    // With a ring buffer, -debug categories are only kept in memory
+    if (pringDebugLog->Add(strOut.data() + nStart, strOut.size() - nStart) && fDebugCategory)
+        strOut.resize(nStart);
+}
+
+/** Write out prepared log text. Requires mutexDebugLog. */
+static int LogWriteStr(const std::string &str)
+{
+    if (str.empty())
+        return 0;
+    int ret = 0;
+    if (fileout == NULL)
+    {
+        // buffer if we haven't opened the log yet
+        assert(vMsgsBeforeOpenLog);
+        ret = str.length();
+        vMsgsBeforeOpenLog->push_back(str);
+    }
+    else
+    {
+        // reopen the log file, if requested
+        if (fReopenDebugLog) {
+            fReopenDebugLog = false;
+            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+            if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
+                setvbuf(fileout, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE);
+        }
+
+        ret = FileWriteStr(str, fileout);
+        fflush(fileout);
+    }
+    return ret;
+}
+
+/** Write out everything queued for the writer thread, in order. Requires mutexDebugLog. */
+static void LogWriteQueued()
+{
+    CLogMessage* pmsg = plogQueue.exchange(NULL, boost::memory_order_acquire);
+    if (pmsg == NULL)
+        return;
+
+    // The queue is newest first
+    CLogMessage* pfirst = NULL;
+    while (pmsg) {
+        CLogMessage* pnext = pmsg->pnext;
+        pmsg->pnext = pfirst;
+        pfirst = pmsg;
+        pmsg = pnext;
+    }
+
+    string& strBatch = *pstrLogBatch;
+    strBatch.clear();
+    size_t nBytes = 0;
+    CLogMessage* plast = NULL;
+    for (pmsg = pfirst; pmsg; pmsg = pmsg->pnext) {
+        LogPrepareStr(strBatch, pmsg->str, pmsg->fDebugCategory, pmsg->nTime);
+        nBytes += pmsg->str.size();
+        if (pmsg->str.capacity() > MAX_LOG_MESSAGE_CAPACITY)
+            string().swap(pmsg->str);
+        plast = pmsg;
+    }
+    nLogQueuedBytes.fetch_sub(nBytes, boost::memory_order_relaxed);
+
+    // Recycle the messages
+    CLogMessage* pfree = plogFree.load(boost::memory_order_relaxed);
+    do {
+        plast->pnext = pfree;
+    } while (!plogFree.compare_exchange_weak(pfree, pfirst, boost::memory_order_release, boost::memory_order_relaxed));
+
+    uint64_t nDropped = nLogDropped.exchange(0, boost::memory_order_relaxed);
+    if (nDropped > 0)
+        LogPrepareStr(strBatch, strprintf("%u log messages dropped, the log writer fell behind\n", nDropped), false, GetTime());
+
+    LogWriteStr(strBatch);
+}
+
+static void ThreadLogWriter()
+{
+    RenameThread("groestlcoin-log");
+    while (true) {
+        {
+            boost::mutex::scoped_lock lock(*mutexLogWriter);
+            if (plogQueue.load(boost::memory_order_acquire) == NULL) {
+                if (fLogWriterStop)
+                    break;
+                condLogWriter->wait(lock);
+            }
+        }
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        LogWriteQueued();
+    }
 }
 
 void OpenDebugLog()
@@ -210,16 +434,82 @@ void OpenDebugLog()
     assert(vMsgsBeforeOpenLog);
     boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
     fileout = fopen(pathDebug.string().c_str(), "a");
-    if (fileout) setbuf(fileout, NULL); // unbuffered
+    if (fileout) setvbuf(fileout, NULL, _IOFBF, LOG_FILE_BUFFER_SIZE); // flushed after every write or batch
 
     // dump buffered messages from before we opened the log
     while (!vMsgsBeforeOpenLog->empty()) {
         FileWriteStr(vMsgsBeforeOpenLog->front(), fileout);
         vMsgsBeforeOpenLog->pop_front();
     }
+    if (fileout)
+        fflush(fileout);
 
     delete vMsgsBeforeOpenLog;
     vMsgsBeforeOpenLog = NULL;
+
+    // Without a file to write to the log stays synchronous, and goes nowhere;
+    // console output is always written directly
+    if (fileout && !fPrintToConsole)
+        StartDebugLogWriter();
+}
+
+void StartDebugLogWriter()
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    assert(pthreadLogWriter == NULL);
+    fLogWriterStop = false;
+    pthreadLogWriter = new boost::thread(&ThreadLogWriter);
+    fLogWriterRunning.store(true, boost::memory_order_release);
+}
+
+void StopDebugLogWriter()
+{
+    if (pthreadLogWriter == NULL)
+        return;
+    // Messages from here on are written directly again
+    fLogWriterRunning.store(false, boost::memory_order_release);
+    {
+        boost::mutex::scoped_lock lock(*mutexLogWriter);
+        fLogWriterStop = true;
+        condLogWriter->notify_one();
+    }
+    pthreadLogWriter->join();
+    delete pthreadLogWriter;
+    pthreadLogWriter = NULL;
+
+    // Anything pushed after the writer's last look
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    LogWriteQueued();
+}
+
+void SetDebugLogBufferSize(size_t nBytes)
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    boost::mutex::scoped_lock lock(pringDebugLog->mutex);
+    pringDebugLog->nMaxBytes = nBytes;
+    pringDebugLog->Trim();
+}
+
+CDebugLogBufferInfo GetDebugLogBuffer(std::vector<std::string>& vLines, bool fClear)
+{
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    {
+        // Let whatever is still queued reach the buffer first
+        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+        LogWriteQueued();
+    }
+    boost::mutex::scoped_lock lock(pringDebugLog->mutex);
+    CDebugLogBufferInfo info;
+    info.nBytes = pringDebugLog->nBytes;
+    info.nMaxBytes = pringDebugLog->nMaxBytes;
+    info.nDiscarded = pringDebugLog->nDiscarded;
+    vLines.assign(pringDebugLog->deqLines.begin(), pringDebugLog->deqLines.end());
+    if (fClear) {
+        pringDebugLog->deqLines.clear();
+        pringDebugLog->nBytes = 0;
+        pringDebugLog->nDiscarded = 0;
+    }
+    return info;
 }
 
 bool LogAcceptCategory(const char* category)
@@ -251,68 +541,70 @@ bool LogAcceptCategory(const char* category)
     return true;
 }
 
-/**
- * fStartedNewLine is a state variable held by the calling context that will
- * suppress printing of the timestamp when multiple calls are made that don't
- * end in a newline. Initialize it to true, and hold it, in the calling context.
- */
-static std::string LogTimestampStr(const std::string &str, bool *fStartedNewLine)
+int LogPrintStr(const std::string &str)
 {
-    string strStamped;
-
-    if (!fLogTimestamps)
-        return str;
-
-    if (*fStartedNewLine)
-        strStamped =  DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()) + ' ' + str;
-    else
-        strStamped = str;
-
-    if (!str.empty() && str[str.size()-1] == '\n')
-        *fStartedNewLine = true;
-    else
-        *fStartedNewLine = false;
+    return LogPrintStr(str, false);
+}
 
-    return strStamped;
+/** A message to fill in and queue, from this thread's cache of written ones if there are any */
+static CLogMessage* LogNewMessage()
+{
+    CLogMessageCache* pcache = pcacheLogMessages->get();
+    if (pcache == NULL) {
+        pcache = new CLogMessageCache();
+        pcacheLogMessages->reset(pcache);
+    }
+    if (pcache->pfirst == NULL)
+        pcache->pfirst = plogFree.exchange(NULL, boost::memory_order_acquire);
+    CLogMessage* pmsg = pcache->pfirst;
+    if (pmsg == NULL)
+        return new CLogMessage();
+    pcache->pfirst = pmsg->pnext;
+    return pmsg;
 }
 
-int LogPrintStr(const std::string &str)
+int LogPrintStr(const std::string &str, bool fDebugCategory)
 {
-    int ret = 0; // Returns total number of characters written
-    static bool fStartedNewLine = true;
     if (fPrintToConsole)
     {
         // print to console
-        ret = fwrite(str.data(), 1, str.size(), stdout);
+        int ret = fwrite(str.data(), 1, str.size(), stdout);
         fflush(stdout);
+        return ret;
     }
-    else if (fPrintToDebugLog)
-    {
-        boost::call_once(&DebugPrintInit, debugPrintInitFlag);
-        boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
-
-        string strTimestamped = LogTimestampStr(str, &fStartedNewLine);
+    if (!fPrintToDebugLog)
+        return 0;
 
-        // buffer if we haven't opened the log yet
-        if (fileout == NULL) {
-            assert(vMsgsBeforeOpenLog);
-            ret = strTimestamped.length();
-            vMsgsBeforeOpenLog->push_back(strTimestamped);
+    if (fLogWriterRunning.load(boost::memory_order_acquire))
+    {
+        if (nLogQueuedBytes.load(boost::memory_order_relaxed) > MAX_LOG_QUEUED_BYTES) {
+            nLogDropped.fetch_add(1, boost::memory_order_relaxed);
+            return 0;
         }
-        else
-        {
-            // reopen the log file, if requested
-            if (fReopenDebugLog) {
-                fReopenDebugLog = false;
-                boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-                if (freopen(pathDebug.string().c_str(),"a",fileout) != NULL)
-                    setbuf(fileout, NULL); // unbuffered
-            }
-
-            ret = FileWriteStr(strTimestamped, fileout);
+        CLogMessage* pmsg = LogNewMessage();
+        pmsg->nTime = GetTime();
+        pmsg->fDebugCategory = fDebugCategory;
+        pmsg->str = str;
+        nLogQueuedBytes.fetch_add(str.size(), boost::memory_order_relaxed);
+
+        CLogMessage* phead = plogQueue.load(boost::memory_order_relaxed);
+        do {
+            pmsg->pnext = phead;
+        } while (!plogQueue.compare_exchange_weak(phead, pmsg, boost::memory_order_release, boost::memory_order_relaxed));
+        if (phead == NULL) {
+            boost::mutex::scoped_lock lock(*mutexLogWriter);
+            condLogWriter->notify_one();
         }
+        return str.size();
     }
-    return ret;
+
+    boost::call_once(&DebugPrintInit, debugPrintInitFlag);
+    boost::mutex::scoped_lock scoped_lock(*mutexDebugLog);
+    LogWriteQueued();
+    string& strOut = *pstrLogBatch;
+    strOut.clear();
+    LogPrepareStr(strOut, str, fDebugCategory, GetTime());
+    return LogWriteStr(strOut);
 }
 
 /** Interpret string as boolean, for argument parsing */
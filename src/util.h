@@ -64,6 +64,8 @@ void SetupEnvironment();
 bool LogAcceptCategory(const char* category);
 /** Send a string to the log output */
 int LogPrintStr(const std::string &str);
+/** Send a string to the log output; fDebugCategory marks output of a -debug category */
+int LogPrintStr(const std::string &str, bool fDebugCategory);
 
 #define LogPrintf(...) LogPrint(NULL, __VA_ARGS__)
 
@@ -77,7 +79,7 @@ int LogPrintStr(const std::string &str);
     static inline int LogPrint(const char* category, const char* format, TINYFORMAT_VARARGS(n))  \
     {                                                                         \
         if(!LogAcceptCategory(category)) return 0;                            \
-        return LogPrintStr(tfm::format(format, TINYFORMAT_PASSARGS(n))); \
+        return LogPrintStr(tfm::format(format, TINYFORMAT_PASSARGS(n)), category != NULL); \
     }                                                                         \
     /**   Log error and return false */                                        \
     template<TINYFORMAT_ARGTYPES(n)>                                          \
@@ -96,7 +98,7 @@ TINYFORMAT_FOREACH_ARGNUM(MAKE_ERROR_AND_LOG_FUNC)
 static inline int LogPrint(const char* category, const char* format)
 {
     if(!LogAcceptCategory(category)) return 0;
-    return LogPrintStr(format);
+    return LogPrintStr(format, category != NULL);
 }
 static inline bool error(const char* format)
 {
@@ -126,7 +128,26 @@ boost::filesystem::path GetSpecialFolderPath(int nFolder, bool fCreate = true);
 #endif
 boost::filesystem::path GetTempPath();
 void OpenDebugLog();
+/** Hand log messages to a writer thread from now on; OpenDebugLog() starts it once there is somewhere to write */
+void StartDebugLogWriter();
+/** Write out what the debug log writer thread still has queued and stop it; later messages are written directly */
+void StopDebugLogWriter();
 void ShrinkDebugFile();
+
+/** Default for -debuglogbuffer, in kilobytes (0 = off) */
+static const unsigned int DEFAULT_DEBUG_LOG_BUFFER = 0;
+
+struct CDebugLogBufferInfo
+{
+    size_t nBytes;
+    size_t nMaxBytes;
+    uint64_t nDiscarded;
+};
+
+/** Keep the last nBytes of log output in memory, in which case -debug categories are no longer written out (0 = off) */
+void SetDebugLogBufferSize(size_t nBytes);
+/** Get the messages kept in memory, oldest first, optionally clearing them */
+CDebugLogBufferInfo GetDebugLogBuffer(std::vector<std::string>& vLines, bool fClear);
 void runCommand(const std::string& strCommand);
 
 inline bool IsSwitchChar(char c)